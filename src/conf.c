@@ -31,11 +31,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
 #include "conf.h"
@@ -52,6 +56,7 @@ struct conf_ctx {
 	struct conf_option *opts;
 	size_t onum;
 	void *mem;
+	char *cache_dir;
 };
 
 int conf_ctx_new(struct conf_ctx **out, const struct conf_option *opts,
@@ -87,6 +92,7 @@ void conf_ctx_free(struct conf_ctx *ctx)
 		return;
 
 	conf_ctx_reset(ctx);
+	free(ctx->cache_dir);
 	free(ctx);
 }
 
@@ -114,6 +120,28 @@ void *conf_ctx_get_mem(struct conf_ctx *ctx)
 	return ctx->mem;
 }
 
+/*
+ * Set the directory for precompiled config files, see "Config Cache" below.
+ * NULL or an empty string disables the cache.
+ */
+int conf_ctx_set_cache(struct conf_ctx *ctx, const char *dir)
+{
+	char *tmp = NULL;
+
+	if (!ctx)
+		return -EINVAL;
+
+	if (dir && *dir) {
+		tmp = strdup(dir);
+		if (!tmp)
+			return -ENOMEM;
+	}
+
+	free(ctx->cache_dir);
+	ctx->cache_dir = tmp;
+	return 0;
+}
+
 /*
  * Copy all entries from \src into \ctx
  * This calls the "copy" callback for each option inside of \ctx with the
@@ -230,7 +258,9 @@ int conf_ctx_parse_argv(struct conf_ctx *ctx, int argc, char **argv)
 	}
 	short_options[pos++] = 0;
 
+	/* reset getopt so the command-line can be parsed again on reload */
 	opterr = 0;
+	optind = 0;
 	while (1) {
 		c = getopt_long(argc, argv, short_options,
 				long_options, NULL);
@@ -324,8 +354,169 @@ int conf_ctx_parse_argv(struct conf_ctx *ctx, int argc, char **argv)
 	return 0;
 }
 
+/*
+ * Config Cache
+ * If a cache directory is set, each config file that was parsed successfully
+ * is also stored there in a precompiled form: a list of records with the index
+ * of the option, whether it was given as "no-<name>" and the stripped value.
+ * Loading these records from an mmap()ed cache file skips reading, lexing and
+ * key-lookup of the config file and all records were validated when the cache
+ * was written. Values are still handed to the option parsers so a cached load
+ * always has the same result as parsing the file.
+ * A cache file belongs to the path of its config file and is only used if the
+ * config file has the same size and mtime. If just the mtime differs (config
+ * management tends to rewrite unchanged files), the content hash decides.
+ * Cache files also carry a hash of the option table so they are ignored
+ * after an update of kmscon.
+ */
+
+#define CONF_CACHE_MAGIC "KMSCONFC"
+#define CONF_CACHE_VERSION 1
+#define CONF_HASH_INIT 14695981039346656037ULL
+
+struct conf_cache_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t onum;
+	uint64_t opts_hash;
+	uint64_t src_size;
+	int64_t src_sec;
+	int64_t src_nsec;
+	uint64_t src_hash;
+	uint64_t data_len;
+	uint64_t data_hash;
+};
+
+struct conf_cache_rec {
+	uint16_t idx;
+	uint8_t set;
+	uint8_t has_value;
+	uint32_t len;
+};
+
+struct conf_blob {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static int blob_append(struct conf_blob *b, const void *data, size_t len)
+{
+	size_t size;
+	char *tmp;
+
+	if (b->len + len > b->size) {
+		size = b->size ? b->size * 2 : 1024;
+		while (size < b->len + len)
+			size *= 2;
+		tmp = realloc(b->data, size);
+		if (!tmp)
+			return -ENOMEM;
+		b->data = tmp;
+		b->size = size;
+	}
+
+	if (data)
+		memcpy(&b->data[b->len], data, len);
+	else
+		memset(&b->data[b->len], 0, len);
+	b->len += len;
+	return 0;
+}
+
+/* FNV-1a */
+static uint64_t conf_hash(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t opts_hash(const struct conf_option *opts, size_t len)
+{
+	uint64_t hash = CONF_HASH_INIT;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		if (opts[i].long_name)
+			hash = conf_hash(hash, opts[i].long_name,
+					 strlen(opts[i].long_name) + 1);
+		hash = conf_hash(hash, &opts[i].type->flags,
+				 sizeof(opts[i].type->flags));
+	}
+
+	return hash;
+}
+
+static int cache_add(struct conf_blob *cache, unsigned int idx, bool set,
+		     const char *value)
+{
+	struct conf_cache_rec rec;
+	int ret;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.idx = idx;
+	rec.set = set;
+	rec.has_value = !!value;
+	rec.len = value ? strlen(value) + 1 : 0;
+
+	ret = blob_append(cache, &rec, sizeof(rec));
+	if (ret)
+		return ret;
+	if (value) {
+		ret = blob_append(cache, value, rec.len);
+		if (ret)
+			return ret;
+	}
+
+	/* keep records aligned */
+	return blob_append(cache, NULL, -cache->len % sizeof(uint32_t));
+}
+
+static int apply_option(struct conf_option *opt, bool set, const char *value)
+{
+	const char *key = set ? &opt->long_name[3] : opt->long_name;
+	int ret;
+
+	/* ignore if already set by command-line arguments */
+	if (opt->flags & CONF_LOCKED)
+		return 0;
+
+	if (opt->file) {
+		ret = opt->file(opt, set, value);
+		if (ret)
+			return ret;
+		return 0;
+	}
+
+	if (opt->type->flags & CONF_HAS_ARG && !value) {
+		log_error("config option '%s' requires an argument",
+			  key);
+		return -EFAULT;
+	} else if (!(opt->type->flags & CONF_HAS_ARG) && value) {
+		log_error("config option '%s' does not take arguments",
+			  key);
+		return -EFAULT;
+	}
+
+	if (opt->type->parse) {
+		ret = opt->type->parse(opt, set, value);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 static int parse_kv_pair(struct conf_option *opts, size_t len,
-			 const char *key, const char *value)
+			 const char *key, const char *value,
+			 struct conf_blob *cache)
 {
 	unsigned int i;
 	int ret;
@@ -344,34 +535,14 @@ static int parse_kv_pair(struct conf_option *opts, size_t len,
 		else
 			continue;
 
-		/* ignore if already set by command-line arguments */
-		if (opt->flags & CONF_LOCKED)
-			return 0;
-
-		if (opt->file) {
-			ret = opt->file(opt, set, value);
+		/* recorded even if locked; that depends on the command-line */
+		if (cache) {
+			ret = cache_add(cache, i, set, value);
 			if (ret)
 				return ret;
-			return 0;
 		}
 
-		if (opt->type->flags & CONF_HAS_ARG && !value) {
-			log_error("config option '%s' requires an argument",
-				  key);
-			return -EFAULT;
-		} else if (!(opt->type->flags & CONF_HAS_ARG) && value) {
-			log_error("config option '%s' does not take arguments",
-				  key);
-			return -EFAULT;
-		}
-
-		if (opt->type->parse) {
-			ret = opt->type->parse(opt, set, value);
-			if (ret)
-				return ret;
-		}
-
-		return 0;
+		return apply_option(opt, set, value);
 	}
 
 	log_error("unknown config option '%s'", key);
@@ -399,7 +570,7 @@ static void strip_spaces(char **buf)
 }
 
 static int parse_line(struct conf_option *opts, size_t olen,
-		      char **buf, size_t *size)
+		      char **buf, size_t *size, struct conf_blob *cache)
 {
 	char *key;
 	char *value = NULL;
@@ -480,7 +651,7 @@ done:
 		if (value)
 			strip_spaces(&value);
 
-		ret = parse_kv_pair(opts, olen, key, value);
+		ret = parse_kv_pair(opts, olen, key, value, cache);
 		if (ret)
 			return ret;
 	}
@@ -496,18 +667,11 @@ done:
 	return 0;
 }
 
-static int parse_buffer(struct conf_option *opts, size_t len,
-			char *buf, size_t size)
+static int run_afterchecks(struct conf_option *opts, size_t len)
 {
-	int ret = 0;
 	struct conf_option *o;
 	unsigned int i;
-
-	while (!ret && size > 0)
-		ret = parse_line(opts, len, &buf, &size);
-
-	if (ret)
-		return ret;
+	int ret;
 
 	for (i = 0; i < len; ++i) {
 		o = &opts[i];
@@ -521,35 +685,29 @@ static int parse_buffer(struct conf_option *opts, size_t len,
 	return 0;
 }
 
+static int parse_buffer(struct conf_option *opts, size_t len,
+			char *buf, size_t size, struct conf_blob *cache)
+{
+	int ret = 0;
+
+	while (!ret && size > 0)
+		ret = parse_line(opts, len, &buf, &size, cache);
+
+	if (ret)
+		return ret;
+
+	return run_afterchecks(opts, len);
+}
+
 /* chunk size when reading config files */
 #define CONF_BUFSIZE 4096
 
-/* This reads the file at \path in memory and parses it as if it was given as
- * command line options. */
-static int conf_parse_file(struct conf_option *opts, size_t len,
-			   const char *path)
+/* Reads the whole file @fd into a zero-terminated buffer. */
+static int read_file(int fd, const char *path, char **out, size_t *out_size)
 {
-	int fd, ret;
 	size_t size, pos;
 	char *buf, *tmp;
-
-	if (!opts || !len || !path)
-		return -EINVAL;
-
-	if (access(path, F_OK))
-		return 0;
-
-	if (access(path, R_OK)) {
-		log_error("read access to config file %s denied", path);
-		return -EACCES;
-	}
-
-	log_info("reading config file %s", path);
-	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
-	if (fd < 0) {
-		log_error("cannot open %s (%d): %m", path, errno);
-		return -EFAULT;
-	}
+	int ret;
 
 	buf = NULL;
 	size = 0;
@@ -561,8 +719,8 @@ static int conf_parse_file(struct conf_option *opts, size_t len,
 			if (!tmp) {
 				log_error("cannot allocate enough memory to parse config file %s (%d): %m",
 					  path, errno);
-				ret = -ENOMEM;
-				goto out_free;
+				free(buf);
+				return -ENOMEM;
 			}
 			buf = tmp;
 			size += CONF_BUFSIZE;
@@ -572,17 +730,311 @@ static int conf_parse_file(struct conf_option *opts, size_t len,
 		if (ret < 0) {
 			log_error("cannot read from config file %s (%d): %m",
 				  path, errno);
-			ret = -EFAULT;
-			goto out_free;
+			free(buf);
+			return -EFAULT;
 		}
 		pos += ret;
 	} while (ret > 0);
 
 	buf[pos] = 0;
-	ret = parse_buffer(opts, len, buf, pos);
+	*out = buf;
+	*out_size = pos;
+	return 0;
+}
+
+static char *cache_path(const char *dir, const char *path)
+{
+	char *cpath;
+
+	if (asprintf(&cpath, "%s/%016" PRIx64 ".conf.cache", dir,
+		     conf_hash(CONF_HASH_INIT, path, strlen(path))) < 0)
+		return NULL;
+
+	return cpath;
+}
+
+/* Cache files are only trusted if nobody but us could have written them. */
+static bool cache_trusted(int cfd, const char *cpath)
+{
+	struct stat st;
+	char *dir, *sep;
+	int ret;
+
+	if (fstat(cfd, &st) || !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() || (st.st_mode & 022))
+		return false;
+
+	dir = strdup(cpath);
+	if (!dir)
+		return false;
+	sep = strrchr(dir, '/');
+	if (sep == dir)
+		sep[1] = 0;
+	else if (sep)
+		*sep = 0;
+	else
+		strcpy(dir, ".");
+
+	ret = stat(dir, &st);
+	free(dir);
+
+	return !ret && st.st_uid == geteuid() && !(st.st_mode & 022);
+}
+
+/* Sets @stale if the file was only recognized by its content and the stored
+ * modification time must be refreshed. */
+static bool cache_valid(const struct conf_cache_hdr *hdr, size_t size,
+			struct conf_option *opts, size_t len, int fd,
+			const char *path, const struct stat *st, bool *stale)
+{
+	const char *data = (const char*)(hdr + 1);
+	uint64_t hash;
+	size_t src_size;
+	char *buf;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, CONF_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != CONF_CACHE_VERSION ||
+	    hdr->onum != len ||
+	    hdr->opts_hash != opts_hash(opts, len) ||
+	    hdr->data_len != size - sizeof(*hdr) ||
+	    hdr->data_hash != conf_hash(CONF_HASH_INIT, data, hdr->data_len) ||
+	    hdr->src_size != (uint64_t)st->st_size)
+		return false;
+
+	if (hdr->src_sec == st->st_mtim.tv_sec &&
+	    hdr->src_nsec == st->st_mtim.tv_nsec)
+		return true;
+
+	if (read_file(fd, path, &buf, &src_size))
+		return false;
+	hash = conf_hash(CONF_HASH_INIT, buf, src_size);
+	free(buf);
+
+	if (src_size != hdr->src_size || hash != hdr->src_hash)
+		return false;
+
+	*stale = true;
+	return true;
+}
+
+static int cache_apply(const struct conf_cache_hdr *hdr,
+		       struct conf_option *opts, size_t len)
+{
+	const char *data = (const char*)(hdr + 1);
+	const char *end = data + hdr->data_len;
+	const struct conf_cache_rec *rec;
+	const char *value;
+	int ret;
+
+	while (data < end) {
+		if ((size_t)(end - data) < sizeof(*rec))
+			return -EINVAL;
+		rec = (const void*)data;
+		data += sizeof(*rec);
+
+		if (rec->idx >= len || !opts[rec->idx].long_name ||
+		    rec->len > (size_t)(end - data) ||
+		    (rec->len && data[rec->len - 1]))
+			return -EINVAL;
+
+		value = rec->has_value ? data : NULL;
+		data += rec->len;
+		data += -(data - (const char*)(hdr + 1)) % sizeof(uint32_t);
+
+		ret = apply_option(&opts[rec->idx], rec->set, value);
+		if (ret)
+			return ret;
+	}
+
+	return run_afterchecks(opts, len);
+}
+
+static void cache_store(struct conf_option *opts, size_t len,
+			const struct stat *st, const char *cpath,
+			uint64_t src_hash, const struct conf_blob *cache);
+
+/* Returns -ENOENT if there is no usable cache-file for @path. */
+static int cache_load(struct conf_option *opts, size_t len, int fd,
+		      const char *path, const struct stat *st,
+		      const char *cpath)
+{
+	const struct conf_cache_hdr *hdr;
+	struct conf_blob blob;
+	struct stat cst;
+	bool stale = false;
+	void *map;
+	int cfd, ret;
+
+	cfd = open(cpath, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW);
+	if (cfd < 0)
+		return -ENOENT;
+
+	if (!cache_trusted(cfd, cpath)) {
+		log_warning("ignoring config cache %s writable by others",
+			    cpath);
+		close(cfd);
+		return -ENOENT;
+	}
+
+	if (fstat(cfd, &cst) || !cst.st_size) {
+		close(cfd);
+		return -ENOENT;
+	}
+
+	map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, cfd, 0);
+	close(cfd);
+	if (map == MAP_FAILED)
+		return -ENOENT;
+
+	if (!cache_valid(map, cst.st_size, opts, len, fd, path, st, &stale)) {
+		ret = -ENOENT;
+		goto out_unmap;
+	}
+
+	log_info("reading config file %s from cache", path);
+	ret = cache_apply(map, opts, len);
+	if (ret == -EINVAL) {
+		log_error("invalid config cache %s", cpath);
+		ret = -EFAULT;
+	}
+
+	/* the file was touched but not changed; store the new mtime so the
+	 * next start does not hash the file again */
+	if (!ret && stale) {
+		hdr = map;
+		blob.data = (char*)(hdr + 1);
+		blob.len = hdr->data_len;
+		blob.size = hdr->data_len;
+		cache_store(opts, len, st, cpath, hdr->src_hash, &blob);
+	}
+
+out_unmap:
+	munmap(map, cst.st_size);
+	return ret;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t l;
+
+	while (len) {
+		l = write(fd, p, len);
+		if (l < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += l;
+		len -= l;
+	}
+
+	return 0;
+}
+
+static void cache_store(struct conf_option *opts, size_t len,
+			const struct stat *st, const char *cpath,
+			uint64_t src_hash, const struct conf_blob *cache)
+{
+	struct conf_cache_hdr hdr;
+	char *tmp;
+	int cfd, ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CONF_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CONF_CACHE_VERSION;
+	hdr.onum = len;
+	hdr.opts_hash = opts_hash(opts, len);
+	hdr.src_size = st->st_size;
+	hdr.src_sec = st->st_mtim.tv_sec;
+	hdr.src_nsec = st->st_mtim.tv_nsec;
+	hdr.src_hash = src_hash;
+	hdr.data_len = cache->len;
+	hdr.data_hash = conf_hash(CONF_HASH_INIT, cache->data, cache->len);
+
+	if (asprintf(&tmp, "%s.XXXXXX", cpath) < 0)
+		return;
+
+	/* write a temporary file and rename it so readers never see a
+	 * partially written cache */
+	cfd = mkostemp(tmp, O_CLOEXEC);
+	if (cfd < 0) {
+		log_warning("cannot create config cache %s (%d): %m",
+			    tmp, errno);
+		goto out_free;
+	}
+
+	ret = write_all(cfd, &hdr, sizeof(hdr));
+	if (!ret)
+		ret = write_all(cfd, cache->data, cache->len);
+	close(cfd);
+
+	if (!ret && rename(tmp, cpath))
+		ret = -errno;
+	if (ret) {
+		log_warning("cannot write config cache %s (%d)", cpath, ret);
+		unlink(tmp);
+	}
 
 out_free:
+	free(tmp);
+}
+
+/* This reads the file at \path in memory and parses it as if it was given as
+ * command line options. */
+static int conf_parse_file(struct conf_option *opts, size_t len,
+			   const char *path, const char *cache_dir)
+{
+	struct conf_blob cache = { NULL, 0, 0 };
+	char *buf, *cpath = NULL;
+	struct stat st;
+	uint64_t src_hash;
+	size_t size;
+	int fd, ret;
+
+	if (!opts || !len || !path)
+		return -EINVAL;
+
+	if (access(path, F_OK))
+		return 0;
+
+	if (access(path, R_OK)) {
+		log_error("read access to config file %s denied", path);
+		return -EACCES;
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd < 0) {
+		log_error("cannot open %s (%d): %m", path, errno);
+		return -EFAULT;
+	}
+
+	/* the cache is keyed by the state of the file before we read it */
+	if (cache_dir && !fstat(fd, &st)) {
+		cpath = cache_path(cache_dir, path);
+		if (cpath) {
+			ret = cache_load(opts, len, fd, path, &st, cpath);
+			if (ret != -ENOENT)
+				goto out_close;
+			lseek(fd, 0, SEEK_SET);
+		}
+	}
+
+	log_info("reading config file %s", path);
+	ret = read_file(fd, path, &buf, &size);
+	if (ret)
+		goto out_close;
+
+	src_hash = conf_hash(CONF_HASH_INIT, buf, size);
+	ret = parse_buffer(opts, len, buf, size, cpath ? &cache : NULL);
+	if (!ret && cpath)
+		cache_store(opts, len, &st, cpath, src_hash, &cache);
+
+	free(cache.data);
 	free(buf);
+out_close:
+	free(cpath);
 	close(fd);
 	return ret;
 }
@@ -605,7 +1057,7 @@ int conf_ctx_parse_file(struct conf_ctx *ctx, const char *format, ...)
 		return -ENOMEM;
 	}
 
-	ret = conf_parse_file(ctx->opts, ctx->onum, path);
+	ret = conf_parse_file(ctx->opts, ctx->onum, path, ctx->cache_dir);
 	free(path);
 	return ret;
 }
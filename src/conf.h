@@ -139,6 +139,7 @@ int conf_ctx_new(struct conf_ctx **out, const struct conf_option *opts,
 void conf_ctx_free(struct conf_ctx *ctx);
 void conf_ctx_reset(struct conf_ctx *ctx);
 void *conf_ctx_get_mem(struct conf_ctx *ctx);
+int conf_ctx_set_cache(struct conf_ctx *ctx, const char *dir);
 
 int conf_ctx_parse_ctx(struct conf_ctx *ctx, const struct conf_ctx *src);
 int conf_ctx_parse_argv(struct conf_ctx *ctx, int argc, char **argv);
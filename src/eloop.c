@@ -180,6 +180,12 @@
 
 #define LLOG_SUBSYSTEM "eloop"
 
+#define EV_WHEEL_SHIFT 20
+#define EV_WHEEL_BITS 6
+#define EV_WHEEL_SIZE (1 << EV_WHEEL_BITS)
+#define EV_WHEEL_MASK (EV_WHEEL_SIZE - 1)
+#define EV_WHEEL_LEVELS 5
+
 /**
  * ev_eloop:
  * @ref: refcnt of this object
@@ -193,6 +199,15 @@
  * @cur_fds: Current dispatch array of fds
  * @cur_fds_cnt: current length of \cur_fds
  * @cur_fds_size: absolute size of \cur_fds
+ * @deferred: Events deferred to the next dispatch round (size: \cur_fds_size)
+ * @deferred_cnt: current length of \deferred
+ * @budget: Dispatch budget in microseconds or 0
+ * @timer_fd: Shared timerfd of all timers or -1
+ * @timer_efd: Unreferenced fd-source for \timer_fd
+ * @timer_armed: Absolute expiry \timer_fd is programmed to or 0
+ * @wheel_tick: Current tick of the timer wheel
+ * @wheel_map: Bitmap of non-empty slots per wheel level
+ * @wheel: Timer wheel slots
  * @exit: true if we should exit the main loop
  *
  * An event loop is an object where you can register event sources. If you then
@@ -217,6 +232,19 @@ struct ev_eloop {
 	struct epoll_event *cur_fds;
 	size_t cur_fds_cnt;
 	size_t cur_fds_size;
+	struct epoll_event *deferred;
+	size_t deferred_cnt;
+	unsigned int budget;
+
+	int timer_fd;
+	struct ev_fd *timer_efd;
+	uint64_t timer_armed;
+	uint64_t wheel_tick;
+	uint64_t wheel_map[EV_WHEEL_LEVELS];
+	struct shl_dlist wheel[EV_WHEEL_LEVELS][EV_WHEEL_SIZE];
+
+	/* children are reaped elsewhere, see ev_eloop_set_reaper() */
+	bool no_reaper;
 	bool exit;
 };
 
@@ -229,6 +257,7 @@ struct ev_eloop {
  * @mask: the event mask for this fd (EV_READABLE, EV_WRITEABLE, ...)
  * @cb: the user callback
  * @data: the user data
+ * @prio: priority class (EV_PRIO_*)
  * @enabled: true if the object is currently enabled
  * @loop: NULL or pointer to eloop if bound
  *
@@ -243,6 +272,7 @@ struct ev_fd {
 	int mask;
 	ev_fd_cb cb;
 	void *data;
+	unsigned int prio;
 
 	bool enabled;
 	struct ev_eloop *loop;
@@ -255,10 +285,16 @@ struct ev_fd {
  * @llog_data: llog log function user-data
  * @cb: user callback
  * @data: user data
- * @fd: the timerfd file descriptor
- * @efd: fd-source for @fd
+ * @loop: NULL or pointer to eloop if bound
+ * @list: link into a wheel slot or the list of expired timers
+ * @level: wheel level of @list or -1 if not linked into the wheel
+ * @slot: wheel slot of @list
+ * @enabled: true if the object is currently enabled
+ * @deadline: absolute CLOCK_MONOTONIC expiry in nanoseconds or 0
+ * @interval: period in nanoseconds or 0 for one-shot timers
  *
- * Based on timerfd this allows firing events based on relative timeouts.
+ * Timers fire events based on relative timeouts. They are multiplexed on the
+ * timer wheel of their event loop.
  */
 struct ev_timer {
 	unsigned long ref;
@@ -267,8 +303,13 @@ struct ev_timer {
 	ev_timer_cb cb;
 	void *data;
 
-	int fd;
-	struct ev_fd *efd;
+	struct ev_eloop *loop;
+	struct shl_dlist list;
+	int level;
+	unsigned int slot;
+	bool enabled;
+	uint64_t deadline;
+	uint64_t interval;
 };
 
 /**
@@ -599,6 +640,7 @@ SHL_EXPORT
 int ev_eloop_new(struct ev_eloop **out, ev_log_t log, void *log_data)
 {
 	struct ev_eloop *loop;
+	unsigned int i, j;
 	int ret;
 	struct epoll_event ep;
 
@@ -613,8 +655,14 @@ int ev_eloop_new(struct ev_eloop **out, ev_log_t log, void *log_data)
 	loop->ref = 1;
 	loop->llog = log;
 	loop->llog_data = log_data;
+	loop->timer_fd = -1;
 	shl_dlist_init(&loop->sig_list);
 
+	for (i = 0; i < EV_WHEEL_LEVELS; ++i) {
+		for (j = 0; j < EV_WHEEL_SIZE; ++j)
+			shl_dlist_init(&loop->wheel[i][j]);
+	}
+
 	loop->cur_fds_size = 32;
 	loop->cur_fds = malloc(sizeof(struct epoll_event) *
 			       loop->cur_fds_size);
@@ -623,9 +671,16 @@ int ev_eloop_new(struct ev_eloop **out, ev_log_t log, void *log_data)
 		goto err_free;
 	}
 
+	loop->deferred = malloc(sizeof(struct epoll_event) *
+				loop->cur_fds_size);
+	if (!loop->deferred) {
+		ret = llog_ENOMEM(loop);
+		goto err_fds;
+	}
+
 	ret = shl_hook_new(&loop->chlds);
 	if (ret)
-		goto err_fds;
+		goto err_deferred;
 
 	ret = shl_hook_new(&loop->idlers);
 	if (ret)
@@ -688,6 +743,8 @@ err_idlers:
 	shl_hook_free(loop->idlers);
 err_childs:
 	shl_hook_free(loop->chlds);
+err_deferred:
+	free(loop->deferred);
 err_fds:
 	free(loop->cur_fds);
 err_free:
@@ -734,7 +791,7 @@ void ev_eloop_unref(struct ev_eloop *loop)
 
 	llog_debug(loop, "free eloop object %p", loop);
 
-	if (shl_hook_num(loop->chlds))
+	if (shl_hook_num(loop->chlds) && !loop->no_reaper)
 		ev_eloop_unregister_signal_cb(loop, SIGCHLD, sig_child, loop);
 
 	while (loop->sig_list.next != &loop->sig_list) {
@@ -750,40 +807,82 @@ void ev_eloop_unref(struct ev_eloop *loop)
 			     loop->idle_fd, errno);
 	close(loop->idle_fd);
 
+	if (loop->timer_fd >= 0) {
+		ret = epoll_ctl(loop->efd, EPOLL_CTL_DEL, loop->timer_fd, NULL);
+		if (ret)
+			llog_warning(loop, "cannot remove fd %d from epollset (%d): %m",
+				     loop->timer_fd, errno);
+		loop->timer_efd->loop = NULL;
+		ev_fd_unref(loop->timer_efd);
+		close(loop->timer_fd);
+	}
+
 	ev_fd_unref(loop->fd);
 	close(loop->efd);
 	shl_hook_free(loop->posts);
 	shl_hook_free(loop->pres);
 	shl_hook_free(loop->idlers);
 	shl_hook_free(loop->chlds);
+	free(loop->deferred);
 	free(loop->cur_fds);
 	free(loop);
 }
 
+/**
+ * ev_eloop_set_budget:
+ * @loop: Event loop to be modified or NULL
+ * @usecs: Dispatch budget in microseconds or 0
+ *
+ * This sets the time budget of a single dispatch round. Once a round has run
+ * for longer than @usecs microseconds, all further events of class
+ * %EV_PRIO_BULK are deferred to the next round. At least one bulk event is
+ * dispatched every round so they cannot starve. 0 disables the budget, which
+ * is the default.
+ */
+SHL_EXPORT
+void ev_eloop_set_budget(struct ev_eloop *loop, unsigned int usecs)
+{
+	if (!loop)
+		return;
+
+	loop->budget = usecs;
+}
+
+static void eloop_unlink_fd(struct ev_eloop *loop, struct ev_fd *fd)
+{
+	size_t i;
+
+	if (loop->dispatching) {
+		for (i = 0; i < loop->cur_fds_cnt; ++i) {
+			if (loop->cur_fds[i].data.ptr == fd)
+				loop->cur_fds[i].data.ptr = NULL;
+		}
+	}
+
+	for (i = 0; i < loop->deferred_cnt; ++i) {
+		if (loop->deferred[i].data.ptr == fd)
+			loop->deferred[i].data.ptr = NULL;
+	}
+}
+
 /**
  * ev_eloop_flush_fd:
  * @loop: The event loop where @fd is registered
  * @fd: The fd to be flushed
  *
  * If @loop is currently dispatching events, this will remove all pending events
- * of @fd from the current event-list.
+ * of @fd from the current event-list. Events of @fd that were deferred to the
+ * next dispatch round are removed, too.
  */
 SHL_EXPORT
 void ev_eloop_flush_fd(struct ev_eloop *loop, struct ev_fd *fd)
 {
-	int i;
-
 	if (!loop)
 		return;
 	if (!fd)
 		return llog_vEINVAL(loop);
 
-	if (loop->dispatching) {
-		for (i = 0; i < loop->cur_fds_cnt; ++i) {
-			if (loop->cur_fds[i].data.ptr == fd)
-				loop->cur_fds[i].data.ptr = NULL;
-		}
-	}
+	eloop_unlink_fd(loop, fd);
 }
 
 static unsigned int convert_mask(uint32_t mask)
@@ -802,6 +901,78 @@ static unsigned int convert_mask(uint32_t mask)
 	return res;
 }
 
+static unsigned int event_prio(struct ev_eloop *loop, struct epoll_event *ep)
+{
+	struct ev_fd *fd = ep->data.ptr;
+
+	if (!fd || ep->data.ptr == loop)
+		return EV_PRIO_DEFAULT;
+
+	return fd->prio;
+}
+
+/*
+ * Stable insertion sort by priority class. Most rounds contain only a handful
+ * of events which are often already sorted, so this is cheaper than anything
+ * fancier. Deferred events are at the front of the array so they stay ahead
+ * of new events of the same class.
+ */
+static void sort_events(struct ev_eloop *loop, struct epoll_event *ep,
+			size_t num)
+{
+	struct epoll_event tmp;
+	unsigned int prio;
+	size_t i, j;
+
+	for (i = 1; i < num; ++i) {
+		prio = event_prio(loop, &ep[i]);
+		if (event_prio(loop, &ep[i - 1]) <= prio)
+			continue;
+
+		tmp = ep[i];
+		for (j = i; j > 0 && event_prio(loop, &ep[j - 1]) > prio; --j)
+			ep[j] = ep[j - 1];
+		ep[j] = tmp;
+	}
+}
+
+/*
+ * Merge deferred events into the array of new events. Level-triggered fds are
+ * reported again by epoll, so their events are merged into the deferred entry
+ * to avoid calling the callback twice.
+ */
+static void merge_deferred(struct ev_eloop *loop, size_t num, size_t count)
+{
+	struct epoll_event *ep = loop->cur_fds;
+	size_t i, j;
+
+	memcpy(ep, loop->deferred, sizeof(*ep) * num);
+	loop->deferred_cnt = 0;
+
+	for (i = num; i < num + count; ++i) {
+		for (j = 0; j < num; ++j) {
+			if (ep[j].data.ptr && ep[j].data.ptr == ep[i].data.ptr) {
+				ep[j].events |= ep[i].events;
+				ep[i].data.ptr = NULL;
+				break;
+			}
+		}
+	}
+}
+
+static bool budget_exhausted(struct ev_eloop *loop,
+			     const struct timespec *start)
+{
+	struct timespec ts;
+	int64_t usecs;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	usecs = (int64_t)(ts.tv_sec - start->tv_sec) * 1000000LL;
+	usecs += (ts.tv_nsec - start->tv_nsec) / 1000;
+
+	return usecs >= loop->budget;
+}
+
 /**
  * ev_eloop_dispatch:
  * @loop: Event loop to be dispatched
@@ -816,6 +987,11 @@ static unsigned int convert_mask(uint32_t mask)
  * checked for events and there are no more pending events, this will return. If
  * it handled events and the timeout has not elapsed, this will still return.
  *
+ * Events are handled in order of the priority class of their source, see
+ * ev_fd_set_priority(). If a dispatch budget is set, bulk events may be
+ * deferred to the next round. In this case the next round is scheduled
+ * immediately.
+ *
  * If ev_eloop_exit() was called on @loop, then this will return immediately.
  *
  * Returns: 0 on success, otherwise negative error code
@@ -825,7 +1001,10 @@ int ev_eloop_dispatch(struct ev_eloop *loop, int timeout)
 {
 	struct epoll_event *ep;
 	struct ev_fd *fd;
-	int i, count, mask, ret;
+	struct timespec start;
+	int count, mask, ret;
+	size_t i, num;
+	unsigned int bulk;
 
 	if (!loop)
 		return -EINVAL;
@@ -840,9 +1019,12 @@ int ev_eloop_dispatch(struct ev_eloop *loop, int timeout)
 
 	shl_hook_call(loop->pres, loop, NULL);
 
+	/* deferred_cnt is always smaller than cur_fds_size as at least one
+	 * bulk event is dispatched every round */
+	num = loop->deferred_cnt;
 	count = epoll_wait(loop->efd,
-			   loop->cur_fds,
-			   loop->cur_fds_size,
+			   loop->cur_fds + num,
+			   loop->cur_fds_size - num,
 			   timeout);
 	if (count < 0) {
 		if (errno == EINTR) {
@@ -853,14 +1035,21 @@ int ev_eloop_dispatch(struct ev_eloop *loop, int timeout)
 			ret = -errno;
 			goto out_dispatch;
 		}
-	} else if (count > loop->cur_fds_size) {
-		count = loop->cur_fds_size;
+	} else if (count > loop->cur_fds_size - num) {
+		count = loop->cur_fds_size - num;
 	}
 
+	if (num)
+		merge_deferred(loop, num, count);
+	if (loop->budget)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
 	ep = loop->cur_fds;
-	loop->cur_fds_cnt = count;
+	loop->cur_fds_cnt = num + count;
+	sort_events(loop, ep, loop->cur_fds_cnt);
+	bulk = 0;
 
-	for (i = 0; i < count; ++i) {
+	for (i = 0; i < loop->cur_fds_cnt; ++i) {
 		if (ep[i].data.ptr == loop) {
 			mask = convert_mask(ep[i].events);
 			eloop_idle_event(loop, mask);
@@ -869,14 +1058,30 @@ int ev_eloop_dispatch(struct ev_eloop *loop, int timeout)
 			if (!fd || !fd->cb || !fd->enabled)
 				continue;
 
+			if (loop->budget && fd->prio == EV_PRIO_BULK &&
+			    bulk++ && budget_exhausted(loop, &start)) {
+				loop->deferred[loop->deferred_cnt++] = ep[i];
+				ep[i].data.ptr = NULL;
+				continue;
+			}
+
 			mask = convert_mask(ep[i].events);
 			fd->cb(fd, mask, fd->data);
 		}
 	}
 
-	if (count == loop->cur_fds_size) {
-		ep = realloc(loop->cur_fds, sizeof(struct epoll_event) *
+	/* make sure we get woken up again to handle deferred events */
+	if (loop->deferred_cnt)
+		write_eventfd(loop->llog, loop->llog_data, loop->idle_fd, 1);
+
+	if (count == loop->cur_fds_size - num) {
+		ep = realloc(loop->deferred, sizeof(struct epoll_event) *
 			     loop->cur_fds_size * 2);
+		if (ep) {
+			loop->deferred = ep;
+			ep = realloc(loop->cur_fds, sizeof(struct epoll_event) *
+				     loop->cur_fds_size * 2);
+		}
 		if (!ep) {
 			llog_warning(loop, "cannot reallocate dispatch cache to size %zu",
 				    loop->cur_fds_size * 2);
@@ -1133,6 +1338,7 @@ int ev_fd_new(struct ev_fd **out, int rfd, int mask, ev_fd_cb cb, void *data,
 	fd->mask = mask;
 	fd->cb = cb;
 	fd->data = data;
+	fd->prio = EV_PRIO_DEFAULT;
 	fd->enabled = true;
 
 	*out = fd;
@@ -1370,6 +1576,45 @@ int ev_fd_update(struct ev_fd *fd, int mask)
 	return 0;
 }
 
+/**
+ * ev_fd_set_priority:
+ * @fd: FD object
+ * @prio: Priority class (EV_PRIO_*)
+ *
+ * This sets the priority class of @fd. During each dispatch round, events of
+ * higher classes are handled first. Events of class %EV_PRIO_BULK may be
+ * deferred to the next round, see ev_eloop_set_budget(). New fds use
+ * %EV_PRIO_DEFAULT.
+ *
+ * Returns: 0 on success, otherwise negative error code
+ */
+SHL_EXPORT
+int ev_fd_set_priority(struct ev_fd *fd, unsigned int prio)
+{
+	if (!fd)
+		return -EINVAL;
+	if (prio >= EV_PRIO_NUM)
+		return llog_EINVAL(fd);
+
+	fd->prio = prio;
+	return 0;
+}
+
+/**
+ * ev_fd_get_priority:
+ * @fd: FD object
+ *
+ * Returns: The priority class of @fd or %EV_PRIO_DEFAULT if @fd is NULL.
+ */
+SHL_EXPORT
+unsigned int ev_fd_get_priority(struct ev_fd *fd)
+{
+	if (!fd)
+		return EV_PRIO_DEFAULT;
+
+	return fd->prio;
+}
+
 /**
  * ev_eloop_new_fd:
  * @loop: Event loop
@@ -1464,7 +1709,6 @@ SHL_EXPORT
 void ev_eloop_rm_fd(struct ev_fd *fd)
 {
 	struct ev_eloop *loop;
-	size_t i;
 
 	if (!fd || !fd->loop)
 		return;
@@ -1475,14 +1719,9 @@ void ev_eloop_rm_fd(struct ev_fd *fd)
 
 	/*
 	 * If we are currently dispatching events, we need to remove ourself
-	 * from the temporary event list.
+	 * from the temporary event list. Deferred events are dropped, too.
 	 */
-	if (loop->dispatching) {
-		for (i = 0; i < loop->cur_fds_cnt; ++i) {
-			if (fd == loop->cur_fds[i].data.ptr)
-				loop->cur_fds[i].data.ptr = NULL;
-		}
-	}
+	eloop_unlink_fd(loop, fd);
 
 	fd->loop = NULL;
 	ev_fd_unref(fd);
@@ -1499,65 +1738,377 @@ void ev_eloop_rm_fd(struct ev_fd *fd)
  * was last called (in case the application couldn't call the callback fast
  * enough). The timeout can be specified with nano-seconds precision. However,
  * real precision depends on the operating-system and hardware.
+ *
+ * Timers do not own a timerfd. Instead, every event loop has a single timerfd
+ * and a hierarchical timer wheel. The wheel has EV_WHEEL_LEVELS levels of
+ * EV_WHEEL_SIZE slots each. A slot on level 0 covers one tick of
+ * 2^EV_WHEEL_SHIFT nanoseconds (about 1ms), a slot on level N covers
+ * EV_WHEEL_SIZE^N ticks. Higher-level slots are cascaded into lower levels
+ * when the wheel reaches them. The timerfd is always programmed to the exact
+ * deadline of the earliest timer (or the next cascade), so precision is not
+ * limited by the tick length.
+ * Linking and unlinking a timer is O(1) and requires a syscall only if it
+ * becomes the earliest timer of the loop. Cancelled timers may cause a single
+ * spurious wakeup, which is cheaper than reprogramming the timerfd every time.
  */
 
-static int timer_drain(struct ev_timer *timer, uint64_t *out)
+static uint64_t timer_now(void)
 {
-	int len;
-	uint64_t expirations;
+	struct timespec ts;
 
-	if (out)
-		*out = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-	len = read(timer->fd, &expirations, sizeof(expirations));
-	if (len < 0) {
-		if (errno == EAGAIN) {
-			return 0;
-		} else {
-			llog_warning(timer, "cannot read timerfd (%d): %m",
-				     errno);
-			return errno;
-		}
-	} else if (len == 0) {
-		llog_warning(timer, "EOF on timer source");
-		return -EFAULT;
-	} else if (len != sizeof(expirations)) {
-		llog_warn(timer, "invalid size %d read on timerfd", len);
-		return -EFAULT;
-	} else {
-		if (out)
-			*out = expirations;
+static uint64_t timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void timer_set_spec(struct ev_timer *timer,
+			   const struct itimerspec *spec)
+{
+	uint64_t value;
+
+	value = timespec_to_ns(&spec->it_value);
+	timer->interval = timespec_to_ns(&spec->it_interval);
+	timer->deadline = value ? timer_now() + value : 0;
+}
+
+/*
+ * Returns the number of expirations of @timer until @now and advances its
+ * deadline past @now. One-shot timers are disarmed. The timer must not be
+ * linked into the wheel while calling this.
+ */
+static uint64_t timer_expire(struct ev_timer *timer, uint64_t now)
+{
+	uint64_t num;
+
+	if (!timer->deadline || timer->deadline > now)
 		return 0;
+
+	if (!timer->interval) {
+		timer->deadline = 0;
+		return 1;
 	}
+
+	num = 1 + (now - timer->deadline) / timer->interval;
+	timer->deadline += num * timer->interval;
+	return num;
 }
 
-static void timer_cb(struct ev_fd *fd, int mask, void *data)
+static void wheel_unlink(struct ev_timer *timer)
 {
-	struct ev_timer *timer = data;
-	uint64_t expirations;
+	struct ev_eloop *loop = timer->loop;
+
+	if (!timer->list.next)
+		return;
+
+	shl_dlist_unlink(&timer->list);
+	if (timer->level >= 0 &&
+	    shl_dlist_empty(&loop->wheel[timer->level][timer->slot]))
+		loop->wheel_map[timer->level] &= ~(1ULL << timer->slot);
+	timer->level = -1;
+}
+
+static void wheel_link(struct ev_eloop *loop, struct ev_timer *timer)
+{
+	uint64_t expires, delta;
+	unsigned int level, shift;
+
+	expires = timer->deadline >> EV_WHEEL_SHIFT;
+	if (expires < loop->wheel_tick)
+		expires = loop->wheel_tick;
+	delta = expires - loop->wheel_tick;
+
+	for (level = 0; level < EV_WHEEL_LEVELS - 1; ++level) {
+		if (delta < 1ULL << (EV_WHEEL_BITS * (level + 1)))
+			break;
+	}
+
+	/* clamp timeouts beyond the top level; they are re-sorted when their
+	 * slot is cascaded */
+	shift = EV_WHEEL_BITS * level;
+	if (delta >= 1ULL << (shift + EV_WHEEL_BITS))
+		expires = loop->wheel_tick +
+			  (1ULL << (shift + EV_WHEEL_BITS)) - 1;
+
+	timer->level = level;
+	timer->slot = (expires >> shift) & EV_WHEEL_MASK;
+	shl_dlist_link_tail(&loop->wheel[level][timer->slot], &timer->list);
+	loop->wheel_map[level] |= 1ULL << timer->slot;
+}
+
+static bool wheel_empty(struct ev_eloop *loop)
+{
+	unsigned int i;
+
+	for (i = 0; i < EV_WHEEL_LEVELS; ++i) {
+		if (loop->wheel_map[i])
+			return false;
+	}
+
+	return true;
+}
+
+static void wheel_cascade(struct ev_eloop *loop, unsigned int level,
+			  unsigned int slot)
+{
+	struct shl_dlist *iter, *tmp;
+	struct ev_timer *timer;
+
+	if (!(loop->wheel_map[level] & (1ULL << slot)))
+		return;
+
+	/* timers are always re-linked into lower levels or, if clamped, into a
+	 * different slot so they are never visited twice */
+	shl_dlist_for_each_safe(iter, tmp, &loop->wheel[level][slot]) {
+		timer = shl_dlist_entry(iter, struct ev_timer, list);
+		shl_dlist_unlink(iter);
+		wheel_link(loop, timer);
+	}
+
+	loop->wheel_map[level] &= ~(1ULL << slot);
+}
+
+/*
+ * Advance the wheel to @now and move all expired timers to @expired. Empty
+ * stretches of the wheel are skipped, so this does not iterate every tick
+ * after long idle periods.
+ */
+static void wheel_advance(struct ev_eloop *loop, uint64_t now,
+			  struct shl_dlist *expired)
+{
+	uint64_t tick, next, now_tick, above;
+	unsigned int level, idx, shift;
+	struct shl_dlist *iter, *tmp;
+	struct ev_timer *timer;
+
+	now_tick = now >> EV_WHEEL_SHIFT;
+
+	while (1) {
+		tick = loop->wheel_tick;
+
+		for (level = 1; level < EV_WHEEL_LEVELS; ++level) {
+			shift = EV_WHEEL_BITS * level;
+			if (tick & ((1ULL << shift) - 1))
+				break;
+			wheel_cascade(loop, level,
+				      (tick >> shift) & EV_WHEEL_MASK);
+		}
+
+		idx = tick & EV_WHEEL_MASK;
+		shl_dlist_for_each_safe(iter, tmp, &loop->wheel[0][idx]) {
+			timer = shl_dlist_entry(iter, struct ev_timer, list);
+			if (timer->deadline > now)
+				continue;
+
+			wheel_unlink(timer);
+			shl_dlist_link_tail(expired, &timer->list);
+		}
+
+		if (tick >= now_tick)
+			break;
+
+		/* find the next tick where anything needs to be done */
+		next = tick + 1;
+		for (level = 0; level < EV_WHEEL_LEVELS; ++level) {
+			shift = EV_WHEEL_BITS * level;
+			idx = (tick >> shift) & EV_WHEEL_MASK;
+			above = idx < EV_WHEEL_MASK ?
+				loop->wheel_map[level] >> (idx + 1) : 0;
+
+			if (above) {
+				next = ((tick >> shift) + 1) << shift;
+				break;
+			}
+
+			next = ((tick >> (shift + EV_WHEEL_BITS)) + 1) <<
+			       (shift + EV_WHEEL_BITS);
+			if (loop->wheel_map[level])
+				break;
+		}
+
+		loop->wheel_tick = next < now_tick ? next : now_tick;
+	}
+}
+
+static unsigned int wheel_find(uint64_t map, unsigned int start)
+{
+	uint64_t rot;
+
+	start &= EV_WHEEL_MASK;
+	rot = (map >> start) | (map << ((EV_WHEEL_SIZE - start) &
+					EV_WHEEL_MASK));
+	return (start + __builtin_ctzll(rot)) & EV_WHEEL_MASK;
+}
+
+/*
+ * Returns the next time the wheel needs to be advanced. This is the exact
+ * deadline of the earliest timer on the lowest level. For higher levels, this
+ * is the time when the next non-empty slot is cascaded. 0 is returned if the
+ * wheel is empty.
+ */
+static uint64_t wheel_next(struct ev_eloop *loop)
+{
+	uint64_t best, t, tick = loop->wheel_tick;
+	unsigned int level, idx, slot, dist, shift;
+	struct shl_dlist *iter;
+	struct ev_timer *timer;
+
+	best = 0;
+
+	if (loop->wheel_map[0]) {
+		slot = wheel_find(loop->wheel_map[0], tick);
+		shl_dlist_for_each(iter, &loop->wheel[0][slot]) {
+			timer = shl_dlist_entry(iter, struct ev_timer, list);
+			if (!best || timer->deadline < best)
+				best = timer->deadline;
+		}
+	}
+
+	for (level = 1; level < EV_WHEEL_LEVELS; ++level) {
+		if (!loop->wheel_map[level])
+			continue;
+
+		shift = EV_WHEEL_BITS * level;
+		idx = (tick >> shift) & EV_WHEEL_MASK;
+		slot = wheel_find(loop->wheel_map[level], idx + 1);
+		dist = (slot - idx) & EV_WHEEL_MASK;
+		if (!dist)
+			dist = EV_WHEEL_SIZE;
+
+		t = (((tick >> shift) + dist) << shift) << EV_WHEEL_SHIFT;
+		if (!best || t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+static void wheel_arm(struct ev_eloop *loop, uint64_t next)
+{
+	struct itimerspec spec;
 	int ret;
 
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = next / 1000000000ULL;
+	spec.it_value.tv_nsec = next % 1000000000ULL;
+
+	ret = timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	if (ret) {
+		llog_warn(loop, "cannot set timerfd (%d): %m", errno);
+		return;
+	}
+
+	loop->timer_armed = next;
+}
+
+/*
+ * Link @timer into the wheel of its event loop and reprogram the timerfd if
+ * this is the new earliest deadline. If @timer is disabled or disarmed, it is
+ * only unlinked.
+ */
+static void timer_schedule(struct ev_timer *timer)
+{
+	struct ev_eloop *loop = timer->loop;
+
+	wheel_unlink(timer);
+	if (!loop || !timer->enabled || !timer->deadline)
+		return;
+
+	if (wheel_empty(loop))
+		loop->wheel_tick = timer_now() >> EV_WHEEL_SHIFT;
+
+	wheel_link(loop, timer);
+	if (!loop->timer_armed || timer->deadline < loop->timer_armed)
+		wheel_arm(loop, timer->deadline);
+}
+
+static void timer_event(struct ev_fd *fd, int mask, void *data)
+{
+	struct ev_eloop *loop = data;
+	struct shl_dlist expired;
+	struct ev_timer *timer;
+	uint64_t now, expirations, next;
+	int len;
+
 	if (mask & (EV_HUP | EV_ERR)) {
-		llog_warn(fd, "HUP/ERR on timer source");
-		goto err_cb;
+		llog_warn(loop, "HUP/ERR on timer source");
+		return;
 	}
 
-	if (mask & EV_READABLE) {
-		ret = timer_drain(timer, &expirations);
-		if (ret)
-			goto err_cb;
-		if (expirations > 0) {
-			if (timer->cb)
-				timer->cb(timer, expirations, timer->data);
-		}
+	if (!(mask & EV_READABLE))
+		return;
+
+	len = read(loop->timer_fd, &expirations, sizeof(expirations));
+	if (len < 0 && errno != EAGAIN)
+		llog_warning(loop, "cannot read timerfd (%d): %m", errno);
+
+	loop->timer_armed = 0;
+	now = timer_now();
+	shl_dlist_init(&expired);
+	wheel_advance(loop, now, &expired);
+
+	while (!shl_dlist_empty(&expired)) {
+		timer = shl_dlist_first(&expired, struct ev_timer, list);
+		shl_dlist_unlink(&timer->list);
+
+		expirations = timer_expire(timer, now);
+		if (!expirations)
+			continue;
+
+		ev_timer_ref(timer);
+		timer_schedule(timer);
+		if (timer->cb)
+			timer->cb(timer, expirations, timer->data);
+		ev_timer_unref(timer);
 	}
 
-	return;
+	next = wheel_next(loop);
+	if (next && (!loop->timer_armed || next < loop->timer_armed))
+		wheel_arm(loop, next);
+}
+
+/*
+ * The timerfd is created on demand when the first timer is added. Its fd
+ * source is bound to the event loop without taking a reference, otherwise
+ * the loop would keep itself alive.
+ */
+static int eloop_init_timers(struct ev_eloop *loop)
+{
+	int ret;
+
+	if (loop->timer_fd >= 0)
+		return 0;
+
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_CLOEXEC | TFD_NONBLOCK);
+	if (loop->timer_fd < 0) {
+		llog_error(loop, "cannot create timerfd (%d): %m", errno);
+		return -EFAULT;
+	}
+
+	ret = ev_fd_new(&loop->timer_efd, loop->timer_fd, EV_READABLE,
+			timer_event, loop, loop->llog, loop->llog_data);
+	if (ret)
+		goto err_close;
 
-err_cb:
-	ev_timer_disable(timer);
-	if (timer->cb)
-		timer->cb(timer, 0, timer->data);
+	loop->timer_efd->loop = loop;
+	ret = fd_epoll_add(loop->timer_efd);
+	if (ret)
+		goto err_fd;
+
+	return 0;
+
+err_fd:
+	loop->timer_efd->loop = NULL;
+	ev_fd_unref(loop->timer_efd);
+	loop->timer_efd = NULL;
+err_close:
+	close(loop->timer_fd);
+	loop->timer_fd = -1;
+	return ret;
 }
 
 static const struct itimerspec ev_timer_zero;
@@ -1582,7 +2133,6 @@ int ev_timer_new(struct ev_timer **out, const struct itimerspec *spec,
 		 ev_timer_cb cb, void *data, ev_log_t log, void *log_data)
 {
 	struct ev_timer *timer;
-	int ret;
 
 	if (!out)
 		return llog_dEINVAL(log, log_data);
@@ -1600,34 +2150,12 @@ int ev_timer_new(struct ev_timer **out, const struct itimerspec *spec,
 	timer->llog_data = log_data;
 	timer->cb = cb;
 	timer->data = data;
-
-	timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
-	if (timer->fd < 0) {
-		llog_error(timer, "cannot create timerfd (%d): %m", errno);
-		ret = -EFAULT;
-		goto err_free;
-	}
-
-	ret = timerfd_settime(timer->fd, 0, spec, NULL);
-	if (ret) {
-		llog_warn(timer, "cannot set timerfd (%d): %m", errno);
-		ret = -EFAULT;
-		goto err_close;
-	}
-
-	ret = ev_fd_new(&timer->efd, timer->fd, EV_READABLE, timer_cb, timer,
-			timer->llog, timer->llog_data);
-	if (ret)
-		goto err_close;
+	timer->level = -1;
+	timer->enabled = true;
+	timer_set_spec(timer, spec);
 
 	*out = timer;
 	return 0;
-
-err_close:
-	close(timer->fd);
-err_free:
-	free(timer);
-	return ret;
 }
 
 /**
@@ -1663,8 +2191,6 @@ void ev_timer_unref(struct ev_timer *timer)
 	if (--timer->ref)
 		return;
 
-	ev_fd_unref(timer->efd);
-	close(timer->fd);
 	free(timer);
 }
 
@@ -1672,8 +2198,8 @@ void ev_timer_unref(struct ev_timer *timer)
  * ev_timer_enable:
  * @timer: Timer object
  *
- * Enable the timer. This calls ev_fd_enable() on the fd that implements this
- * timer.
+ * Enable the timer. If it expired while it was disabled, the callback is
+ * called during the next dispatch round with all missed expirations.
  *
  * Returns: 0 on success negative error code on failure
  */
@@ -1682,26 +2208,29 @@ int ev_timer_enable(struct ev_timer *timer)
 {
 	if (!timer)
 		return -EINVAL;
+	if (timer->enabled)
+		return 0;
 
-	return ev_fd_enable(timer->efd);
+	timer->enabled = true;
+	timer_schedule(timer);
+	return 0;
 }
 
 /**
  * ev_timer_disable:
  * @timer: Timer object
  *
- * Disable the timer. This calls ev_fd_disable() on the fd that implements this
- * timer.
- *
- * Returns: 0 on success and negative error code on failure
+ * Disable the timer. The timer keeps running, but the callback is not called
+ * until the timer is enabled again.
  */
 SHL_EXPORT
 void ev_timer_disable(struct ev_timer *timer)
 {
-	if (!timer)
+	if (!timer || !timer->enabled)
 		return;
 
-	ev_fd_disable(timer->efd);
+	timer->enabled = false;
+	timer_schedule(timer);
 }
 
 /**
@@ -1715,7 +2244,7 @@ void ev_timer_disable(struct ev_timer *timer)
 SHL_EXPORT
 bool ev_timer_is_enabled(struct ev_timer *timer)
 {
-	return timer && ev_fd_is_enabled(timer->efd);
+	return timer && timer->enabled;
 }
 
 /**
@@ -1729,7 +2258,7 @@ bool ev_timer_is_enabled(struct ev_timer *timer)
 SHL_EXPORT
 bool ev_timer_is_bound(struct ev_timer *timer)
 {
-	return timer && ev_fd_is_bound(timer->efd);
+	return timer && timer->loop;
 }
 
 /**
@@ -1757,27 +2286,22 @@ void ev_timer_set_cb_data(struct ev_timer *timer, ev_timer_cb cb, void *data)
  * @spec: timespan
  *
  * This changes the timer timespan. See "man timerfd_settime" for information
- * on the @spec parameter.
+ * on the @spec parameter. This does not require a syscall unless @timer
+ * becomes the earliest timer of its event loop.
  *
  * Returns: 0 on success, negative error code on failure.
  */
 SHL_EXPORT
 int ev_timer_update(struct ev_timer *timer, const struct itimerspec *spec)
 {
-	int ret;
-
 	if (!timer)
 		return -EINVAL;
 
 	if (!spec)
 		spec = &ev_timer_zero;
 
-	ret = timerfd_settime(timer->fd, 0, spec, NULL);
-	if (ret) {
-		llog_warn(timer, "cannot set timerfd (%d): %m", errno);
-		return -EFAULT;
-	}
-
+	timer_set_spec(timer, spec);
+	timer_schedule(timer);
 	return 0;
 }
 
@@ -1789,18 +2313,26 @@ int ev_timer_update(struct ev_timer *timer, const struct itimerspec *spec)
  * This reads the current expiration-count from the timer object @timer and
  * saves it in @expirations (if it is non-NULL). This can be used to clear the
  * timer after an idle-period or similar.
- * Note that the timer_cb() callback function automatically calls this before
- * calling the user-supplied callback.
+ * Note that the dispatcher automatically does this before calling the
+ * user-supplied callback.
  *
  * Returns: 0 on success, negative error code on failure.
  */
 SHL_EXPORT
 int ev_timer_drain(struct ev_timer *timer, uint64_t *expirations)
 {
+	uint64_t num;
+
 	if (!timer)
 		return -EINVAL;
 
-	return timer_drain(timer, expirations);
+	wheel_unlink(timer);
+	num = timer_expire(timer, timer_now());
+	timer_schedule(timer);
+
+	if (expirations)
+		*expirations = num;
+	return 0;
 }
 
 /**
@@ -1864,14 +2396,18 @@ int ev_eloop_add_timer(struct ev_eloop *loop, struct ev_timer *timer)
 	if (!timer)
 		return llog_EINVAL(loop);
 
-	if (ev_fd_is_bound(timer->efd))
+	if (timer->loop)
 		return -EALREADY;
 
-	ret = ev_eloop_add_fd(loop, timer->efd);
+	ret = eloop_init_timers(loop);
 	if (ret)
 		return ret;
 
+	timer->loop = loop;
+	timer_schedule(timer);
+
 	ev_timer_ref(timer);
+	ev_eloop_ref(loop);
 	return 0;
 }
 
@@ -1885,11 +2421,16 @@ int ev_eloop_add_timer(struct ev_eloop *loop, struct ev_timer *timer)
 SHL_EXPORT
 void ev_eloop_rm_timer(struct ev_timer *timer)
 {
-	if (!timer || !ev_fd_is_bound(timer->efd))
+	struct ev_eloop *loop;
+
+	if (!timer || !timer->loop)
 		return;
 
-	ev_eloop_rm_fd(timer->efd);
+	loop = timer->loop;
+	wheel_unlink(timer);
+	timer->loop = NULL;
 	ev_timer_unref(timer);
+	ev_eloop_unref(loop);
 }
 
 /*
@@ -2337,7 +2878,7 @@ int ev_eloop_register_child_cb(struct ev_eloop *loop, ev_child_cb cb,
 	if (ret)
 		return ret;
 
-	if (empty) {
+	if (empty && !loop->no_reaper) {
 		ret = ev_eloop_register_signal_cb(loop, SIGCHLD, sig_child,
 						  loop);
 		if (ret) {
@@ -2357,10 +2898,56 @@ void ev_eloop_unregister_child_cb(struct ev_eloop *loop, ev_child_cb cb,
 		return;
 
 	shl_hook_rm_cast(loop->chlds, cb, data);
-	if (!shl_hook_num(loop->chlds))
+	if (!shl_hook_num(loop->chlds) && !loop->no_reaper)
 		ev_eloop_unregister_signal_cb(loop, SIGCHLD, sig_child, loop);
 }
 
+/**
+ * ev_eloop_set_reaper:
+ * @loop: event loop
+ * @reap: whether @loop reaps children itself
+ *
+ * SIGCHLD is process-wide and waitpid(-1) reaps the children of everybody, so
+ * only a single eloop of a process may reap children. Other eloops disable
+ * reaping before child callbacks are registered and get the events forwarded
+ * with ev_eloop_dispatch_child() by the reaping eloop's owner.
+ *
+ * Returns: 0 on success, -EBUSY if child callbacks are already registered.
+ */
+SHL_EXPORT
+int ev_eloop_set_reaper(struct ev_eloop *loop, bool reap)
+{
+	if (!loop)
+		return -EINVAL;
+	if (shl_hook_num(loop->chlds))
+		return -EBUSY;
+
+	loop->no_reaper = !reap;
+	return 0;
+}
+
+/**
+ * ev_eloop_dispatch_child:
+ * @loop: event loop
+ * @pid: pid of the reaped child
+ * @status: status as returned by waitpid()
+ *
+ * Calls the child callbacks of @loop as if @loop had reaped @pid itself. This
+ * must be called from the thread that dispatches @loop.
+ */
+SHL_EXPORT
+void ev_eloop_dispatch_child(struct ev_eloop *loop, pid_t pid, int status)
+{
+	struct ev_child_data d;
+
+	if (!loop)
+		return;
+
+	d.pid = pid;
+	d.status = status;
+	shl_hook_call(loop->chlds, loop, &d);
+}
+
 /*
  * Idle sources
  * Idle sources are called every time when a next dispatch round is started.
@@ -172,9 +172,30 @@ enum ev_eloop_flags {
 	EV_ET = 0x10,
 };
 
+/**
+ * ev_priority:
+ * @EV_PRIO_INPUT: Input devices
+ * @EV_PRIO_DISPLAY: Page-flip and vblank events
+ * @EV_PRIO_DEFAULT: Default class of all sources
+ * @EV_PRIO_BULK: Bulk data like pty output
+ *
+ * Priority classes of fd sources. All events of a single dispatch round are
+ * handled in class-order, starting with @EV_PRIO_INPUT. Events of class
+ * @EV_PRIO_BULK may be deferred to the next round if the dispatch budget of
+ * the event loop is exhausted.
+ */
+enum ev_priority {
+	EV_PRIO_INPUT,
+	EV_PRIO_DISPLAY,
+	EV_PRIO_DEFAULT,
+	EV_PRIO_BULK,
+	EV_PRIO_NUM,
+};
+
 int ev_eloop_new(struct ev_eloop **out, ev_log_t log, void *log_data);
 void ev_eloop_ref(struct ev_eloop *loop);
 void ev_eloop_unref(struct ev_eloop *loop);
+void ev_eloop_set_budget(struct ev_eloop *loop, unsigned int usecs);
 
 void ev_eloop_flush_fd(struct ev_eloop *loop, struct ev_fd *fd);
 int ev_eloop_dispatch(struct ev_eloop *loop, int timeout);
@@ -201,6 +222,8 @@ bool ev_fd_is_enabled(struct ev_fd *fd);
 bool ev_fd_is_bound(struct ev_fd *fd);
 void ev_fd_set_cb_data(struct ev_fd *fd, ev_fd_cb cb, void *data);
 int ev_fd_update(struct ev_fd *fd, int mask);
+int ev_fd_set_priority(struct ev_fd *fd, unsigned int prio);
+unsigned int ev_fd_get_priority(struct ev_fd *fd);
 
 int ev_eloop_new_fd(struct ev_eloop *loop, struct ev_fd **out, int rfd,
 			int mask, ev_fd_cb cb, void *data);
@@ -261,6 +284,8 @@ int ev_eloop_register_child_cb(struct ev_eloop *loop, ev_child_cb cb,
 			       void *data);
 void ev_eloop_unregister_child_cb(struct ev_eloop *loop, ev_child_cb cb,
 				  void *data);
+int ev_eloop_set_reaper(struct ev_eloop *loop, bool reap);
+void ev_eloop_dispatch_child(struct ev_eloop *loop, pid_t pid, int status);
 
 /* idle sources */
 
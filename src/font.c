@@ -205,10 +205,14 @@ static int new_font(struct kmscon_font *font,
 	memset(font, 0, sizeof(*font));
 	font->ref = 1;
 
-	if (backend)
+	if (backend) {
 		record = shl_register_find(&font_reg, backend);
-	else
+		if (!record &&
+		    !kmscon_module_request(KMSCON_MODULE_FONT, backend))
+			record = shl_register_find(&font_reg, backend);
+	} else {
 		record = shl_register_first(&font_reg);
+	}
 
 	if (!record) {
 		log_error("requested backend '%s' not found", name);
@@ -0,0 +1,1407 @@
+/*
+ * kmscon - Compressed Scrollback
+ *
+ * Copyright (c) 2012 Ran Benita <ran234@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Compressed Scrollback
+ * Line Encoding:
+ *   Each archived line is a sequence of cells. Printable cells are stored as
+ *   UTF-8 code-points. Code-points below HIST_OP_NUM never occur in cells, so
+ *   these values are used as opcodes: attributes are only stored when they
+ *   differ from the previous cell, double-width and combined cells are marked
+ *   by a prefix, and trailing empty cells that share the attributes of the last
+ *   cell are dropped entirely. They are restored up to the screen width when
+ *   drawing.
+ *
+ * Blocks:
+ *   Lines are appended to an open block. Once it holds HIST_BLOCK_LINES lines,
+ *   it is sealed and, with liblz4, compressed. Sealed blocks are always full
+ *   so line lookups are a division. The oldest blocks are dropped once the
+ *   history exceeds its limit. A small cache keeps the last decoded blocks so
+ *   scrolling does not decompress the same block again for each frame.
+ *
+ * Capturing:
+ *   libtsm keeps one screen of its own scrollback, so it is the authority on
+ *   which lines left the screen. VTE input is fed in chunks which can scroll
+ *   at most half a screen. After each chunk, the libtsm view is scrolled back
+ *   by a full screen and captured together with the screen itself. The view
+ *   shows the new scrollback lines followed by the top rows of the screen, so
+ *   the number of new lines is the offset at which both captures line up. Row
+ *   hashes keep this cheap. Identical rows can line up at several offsets;
+ *   the one closest to the guess from the line-feeds and wraps of the chunk
+ *   wins. The archived lines are then dropped from libtsm. Plain text that
+ *   doesn't reach the bottom row cannot scroll, so such chunks are not
+ *   captured at all. Nothing is captured on the alternate screen; libtsm
+ *   doesn't keep scrollback there either.
+ *
+ * Search Index:
+ *   Each block has a bloom filter of the byte-trigrams of its text. Substring
+ *   searches skip all blocks that lack any trigram of the pattern and decode
+ *   only the remaining ones. Regular expressions cannot be filtered this way
+ *   and are matched against every line, hence, searches are run in steps of
+ *   a limited number of lines so the caller can keep other work going.
+ */
+
+#include <errno.h>
+#include <libtsm.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+#include "shl_log.h"
+#include "shl_misc.h"
+
+#ifdef BUILD_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#define LOG_SUBSYSTEM "history"
+
+#define HIST_BLOCK_LINES 256
+#define HIST_CACHE_SIZE 4
+#define HIST_MAX_COMBINE 10
+#define HIST_BLOOM_SHIFT 14
+#define HIST_BLOOM_SIZE ((1 << HIST_BLOOM_SHIFT) / 8)
+#define HIST_QUERY_GRAMS 32
+
+enum hist_op {
+	HIST_EMPTY	= 0x00,	/* empty cell */
+	HIST_COMBINE	= 0x01,	/* next code-point belongs to the last cell */
+	HIST_WIDE	= 0x02,	/* next code-point is a double-width cell */
+	HIST_SKIP	= 0x03,	/* column that libtsm didn't draw */
+	HIST_ATTR	= 0x04,	/* followed by HIST_ATTR_SIZE bytes */
+	HIST_ZERO	= 0x05,	/* next code-point is a zero-width cell */
+	HIST_OP_NUM	= 0x20,
+};
+
+#define HIST_ATTR_SIZE 9
+
+enum hist_esc {
+	HIST_ESC_NONE,
+	HIST_ESC_START,		/* after ESC */
+	HIST_ESC_CSI,		/* parameters of a CSI sequence */
+	HIST_ESC_STRING,	/* OSC, DCS and friends up to BEL or ST */
+	HIST_ESC_STRING_END,	/* ESC inside a string */
+};
+
+struct hist_buf {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+struct hist_block {
+	uint8_t *data;
+	size_t size;
+	size_t raw_size;
+	uint8_t *bloom;
+};
+
+struct hist_cache {
+	uint64_t id;
+	uint64_t used;
+	const uint8_t *data;
+	struct hist_buf buf;
+	size_t offs[HIST_BLOCK_LINES];
+};
+
+struct kmscon_history {
+	unsigned int max;
+
+	/* sealed blocks, oldest first; @base blocks were dropped before */
+	struct hist_block *blocks;
+	size_t num_blocks;
+	size_t size_blocks;
+	uint64_t base;
+
+	struct hist_buf open;
+	unsigned int open_lines;
+	size_t open_offs[HIST_BLOCK_LINES];
+	uint8_t open_bloom[HIST_BLOOM_SIZE];
+
+	/* plain text of a single line for indexing and searching */
+	struct hist_buf text;
+
+	struct hist_cache cache[HIST_CACHE_SIZE];
+	uint64_t cache_used;
+
+	/* captures of the scrolled-back view and of the screen, one encoded
+	 * line per row */
+	struct hist_buf *view;
+	struct hist_buf *screen;
+	uint32_t *view_hash;
+	uint32_t *screen_hash;
+	unsigned int width;
+	unsigned int height;
+
+	/* escape sequence parser of kmscon_history_input() */
+	unsigned int esc;
+};
+
+struct kmscon_history_query {
+	bool regex;
+	regex_t re;
+	char *text;
+	size_t len;
+	unsigned int num_grams;
+	unsigned int grams[HIST_QUERY_GRAMS];
+};
+
+struct hist_enc {
+	struct hist_buf *rows;
+	unsigned int height;
+	struct hist_buf *row;
+	unsigned int posy;
+	unsigned int posx;
+	unsigned int empty;
+	bool has_attr;
+	uint8_t attr[HIST_ATTR_SIZE];
+	int err;
+};
+
+struct hist_shift {
+	tsm_screen_draw_cb cb;
+	void *data;
+	unsigned int shift;
+	unsigned int height;
+};
+
+static int buf_reserve(struct hist_buf *buf, size_t num)
+{
+	size_t size;
+	uint8_t *data;
+
+	if (buf->len + num <= buf->size)
+		return 0;
+
+	size = buf->size ? buf->size : 64;
+	while (size < buf->len + num)
+		size *= 2;
+
+	data = realloc(buf->data, size);
+	if (!data)
+		return -ENOMEM;
+
+	buf->data = data;
+	buf->size = size;
+	return 0;
+}
+
+static void buf_free(struct hist_buf *buf)
+{
+	free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+}
+
+static bool buf_equal(const struct hist_buf *a, const struct hist_buf *b)
+{
+	return a->len == b->len && !memcmp(a->data, b->data, a->len);
+}
+
+/* callers reserve at least 5 bytes */
+static void put_varint(struct hist_buf *buf, size_t val)
+{
+	while (val >= 0x80) {
+		buf->data[buf->len++] = 0x80 | (val & 0x7f);
+		val >>= 7;
+	}
+	buf->data[buf->len++] = val;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end,
+				 size_t *out)
+{
+	size_t val = 0;
+	unsigned int shift = 0;
+
+	while (p < end && shift < 35) {
+		val |= (size_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*out = val;
+			return p;
+		}
+		shift += 7;
+	}
+
+	*out = 0;
+	return end;
+}
+
+/* callers reserve at least 4 bytes */
+static void put_cp(struct hist_buf *buf, uint32_t cp)
+{
+	uint8_t *p = &buf->data[buf->len];
+
+	if (cp < HIST_OP_NUM)
+		cp = ' ';
+	else if (cp > 0x10ffff)
+		cp = 0xfffd;
+
+	if (cp < 0x80) {
+		p[0] = cp;
+		buf->len += 1;
+	} else if (cp < 0x800) {
+		p[0] = 0xc0 | (cp >> 6);
+		p[1] = 0x80 | (cp & 0x3f);
+		buf->len += 2;
+	} else if (cp < 0x10000) {
+		p[0] = 0xe0 | (cp >> 12);
+		p[1] = 0x80 | ((cp >> 6) & 0x3f);
+		p[2] = 0x80 | (cp & 0x3f);
+		buf->len += 3;
+	} else {
+		p[0] = 0xf0 | (cp >> 18);
+		p[1] = 0x80 | ((cp >> 12) & 0x3f);
+		p[2] = 0x80 | ((cp >> 6) & 0x3f);
+		p[3] = 0x80 | (cp & 0x3f);
+		buf->len += 4;
+	}
+}
+
+static const uint8_t *get_cp(const uint8_t *p, const uint8_t *end,
+			     uint32_t *out)
+{
+	uint32_t cp;
+	unsigned int i, num;
+
+	if (*p < 0x80) {
+		*out = *p;
+		return p + 1;
+	} else if ((*p & 0xe0) == 0xc0) {
+		cp = *p & 0x1f;
+		num = 1;
+	} else if ((*p & 0xf0) == 0xe0) {
+		cp = *p & 0x0f;
+		num = 2;
+	} else {
+		cp = *p & 0x07;
+		num = 3;
+	}
+
+	++p;
+	for (i = 0; i < num && p < end; ++i)
+		cp = (cp << 6) | (*p++ & 0x3f);
+
+	*out = cp;
+	return p;
+}
+
+static void pack_attr(uint8_t *out, const struct tsm_screen_attr *attr)
+{
+	out[0] = attr->fccode;
+	out[1] = attr->bccode;
+	out[2] = attr->fr;
+	out[3] = attr->fg;
+	out[4] = attr->fb;
+	out[5] = attr->br;
+	out[6] = attr->bg;
+	out[7] = attr->bb;
+	out[8] = attr->bold | attr->italic << 1 | attr->underline << 2 |
+		 attr->inverse << 3 | attr->protect << 4 | attr->blink << 5;
+}
+
+static void unpack_attr(struct tsm_screen_attr *attr, const uint8_t *in)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->fccode = in[0];
+	attr->bccode = in[1];
+	attr->fr = in[2];
+	attr->fg = in[3];
+	attr->fb = in[4];
+	attr->br = in[5];
+	attr->bg = in[6];
+	attr->bb = in[7];
+	attr->bold = !!(in[8] & 0x01);
+	attr->italic = !!(in[8] & 0x02);
+	attr->underline = !!(in[8] & 0x04);
+	attr->inverse = !!(in[8] & 0x08);
+	attr->protect = !!(in[8] & 0x10);
+	attr->blink = !!(in[8] & 0x20);
+}
+
+/* single code-points use the same IDs as libtsm, combined cells get our own */
+static uint64_t cell_id(const uint32_t *ch, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	if (len == 1)
+		return ch[0];
+
+	for (i = 0; i < len; ++i) {
+		hash ^= ch[i];
+		hash *= 16777619U;
+	}
+
+	return (1ULL << 32) | hash;
+}
+
+/* Strips an encoded line down to its UTF-8 text. Attributes are dropped and
+ * empty cells become spaces. The result is zero-terminated for regexec(). */
+static int line_text(struct hist_buf *out, const uint8_t *p, size_t len)
+{
+	const uint8_t *end = p + len;
+
+	out->len = 0;
+	if (buf_reserve(out, len + 1))
+		return -ENOMEM;
+
+	while (p < end) {
+		if (*p == HIST_ATTR) {
+			p += 1 + HIST_ATTR_SIZE;
+			continue;
+		}
+
+		if (*p == HIST_EMPTY)
+			out->data[out->len++] = ' ';
+		else if (*p >= HIST_OP_NUM)
+			out->data[out->len++] = *p;
+		++p;
+	}
+
+	out->data[out->len] = 0;
+	return 0;
+}
+
+static unsigned int gram_hash(const uint8_t *p)
+{
+	uint32_t val = p[0] | p[1] << 8 | p[2] << 16;
+
+	return (val * 2654435761U) >> (32 - HIST_BLOOM_SHIFT);
+}
+
+static void bloom_add(uint8_t *bloom, const struct hist_buf *text)
+{
+	unsigned int h;
+	size_t i;
+
+	for (i = 0; i + 3 <= text->len; ++i) {
+		h = gram_hash(&text->data[i]);
+		bloom[h / 8] |= 1 << (h % 8);
+	}
+}
+
+static bool bloom_test(const uint8_t *bloom,
+		       const struct kmscon_history_query *q)
+{
+	unsigned int i, h;
+
+	if (!bloom)
+		return true;
+
+	for (i = 0; i < q->num_grams; ++i) {
+		h = q->grams[i];
+		if (!(bloom[h / 8] & (1 << (h % 8))))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Encoder
+ */
+
+static int enc_flush(struct hist_enc *enc)
+{
+	if (!enc->empty)
+		return 0;
+	if (buf_reserve(enc->row, enc->empty))
+		return -ENOMEM;
+
+	memset(&enc->row->data[enc->row->len], HIST_EMPTY, enc->empty);
+	enc->row->len += enc->empty;
+	enc->empty = 0;
+	return 0;
+}
+
+static int enc_cell(struct hist_enc *enc, const uint32_t *ch, size_t len,
+		    unsigned int width, unsigned int posx,
+		    const struct tsm_screen_attr *attr)
+{
+	struct hist_buf *row = enc->row;
+	uint8_t a[HIST_ATTR_SIZE];
+	bool same;
+	size_t i;
+
+	if (posx < enc->posx)
+		return 0;
+
+	pack_attr(a, attr);
+	same = enc->has_attr && !memcmp(a, enc->attr, sizeof(a));
+
+	if (enc_flush(enc))
+		return -ENOMEM;
+	if (buf_reserve(row, posx - enc->posx))
+		return -ENOMEM;
+	while (enc->posx < posx) {
+		row->data[row->len++] = HIST_SKIP;
+		++enc->posx;
+	}
+
+	enc->posx = posx + 1;
+	if (!len && same) {
+		++enc->empty;
+		return 0;
+	}
+
+	if (buf_reserve(row, 1 + HIST_ATTR_SIZE + 1 + len * 5))
+		return -ENOMEM;
+
+	if (!same) {
+		row->data[row->len++] = HIST_ATTR;
+		memcpy(&row->data[row->len], a, sizeof(a));
+		row->len += sizeof(a);
+		memcpy(enc->attr, a, sizeof(a));
+		enc->has_attr = true;
+	}
+
+	if (!len) {
+		row->data[row->len++] = HIST_EMPTY;
+		return 0;
+	}
+
+	if (width == 2)
+		row->data[row->len++] = HIST_WIDE;
+	else if (!width)
+		row->data[row->len++] = HIST_ZERO;
+
+	put_cp(row, ch[0]);
+	for (i = 1; i < len; ++i) {
+		row->data[row->len++] = HIST_COMBINE;
+		put_cp(row, ch[i]);
+	}
+
+	return 0;
+}
+
+static int capture_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		      size_t len, unsigned int width, unsigned int posx,
+		      unsigned int posy, const struct tsm_screen_attr *attr,
+		      tsm_age_t age, void *data)
+{
+	struct hist_enc *enc = data;
+
+	if (enc->err || posy >= enc->height)
+		return 0;
+
+	if (!enc->row || posy != enc->posy) {
+		enc->row = &enc->rows[posy];
+		enc->row->len = 0;
+		enc->posy = posy;
+		enc->posx = 0;
+		enc->empty = 0;
+		enc->has_attr = false;
+	}
+
+	enc->err = enc_cell(enc, ch, len, width, posx, attr);
+	return 0;
+}
+
+static int capture(struct kmscon_history *hist, struct tsm_screen *con,
+		   struct hist_buf *rows, uint32_t *hash)
+{
+	struct hist_enc enc;
+	unsigned int i, flags;
+	size_t j;
+
+	for (i = 0; i < hist->height; ++i)
+		rows[i].len = 0;
+
+	memset(&enc, 0, sizeof(enc));
+	enc.rows = rows;
+	enc.height = hist->height;
+
+	/* we never want libtsm's software cursor in the history */
+	flags = tsm_screen_get_flags(con);
+	if (!(flags & TSM_SCREEN_HIDE_CURSOR))
+		tsm_screen_set_flags(con, TSM_SCREEN_HIDE_CURSOR);
+	tsm_screen_draw(con, capture_cb, &enc);
+	if (!(flags & TSM_SCREEN_HIDE_CURSOR))
+		tsm_screen_reset_flags(con, TSM_SCREEN_HIDE_CURSOR);
+
+	if (enc.err)
+		return enc.err;
+
+	for (i = 0; i < hist->height; ++i) {
+		hash[i] = 2166136261U;
+		for (j = 0; j < rows[i].len; ++j) {
+			hash[i] ^= rows[i].data[j];
+			hash[i] *= 16777619U;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Block Storage
+ */
+
+static void cache_drop(struct kmscon_history *hist)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_CACHE_SIZE; ++i) {
+		if (hist->cache[i].id && hist->cache[i].id <= hist->base)
+			hist->cache[i].id = 0;
+	}
+}
+
+static void drop_block(struct kmscon_history *hist)
+{
+	free(hist->blocks[0].bloom);
+	free(hist->blocks[0].data);
+	memmove(hist->blocks, &hist->blocks[1],
+		sizeof(*hist->blocks) * (hist->num_blocks - 1));
+	--hist->num_blocks;
+	++hist->base;
+	cache_drop(hist);
+}
+
+static int seal_block(struct kmscon_history *hist)
+{
+	struct hist_block *b;
+	size_t size;
+	void *tmp;
+
+	if (hist->num_blocks >= hist->size_blocks) {
+		size = hist->size_blocks ? hist->size_blocks * 2 : 16;
+		tmp = realloc(hist->blocks, sizeof(*hist->blocks) * size);
+		if (!tmp)
+			return -ENOMEM;
+		hist->blocks = tmp;
+		hist->size_blocks = size;
+	}
+
+	b = &hist->blocks[hist->num_blocks];
+	memset(b, 0, sizeof(*b));
+	b->raw_size = hist->open.len;
+
+	/* without an index, the block is simply always searched */
+	b->bloom = malloc(HIST_BLOOM_SIZE);
+	if (b->bloom)
+		memcpy(b->bloom, hist->open_bloom, HIST_BLOOM_SIZE);
+	memset(hist->open_bloom, 0, HIST_BLOOM_SIZE);
+
+#ifdef BUILD_HAVE_LZ4
+	size = LZ4_compressBound(hist->open.len);
+	b->data = malloc(size);
+	if (b->data) {
+		size = LZ4_compress_default((const char*)hist->open.data,
+					    (char*)b->data, hist->open.len,
+					    size);
+		if (size > 0 && size < hist->open.len) {
+			tmp = realloc(b->data, size);
+			if (tmp)
+				b->data = tmp;
+			b->size = size;
+			goto done;
+		}
+		free(b->data);
+	}
+#endif
+
+	/* hand the open block over; the next one starts empty */
+	b->data = realloc(hist->open.data, hist->open.len);
+	if (!b->data)
+		b->data = hist->open.data;
+	b->size = hist->open.len;
+	memset(&hist->open, 0, sizeof(hist->open));
+
+#ifdef BUILD_HAVE_LZ4
+done:
+#endif
+	++hist->num_blocks;
+	hist->open.len = 0;
+	hist->open_lines = 0;
+	return 0;
+}
+
+static int push_line(struct kmscon_history *hist, const struct hist_buf *line)
+{
+	size_t total;
+	int ret;
+
+	if (hist->open_lines >= HIST_BLOCK_LINES) {
+		ret = seal_block(hist);
+		if (ret)
+			return ret;
+	}
+
+	ret = buf_reserve(&hist->open, line->len + 5);
+	if (ret)
+		return ret;
+
+	hist->open_offs[hist->open_lines++] = hist->open.len;
+	put_varint(&hist->open, line->len);
+	memcpy(&hist->open.data[hist->open.len], line->data, line->len);
+	hist->open.len += line->len;
+
+	if (!line_text(&hist->text, line->data, line->len))
+		bloom_add(hist->open_bloom, &hist->text);
+
+	/* keep at least @max lines */
+	total = hist->num_blocks * HIST_BLOCK_LINES + hist->open_lines;
+	while (hist->num_blocks && total - HIST_BLOCK_LINES >= hist->max) {
+		drop_block(hist);
+		total -= HIST_BLOCK_LINES;
+	}
+
+	return 0;
+}
+
+static struct hist_cache *load_block(struct kmscon_history *hist, size_t idx)
+{
+	struct hist_block *b = &hist->blocks[idx];
+	struct hist_cache *c, *lru = NULL;
+	const uint8_t *p, *end;
+	uint64_t id = hist->base + idx + 1;
+	unsigned int i;
+	size_t len;
+
+	for (i = 0; i < HIST_CACHE_SIZE; ++i) {
+		c = &hist->cache[i];
+		if (c->id == id) {
+			c->used = ++hist->cache_used;
+			return c;
+		}
+		if (!lru || c->used < lru->used)
+			lru = c;
+	}
+
+	c = lru;
+	c->id = 0;
+
+	if (b->size == b->raw_size) {
+		c->data = b->data;
+	} else {
+#ifdef BUILD_HAVE_LZ4
+		c->buf.len = 0;
+		if (buf_reserve(&c->buf, b->raw_size))
+			return NULL;
+		if (LZ4_decompress_safe((const char*)b->data,
+					(char*)c->buf.data, b->size,
+					b->raw_size) != (int)b->raw_size) {
+			log_warning("cannot decompress scrollback block");
+			return NULL;
+		}
+		c->data = c->buf.data;
+#else
+		return NULL;
+#endif
+	}
+
+	p = c->data;
+	end = c->data + b->raw_size;
+	for (i = 0; i < HIST_BLOCK_LINES; ++i) {
+		c->offs[i] = p - c->data;
+		p = get_varint(p, end, &len);
+		p = (len > (size_t)(end - p)) ? end : p + len;
+	}
+
+	c->id = id;
+	c->used = ++hist->cache_used;
+	return c;
+}
+
+/* returns the encoded line with absolute index @line or NULL */
+static const uint8_t *get_line(struct kmscon_history *hist, size_t line,
+			       size_t *len)
+{
+	struct hist_cache *c;
+	const uint8_t *p, *end;
+	size_t idx = line / HIST_BLOCK_LINES;
+	size_t off = line % HIST_BLOCK_LINES;
+
+	if (idx < hist->num_blocks) {
+		c = load_block(hist, idx);
+		if (!c)
+			return NULL;
+		p = c->data + c->offs[off];
+		end = c->data + hist->blocks[idx].raw_size;
+	} else if (idx == hist->num_blocks && off < hist->open_lines) {
+		p = hist->open.data + hist->open_offs[off];
+		end = hist->open.data + hist->open.len;
+	} else {
+		return NULL;
+	}
+
+	p = get_varint(p, end, len);
+	if (*len > (size_t)(end - p))
+		return NULL;
+
+	return p;
+}
+
+static void draw_line(struct tsm_screen *con, const uint8_t *p, size_t len,
+		      unsigned int posy, unsigned int width,
+		      tsm_screen_draw_cb cb, void *data)
+{
+	const uint8_t *end = p + len;
+	struct tsm_screen_attr attr;
+	uint32_t ch[HIST_MAX_COMBINE], cp;
+	unsigned int posx = 0, w;
+	size_t num;
+
+	memset(&attr, 0, sizeof(attr));
+
+	while (p < end) {
+		switch (*p) {
+		case HIST_ATTR:
+			if (end - p <= HIST_ATTR_SIZE)
+				return;
+			unpack_attr(&attr, p + 1);
+			p += 1 + HIST_ATTR_SIZE;
+			continue;
+		case HIST_SKIP:
+			++p;
+			++posx;
+			continue;
+		case HIST_EMPTY:
+			++p;
+			if (posx < width)
+				cb(con, 0, NULL, 0, 1, posx, posy, &attr, 0,
+				   data);
+			++posx;
+			continue;
+		case HIST_WIDE:
+			w = 2;
+			++p;
+			break;
+		case HIST_ZERO:
+			w = 0;
+			++p;
+			break;
+		default:
+			w = 1;
+			break;
+		}
+
+		if (p >= end)
+			break;
+
+		num = 0;
+		p = get_cp(p, end, &ch[num++]);
+		while (p < end && *p == HIST_COMBINE && ++p < end) {
+			p = get_cp(p, end, &cp);
+			if (num < HIST_MAX_COMBINE)
+				ch[num++] = cp;
+		}
+
+		if (posx < width)
+			cb(con, cell_id(ch, num), ch, num, w, posx, posy, &attr,
+			   0, data);
+		++posx;
+	}
+
+	for ( ; posx < width; ++posx)
+		cb(con, 0, NULL, 0, 1, posx, posy, &attr, 0, data);
+}
+
+/*
+ * Capturing
+ */
+
+static void free_rows(struct kmscon_history *hist)
+{
+	unsigned int i;
+
+	for (i = 0; i < hist->height; ++i) {
+		if (hist->view)
+			buf_free(&hist->view[i]);
+		if (hist->screen)
+			buf_free(&hist->screen[i]);
+	}
+
+	free(hist->view);
+	free(hist->screen);
+	free(hist->view_hash);
+	free(hist->screen_hash);
+	hist->view = NULL;
+	hist->screen = NULL;
+	hist->view_hash = NULL;
+	hist->screen_hash = NULL;
+	hist->width = 0;
+	hist->height = 0;
+}
+
+static int alloc_rows(struct kmscon_history *hist, unsigned int width,
+		      unsigned int height)
+{
+	free_rows(hist);
+
+	hist->view = calloc(height, sizeof(*hist->view));
+	hist->screen = calloc(height, sizeof(*hist->screen));
+	hist->view_hash = calloc(height, sizeof(*hist->view_hash));
+	hist->screen_hash = calloc(height, sizeof(*hist->screen_hash));
+	if (!hist->view || !hist->screen || !hist->view_hash ||
+	    !hist->screen_hash) {
+		free(hist->view);
+		free(hist->screen);
+		free(hist->view_hash);
+		free(hist->screen_hash);
+		hist->view = NULL;
+		hist->screen = NULL;
+		hist->view_hash = NULL;
+		hist->screen_hash = NULL;
+		return -ENOMEM;
+	}
+
+	hist->width = width;
+	hist->height = height;
+	return 0;
+}
+
+/* view rows [k, height) must equal screen rows [0, height - k) */
+static bool rows_match(struct kmscon_history *hist, unsigned int k)
+{
+	unsigned int i;
+
+	for (i = k; i < hist->height; ++i) {
+		if (hist->view_hash[i] != hist->screen_hash[i - k])
+			return false;
+	}
+
+	for (i = k; i < hist->height; ++i) {
+		if (!buf_equal(&hist->view[i], &hist->screen[i - k]))
+			return false;
+	}
+
+	return true;
+}
+
+/* Returns the number of scrollback lines in the view. All offsets are tried
+ * from @est outwards; a full screen always matches. Rows are first compared
+ * by hash, so mismatches usually cost a single comparison. */
+static unsigned int find_scroll(struct kmscon_history *hist, unsigned int est)
+{
+	unsigned int d, h = hist->height;
+
+	if (est > h)
+		est = h;
+
+	for (d = 0; d <= h; ++d) {
+		if (est >= d && rows_match(hist, est - d))
+			return est - d;
+		if (d && est + d <= h && rows_match(hist, est + d))
+			return est + d;
+	}
+
+	return h;
+}
+
+/* @moved is set if the chunk contains escape sequences that may move the
+ * cursor vertically or scroll */
+static unsigned int feed(struct kmscon_history *hist, struct tsm_vte *vte,
+			 struct tsm_screen *con, const char *u8, size_t len,
+			 unsigned int lines, bool moved)
+{
+	unsigned int i, k, y0, est;
+	int ret;
+
+	y0 = tsm_screen_get_cursor_y(con);
+	tsm_vte_input(vte, u8, len);
+
+	/* anything libtsm archived on the way stays until the next capture */
+	if (!moved && y0 + lines < hist->height)
+		return 0;
+	if (tsm_screen_get_flags(con) & TSM_SCREEN_ALTERNATE)
+		return 0;
+
+	ret = capture(hist, con, hist->screen, hist->screen_hash);
+	if (!ret) {
+		tsm_screen_sb_up(con, hist->height);
+		ret = capture(hist, con, hist->view, hist->view_hash);
+		tsm_screen_sb_reset(con);
+	}
+	if (ret) {
+		log_warning("cannot capture console for scrollback");
+		return 0;
+	}
+
+	est = (y0 + lines >= hist->height) ? y0 + lines + 1 - hist->height : 0;
+	k = find_scroll(hist, est);
+	for (i = 0; i < k; ++i) {
+		if (push_line(hist, &hist->view[i])) {
+			log_warning("cannot store scrollback line");
+			k = i;
+			break;
+		}
+	}
+
+	tsm_screen_clear_sb(con);
+	return k;
+}
+
+int kmscon_history_new(struct kmscon_history **out, unsigned int max)
+{
+	struct kmscon_history *hist;
+
+	if (!out)
+		return -EINVAL;
+
+	hist = malloc(sizeof(*hist));
+	if (!hist)
+		return -ENOMEM;
+	memset(hist, 0, sizeof(*hist));
+	hist->max = max;
+
+	log_debug("new history object %p for %u lines", hist, max);
+	*out = hist;
+	return 0;
+}
+
+void kmscon_history_free(struct kmscon_history *hist)
+{
+	unsigned int i;
+
+	if (!hist)
+		return;
+
+	kmscon_history_clear(hist);
+	free_rows(hist);
+	for (i = 0; i < HIST_CACHE_SIZE; ++i)
+		buf_free(&hist->cache[i].buf);
+	buf_free(&hist->text);
+	buf_free(&hist->open);
+	free(hist->blocks);
+	free(hist);
+}
+
+void kmscon_history_clear(struct kmscon_history *hist)
+{
+	if (!hist)
+		return;
+
+	while (hist->num_blocks)
+		drop_block(hist);
+
+	/* drop_block() only invalidates sealed blocks */
+	++hist->base;
+	cache_drop(hist);
+	hist->open.len = 0;
+	hist->open_lines = 0;
+	memset(hist->open_bloom, 0, HIST_BLOOM_SIZE);
+}
+
+unsigned int kmscon_history_get_count(struct kmscon_history *hist)
+{
+	size_t total;
+
+	if (!hist)
+		return 0;
+
+	total = hist->num_blocks * HIST_BLOCK_LINES + hist->open_lines;
+	return total < hist->max ? total : hist->max;
+}
+
+size_t kmscon_history_get_memory(struct kmscon_history *hist)
+{
+	size_t size, i;
+
+	if (!hist)
+		return 0;
+
+	size = sizeof(*hist) + hist->open.size + hist->text.size;
+	size += hist->size_blocks * sizeof(*hist->blocks);
+	for (i = 0; i < hist->num_blocks; ++i) {
+		size += hist->blocks[i].size;
+		if (hist->blocks[i].bloom)
+			size += HIST_BLOOM_SIZE;
+	}
+	for (i = 0; i < HIST_CACHE_SIZE; ++i)
+		size += hist->cache[i].buf.size;
+	for (i = 0; i < hist->height; ++i)
+		size += hist->view[i].size + hist->screen[i].size;
+	size += hist->height * 2 * sizeof(*hist->view_hash);
+
+	return size;
+}
+
+/**
+ * kmscon_history_input:
+ * @hist: history object
+ * @vte: VTE to feed
+ * @con: console of @vte
+ * @u8: UTF-8 input
+ * @len: length of @u8
+ *
+ * Feeds @u8 into @vte like tsm_vte_input() but archives all lines that scroll
+ * off the top of @con.
+ *
+ * Returns: Number of lines added to the history.
+ */
+unsigned int kmscon_history_input(struct kmscon_history *hist,
+				  struct tsm_vte *vte,
+				  struct tsm_screen *con,
+				  const char *u8, size_t len)
+{
+	unsigned int width, height, limit, col, lines = 0, num = 0;
+	size_t i, start = 0;
+	bool moved = false;
+	char c;
+
+	width = tsm_screen_get_width(con);
+	height = tsm_screen_get_height(con);
+
+	if (!hist->max || height < 4) {
+		tsm_vte_input(vte, u8, len);
+		return 0;
+	}
+
+	if (width != hist->width || height != hist->height) {
+		if (alloc_rows(hist, width, height)) {
+			log_warning("cannot allocate scrollback capture buffers");
+			tsm_vte_input(vte, u8, len);
+			return 0;
+		}
+		tsm_screen_set_max_sb(con, height);
+	}
+
+	/* Two chunks per screen. Wide characters take two columns but are
+	 * counted once, so even then a chunk cannot scroll more lines than
+	 * libtsm keeps. */
+	limit = (height - 1) / 2;
+	col = tsm_screen_get_cursor_x(con);
+
+	for (i = 0; i < len; ++i) {
+		c = u8[i];
+
+		/* escape sequences don't print anything; only some of them
+		 * move the cursor vertically or scroll */
+		switch (hist->esc) {
+		case HIST_ESC_NONE:
+			break;
+		case HIST_ESC_START:
+			if (c == '[') {
+				hist->esc = HIST_ESC_CSI;
+			} else if (c && strchr("]PX^_", c)) {
+				hist->esc = HIST_ESC_STRING;
+			} else if (c < 0x20 || c > 0x2f) {
+				if (c && strchr("DEMc", c))
+					moved = true;
+				hist->esc = HIST_ESC_NONE;
+			}
+			continue;
+		case HIST_ESC_CSI:
+			if (c >= 0x40 && c <= 0x7e) {
+				if (strchr("ABEFHLMSTdfr", c))
+					moved = true;
+				hist->esc = HIST_ESC_NONE;
+			}
+			continue;
+		case HIST_ESC_STRING:
+			if (c == '\a')
+				hist->esc = HIST_ESC_NONE;
+			else if (c == '\033')
+				hist->esc = HIST_ESC_STRING_END;
+			continue;
+		case HIST_ESC_STRING_END:
+			hist->esc = (c == '\\') ? HIST_ESC_NONE :
+						   HIST_ESC_STRING;
+			continue;
+		}
+
+		switch (c) {
+		case '\033':
+			hist->esc = HIST_ESC_START;
+			break;
+		case '\n':
+		case '\v':
+		case '\f':
+			++lines;
+			col = 0;
+			break;
+		case '\r':
+			col = 0;
+			break;
+		case '\b':
+			if (col)
+				--col;
+			break;
+		case '\t':
+			col = (col + 8) & ~7U;
+			if (col >= width)
+				col = width - 1;
+			break;
+		default:
+			/* other controls and UTF-8 continuation bytes */
+			if ((unsigned char)c < 0x20 || c == 0x7f ||
+			    ((unsigned char)c & 0xc0) == 0x80)
+				break;
+			if (++col >= width) {
+				++lines;
+				col = 0;
+			}
+			break;
+		}
+
+		if (lines >= limit) {
+			num += feed(hist, vte, con, &u8[start], i + 1 - start,
+				    lines, moved);
+			start = i + 1;
+			lines = 0;
+			moved = false;
+		}
+	}
+
+	if (start < len)
+		num += feed(hist, vte, con, &u8[start], len - start, lines,
+			    moved);
+
+	return num;
+}
+
+static int shift_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		    size_t len, unsigned int width, unsigned int posx,
+		    unsigned int posy, const struct tsm_screen_attr *attr,
+		    tsm_age_t age, void *data)
+{
+	struct hist_shift *s = data;
+
+	if (posy + s->shift >= s->height)
+		return 0;
+
+	return s->cb(con, id, ch, len, width, posx, posy + s->shift, attr, age,
+		     s->data);
+}
+
+/**
+ * kmscon_history_draw:
+ * @hist: history object
+ * @con: console
+ * @pos: number of lines the view is scrolled back
+ * @cb: draw callback
+ * @data: user data for @cb
+ *
+ * Works like tsm_screen_draw() but shows the last @pos archived lines at the
+ * top of the screen, followed by the upper rows of @con. The cursor is hidden
+ * while the view is scrolled back.
+ */
+void kmscon_history_draw(struct kmscon_history *hist,
+			 struct tsm_screen *con, unsigned int pos,
+			 tsm_screen_draw_cb cb, void *data)
+{
+	struct hist_shift shift;
+	unsigned int y, width, height, count, flags;
+	const uint8_t *line;
+	size_t total, len;
+
+	count = kmscon_history_get_count(hist);
+	if (pos > count)
+		pos = count;
+
+	if (!pos) {
+		tsm_screen_draw(con, cb, data);
+		return;
+	}
+
+	width = tsm_screen_get_width(con);
+	height = tsm_screen_get_height(con);
+	total = hist->num_blocks * HIST_BLOCK_LINES + hist->open_lines;
+
+	for (y = 0; y < pos && y < height; ++y) {
+		line = get_line(hist, total - pos + y, &len);
+		if (!line)
+			len = 0;
+		draw_line(con, line, len, y, width, cb, data);
+	}
+
+	if (pos >= height)
+		return;
+
+	shift.cb = cb;
+	shift.data = data;
+	shift.shift = pos;
+	shift.height = height;
+
+	flags = tsm_screen_get_flags(con);
+	if (!(flags & TSM_SCREEN_HIDE_CURSOR))
+		tsm_screen_set_flags(con, TSM_SCREEN_HIDE_CURSOR);
+	tsm_screen_draw(con, shift_cb, &shift);
+	if (!(flags & TSM_SCREEN_HIDE_CURSOR))
+		tsm_screen_reset_flags(con, TSM_SCREEN_HIDE_CURSOR);
+}
+
+/**
+ * kmscon_history_query_new:
+ * @out: place to store the new query
+ * @ch: UCS-4 pattern
+ * @len: length of @ch
+ * @regex: true if @ch is a POSIX extended regular expression
+ *
+ * Returns: 0 on success, -EINVAL if @ch is not a valid regular expression,
+ * negative error code otherwise.
+ */
+int kmscon_history_query_new(struct kmscon_history_query **out,
+			     const uint32_t *ch, size_t len, bool regex)
+{
+	struct kmscon_history_query *q;
+	struct hist_buf buf;
+	size_t i;
+	int ret;
+
+	if (!out || (len && !ch))
+		return -EINVAL;
+
+	memset(&buf, 0, sizeof(buf));
+	if (buf_reserve(&buf, len * 4 + 1))
+		return -ENOMEM;
+	for (i = 0; i < len; ++i)
+		put_cp(&buf, ch[i]);
+	buf.data[buf.len] = 0;
+
+	q = malloc(sizeof(*q));
+	if (!q) {
+		ret = -ENOMEM;
+		goto err_buf;
+	}
+	memset(q, 0, sizeof(*q));
+	q->regex = regex;
+	q->text = (char*)buf.data;
+	q->len = buf.len;
+
+	if (regex) {
+		if (regcomp(&q->re, q->text, REG_EXTENDED | REG_NOSUB)) {
+			ret = -EINVAL;
+			goto err_free;
+		}
+	} else {
+		for (i = 0; i + 3 <= q->len && q->num_grams < HIST_QUERY_GRAMS;
+		     ++i)
+			q->grams[q->num_grams++] = gram_hash(&buf.data[i]);
+	}
+
+	*out = q;
+	return 0;
+
+err_free:
+	free(q);
+err_buf:
+	buf_free(&buf);
+	return ret;
+}
+
+void kmscon_history_query_free(struct kmscon_history_query *q)
+{
+	if (!q)
+		return;
+
+	if (q->regex)
+		regfree(&q->re);
+	free(q->text);
+	free(q);
+}
+
+/* Lines are numbered from the first line ever archived. This returns the
+ * number of the line that will be archived next. */
+uint64_t kmscon_history_get_end(struct kmscon_history *hist)
+{
+	if (!hist)
+		return 0;
+
+	return hist->base * HIST_BLOCK_LINES +
+	       hist->num_blocks * HIST_BLOCK_LINES + hist->open_lines;
+}
+
+static bool line_matches(struct kmscon_history *hist,
+			 const struct kmscon_history_query *q,
+			 const uint8_t *p, size_t len)
+{
+	if (line_text(&hist->text, p, len))
+		return false;
+
+	if (q->regex)
+		return !regexec(&q->re, (char*)hist->text.data, 0, NULL, 0);
+
+	return memmem(hist->text.data, hist->text.len, q->text, q->len);
+}
+
+/**
+ * kmscon_history_search:
+ * @hist: history object
+ * @q: search query
+ * @line: line to search upwards from, exclusive
+ * @max: maximum number of lines to match in this call
+ *
+ * Searches the history for the next line above @line that matches @q. Blocks
+ * that cannot contain a match are skipped without counting against @max.
+ *
+ * Returns: 0 if a match was found and stored in @line. -EAGAIN if @max lines
+ * were searched without a match; @line is updated so the search can be
+ * continued. -ENOENT if the top of the history was reached.
+ */
+int kmscon_history_search(struct kmscon_history *hist,
+			  const struct kmscon_history_query *q,
+			  uint64_t *line, unsigned int max)
+{
+	uint64_t l, first, start, base, end;
+	const uint8_t *bloom, *p;
+	unsigned int num = 0;
+	size_t idx, len;
+
+	if (!hist || !q || !line)
+		return -EINVAL;
+
+	base = hist->base * HIST_BLOCK_LINES;
+	end = kmscon_history_get_end(hist);
+	first = end - kmscon_history_get_count(hist);
+	l = *line < end ? *line : end;
+
+	while (l > first) {
+		idx = (l - 1 - base) / HIST_BLOCK_LINES;
+		start = base + idx * HIST_BLOCK_LINES;
+		if (start < first)
+			start = first;
+
+		if (idx < hist->num_blocks)
+			bloom = hist->blocks[idx].bloom;
+		else
+			bloom = hist->open_bloom;
+
+		if (!bloom_test(bloom, q)) {
+			l = start;
+			continue;
+		}
+
+		while (l > start) {
+			--l;
+			p = get_line(hist, l - base, &len);
+			if (p && line_matches(hist, q, p, len)) {
+				*line = l;
+				return 0;
+			}
+			if (++num >= max) {
+				*line = l;
+				return -EAGAIN;
+			}
+		}
+	}
+
+	*line = first;
+	return -ENOENT;
+}
@@ -0,0 +1,75 @@
+/*
+ * kmscon - Compressed Scrollback
+ *
+ * Copyright (c) 2012 Ran Benita <ran234@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Compressed Scrollback
+ * libtsm stores each scrollback line at full width with per-cell attributes.
+ * With --sb-compress, libtsm keeps only one screen of scrollback. The history
+ * object watches the console while VTE input is fed and moves every line that
+ * libtsm archived into a compact encoding: UTF-8 text with run-length encoded
+ * attributes. Lines are grouped into blocks, which are
+ * LZ4-compressed once full if liblz4 is available. Blocks are only decoded
+ * when the user scrolls back, so the cost of drawing a scrolled-back page
+ * depends on the screen size only, not on the length of the history.
+ * Each block carries a trigram bloom filter so substring searches only decode
+ * blocks that may contain a match.
+ */
+
+#ifndef KMSCON_HISTORY_H
+#define KMSCON_HISTORY_H
+
+#include <libtsm.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct kmscon_history;
+struct kmscon_history_query;
+
+int kmscon_history_new(struct kmscon_history **out, unsigned int max);
+void kmscon_history_free(struct kmscon_history *hist);
+void kmscon_history_clear(struct kmscon_history *hist);
+
+unsigned int kmscon_history_get_count(struct kmscon_history *hist);
+size_t kmscon_history_get_memory(struct kmscon_history *hist);
+
+unsigned int kmscon_history_input(struct kmscon_history *hist,
+				  struct tsm_vte *vte,
+				  struct tsm_screen *con,
+				  const char *u8, size_t len);
+void kmscon_history_draw(struct kmscon_history *hist,
+			 struct tsm_screen *con, unsigned int pos,
+			 tsm_screen_draw_cb cb, void *data);
+
+int kmscon_history_query_new(struct kmscon_history_query **out,
+			     const uint32_t *ch, size_t len, bool regex);
+void kmscon_history_query_free(struct kmscon_history_query *q);
+
+uint64_t kmscon_history_get_end(struct kmscon_history *hist);
+int kmscon_history_search(struct kmscon_history *hist,
+			  const struct kmscon_history_query *q,
+			  uint64_t *line, unsigned int max);
+
+#endif /* KMSCON_HISTORY_H */
@@ -0,0 +1,749 @@
+/*
+ * kmscon - Screen Capture
+ *
+ * Copyright (c) 2012-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Screen Capture
+ * All requests are served on the seat eloop. Exports never touch the pixels if
+ * the backend provides a dma-buf. Saving copies the front-buffer once on the
+ * seat eloop so the frame is consistent, and leaves the conversion and file
+ * I/O to a worker thread. The worker drains all queued jobs before it exits.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/dma-buf.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "eloop.h"
+#include "kmscon_capture.h"
+#include "shl_dlist.h"
+#include "shl_log.h"
+#include "shl_misc.h"
+#include "uterm_video.h"
+
+#define LOG_SUBSYSTEM "capture"
+
+struct capture_display {
+	struct shl_dlist list;
+	struct uterm_display *disp;
+};
+
+struct capture_client {
+	struct shl_dlist list;
+	struct kmscon_capture *cap;
+	int fd;
+	struct ev_fd *efd;
+};
+
+struct capture_job {
+	struct shl_dlist list;
+	char *path;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned int format;
+	uint8_t *data;
+};
+
+struct kmscon_capture {
+	struct ev_eloop *eloop;
+	char *dir;
+	char *name;
+	char *path;
+	unsigned long seq;
+
+	int sfd;
+	struct ev_fd *efd;
+	struct shl_dlist clients;
+	struct shl_dlist displays;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool quit;
+	struct shl_dlist jobs;
+};
+
+static void job_free(struct capture_job *job)
+{
+	free(job->data);
+	free(job->path);
+	free(job);
+}
+
+static void job_write(struct capture_job *job)
+{
+	unsigned int i, j;
+	const uint8_t *src;
+	uint8_t *rgb;
+	uint32_t val;
+	FILE *f;
+	int fd;
+
+	rgb = malloc(job->width * 3);
+	if (!rgb) {
+		log_error("cannot allocate row buffer for %s", job->path);
+		return;
+	}
+
+	/* never follow or overwrite files planted in the capture directory */
+	fd = open(job->path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW |
+		  O_CLOEXEC, 0600);
+	if (fd < 0) {
+		log_error("cannot open screen capture %s (%d): %m", job->path,
+			  errno);
+		free(rgb);
+		return;
+	}
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		log_error("cannot open screen capture %s (%d): %m", job->path,
+			  errno);
+		close(fd);
+		free(rgb);
+		return;
+	}
+
+	fprintf(f, "P6\n%u %u\n255\n", job->width, job->height);
+	src = job->data;
+	for (i = 0; i < job->height; ++i) {
+		for (j = 0; j < job->width; ++j) {
+			if (job->format == UTERM_FORMAT_XRGB32) {
+				val = ((const uint32_t*)src)[j];
+				rgb[j * 3 + 0] = val >> 16;
+				rgb[j * 3 + 1] = val >> 8;
+				rgb[j * 3 + 2] = val;
+			} else {
+				val = ((const uint16_t*)src)[j];
+				rgb[j * 3 + 0] = ((val >> 11) & 0x1f) << 3;
+				rgb[j * 3 + 1] = ((val >> 5) & 0x3f) << 2;
+				rgb[j * 3 + 2] = (val & 0x1f) << 3;
+			}
+		}
+		fwrite(rgb, 3, job->width, f);
+		src += job->stride;
+	}
+
+	if (ferror(f))
+		log_error("cannot write screen capture %s", job->path);
+	else
+		log_info("saved screen capture %s", job->path);
+
+	fclose(f);
+	free(rgb);
+}
+
+static void *capture_worker(void *data)
+{
+	struct kmscon_capture *cap = data;
+	struct capture_job *job;
+	sigset_t mask;
+
+	/* signals are dispatched via signalfd, never on this thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pthread_mutex_lock(&cap->lock);
+	while (1) {
+		while (!cap->quit && shl_dlist_empty(&cap->jobs))
+			pthread_cond_wait(&cap->cond, &cap->lock);
+		if (shl_dlist_empty(&cap->jobs))
+			break;
+
+		job = shl_dlist_first(&cap->jobs, struct capture_job, list);
+		shl_dlist_unlink(&job->list);
+		pthread_mutex_unlock(&cap->lock);
+
+		job_write(job);
+		job_free(job);
+
+		pthread_mutex_lock(&cap->lock);
+	}
+	pthread_mutex_unlock(&cap->lock);
+
+	return NULL;
+}
+
+static int send_packet(int fd, const void *data, size_t len, int pass)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char buf[CMSG_SPACE(sizeof(int))];
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void*)data;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (pass >= 0) {
+		memset(buf, 0, sizeof(buf));
+		msg.msg_control = buf;
+		msg.msg_controllen = sizeof(buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &pass, sizeof(int));
+	}
+
+	ret = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* copy a buffer without dma-buf into a memfd so it can be passed on */
+static int copy_to_memfd(const struct uterm_video_capture *c)
+{
+	const uint8_t *src = c->data;
+	size_t len = c->size;
+	ssize_t l;
+	int fd;
+
+	fd = memfd_create("kmscon-capture", MFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	while (len > 0) {
+		l = write(fd, src, len);
+		if (l < 0) {
+			if (errno == EINTR)
+				continue;
+			l = -errno;
+			close(fd);
+			return l;
+		}
+		src += l;
+		len -= l;
+	}
+
+	return fd;
+}
+
+static int capture_export(struct kmscon_capture *cap, int fd)
+{
+	struct shl_dlist *iter;
+	struct capture_display *d;
+	struct uterm_video_capture c;
+	struct kmscon_capture_frame frame;
+	unsigned int i = 0;
+	int ret, pass;
+
+	shl_dlist_for_each(iter, &cap->displays) {
+		d = shl_dlist_entry(iter, struct capture_display, list);
+		++i;
+
+		ret = uterm_display_capture(d->disp, &c);
+		if (ret) {
+			log_debug("cannot capture display %p: %d", d->disp,
+				  ret);
+			continue;
+		}
+
+		memset(&frame, 0, sizeof(frame));
+		frame.index = i - 1;
+		frame.width = c.width;
+		frame.height = c.height;
+		frame.stride = c.stride;
+		frame.format = c.format;
+		frame.size = c.size;
+		frame.fourcc = c.fourcc;
+
+		if (c.fd >= 0) {
+			frame.dmabuf = 1;
+			frame.offset = c.offset;
+			frame.modifier = c.modifier;
+			pass = c.fd;
+		} else {
+			frame.modifier = UTERM_MODIFIER_LINEAR;
+			pass = copy_to_memfd(&c);
+			if (pass < 0) {
+				log_warning("cannot copy display %p into memfd: %d",
+					    d->disp, pass);
+				continue;
+			}
+		}
+
+		ret = send_packet(fd, &frame, sizeof(frame), pass);
+		close(pass);
+		if (ret)
+			return ret;
+	}
+
+	memset(&frame, 0, sizeof(frame));
+	return send_packet(fd, &frame, sizeof(frame), -1);
+}
+
+static void unmap_dmabuf(const struct uterm_video_capture *c, void *map)
+{
+	struct dma_buf_sync sync;
+
+	memset(&sync, 0, sizeof(sync));
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+	ioctl(c->fd, DMA_BUF_IOCTL_SYNC, &sync);
+	munmap(map, c->offset + c->size);
+}
+
+static int capture_job_new(struct kmscon_capture *cap,
+			   struct capture_job **out,
+			   const struct uterm_video_capture *c,
+			   unsigned int index, uint64_t now)
+{
+	struct capture_job *job;
+	struct dma_buf_sync sync;
+	const uint8_t *src;
+	void *map = NULL;
+	size_t len;
+	int ret;
+
+	*out = NULL;
+
+	if (c->format != UTERM_FORMAT_XRGB32 &&
+	    c->format != UTERM_FORMAT_RGB16)
+		return -EOPNOTSUPP;
+
+	len = (size_t)c->stride * c->height;
+	if (len > c->size)
+		return -EINVAL;
+
+	/* Mapped dma-bufs are only linear if the modifier says so and the
+	 * CPU view must be synchronized with pending GPU access. */
+	src = c->data;
+	if (!src) {
+		if (c->modifier != UTERM_MODIFIER_LINEAR)
+			return -EOPNOTSUPP;
+
+		map = mmap(NULL, c->offset + c->size, PROT_READ, MAP_SHARED,
+			   c->fd, 0);
+		if (map == MAP_FAILED)
+			return -errno;
+		src = (const uint8_t*)map + c->offset;
+
+		memset(&sync, 0, sizeof(sync));
+		sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+		if (ioctl(c->fd, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+			log_debug("cannot sync dma-buf for reading (%d): %m",
+				  errno);
+	}
+
+	job = malloc(sizeof(*job));
+	if (!job) {
+		ret = -ENOMEM;
+		goto err_map;
+	}
+	memset(job, 0, sizeof(*job));
+	job->width = c->width;
+	job->height = c->height;
+	job->stride = c->stride;
+	job->format = c->format;
+
+	ret = asprintf(&job->path, "%s/%s-%" PRIu64 "-%lu-%u.ppm", cap->dir,
+		       cap->name, now, cap->seq, index);
+	if (ret < 0) {
+		job->path = NULL;
+		ret = -ENOMEM;
+		goto err_job;
+	}
+
+	job->data = malloc(len);
+	if (!job->data) {
+		ret = -ENOMEM;
+		goto err_job;
+	}
+	memcpy(job->data, src, len);
+
+	if (map)
+		unmap_dmabuf(c, map);
+	*out = job;
+	return 0;
+
+err_job:
+	job_free(job);
+err_map:
+	if (map)
+		unmap_dmabuf(c, map);
+	return ret;
+}
+
+/* queue all displays for the worker; file paths are sent to @fd if valid */
+static int capture_save(struct kmscon_capture *cap, int fd)
+{
+	struct shl_dlist *iter;
+	struct capture_display *d;
+	struct uterm_video_capture c;
+	struct capture_job *job;
+	unsigned int i = 0;
+	uint64_t now;
+	int ret;
+
+	now = time(NULL);
+	++cap->seq;
+
+	shl_dlist_for_each(iter, &cap->displays) {
+		d = shl_dlist_entry(iter, struct capture_display, list);
+		++i;
+
+		ret = uterm_display_capture(d->disp, &c);
+		if (ret) {
+			log_debug("cannot capture display %p: %d", d->disp,
+				  ret);
+			continue;
+		}
+
+		ret = capture_job_new(cap, &job, &c, i - 1, now);
+		if (c.fd >= 0)
+			close(c.fd);
+		if (ret) {
+			log_warning("cannot copy display %p: %d", d->disp, ret);
+			continue;
+		}
+
+		if (fd >= 0)
+			send_packet(fd, job->path, strlen(job->path), -1);
+
+		pthread_mutex_lock(&cap->lock);
+		shl_dlist_link_tail(&cap->jobs, &job->list);
+		pthread_cond_signal(&cap->cond);
+		pthread_mutex_unlock(&cap->lock);
+	}
+
+	if (fd >= 0)
+		return send_packet(fd, "", 0, -1);
+
+	return 0;
+}
+
+static void client_free(struct capture_client *client)
+{
+	shl_dlist_unlink(&client->list);
+	ev_eloop_rm_fd(client->efd);
+	close(client->fd);
+	free(client);
+}
+
+static void client_event(struct ev_fd *fd, int mask, void *data)
+{
+	struct capture_client *client = data;
+	struct kmscon_capture *cap = client->cap;
+	char buf[64];
+	ssize_t len;
+	int ret;
+
+	if (mask & EV_READABLE) {
+		len = recv(client->fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (len <= 0) {
+			client_free(client);
+			return;
+		}
+
+		buf[len] = 0;
+		if (len > 0 && buf[len - 1] == '\n')
+			buf[len - 1] = 0;
+
+		if (!strcmp(buf, "export")) {
+			ret = capture_export(cap, client->fd);
+		} else if (!strcmp(buf, "save")) {
+			ret = capture_save(cap, client->fd);
+		} else {
+			log_debug("unknown capture request: %s", buf);
+			ret = send_packet(client->fd, "", 0, -1);
+		}
+
+		if (ret) {
+			log_debug("dropping capture client %d: %d",
+				  client->fd, ret);
+			client_free(client);
+		}
+		return;
+	}
+
+	if (mask & (EV_HUP | EV_ERR))
+		client_free(client);
+}
+
+static void capture_accept(struct ev_fd *fd, int mask, void *data)
+{
+	struct kmscon_capture *cap = data;
+	struct capture_client *client;
+	int cfd, ret;
+
+	if (mask & (EV_HUP | EV_ERR)) {
+		log_warning("HUP/ERR on capture socket %s", cap->path);
+		ev_fd_disable(cap->efd);
+		return;
+	}
+
+	cfd = accept4(cap->sfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (cfd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			log_warning("cannot accept capture client (%d): %m",
+				    errno);
+		return;
+	}
+
+	client = malloc(sizeof(*client));
+	if (!client) {
+		close(cfd);
+		return;
+	}
+	memset(client, 0, sizeof(*client));
+	client->cap = cap;
+	client->fd = cfd;
+
+	ret = ev_eloop_new_fd(cap->eloop, &client->efd, cfd, EV_READABLE,
+			      client_event, client);
+	if (ret) {
+		log_error("cannot watch capture client: %d", ret);
+		close(cfd);
+		free(client);
+		return;
+	}
+
+	shl_dlist_link(&cap->clients, &client->list);
+	log_debug("new capture client %d on %s", cfd, cap->path);
+}
+
+static int capture_listen(struct kmscon_capture *cap)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int ret;
+
+	if (strlen(cap->path) >= sizeof(addr.sun_path)) {
+		log_error("capture socket path too long: %s", cap->path);
+		return -ENAMETOOLONG;
+	}
+
+	cap->sfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+			  SOCK_NONBLOCK, 0);
+	if (cap->sfd < 0) {
+		log_error("cannot create capture socket (%d): %m", errno);
+		return -errno;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, cap->path);
+
+	/* remove stale sockets of previous instances */
+	unlink(cap->path);
+
+	/* The socket hands out screen contents, so it must never be
+	 * accessible to others, not even between bind() and chmod(). */
+	mask = umask(0177);
+	ret = bind(cap->sfd, (struct sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+
+	if (ret < 0 || listen(cap->sfd, 4) < 0) {
+		ret = -errno;
+		log_error("cannot listen on capture socket %s (%d): %m",
+			  cap->path, errno);
+		close(cap->sfd);
+		cap->sfd = -1;
+		return ret;
+	}
+
+	return 0;
+}
+
+int kmscon_capture_new(struct kmscon_capture **out, struct ev_eloop *eloop,
+		       const char *dir, const char *name)
+{
+	struct kmscon_capture *cap;
+	int ret;
+
+	if (!out || !eloop || !dir || !name)
+		return -EINVAL;
+
+	cap = malloc(sizeof(*cap));
+	if (!cap)
+		return -ENOMEM;
+	memset(cap, 0, sizeof(*cap));
+	cap->eloop = eloop;
+	cap->sfd = -1;
+	shl_dlist_init(&cap->clients);
+	shl_dlist_init(&cap->displays);
+	shl_dlist_init(&cap->jobs);
+
+	cap->dir = strdup(dir);
+	cap->name = strdup(name);
+	if (!cap->dir || !cap->name) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = asprintf(&cap->path, "%s/%s.capture", dir, name);
+	if (ret < 0) {
+		cap->path = NULL;
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = capture_listen(cap);
+	if (ret)
+		goto err_free;
+
+	ret = ev_eloop_new_fd(eloop, &cap->efd, cap->sfd, EV_READABLE,
+			      capture_accept, cap);
+	if (ret)
+		goto err_sock;
+
+	pthread_mutex_init(&cap->lock, NULL);
+	pthread_cond_init(&cap->cond, NULL);
+
+	ret = pthread_create(&cap->thread, NULL, capture_worker, cap);
+	if (ret) {
+		log_error("cannot start capture worker (%d)", ret);
+		ret = -ret;
+		goto err_lock;
+	}
+
+	ev_eloop_ref(cap->eloop);
+	log_info("listening for screen capture requests on %s", cap->path);
+	*out = cap;
+	return 0;
+
+err_lock:
+	pthread_cond_destroy(&cap->cond);
+	pthread_mutex_destroy(&cap->lock);
+	ev_eloop_rm_fd(cap->efd);
+err_sock:
+	close(cap->sfd);
+	unlink(cap->path);
+err_free:
+	free(cap->path);
+	free(cap->name);
+	free(cap->dir);
+	free(cap);
+	return ret;
+}
+
+void kmscon_capture_free(struct kmscon_capture *cap)
+{
+	struct capture_client *client;
+	struct capture_display *d;
+
+	if (!cap)
+		return;
+
+	pthread_mutex_lock(&cap->lock);
+	cap->quit = true;
+	pthread_cond_signal(&cap->cond);
+	pthread_mutex_unlock(&cap->lock);
+	pthread_join(cap->thread, NULL);
+	pthread_cond_destroy(&cap->cond);
+	pthread_mutex_destroy(&cap->lock);
+
+	while (!shl_dlist_empty(&cap->clients)) {
+		client = shl_dlist_first(&cap->clients, struct capture_client,
+					 list);
+		client_free(client);
+	}
+
+	while (!shl_dlist_empty(&cap->displays)) {
+		d = shl_dlist_first(&cap->displays, struct capture_display,
+				    list);
+		shl_dlist_unlink(&d->list);
+		uterm_display_unref(d->disp);
+		free(d);
+	}
+
+	ev_eloop_rm_fd(cap->efd);
+	close(cap->sfd);
+	unlink(cap->path);
+	ev_eloop_unref(cap->eloop);
+	free(cap->path);
+	free(cap->name);
+	free(cap->dir);
+	free(cap);
+}
+
+int kmscon_capture_add_display(struct kmscon_capture *cap,
+			       struct uterm_display *disp)
+{
+	struct capture_display *d;
+
+	if (!cap || !disp)
+		return -EINVAL;
+
+	d = malloc(sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+	memset(d, 0, sizeof(*d));
+	d->disp = disp;
+
+	uterm_display_ref(disp);
+	shl_dlist_link_tail(&cap->displays, &d->list);
+	return 0;
+}
+
+void kmscon_capture_remove_display(struct kmscon_capture *cap,
+				   struct uterm_display *disp)
+{
+	struct shl_dlist *iter;
+	struct capture_display *d;
+
+	if (!cap || !disp)
+		return;
+
+	shl_dlist_for_each(iter, &cap->displays) {
+		d = shl_dlist_entry(iter, struct capture_display, list);
+		if (d->disp != disp)
+			continue;
+
+		shl_dlist_unlink(&d->list);
+		uterm_display_unref(disp);
+		free(d);
+		return;
+	}
+}
+
+/* save all displays into the capture directory, see --grab-capture */
+int kmscon_capture_save(struct kmscon_capture *cap)
+{
+	if (!cap)
+		return -EINVAL;
+
+	return capture_save(cap, -1);
+}
@@ -0,0 +1,81 @@
+/*
+ * kmscon - Screen Capture
+ *
+ * Copyright (c) 2012-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Screen Capture
+ * With --capture-dir, each seat listens on the SOCK_SEQPACKET socket
+ * <dir>/<seat>.capture. Clients send one of the following requests as a single
+ * packet and may send further requests on the same connection:
+ *   "export": One packet with a struct kmscon_capture_frame is sent back per
+ *             display. If the display buffer can be exported as dma-buf, its
+ *             fd is attached as SCM_RIGHTS and nothing is copied. Otherwise,
+ *             a memfd with a copy of the buffer is attached. A packet with
+ *             zero @size terminates the list.
+ *   "save":   The displays are written as PPM images into the capture
+ *             directory on a worker thread. One packet with the file path is
+ *             sent back per display, followed by an empty packet.
+ * The save request can also be triggered with --grab-capture.
+ */
+
+#ifndef KMSCON_CAPTURE_H
+#define KMSCON_CAPTURE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "eloop.h"
+#include "uterm_video.h"
+
+/* wire format of the export reply */
+struct kmscon_capture_frame {
+	uint32_t index;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	/* UTERM_FORMAT_XRGB32 or UTERM_FORMAT_RGB16 */
+	uint32_t format;
+	/* 1 if the fd is the dma-buf of the display, 0 for a memfd copy */
+	uint32_t dmabuf;
+	uint64_t size;
+	/* DRM fourcc, pixel offset and DRM modifier; copies are always
+	 * linear at offset 0 */
+	uint32_t fourcc;
+	uint32_t offset;
+	uint64_t modifier;
+};
+
+struct kmscon_capture;
+
+int kmscon_capture_new(struct kmscon_capture **out, struct ev_eloop *eloop,
+		       const char *dir, const char *name);
+void kmscon_capture_free(struct kmscon_capture *cap);
+
+int kmscon_capture_add_display(struct kmscon_capture *cap,
+			       struct uterm_display *disp);
+void kmscon_capture_remove_display(struct kmscon_capture *cap,
+				   struct uterm_display *disp);
+
+int kmscon_capture_save(struct kmscon_capture *cap);
+
+#endif /* KMSCON_CAPTURE_H */
@@ -65,20 +65,34 @@ static void print_help()
 		"\t-v, --verbose               [off]   Print verbose messages\n"
 		"\t    --debug                 [off]   Enable debug mode\n"
 		"\t    --silent                [off]   Suppress notices and warnings\n"
+		"\t    --async-log             [off]   Write log messages from a background\n"
+		"\t                                    thread\n"
 		"\t-c, --configdir </foo/bar>  [/etc/kmscon]\n"
 		"\t                                    Path to config directory\n"
+		"\t    --config-cache <dir>    [-]     Keep precompiled config files in\n"
+		"\t                                    this directory\n"
 		"\t    --listen                [off]   Listen for new seats and spawn\n"
 		"\t                                    sessions accordingly (daemon mode)\n"
+		"\t    --latency-stats <file>  [-]     Trace key-press to scanout latency\n"
+		"\t                                    and write statistics to file\n"
 		"\n"
 		"Seat Options:\n"
 		"\t    --vt <vt>               [auto]  Select which VT to run on\n"
 		"\t    --switchvt              [on]    Automatically switch to VT\n"
 		"\t    --seats <list,of,seats> [current] Select seats to run on\n"
+		"\t    --seat-threads          [off]   Run each seat on its own thread\n"
 		"\n"
 		"Session Options:\n"
 		"\t    --session-max <max>         [50]  Maximum number of sessions\n"
 		"\t    --session-control           [off] Allow keyboard session-control\n"
 		"\t    --terminal-session          [on]  Enable terminal session\n"
+		"\t    --idle-trim <minutes>       [0]   Drop renderer caches of sessions\n"
+		"\t                                      hidden for <minutes>, 0 disables\n"
+		"\t    --memory-report             [off] Log memory usage of each session\n"
+		"\t                                      once a minute\n"
+		"\t    --capture-dir <dir>         [off] Serve screen captures on\n"
+		"\t                                      <dir>/<seat>.capture and save\n"
+		"\t                                      screenshots into <dir>\n"
 		"\n"
 		"Terminal Options:\n"
 		"\t-l, --login                 [/bin/login -p]\n"
@@ -98,6 +112,11 @@ static void print_help()
 		"\t                              Select the used color palette\n"
 		"\t    --sb-size <num>         [1000]\n"
 		"\t                              Size of the scrollback-buffer in lines\n"
+		"\t    --sb-compress           [off]\n"
+		"\t                              Store the scrollback-buffer compressed\n"
+		"\t    --session-threads       [off]\n"
+		"\t                              Parse terminal output of each session\n"
+		"\t                              in a separate thread\n"
 		"\n"
 		"Input Options:\n"
 		"\t    --xkb-model <model>        [-]  Set XkbModel for input devices\n"
@@ -121,6 +140,8 @@ static void print_help()
 		"\t                                  Shortcut to scroll page up\n"
 		"\t    --grab-page-down <grab>     [<Shift>Next]\n"
 		"\t                                  Shortcut to scroll page down\n"
+		"\t    --grab-search <grab>        [<Ctrl><Shift>F]\n"
+		"\t                                  Search the scrollback-buffer\n"
 		"\t    --grab-zoom-in <grab>       [<Ctrl>Plus]\n"
 		"\t                                  Shortcut to increase font size\n"
 		"\t    --grab-zoom-out <grab>      [<Ctrl>Minus]\n"
@@ -135,14 +156,21 @@ static void print_help()
 		"\t                                  Close current session\n"
 		"\t    --grab-terminal-new <grab>  [<Ctrl><Logo>Return]\n"
 		"\t                                  Create new terminal session\n"
+		"\t    --grab-capture <grab>       [<Ctrl><Logo>Print]\n"
+		"\t                                  Save a screenshot, see --capture-dir\n"
 		"\n"
 		"Video Options:\n"
 		"\t    --drm                   [on]    Use DRM if available\n"
 		"\t    --hwaccel               [off]   Use 3D hardware-acceleration if\n"
 		"\t                                    available\n"
 		"\t    --gpus={all,aux,primary}[all]   GPU selection mode\n"
+		"\t    --async-probe           [off]   Probe DRM devices in parallel\n"
 		"\t    --render-engine <eng>   [-]     Console renderer\n"
 		"\t    --render-timing         [off]   Print renderer timing information\n"
+		"\t    --frame-pacing          [off]   Render just before the next vblank\n"
+		"\t    --hwcursor              [off]   Show the cursor on a hardware plane\n"
+		"\t    --render-buffers <num>  [0]     Number of render buffers (2-4),\n"
+		"\t                                    0 for the device default\n"
 		"\n"
 		"Font Options:\n"
 		"\t    --font-engine <engine>  [pango]\n"
@@ -463,6 +491,23 @@ static int aftercheck_drm(struct conf_option *opt, int argc, char **argv,
 	return 0;
 }
 
+static int aftercheck_render_buffers(struct conf_option *opt, int argc,
+				     char **argv, int idx)
+{
+	struct kmscon_conf_t *conf = KMSCON_CONF_FROM_FIELD(opt->mem,
+							    render_buffers);
+
+	if (conf->render_buffers &&
+	    (conf->render_buffers < 2 ||
+	     conf->render_buffers > UTERM_MAX_BUFFERS)) {
+		log_error("--render-buffers must be 0 or between 2 and %d",
+			  UTERM_MAX_BUFFERS);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static int aftercheck_vt(struct conf_option *opt, int argc, char **argv,
 			 int idx)
 {
@@ -510,6 +555,9 @@ static struct conf_grab def_grab_page_up =
 static struct conf_grab def_grab_page_down =
 		CONF_SINGLE_GRAB(SHL_SHIFT_MASK, XKB_KEY_Next);
 
+static struct conf_grab def_grab_search =
+		CONF_SINGLE_GRAB(SHL_CONTROL_MASK | SHL_SHIFT_MASK, XKB_KEY_F);
+
 static struct conf_grab def_grab_zoom_in =
 		CONF_SINGLE_GRAB(SHL_CONTROL_MASK, XKB_KEY_plus);
 
@@ -531,6 +579,9 @@ static struct conf_grab def_grab_session_close =
 static struct conf_grab def_grab_terminal_new =
 		CONF_SINGLE_GRAB(SHL_CONTROL_MASK | SHL_LOGO_MASK, XKB_KEY_Return);
 
+static struct conf_grab def_grab_capture =
+		CONF_SINGLE_GRAB(SHL_CONTROL_MASK | SHL_LOGO_MASK, XKB_KEY_Print);
+
 int kmscon_conf_new(struct conf_ctx **out)
 {
 	struct conf_ctx *ctx;
@@ -551,18 +602,25 @@ int kmscon_conf_new(struct conf_ctx **out)
 		CONF_OPTION_BOOL('v', "verbose", &conf->verbose, false),
 		CONF_OPTION_BOOL_FULL(0, "debug", aftercheck_debug, NULL, NULL, &conf->debug, false),
 		CONF_OPTION_BOOL(0, "silent", &conf->silent, false),
+		CONF_OPTION_BOOL(0, "async-log", &conf->async_log, false),
 		CONF_OPTION_STRING('c', "configdir", &conf->configdir, "/etc/kmscon"),
+		CONF_OPTION_STRING(0, "config-cache", &conf->config_cache, NULL),
 		CONF_OPTION_BOOL_FULL(0, "listen", aftercheck_listen, NULL, NULL, &conf->listen, false),
+		CONF_OPTION_STRING(0, "latency-stats", &conf->latency_stats, NULL),
 
 		/* Seat Options */
 		CONF_OPTION(0, 0, "vt", &conf_vt, aftercheck_vt, NULL, NULL, &conf->vt, NULL),
 		CONF_OPTION_BOOL(0, "switchvt", &conf->switchvt, true),
 		CONF_OPTION_STRING_LIST(0, "seats", &conf->seats, def_seats),
+		CONF_OPTION_BOOL(0, "seat-threads", &conf->seat_threads, false),
 
 		/* Session Options */
 		CONF_OPTION_UINT(0, "session-max", &conf->session_max, 50),
 		CONF_OPTION_BOOL(0, "session-control", &conf->session_control, false),
 		CONF_OPTION_BOOL(0, "terminal-session", &conf->terminal_session, true),
+		CONF_OPTION_UINT(0, "idle-trim", &conf->idle_trim, 0),
+		CONF_OPTION_BOOL(0, "memory-report", &conf->memory_report, false),
+		CONF_OPTION_STRING(0, "capture-dir", &conf->capture_dir, NULL),
 
 		/* Terminal Options */
 		CONF_OPTION(0, 'l', "login", &conf_login, aftercheck_login, NULL, file_login, &conf->login, false),
@@ -570,6 +628,8 @@ int kmscon_conf_new(struct conf_ctx **out)
 		CONF_OPTION_BOOL(0, "reset-env", &conf->reset_env, true),
 		CONF_OPTION_STRING(0, "palette", &conf->palette, NULL),
 		CONF_OPTION_UINT(0, "sb-size", &conf->sb_size, 1000),
+		CONF_OPTION_BOOL(0, "sb-compress", &conf->sb_compress, false),
+		CONF_OPTION_BOOL(0, "session-threads", &conf->session_threads, false),
 
 		/* Input Options */
 		CONF_OPTION_STRING(0, "xkb-model", &conf->xkb_model, ""),
@@ -586,6 +646,7 @@ int kmscon_conf_new(struct conf_ctx **out)
 		CONF_OPTION_GRAB(0, "grab-scroll-down", &conf->grab_scroll_down, &def_grab_scroll_down),
 		CONF_OPTION_GRAB(0, "grab-page-up", &conf->grab_page_up, &def_grab_page_up),
 		CONF_OPTION_GRAB(0, "grab-page-down", &conf->grab_page_down, &def_grab_page_down),
+		CONF_OPTION_GRAB(0, "grab-search", &conf->grab_search, &def_grab_search),
 		CONF_OPTION_GRAB(0, "grab-zoom-in", &conf->grab_zoom_in, &def_grab_zoom_in),
 		CONF_OPTION_GRAB(0, "grab-zoom-out", &conf->grab_zoom_out, &def_grab_zoom_out),
 		CONF_OPTION_GRAB(0, "grab-session-next", &conf->grab_session_next, &def_grab_session_next),
@@ -593,12 +654,17 @@ int kmscon_conf_new(struct conf_ctx **out)
 		CONF_OPTION_GRAB(0, "grab-session-dummy", &conf->grab_session_dummy, &def_grab_session_dummy),
 		CONF_OPTION_GRAB(0, "grab-session-close", &conf->grab_session_close, &def_grab_session_close),
 		CONF_OPTION_GRAB(0, "grab-terminal-new", &conf->grab_terminal_new, &def_grab_terminal_new),
+		CONF_OPTION_GRAB(0, "grab-capture", &conf->grab_capture, &def_grab_capture),
 
 		/* Video Options */
 		CONF_OPTION_BOOL_FULL(0, "drm", aftercheck_drm, NULL, NULL, &conf->drm, true),
 		CONF_OPTION_BOOL(0, "hwaccel", &conf->hwaccel, false),
 		CONF_OPTION(0, 0, "gpus", &conf_gpus, NULL, NULL, NULL, &conf->gpus, KMSCON_GPU_ALL),
+		CONF_OPTION_BOOL(0, "async-probe", &conf->async_probe, false),
 		CONF_OPTION_STRING(0, "render-engine", &conf->render_engine, NULL),
+		CONF_OPTION_BOOL(0, "frame-pacing", &conf->frame_pacing, false),
+		CONF_OPTION_BOOL(0, "hwcursor", &conf->hwcursor, false),
+		CONF_OPTION_UINT_FULL(0, "render-buffers", aftercheck_render_buffers, NULL, NULL, &conf->render_buffers, 0),
 
 		/* Font Options */
 		CONF_OPTION_STRING(0, "font-engine", &conf->font_engine, "pango"),
@@ -629,6 +695,18 @@ void kmscon_conf_free(struct conf_ctx *ctx)
 	free(conf);
 }
 
+static int load_main_file(struct conf_ctx *ctx)
+{
+	struct kmscon_conf_t *conf = conf_ctx_get_mem(ctx);
+	int ret;
+
+	ret = conf_ctx_set_cache(ctx, conf->config_cache);
+	if (ret)
+		return ret;
+
+	return conf_ctx_parse_file(ctx, "%s/kmscon.conf", conf->configdir);
+}
+
 int kmscon_conf_load_main(struct conf_ctx *ctx, int argc, char **argv)
 {
 	int ret;
@@ -655,11 +733,30 @@ int kmscon_conf_load_main(struct conf_ctx *ctx, int argc, char **argv)
 
 	log_print_init("kmscon");
 
-	ret = conf_ctx_parse_file(ctx, "%s/kmscon.conf", conf->configdir);
+	return load_main_file(ctx);
+}
+
+/*
+ * Reload the main configuration. This parses the command-line and the main
+ * config-file into a fresh context @ctx just like kmscon_conf_load_main() but
+ * leaves the log-configuration alone. It is used on SIGHUP.
+ */
+int kmscon_conf_reload_main(struct conf_ctx *ctx, int argc, char **argv)
+{
+	int ret;
+	struct kmscon_conf_t *conf;
+
+	if (!ctx)
+		return -EINVAL;
+
+	conf = conf_ctx_get_mem(ctx);
+	conf->seat_config = false;
+
+	ret = conf_ctx_parse_argv(ctx, argc, argv);
 	if (ret)
 		return ret;
 
-	return 0;
+	return load_main_file(ctx);
 }
 
 int kmscon_conf_load_seat(struct conf_ctx *ctx, const struct conf_ctx *main,
@@ -680,6 +777,10 @@ int kmscon_conf_load_seat(struct conf_ctx *ctx, const struct conf_ctx *main,
 	if (ret)
 		return ret;
 
+	ret = conf_ctx_set_cache(ctx, conf->config_cache);
+	if (ret)
+		return ret;
+
 	ret = conf_ctx_parse_file(ctx, "%s/%s.seat.conf", conf->configdir,
 				  seat);
 	if (ret)
@@ -687,3 +788,59 @@ int kmscon_conf_load_seat(struct conf_ctx *ctx, const struct conf_ctx *main,
 
 	return 0;
 }
+
+static bool str_changed(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a != b;
+	return strcmp(a, b);
+}
+
+/* Return the KMSCON_CONF_* groups that differ between @a and @b. */
+unsigned int kmscon_conf_diff(const struct kmscon_conf_t *a,
+			      const struct kmscon_conf_t *b)
+{
+	unsigned int changes = 0;
+
+	if (str_changed(a->font_engine, b->font_engine) ||
+	    str_changed(a->font_name, b->font_name) ||
+	    a->font_size != b->font_size ||
+	    a->font_ppi != b->font_ppi)
+		changes |= KMSCON_CONF_FONT;
+	if (str_changed(a->palette, b->palette))
+		changes |= KMSCON_CONF_PALETTE;
+	if (a->xkb_repeat_delay != b->xkb_repeat_delay ||
+	    a->xkb_repeat_rate != b->xkb_repeat_rate)
+		changes |= KMSCON_CONF_REPEAT;
+	if (str_changed(a->render_engine, b->render_engine))
+		changes |= KMSCON_CONF_RENDER;
+
+	return changes;
+}
+
+/*
+ * Copy a freshly loaded configuration @src into the live context @ctx. As @src
+ * was created from scratch, options removed from the config-files fall back to
+ * their defaults. Command-line options stay locked. The groups that changed
+ * are returned in @changes so the caller can update only what is affected.
+ */
+int kmscon_conf_reload(struct conf_ctx *ctx, const struct conf_ctx *src,
+		       unsigned int *changes)
+{
+	unsigned int diff;
+	int ret;
+
+	if (!ctx || !src)
+		return -EINVAL;
+
+	diff = kmscon_conf_diff(conf_ctx_get_mem(ctx),
+				conf_ctx_get_mem((struct conf_ctx *)src));
+
+	ret = conf_ctx_parse_ctx(ctx, src);
+	if (ret)
+		return ret;
+
+	if (changes)
+		*changes = diff;
+	return 0;
+}
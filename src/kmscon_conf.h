@@ -58,10 +58,16 @@ struct kmscon_conf_t {
 	bool debug;
 	/* disable notices and warnings */
 	bool silent;
+	/* write log messages from a background thread */
+	bool async_log;
 	/* config directory name */
 	char *configdir;
+	/* directory for precompiled config files */
+	char *config_cache;
 	/* listen mode */
 	bool listen;
+	/* key-press to scanout latency statistics file */
+	char *latency_stats;
 
 	/* Seat Options */
 	/* VT number to run on */
@@ -70,6 +76,8 @@ struct kmscon_conf_t {
 	bool switchvt;
 	/* seats */
 	char **seats;
+	/* run each seat on its own thread */
+	bool seat_threads;
 
 	/* Session Options */
 	/* sessions */
@@ -78,6 +86,12 @@ struct kmscon_conf_t {
 	bool session_control;
 	/* run terminal session */
 	bool terminal_session;
+	/* minutes after which hidden sessions drop their caches, 0 disables */
+	unsigned int idle_trim;
+	/* periodically log memory usage of all sessions */
+	bool memory_report;
+	/* screen capture socket and screenshot directory */
+	char *capture_dir;
 
 	/* Terminal Options */
 	/* custom login process */
@@ -92,6 +106,10 @@ struct kmscon_conf_t {
 	char *palette;
 	/* terminal scroll-back buffer size */
 	unsigned int sb_size;
+	/* keep scroll-back lines in compressed blocks */
+	bool sb_compress;
+	/* run pty and VTE of each terminal in a separate thread */
+	bool session_threads;
 
 	/* Input Options */
 	/* input KBD model */
@@ -120,6 +138,8 @@ struct kmscon_conf_t {
 	struct conf_grab *grab_page_up;
 	/* page-down grab */
 	struct conf_grab *grab_page_down;
+	/* search grab */
+	struct conf_grab *grab_search;
 	/* zoom-in grab */
 	struct conf_grab *grab_zoom_in;
 	/* zoom-out grab */
@@ -134,6 +154,8 @@ struct kmscon_conf_t {
 	struct conf_grab *grab_session_close;
 	/* terminal-new grab */
 	struct conf_grab *grab_terminal_new;
+	/* capture grab */
+	struct conf_grab *grab_capture;
 
 	/* Video Options */
 	/* use DRM if available */
@@ -142,8 +164,16 @@ struct kmscon_conf_t {
 	bool hwaccel;
 	/* gpu selection mode */
 	unsigned int gpus;
+	/* probe DRM devices on separate threads */
+	bool async_probe;
 	/* render engine */
 	char *render_engine;
+	/* delay rendering until shortly before the next vblank */
+	bool frame_pacing;
+	/* use the hardware cursor plane for the terminal cursor */
+	bool hwcursor;
+	/* number of render buffers per display, 0 for the default */
+	unsigned int render_buffers;
 
 	/* Font Options */
 	/* font engine */
@@ -156,11 +186,24 @@ struct kmscon_conf_t {
 	unsigned int font_ppi;
 };
 
+/* option groups that can be applied to running sessions on reload */
+enum kmscon_conf_change {
+	KMSCON_CONF_FONT		= 0x01,
+	KMSCON_CONF_PALETTE		= 0x02,
+	KMSCON_CONF_REPEAT		= 0x04,
+	KMSCON_CONF_RENDER		= 0x08,
+};
+
 int kmscon_conf_new(struct conf_ctx **out);
 void kmscon_conf_free(struct conf_ctx *ctx);
 int kmscon_conf_load_main(struct conf_ctx *ctx, int argc, char **argv);
 int kmscon_conf_load_seat(struct conf_ctx *ctx, const struct conf_ctx *main,
 			  const char *seat);
+int kmscon_conf_reload_main(struct conf_ctx *ctx, int argc, char **argv);
+unsigned int kmscon_conf_diff(const struct kmscon_conf_t *a,
+			      const struct kmscon_conf_t *b);
+int kmscon_conf_reload(struct conf_ctx *ctx, const struct conf_ctx *src,
+		       unsigned int *changes);
 
 static inline bool kmscon_conf_is_current_seat(struct kmscon_conf_t *conf)
 {
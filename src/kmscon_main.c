@@ -24,7 +24,9 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <paths.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -37,8 +39,10 @@
 #include "kmscon_module.h"
 #include "kmscon_seat.h"
 #include "shl_dlist.h"
+#include "shl_latency.h"
 #include "shl_log.h"
 #include "shl_misc.h"
+#include "shl_timer.h"
 #include "text.h"
 #include "uterm_input.h"
 #include "uterm_monitor.h"
@@ -50,8 +54,50 @@ struct app_video {
 	struct app_seat *seat;
 	struct uterm_monitor_dev *udev;
 
+	unsigned int type;
 	char *node;
 	struct uterm_video *video;
+
+	/* bring-up timing and deferred probing, see app_video_probe() */
+	struct shl_timer timer;
+	const struct uterm_video_module *mod;
+	bool probing;
+	bool joined;
+	bool probed;
+	bool removed;
+	pthread_t probe;
+	uint64_t probe_time;
+};
+
+/*
+ * Seat Threads
+ * With --seat-threads, each seat gets its own eloop and VT master which are
+ * dispatched on a dedicated thread. All seat objects (input, VTs, video
+ * devices, sessions) are bound to this eloop. The device monitor stays on the
+ * main thread and forwards device events to the owning seat as messages. The
+ * seat thread must not touch the monitor or any other seat. Without seat
+ * threads, messages are executed directly on the app eloop.
+ */
+
+enum app_msg_type {
+	APP_MSG_ADD_VIDEO,
+	APP_MSG_REMOVE_VIDEO,
+	APP_MSG_POLL_VIDEO,
+	APP_MSG_PROBED_VIDEO,
+	APP_MSG_ADD_INPUT,
+	APP_MSG_REMOVE_INPUT,
+	APP_MSG_RELOAD,
+	APP_MSG_CHILD,
+};
+
+struct app_msg {
+	struct shl_dlist list;
+	unsigned int type;
+	struct app_video *vid;
+	char *node;
+	struct conf_ctx *conf;
+	pid_t pid;
+	int status;
 };
 
 struct app_seat {
@@ -65,15 +111,32 @@ struct app_seat {
 	struct conf_ctx *conf_ctx;
 	struct kmscon_conf_t *conf;
 	struct shl_dlist videos;
+	struct shl_dlist probes;
+
+	struct ev_eloop *eloop;
+	struct uterm_vt_master *vtm;
+
+	bool threaded;
+	bool quit;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct shl_dlist msgs;
+	struct ev_counter *msg_cnt;
 };
 
 struct kmscon_app {
 	struct conf_ctx *conf_ctx;
 	struct kmscon_conf_t *conf;
 	bool exiting;
+	int argc;
+	char **argv;
 
 	struct ev_eloop *eloop;
 	unsigned int vt_exit_count;
+	struct ev_counter *hup_cnt;
+
+	struct ev_timer *latency_timer;
+	uint64_t latency_written;
 
 	struct uterm_vt_master *vtm;
 	struct uterm_monitor *mon;
@@ -81,6 +144,30 @@ struct kmscon_app {
 	unsigned int running_seats;
 };
 
+/* @exiting is written on the main thread but read by seat threads */
+static bool app_is_exiting(struct kmscon_app *app)
+{
+	return __atomic_load_n(&app->exiting, __ATOMIC_RELAXED);
+}
+
+static void app_seat_hup(struct kmscon_app *app, unsigned int num)
+{
+	app->running_seats -= num;
+	if (!app->running_seats) {
+		log_debug("no more running seats; exiting...");
+		ev_eloop_exit(app->eloop);
+	} else {
+		log_debug("%u more running seats", app->running_seats);
+	}
+}
+
+static void app_hup_event(struct ev_counter *cnt, uint64_t num, void *data)
+{
+	struct kmscon_app *app = data;
+
+	app_seat_hup(app, num);
+}
+
 static int app_seat_event(struct kmscon_seat *s, unsigned int event,
 			  void *data)
 {
@@ -111,45 +198,597 @@ static int app_seat_event(struct kmscon_seat *s, unsigned int event,
 			log_debug("deactivating VT on exit, %d to go",
 				  app->vt_exit_count - 1);
 			if (!--app->vt_exit_count)
-				ev_eloop_exit(app->eloop);
+				ev_eloop_exit(seat->eloop);
+		}
+		break;
+	case KMSCON_SEAT_WAKE_UP:
+		if (app_is_exiting(app))
+			return -EBUSY;
+		break;
+	case KMSCON_SEAT_HUP:
+		kmscon_seat_free(seat->seat);
+		seat->seat = NULL;
+
+		if (!app->conf->listen) {
+			log_debug("seat HUP on %s in default-mode", seat->name);
+			if (seat->threaded)
+				ev_counter_inc(app->hup_cnt, 1);
+			else
+				app_seat_hup(app, 1);
+		} else {
+			/* Seat HUP here means that we are running in
+			 * listen-mode on a modular-VT like kmscon-fake-VTs. But
+			 * this is an invalid setup. In listen-mode we
+			 * exclusively run as seat-VT-master without a
+			 * controlling VT and we effectively prevent other
+			 * setups during startup. Hence, we can safely drop the
+			 * seat here and ignore it.
+			 * You can destroy and recreate the seat to make kmscon
+			 * pick it up again in listen-mode. */
+			log_warning("seat HUP on %s in listen-mode; dropping seat...",
+				    seat->name);
+		}
+
+		break;
+	}
+
+	return 0;
+}
+
+static void app_seat_video_event(struct uterm_video *video,
+				 struct uterm_video_hotplug *ev,
+				 void *data)
+{
+	struct app_video *vid = data;
+
+	switch (ev->action) {
+	case UTERM_NEW:
+		if (!app_is_exiting(vid->seat->app))
+			kmscon_seat_add_display(vid->seat->seat, ev->display);
+		break;
+	case UTERM_GONE:
+		kmscon_seat_remove_display(vid->seat->seat, ev->display);
+		break;
+	case UTERM_REFRESH:
+		if (!app_is_exiting(vid->seat->app))
+			kmscon_seat_refresh_display(vid->seat->seat,
+						    ev->display);
+		break;
+	}
+}
+
+static bool app_seat_gpu_is_ignored(struct app_seat *seat,
+				    unsigned int type,
+				    bool drm_backed,
+				    bool primary,
+				    bool aux,
+				    const char *node)
+{
+	switch (type) {
+	case UTERM_MONITOR_FBDEV:
+		if (seat->conf->drm) {
+			if (drm_backed) {
+				log_info("ignoring video device %s on seat %s as it is a DRM-fbdev device",
+					 node, seat->name);
+				return true;
+			}
+		}
+		break;
+	case UTERM_MONITOR_DRM:
+		if (!seat->conf->drm) {
+			log_info("ignoring video device %s on seat %s as it is a DRM device",
+				  node, seat->name);
+			return true;
+		}
+		break;
+	default:
+		log_info("ignoring unknown video device %s on seat %s",
+			 node, seat->name);
+		return true;
+	}
+
+	if (seat->conf->gpus == KMSCON_GPU_PRIMARY && !primary) {
+		log_info("ignoring video device %s on seat %s as it is no primary GPU",
+			 node, seat->name);
+		return true;
+	}
+
+	if (seat->conf->gpus == KMSCON_GPU_AUX && !primary && !aux) {
+		log_info("ignoring video device %s on seat %s as it is neither a primary nor auxiliary GPU",
+			 node, seat->name);
+		return true;
+	}
+
+	return false;
+}
+
+static const struct uterm_video_module *app_video_module(struct app_video *vid)
+{
+	if (vid->type != UTERM_MONITOR_DRM)
+		return UTERM_VIDEO_FBDEV;
+	if (vid->seat->conf->hwaccel)
+		return UTERM_VIDEO_DRM3D;
+	return UTERM_VIDEO_DRM2D;
+}
+
+/* runs on the seat thread; on failure @vid stays around without video object */
+static void app_video_start(struct app_video *vid)
+{
+	struct app_seat *seat = vid->seat;
+	const struct uterm_video_module *mode;
+	int ret;
+
+	if (app_is_exiting(seat->app))
+		return;
+
+	mode = app_video_module(vid);
+	ret = uterm_video_new(&vid->video, seat->eloop, vid->node, mode);
+	if (ret) {
+		if (mode == UTERM_VIDEO_DRM3D) {
+			log_info("cannot create drm3d device %s on seat %s (%d); trying drm2d mode",
+				 vid->node, seat->name, ret);
+			ret = uterm_video_new(&vid->video, seat->eloop,
+					      vid->node, UTERM_VIDEO_DRM2D);
+		}
+		if (ret) {
+			log_error("cannot create video device %s on seat %s: %d",
+				  vid->node, seat->name, ret);
+			vid->video = NULL;
+			return;
+		}
+	}
+
+	if (vid->probed)
+		uterm_video_set_probed(vid->video);
+
+	ret = uterm_video_set_buffers(vid->video, seat->conf->render_buffers);
+	if (ret)
+		log_warning("cannot use %u render buffers on device %s: %d",
+			    seat->conf->render_buffers, vid->node, ret);
+
+	ret = uterm_video_register_cb(vid->video, app_seat_video_event, vid);
+	if (ret) {
+		log_error("cannot register video callback for device %s on seat %s: %d",
+			  vid->node, seat->name, ret);
+		uterm_video_unref(vid->video);
+		vid->video = NULL;
+		return;
+	}
+
+	if (seat->awake)
+		uterm_video_wake_up(vid->video);
+
+	shl_dlist_link(&seat->videos, &vid->list);
+
+	log_info("video device %s on seat %s ready after %" PRIu64 "ms (probing %" PRIu64 "ms)",
+		 vid->node, seat->name, shl_timer_elapsed(&vid->timer) / 1000,
+		 vid->probe_time / 1000);
+}
+
+/*
+ * Deferred Probing
+ * Probing the outputs of a DRM device reads EDIDs and can take seconds on slow
+ * drivers. With --async-probe, each DRM device is probed on its own thread
+ * before its video object is created on the seat, so a slow device doesn't
+ * delay the others. Each device joins the seat as soon as its probe is done.
+ * While @vid->probing is set, @vid is linked into @seat->probes and the probe
+ * thread may read @vid->node and @vid->mod and write @vid->probe_time and
+ * @vid->probed. Everybody else must call app_video_join() first. The thread
+ * always finishes by queueing APP_MSG_PROBED_VIDEO, so a device that is removed
+ * while probing is only marked and freed once that message arrives; the seat
+ * never blocks on a slow probe. Only app_seat_stop() waits for probes, and it
+ * leaves them linked until their message is handled.
+ */
+
+static void app_seat_queue(struct app_seat *seat, unsigned int type,
+			   struct app_video *vid, const char *node);
+
+static void *app_video_probe(void *data)
+{
+	struct app_video *vid = data;
+	struct shl_timer timer;
+	sigset_t mask;
+	int ret;
+
+	/* signals are dispatched via signalfd, never on this thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	shl_timer_reset(&timer);
+	ret = uterm_video_probe(vid->mod, vid->node);
+	vid->probe_time = shl_timer_elapsed(&timer);
+	vid->probed = !ret;
+
+	app_seat_queue(vid->seat, APP_MSG_PROBED_VIDEO, vid, NULL);
+	return NULL;
+}
+
+static void app_video_probe_start(struct app_video *vid)
+{
+	struct app_seat *seat = vid->seat;
+	int ret;
+
+	if (app_is_exiting(seat->app))
+		return;
+
+	vid->mod = app_video_module(vid);
+	vid->probing = true;
+	ret = -pthread_create(&vid->probe, NULL, app_video_probe, vid);
+	if (ret) {
+		log_warning("cannot create probe thread for video device %s on seat %s: %d",
+			    vid->node, seat->name, ret);
+		vid->probing = false;
+		app_video_start(vid);
+		return;
+	}
+
+	shl_dlist_link(&seat->probes, &vid->list);
+}
+
+static void app_video_wait(struct app_video *vid)
+{
+	if (vid->joined)
+		return;
+
+	pthread_join(vid->probe, NULL);
+	vid->joined = true;
+}
+
+static void app_video_join(struct app_video *vid)
+{
+	if (!vid->probing)
+		return;
+
+	app_video_wait(vid);
+	vid->probing = false;
+	vid->joined = false;
+	shl_dlist_unlink(&vid->list);
+}
+
+static void app_video_stop(struct app_video *vid);
+
+static void app_video_probed(struct app_video *vid)
+{
+	app_video_join(vid);
+	if (vid->removed)
+		app_video_stop(vid);
+	else
+		app_video_start(vid);
+}
+
+static void app_video_stop(struct app_video *vid)
+{
+	struct uterm_display *disp;
+
+	if (vid->probing) {
+		vid->removed = true;
+		return;
+	}
+
+	if (vid->video) {
+		shl_dlist_unlink(&vid->list);
+		uterm_video_unregister_cb(vid->video, app_seat_video_event,
+					  vid);
+
+		disp = uterm_video_get_displays(vid->video);
+		while (disp) {
+			kmscon_seat_remove_display(vid->seat->seat, disp);
+			disp = uterm_display_next(disp);
+		}
+
+		uterm_video_unref(vid->video);
+	}
+
+	free(vid->node);
+	free(vid);
+}
+
+static void app_seat_exec(struct app_seat *seat, const struct app_msg *msg)
+{
+	struct app_video *vid = msg->vid;
+	const char *node = msg->node;
+
+	switch (msg->type) {
+	case APP_MSG_ADD_VIDEO:
+		if (seat->app->conf->async_probe &&
+		    vid->type == UTERM_MONITOR_DRM)
+			app_video_probe_start(vid);
+		else
+			app_video_start(vid);
+		break;
+	case APP_MSG_PROBED_VIDEO:
+		app_video_probed(vid);
+		break;
+	case APP_MSG_REMOVE_VIDEO:
+		app_video_stop(vid);
+		break;
+	case APP_MSG_POLL_VIDEO:
+		if (vid->video)
+			uterm_video_poll(vid->video);
+		break;
+	case APP_MSG_ADD_INPUT:
+		kmscon_seat_add_input(seat->seat, node);
+		break;
+	case APP_MSG_REMOVE_INPUT:
+		kmscon_seat_remove_input(seat->seat, node);
+		break;
+	case APP_MSG_RELOAD:
+		if (seat->seat)
+			kmscon_seat_reload(seat->seat, msg->conf);
+		break;
+	case APP_MSG_CHILD:
+		ev_eloop_dispatch_child(seat->eloop, msg->pid, msg->status);
+		break;
+	}
+}
+
+static void app_msg_free(struct app_msg *msg)
+{
+	kmscon_conf_free(msg->conf);
+	free(msg->node);
+	free(msg);
+}
+
+static struct app_msg *app_seat_pop(struct app_seat *seat)
+{
+	struct app_msg *msg = NULL;
+
+	pthread_mutex_lock(&seat->lock);
+	if (!shl_dlist_empty(&seat->msgs)) {
+		msg = shl_dlist_first(&seat->msgs, struct app_msg, list);
+		shl_dlist_unlink(&msg->list);
+	}
+	pthread_mutex_unlock(&seat->lock);
+
+	return msg;
+}
+
+static void app_seat_msg_event(struct ev_counter *cnt, uint64_t num,
+			       void *data)
+{
+	struct app_seat *seat = data;
+	struct app_msg *msg;
+
+	if (__atomic_load_n(&seat->quit, __ATOMIC_SEQ_CST)) {
+		ev_eloop_exit(seat->eloop);
+		return;
+	}
+
+	while ((msg = app_seat_pop(seat))) {
+		app_seat_exec(seat, msg);
+		app_msg_free(msg);
+	}
+}
+
+static void app_seat_push(struct app_seat *seat, struct app_msg *msg)
+{
+	pthread_mutex_lock(&seat->lock);
+	shl_dlist_link_tail(&seat->msgs, &msg->list);
+	pthread_mutex_unlock(&seat->lock);
+
+	ev_counter_inc(seat->msg_cnt, 1);
+}
+
+/* Queue a message for the seat eloop; may be called from any thread. */
+static void app_seat_queue(struct app_seat *seat, unsigned int type,
+			   struct app_video *vid, const char *node)
+{
+	struct app_msg *msg;
+
+	msg = malloc(sizeof(*msg));
+	if (!msg)
+		goto err;
+	memset(msg, 0, sizeof(*msg));
+	msg->type = type;
+	msg->vid = vid;
+
+	if (node) {
+		msg->node = strdup(node);
+		if (!msg->node) {
+			free(msg);
+			goto err;
+		}
+	}
+
+	app_seat_push(seat, msg);
+	return;
+
+err:
+	log_error("cannot allocate message for seat %s; dropping device event",
+		  seat->name);
+}
+
+/* Forward a device event to the seat; executed directly without threads. */
+static void app_seat_post(struct app_seat *seat, unsigned int type,
+			  struct app_video *vid, const char *node)
+{
+	struct app_msg msg;
+
+	if (seat->threaded) {
+		app_seat_queue(seat, type, vid, node);
+		return;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	msg.vid = vid;
+	msg.node = (char*)node;
+	app_seat_exec(seat, &msg);
+}
+
+/* Queue or execute @msg depending on seat threads; takes ownership of @msg. */
+static void app_seat_deliver(struct app_seat *seat, struct app_msg *msg)
+{
+	if (seat->threaded) {
+		app_seat_push(seat, msg);
+	} else {
+		app_seat_exec(seat, msg);
+		app_msg_free(msg);
+	}
+}
+
+/* Forward a reloaded seat configuration; takes ownership of @conf. */
+static void app_seat_post_reload(struct app_seat *seat, struct conf_ctx *conf)
+{
+	struct app_msg *msg;
+
+	msg = malloc(sizeof(*msg));
+	if (!msg) {
+		log_error("cannot allocate message for seat %s; dropping reload",
+			  seat->name);
+		kmscon_conf_free(conf);
+		return;
+	}
+	memset(msg, 0, sizeof(*msg));
+	msg->type = APP_MSG_RELOAD;
+	msg->conf = conf;
+
+	app_seat_deliver(seat, msg);
+}
+
+/*
+ * SIGCHLD is process-wide, so with seat threads only the main eloop reaps
+ * children. Seat eloops have reaping disabled and each exit is forwarded to
+ * all seats whose child callbacks pick the pids they own.
+ */
+static void app_child_event(struct ev_eloop *eloop,
+			    struct ev_child_data *chld, void *data)
+{
+	struct kmscon_app *app = data;
+	struct shl_dlist *iter;
+	struct app_seat *seat;
+	struct app_msg *msg;
+
+	shl_dlist_for_each(iter, &app->seats) {
+		seat = shl_dlist_entry(iter, struct app_seat, list);
+		if (seat->eloop == app->eloop)
+			continue;
+
+		msg = malloc(sizeof(*msg));
+		if (!msg) {
+			log_error("cannot allocate message for seat %s; dropping child %d",
+				  seat->name, chld->pid);
+			continue;
+		}
+		memset(msg, 0, sizeof(*msg));
+		msg->type = APP_MSG_CHILD;
+		msg->pid = chld->pid;
+		msg->status = chld->status;
+
+		app_seat_deliver(seat, msg);
+	}
+}
+
+static void *app_seat_run(void *data)
+{
+	struct app_seat *seat = data;
+	sigset_t mask;
+
+	/* signals are dispatched via signalfd, never on this thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	ev_eloop_run(seat->eloop, -1);
+	return NULL;
+}
+
+static int app_seat_setup_eloop(struct app_seat *seat)
+{
+	struct kmscon_app *app = seat->app;
+	int ret;
+
+	if (!app->conf->seat_threads) {
+		seat->eloop = app->eloop;
+		ev_eloop_ref(seat->eloop);
+		seat->vtm = app->vtm;
+		uterm_vt_master_ref(seat->vtm);
+	} else {
+		ret = ev_eloop_new(&seat->eloop, log_llog, NULL);
+		if (ret)
+			return ret;
+		ev_eloop_set_budget(seat->eloop, 4000);
+
+		/* children are reaped on the main eloop, see app_child_event() */
+		ev_eloop_set_reaper(seat->eloop, false);
+
+		ret = uterm_vt_master_new(&seat->vtm, seat->eloop);
+		if (ret)
+			goto err_eloop;
+	}
+
+	/* probe threads queue messages even without seat threads */
+	ret = -pthread_mutex_init(&seat->lock, NULL);
+	if (ret)
+		goto err_vtm;
+
+	ret = ev_eloop_new_counter(seat->eloop, &seat->msg_cnt,
+				   app_seat_msg_event, seat);
+	if (ret)
+		goto err_lock;
+
+	return 0;
+
+err_lock:
+	pthread_mutex_destroy(&seat->lock);
+err_vtm:
+	uterm_vt_master_unref(seat->vtm);
+err_eloop:
+	ev_eloop_unref(seat->eloop);
+	return ret;
+}
+
+static void app_seat_destroy_eloop(struct app_seat *seat)
+{
+	if (seat->msg_cnt) {
+		ev_eloop_rm_counter(seat->msg_cnt);
+		pthread_mutex_destroy(&seat->lock);
+	}
+	uterm_vt_master_unref(seat->vtm);
+	ev_eloop_unref(seat->eloop);
+}
+
+/*
+ * Stop the seat thread and wait for pending probes; the seat is dispatched by
+ * the main thread afterwards. Probes stay linked until their PROBED message
+ * is handled, as a queued REMOVE may still refer to them.
+ */
+static void app_seat_stop(struct app_seat *seat)
+{
+	struct app_msg *msg;
+	struct app_video *vid;
+	struct shl_dlist *iter, *tmp;
+
+	if (seat->threaded) {
+		__atomic_store_n(&seat->quit, true, __ATOMIC_SEQ_CST);
+		ev_counter_inc(seat->msg_cnt, 1);
+		pthread_join(seat->thread, NULL);
+		seat->threaded = false;
+		log_debug("stopped thread of seat %s", seat->name);
+	}
+
+	for (;;) {
+		shl_dlist_for_each(iter, &seat->probes) {
+			vid = shl_dlist_entry(iter, struct app_video, list);
+			app_video_wait(vid);
 		}
-		break;
-	case KMSCON_SEAT_WAKE_UP:
-		if (app->exiting)
-			return -EBUSY;
-		break;
-	case KMSCON_SEAT_HUP:
-		kmscon_seat_free(seat->seat);
-		seat->seat = NULL;
 
-		if (!app->conf->listen) {
-			--app->running_seats;
-			if (!app->running_seats) {
-				log_debug("seat HUP on %s in default-mode; exiting...",
-					  seat->name);
-				ev_eloop_exit(app->eloop);
-			} else {
-				log_debug("seat HUP on %s in default-mode; %u more running seats",
-					  seat->name, app->running_seats);
-			}
-		} else {
-			/* Seat HUP here means that we are running in
-			 * listen-mode on a modular-VT like kmscon-fake-VTs. But
-			 * this is an invalid setup. In listen-mode we
-			 * exclusively run as seat-VT-master without a
-			 * controlling VT and we effectively prevent other
-			 * setups during startup. Hence, we can safely drop the
-			 * seat here and ignore it.
-			 * You can destroy and recreate the seat to make kmscon
-			 * pick it up again in listen-mode. */
-			log_warning("seat HUP on %s in listen-mode; dropping seat...",
-				    seat->name);
+		/* handles PROBED of all waited probes, in queue order with
+		 * their REMOVE; may start new probes */
+		while ((msg = app_seat_pop(seat))) {
+			app_seat_exec(seat, msg);
+			app_msg_free(msg);
 		}
 
-		break;
-	}
+		if (shl_dlist_empty(&seat->probes))
+			break;
 
-	return 0;
+		/* PROBED is lost if the probe thread couldn't allocate it */
+		shl_dlist_for_each_safe(iter, tmp, &seat->probes) {
+			vid = shl_dlist_entry(iter, struct app_video, list);
+			if (vid->joined)
+				app_video_probed(vid);
+		}
+	}
 }
 
 static int app_seat_new(struct kmscon_app *app, const char *sname,
@@ -161,7 +800,7 @@ static int app_seat_new(struct kmscon_app *app, const char *sname,
 	bool found;
 	char *cseat;
 
-	if (app->exiting)
+	if (app_is_exiting(app))
 		return -EBUSY;
 
 	found = false;
@@ -199,6 +838,8 @@ static int app_seat_new(struct kmscon_app *app, const char *sname,
 	seat->app = app;
 	seat->useat = useat;
 	shl_dlist_init(&seat->videos);
+	shl_dlist_init(&seat->probes);
+	shl_dlist_init(&seat->msgs);
 
 	seat->name = strdup(sname);
 	if (!seat->name) {
@@ -211,8 +852,14 @@ static int app_seat_new(struct kmscon_app *app, const char *sname,
 	if (!app->conf->listen)
 		types |= UTERM_VT_REAL;
 
-	ret = kmscon_seat_new(&seat->seat, app->conf_ctx, app->eloop, app->vtm,
-			      types, sname, app_seat_event, seat);
+	ret = app_seat_setup_eloop(seat);
+	if (ret) {
+		log_error("cannot create eloop for seat %s: %d", sname, ret);
+		goto err_name;
+	}
+
+	ret = kmscon_seat_new(&seat->seat, app->conf_ctx, seat->eloop,
+			      seat->vtm, types, sname, app_seat_event, seat);
 	if (ret) {
 		if (ret == -ERANGE)
 			log_debug("ignoring seat %s as it already has a seat manager",
@@ -220,19 +867,35 @@ static int app_seat_new(struct kmscon_app *app, const char *sname,
 		else
 			log_error("cannot create seat object on seat %s: %d",
 				  sname, ret);
-		goto err_name;
+		goto err_eloop;
 	}
 	seat->conf_ctx = kmscon_seat_get_conf(seat->seat);
 	seat->conf = conf_ctx_get_mem(seat->conf_ctx);
 
+	kmscon_seat_startup(seat->seat);
+
+	if (app->conf->seat_threads) {
+		seat->threaded = true;
+		ret = -pthread_create(&seat->thread, NULL, app_seat_run, seat);
+		if (ret) {
+			log_error("cannot create thread for seat %s: %d",
+				  sname, ret);
+			seat->threaded = false;
+			goto err_seat;
+		}
+		log_debug("started thread for seat %s", sname);
+	}
+
 	uterm_monitor_set_seat_data(seat->useat, seat);
 	shl_dlist_link(&app->seats, &seat->list);
 	++app->running_seats;
 
-	kmscon_seat_startup(seat->seat);
-
 	return 0;
 
+err_seat:
+	kmscon_seat_free(seat->seat);
+err_eloop:
+	app_seat_destroy_eloop(seat);
 err_name:
 	free(seat->name);
 err_free:
@@ -244,91 +907,24 @@ static void app_seat_free(struct app_seat *seat)
 {
 	log_debug("free seat %s", seat->name);
 
+	app_seat_stop(seat);
 	shl_dlist_unlink(&seat->list);
 	uterm_monitor_set_seat_data(seat->useat, NULL);
 	kmscon_seat_free(seat->seat);
+	app_seat_destroy_eloop(seat);
 	free(seat->name);
 	free(seat);
 }
 
-static void app_seat_video_event(struct uterm_video *video,
-				 struct uterm_video_hotplug *ev,
-				 void *data)
-{
-	struct app_video *vid = data;
-
-	switch (ev->action) {
-	case UTERM_NEW:
-		if (!vid->seat->app->exiting)
-			kmscon_seat_add_display(vid->seat->seat, ev->display);
-		break;
-	case UTERM_GONE:
-		kmscon_seat_remove_display(vid->seat->seat, ev->display);
-		break;
-	case UTERM_REFRESH:
-		if (!vid->seat->app->exiting)
-			kmscon_seat_refresh_display(vid->seat->seat,
-						    ev->display);
-		break;
-	}
-}
-
-static bool app_seat_gpu_is_ignored(struct app_seat *seat,
-				    unsigned int type,
-				    bool drm_backed,
-				    bool primary,
-				    bool aux,
-				    const char *node)
-{
-	switch (type) {
-	case UTERM_MONITOR_FBDEV:
-		if (seat->conf->drm) {
-			if (drm_backed) {
-				log_info("ignoring video device %s on seat %s as it is a DRM-fbdev device",
-					 node, seat->name);
-				return true;
-			}
-		}
-		break;
-	case UTERM_MONITOR_DRM:
-		if (!seat->conf->drm) {
-			log_info("ignoring video device %s on seat %s as it is a DRM device",
-				  node, seat->name);
-			return true;
-		}
-		break;
-	default:
-		log_info("ignoring unknown video device %s on seat %s",
-			 node, seat->name);
-		return true;
-	}
-
-	if (seat->conf->gpus == KMSCON_GPU_PRIMARY && !primary) {
-		log_info("ignoring video device %s on seat %s as it is no primary GPU",
-			 node, seat->name);
-		return true;
-	}
-
-	if (seat->conf->gpus == KMSCON_GPU_AUX && !primary && !aux) {
-		log_info("ignoring video device %s on seat %s as it is neither a primary nor auxiliary GPU",
-			 node, seat->name);
-		return true;
-	}
-
-	return false;
-}
-
 static int app_seat_add_video(struct app_seat *seat,
 			      unsigned int type,
 			      unsigned int flags,
 			      const char *node,
 			      struct uterm_monitor_dev *udev)
 {
-	int ret;
-	const struct uterm_video_module *mode;
 	struct app_video *vid;
 
-	if (seat->app->exiting)
+	if (app_is_exiting(seat->app))
 		return -EBUSY;
 
 	if (app_seat_gpu_is_ignored(seat, type,
@@ -349,80 +945,28 @@ static int app_seat_add_video(struct app_seat *seat,
 	memset(vid, 0, sizeof(*vid));
 	vid->seat = seat;
 	vid->udev = udev;
+	vid->type = type;
+	shl_timer_reset(&vid->timer);
 
 	vid->node = strdup(node);
 	if (!vid->node) {
 		log_error("cannot copy video device name %s on seat %s",
 			  node, seat->name);
-		ret = -ENOMEM;
-		goto err_free;
-	}
-
-	if (type == UTERM_MONITOR_DRM) {
-		if (seat->conf->hwaccel)
-			mode = UTERM_VIDEO_DRM3D;
-		else
-			mode = UTERM_VIDEO_DRM2D;
-	} else {
-		mode = UTERM_VIDEO_FBDEV;
-	}
-
-	ret = uterm_video_new(&vid->video, seat->app->eloop, node, mode);
-	if (ret) {
-		if (mode == UTERM_VIDEO_DRM3D) {
-			log_info("cannot create drm3d device %s on seat %s (%d); trying drm2d mode",
-				 vid->node, seat->name, ret);
-			ret = uterm_video_new(&vid->video, seat->app->eloop,
-					      node, UTERM_VIDEO_DRM2D);
-			if (ret)
-				goto err_node;
-		} else {
-			goto err_node;
-		}
-	}
-
-	ret = uterm_video_register_cb(vid->video, app_seat_video_event, vid);
-	if (ret) {
-		log_error("cannot register video callback for device %s on seat %s: %d",
-			  vid->node, seat->name, ret);
-		goto err_video;
+		free(vid);
+		return -ENOMEM;
 	}
 
-	if (seat->awake)
-		uterm_video_wake_up(vid->video);
-
 	uterm_monitor_set_dev_data(vid->udev, vid);
-	shl_dlist_link(&seat->videos, &vid->list);
+	app_seat_post(seat, APP_MSG_ADD_VIDEO, vid, NULL);
 	return 0;
-
-err_video:
-	uterm_video_unref(vid->video);
-err_node:
-	free(vid->node);
-err_free:
-	free(vid);
-	return ret;
 }
 
 static void app_seat_remove_video(struct app_seat *seat, struct app_video *vid)
 {
-	struct uterm_display *disp;
-
 	log_debug("free video device %s on seat %s", vid->node, seat->name);
 
-	shl_dlist_unlink(&vid->list);
 	uterm_monitor_set_dev_data(vid->udev, NULL);
-	uterm_video_unregister_cb(vid->video, app_seat_video_event, vid);
-
-	disp = uterm_video_get_displays(vid->video);
-	while (disp) {
-		kmscon_seat_remove_display(seat->seat, disp);
-		disp = uterm_display_next(disp);
-	}
-
-	uterm_video_unref(vid->video);
-	free(vid->node);
-	free(vid);
+	app_seat_post(seat, APP_MSG_REMOVE_VIDEO, vid, NULL);
 }
 
 static void app_monitor_event(struct uterm_monitor *mon,
@@ -461,7 +1005,8 @@ static void app_monitor_event(struct uterm_monitor *mon,
 		case UTERM_MONITOR_INPUT:
 			log_debug("new input device %s on seat %s",
 				  ev->dev_node, seat->name);
-			kmscon_seat_add_input(seat->seat, ev->dev_node);
+			app_seat_post(seat, APP_MSG_ADD_INPUT, NULL,
+				      ev->dev_node);
 			break;
 		}
 		break;
@@ -479,7 +1024,8 @@ static void app_monitor_event(struct uterm_monitor *mon,
 		case UTERM_MONITOR_INPUT:
 			log_debug("free input device %s on seat %s",
 				  ev->dev_node, seat->name);
-			kmscon_seat_remove_input(seat->seat, ev->dev_node);
+			app_seat_post(seat, APP_MSG_REMOVE_INPUT, NULL,
+				      ev->dev_node);
 			break;
 		}
 		break;
@@ -497,13 +1043,63 @@ static void app_monitor_event(struct uterm_monitor *mon,
 
 			log_debug("video hotplug event on device %s on seat %s",
 				  vid->node, seat->name);
-			uterm_video_poll(vid->video);
+			app_seat_post(seat, APP_MSG_POLL_VIDEO, vid, NULL);
 			break;
 		}
 		break;
 	}
 }
 
+/* join all seat threads; seats are dispatched on the main thread afterwards */
+static void app_stop_seats(struct kmscon_app *app)
+{
+	struct shl_dlist *iter;
+	struct app_seat *seat;
+
+	shl_dlist_for_each(iter, &app->seats) {
+		seat = shl_dlist_entry(iter, struct app_seat, list);
+		app_seat_stop(seat);
+	}
+}
+
+static void app_deactivate_vts(struct kmscon_app *app)
+{
+	struct shl_dlist *iter;
+	struct app_seat *seat;
+	int ret;
+
+	/* The VT subsystem needs to acknowledge the VT-leave so if it
+	 * returns -EINPROGRESS we need to wait for the VT-leave SIGUSR2
+	 * signal to arrive. Therefore, we use a separate eloop object
+	 * which is used by the VT system only. Therefore, waiting on
+	 * this eloop allows us to safely wait 50ms for the SIGUSR2 to
+	 * arrive.
+	 * We use a timeout of 100ms to avoid hanging on exit. */
+	log_debug("deactivating VTs during shutdown");
+
+	if (!app->conf->seat_threads) {
+		ret = uterm_vt_master_deactivate_all(app->vtm);
+		if (ret > 0) {
+			log_debug("waiting for %d VTs to deactivate", ret);
+			app->vt_exit_count = ret;
+			ev_eloop_run(app->eloop, 50);
+		}
+		return;
+	}
+
+	/* each seat has its own VT master and eloop */
+	shl_dlist_for_each(iter, &app->seats) {
+		seat = shl_dlist_entry(iter, struct app_seat, list);
+		ret = uterm_vt_master_deactivate_all(seat->vtm);
+		if (ret > 0) {
+			log_debug("waiting for %d VTs on seat %s to deactivate",
+				  ret, seat->name);
+			app->vt_exit_count = ret;
+			ev_eloop_run(seat->eloop, 50);
+		}
+	}
+}
+
 static void app_sig_generic(struct ev_eloop *eloop,
 			    struct signalfd_siginfo *info,
 			    void *data)
@@ -514,18 +1110,151 @@ static void app_sig_generic(struct ev_eloop *eloop,
 	ev_eloop_exit(app->eloop);
 }
 
+/*
+ * Configuration Reload
+ * On SIGHUP the command-line and all config-files are parsed again into fresh
+ * contexts. If that fails, the running configuration is kept. Otherwise, each
+ * running seat receives its new configuration and applies the changes on its
+ * own eloop. Options of the main context (seats, threads, listen mode, ...)
+ * require a restart and are not touched.
+ */
+static void app_sig_reload(struct ev_eloop *eloop,
+			   struct signalfd_siginfo *info,
+			   void *data)
+{
+	struct kmscon_app *app = data;
+	struct conf_ctx *main_ctx, *conf;
+	struct shl_dlist *iter;
+	struct app_seat *seat;
+	int ret;
+
+	log_info("reloading configuration");
+
+	ret = kmscon_conf_new(&main_ctx);
+	if (ret) {
+		log_error("cannot create configuration: %d", ret);
+		return;
+	}
+
+	ret = kmscon_conf_reload_main(main_ctx, app->argc, app->argv);
+	if (ret) {
+		log_error("cannot reload configuration, keeping the current one: %d",
+			  ret);
+		goto out;
+	}
+
+	shl_dlist_for_each(iter, &app->seats) {
+		seat = shl_dlist_entry(iter, struct app_seat, list);
+
+		/* seats that hung up in between ignore the message */
+		ret = kmscon_conf_new(&conf);
+		if (ret) {
+			log_error("cannot create configuration: %d", ret);
+			continue;
+		}
+
+		ret = kmscon_conf_load_seat(conf, main_ctx, seat->name);
+		if (ret) {
+			log_error("cannot reload configuration of seat %s, keeping the current one: %d",
+				  seat->name, ret);
+			kmscon_conf_free(conf);
+			continue;
+		}
+
+		app_seat_post_reload(seat, conf);
+	}
+
+out:
+	kmscon_conf_free(main_ctx);
+}
+
 static void app_sig_ignore(struct ev_eloop *eloop,
 			   struct signalfd_siginfo *info,
 			   void *data)
 {
 }
 
+static void app_latency_write(struct kmscon_app *app)
+{
+	int ret;
+
+	if (shl_latency_get_count() == app->latency_written)
+		return;
+
+	ret = shl_latency_write(app->conf->latency_stats);
+	if (ret)
+		log_warning("cannot write latency statistics to %s: %d",
+			    app->conf->latency_stats, ret);
+	else
+		app->latency_written = shl_latency_get_count();
+}
+
+static void app_latency_event(struct ev_timer *timer, uint64_t num,
+			      void *data)
+{
+	struct kmscon_app *app = data;
+
+	app_latency_write(app);
+}
+
+static int setup_latency(struct kmscon_app *app)
+{
+	struct itimerspec spec;
+	int ret;
+
+	if (!app->conf->latency_stats)
+		return 0;
+
+	/* the tracer keeps global state without any locking */
+	if (app->conf->seat_threads) {
+		log_warning("latency tracing is not supported with seat threads");
+		return 0;
+	}
+	if (app->conf->session_threads) {
+		log_warning("latency tracing is not supported with session threads");
+		return 0;
+	}
+
+	/* Statistics are rewritten every 5s if new traces arrived and
+	 * once more during shutdown. */
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = 5;
+	spec.it_interval.tv_sec = 5;
+
+	ret = ev_eloop_new_timer(app->eloop, &app->latency_timer, &spec,
+				 app_latency_event, app);
+	if (ret)
+		return ret;
+
+	shl_latency_reset();
+	shl_latency_enable(true);
+	log_info("tracing key-press latency to %s", app->conf->latency_stats);
+	return 0;
+}
+
+static void destroy_latency(struct kmscon_app *app)
+{
+	if (!app->latency_timer)
+		return;
+
+	app_latency_write(app);
+	shl_latency_log();
+	shl_latency_enable(false);
+	ev_eloop_rm_timer(app->latency_timer);
+	app->latency_timer = NULL;
+}
+
 static void destroy_app(struct kmscon_app *app)
 {
+	destroy_latency(app);
 	uterm_monitor_unref(app->mon);
+	ev_eloop_rm_counter(app->hup_cnt);
+	ev_eloop_unregister_child_cb(app->eloop, app_child_event, app);
 	uterm_vt_master_unref(app->vtm);
 	ev_eloop_unregister_signal_cb(app->eloop, SIGPIPE, app_sig_ignore,
 				      app);
+	ev_eloop_unregister_signal_cb(app->eloop, SIGHUP, app_sig_reload,
+				      app);
 	ev_eloop_unregister_signal_cb(app->eloop, SIGINT, app_sig_generic,
 				      app);
 	ev_eloop_unregister_signal_cb(app->eloop, SIGTERM, app_sig_generic,
@@ -545,6 +1274,11 @@ static int setup_app(struct kmscon_app *app)
 		goto err_app;
 	}
 
+	/* Input and page-flips are always handled first. Limit pty output of
+	 * a single dispatch round to a quarter of a 60Hz frame so flooding
+	 * terminals cannot delay the next round. */
+	ev_eloop_set_budget(app->eloop, 4000);
+
 	ret = ev_eloop_register_signal_cb(app->eloop, SIGTERM,
 					  app_sig_generic, app);
 	if (ret) {
@@ -566,12 +1300,41 @@ static int setup_app(struct kmscon_app *app)
 		goto err_app;
 	}
 
+	ret = ev_eloop_register_signal_cb(app->eloop, SIGHUP,
+					  app_sig_reload, app);
+	if (ret) {
+		log_error("cannot register SIGHUP signal handler: %d", ret);
+		goto err_app;
+	}
+
+	ret = setup_latency(app);
+	if (ret) {
+		log_error("cannot setup latency tracing: %d", ret);
+		goto err_app;
+	}
+
 	ret = uterm_vt_master_new(&app->vtm, app->eloop);
 	if (ret) {
 		log_error("cannot create VT master: %d", ret);
 		goto err_app;
 	}
 
+	if (app->conf->seat_threads) {
+		ret = ev_eloop_new_counter(app->eloop, &app->hup_cnt,
+					   app_hup_event, app);
+		if (ret) {
+			log_error("cannot create seat HUP counter: %d", ret);
+			goto err_app;
+		}
+
+		ret = ev_eloop_register_child_cb(app->eloop, app_child_event,
+						 app);
+		if (ret) {
+			log_error("cannot register child reaper: %d", ret);
+			goto err_app;
+		}
+	}
+
 	ret = uterm_monitor_new(&app->mon, app->eloop, app_monitor_event, app);
 	if (ret) {
 		log_error("cannot create device monitor: %d", ret);
@@ -613,6 +1376,13 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (conf->async_log) {
+		ret = log_set_async(true);
+		if (ret)
+			log_warning("cannot enable asynchronous logging: %d",
+				    ret);
+	}
+
 	kmscon_load_modules();
 	kmscon_font_register(&kmscon_font_8x16_ops);
 	kmscon_text_register(&kmscon_text_bblit_ops);
@@ -620,6 +1390,8 @@ int main(int argc, char **argv)
 	memset(&app, 0, sizeof(app));
 	app.conf_ctx = conf_ctx;
 	app.conf = conf;
+	app.argc = argc;
+	app.argv = argv;
 
 	ret = setup_app(&app);
 	if (ret)
@@ -632,24 +1404,11 @@ int main(int argc, char **argv)
 		ev_eloop_run(app.eloop, -1);
 	}
 
-	app.exiting = true;
+	__atomic_store_n(&app.exiting, true, __ATOMIC_RELAXED);
+	app_stop_seats(&app);
 
-	if (app.conf->switchvt) {
-		/* The VT subsystem needs to acknowledge the VT-leave so if it
-		 * returns -EINPROGRESS we need to wait for the VT-leave SIGUSR2
-		 * signal to arrive. Therefore, we use a separate eloop object
-		 * which is used by the VT system only. Therefore, waiting on
-		 * this eloop allows us to safely wait 50ms for the SIGUSR2 to
-		 * arrive.
-		 * We use a timeout of 100ms to avoid hanging on exit. */
-		log_debug("deactivating VTs during shutdown");
-		ret = uterm_vt_master_deactivate_all(app.vtm);
-		if (ret > 0) {
-			log_debug("waiting for %d VTs to deactivate", ret);
-			app.vt_exit_count = ret;
-			ev_eloop_run(app.eloop, 50);
-		}
-	}
+	if (app.conf->switchvt)
+		app_deactivate_vts(&app);
 
 	ret = 0;
 
@@ -665,5 +1424,6 @@ err_out:
 		log_err("cannot initialize kmscon, errno %d: %s",
 			ret, strerror(-ret));
 	log_info("exiting");
+	log_set_async(false);
 	return -ret;
 }
@@ -26,7 +26,9 @@
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -39,7 +41,37 @@
 
 #define LOG_SUBSYSTEM "module"
 
+/*
+ * Module Index
+ * "make" generates BUILD_MODULE_DIR/modules.index which lists each installed
+ * module with its file and the backends it registers. Each line looks like:
+ *   <name> <file> <type>:<backend> [<type>:<backend> ...]
+ * where <type> is "font" or "text". Empty lines and lines starting with '#'
+ * are ignored. If the index is available, kmscon_load_modules() only reads it
+ * and modules are opened on demand via kmscon_module_request(). Modules in
+ * BUILD_MODULE_DIR that are missing from the index (e.g., installed by a
+ * third party) are still loaded right away. Without a usable index, we fall
+ * back to loading every module in BUILD_MODULE_DIR.
+ */
+
+#define MODULE_INDEX "modules.index"
+
+struct module_entry {
+	struct shl_dlist list;
+	char *name;
+	char *file;
+	char *provides;
+	bool tried;
+};
+
+static const char *module_types[] = {
+	[KMSCON_MODULE_FONT] = "font",
+	[KMSCON_MODULE_TEXT] = "text",
+};
+
+static pthread_mutex_t module_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct shl_dlist module_list = SHL_DLIST_INIT(module_list);
+static struct shl_dlist index_list = SHL_DLIST_INIT(index_list);
 
 int kmscon_module_open(struct kmscon_module **out, const char *file)
 {
@@ -177,7 +209,22 @@ void kmscon_module_unload(struct kmscon_module *module)
 	module->loaded = false;
 }
 
-void kmscon_load_modules(void)
+static bool is_indexed(const char *file)
+{
+	struct shl_dlist *iter;
+	struct module_entry *entry;
+
+	shl_dlist_for_each(iter, &index_list) {
+		entry = shl_dlist_entry(iter, struct module_entry, list);
+		if (!strcmp(entry->file, file))
+			return true;
+	}
+
+	return false;
+}
+
+/* loads all modules in BUILD_MODULE_DIR that are not in the index */
+static void load_all_modules(void)
 {
 	int ret;
 	DIR *ent;
@@ -187,11 +234,6 @@ void kmscon_load_modules(void)
 
 	log_debug("loading global modules from %s", BUILD_MODULE_DIR);
 
-	if (!shl_dlist_empty(&module_list)) {
-		log_error("trying to load global modules twice");
-		return;
-	}
-
 	ent = opendir(BUILD_MODULE_DIR);
 	if (!ent) {
 		if (errno == ENOTDIR || errno == ENOENT)
@@ -235,6 +277,11 @@ void kmscon_load_modules(void)
 			continue;
 		}
 
+		if (is_indexed(file)) {
+			free(file);
+			continue;
+		}
+
 		ret = kmscon_module_open(&mod, file);
 		free(file);
 
@@ -253,12 +300,235 @@ void kmscon_load_modules(void)
 	closedir(ent);
 }
 
+static void free_entry(struct module_entry *entry)
+{
+	shl_dlist_unlink(&entry->list);
+	free(entry->provides);
+	free(entry->file);
+	free(entry->name);
+	free(entry);
+}
+
+static int parse_entry(char *line)
+{
+	struct module_entry *entry;
+	char *name, *file, *provides, *tmp;
+	int ret;
+
+	name = strtok_r(line, " \t\n", &tmp);
+	if (!name || *name == '#')
+		return 0;
+
+	file = strtok_r(NULL, " \t\n", &tmp);
+	provides = strtok_r(NULL, "\n", &tmp);
+	if (!file || !provides)
+		return -EINVAL;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+	memset(entry, 0, sizeof(*entry));
+
+	entry->name = strdup(name);
+	if (!entry->name) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	if (*file == '/')
+		entry->file = strdup(file);
+	else if (asprintf(&entry->file, "%s/%s", BUILD_MODULE_DIR, file) < 0)
+		entry->file = NULL;
+	if (!entry->file) {
+		ret = -ENOMEM;
+		goto err_name;
+	}
+
+	entry->provides = strdup(provides);
+	if (!entry->provides) {
+		ret = -ENOMEM;
+		goto err_file;
+	}
+
+	shl_dlist_link_tail(&index_list, &entry->list);
+	return 0;
+
+err_file:
+	free(entry->file);
+err_name:
+	free(entry->name);
+err_free:
+	free(entry);
+	return ret;
+}
+
+static int load_index(void)
+{
+	struct shl_dlist *iter;
+	FILE *f;
+	char *path, *line = NULL;
+	size_t size = 0;
+	unsigned int num = 0, lineno = 0;
+	int ret;
+
+	ret = asprintf(&path, "%s/%s", BUILD_MODULE_DIR, MODULE_INDEX);
+	if (ret < 0)
+		return -ENOMEM;
+
+	f = fopen(path, "re");
+	if (!f) {
+		ret = -errno;
+		if (ret != -ENOENT)
+			log_error("cannot open module index %s (%d): %m",
+				  path, errno);
+		free(path);
+		return ret;
+	}
+
+	while (getline(&line, &size, f) >= 0) {
+		++lineno;
+		ret = parse_entry(line);
+		if (ret == -EINVAL)
+			log_warning("invalid entry in module index %s:%u",
+				    path, lineno);
+		else if (ret)
+			break;
+	}
+
+	free(line);
+	fclose(f);
+
+	if (ret == -ENOMEM) {
+		log_error("cannot allocate memory for module index");
+		while (!shl_dlist_empty(&index_list))
+			free_entry(shl_dlist_entry(index_list.next,
+						   struct module_entry, list));
+		free(path);
+		return ret;
+	}
+
+	shl_dlist_for_each(iter, &index_list)
+		++num;
+	log_debug("read %u modules from index %s", num, path);
+	free(path);
+	return 0;
+}
+
+static bool entry_provides(struct module_entry *entry, unsigned int type,
+			   const char *backend)
+{
+	const char *p = entry->provides;
+	size_t tlen, blen;
+
+	tlen = strlen(module_types[type]);
+	blen = strlen(backend);
+
+	while (*p) {
+		p += strspn(p, " \t");
+		if (!strncmp(p, module_types[type], tlen) && p[tlen] == ':' &&
+		    !strncmp(&p[tlen + 1], backend, blen) &&
+		    (!p[tlen + 1 + blen] ||
+		     strchr(" \t", p[tlen + 1 + blen])))
+			return true;
+		p += strcspn(p, " \t");
+	}
+
+	return false;
+}
+
+/**
+ * kmscon_module_request:
+ * @type: Backend type (KMSCON_MODULE_FONT or KMSCON_MODULE_TEXT)
+ * @backend: Name of the requested backend
+ *
+ * Looks up @backend in the module index and opens and loads the module that
+ * provides it, unless this was already tried before. This is called by the
+ * font and text subsystems whenever a backend is requested that is not
+ * registered yet.
+ *
+ * Returns: 0 if a module was loaded, -ENOENT if no (new) module provides
+ * @backend, other negative error codes on failure.
+ */
+int kmscon_module_request(unsigned int type, const char *backend)
+{
+	struct shl_dlist *iter;
+	struct module_entry *entry = NULL;
+	struct kmscon_module *mod;
+	int ret;
+
+	if (type > KMSCON_MODULE_TEXT || !backend)
+		return -EINVAL;
+
+	pthread_mutex_lock(&module_lock);
+
+	shl_dlist_for_each(iter, &index_list) {
+		entry = shl_dlist_entry(iter, struct module_entry, list);
+		if (!entry->tried && entry_provides(entry, type, backend))
+			break;
+		entry = NULL;
+	}
+
+	if (!entry) {
+		ret = -ENOENT;
+		goto out_unlock;
+	}
+
+	log_debug("loading module %s on demand for %s backend %s",
+		  entry->name, module_types[type], backend);
+
+	/* never retry a module, even if it failed */
+	entry->tried = true;
+
+	ret = kmscon_module_open(&mod, entry->file);
+	if (ret)
+		goto out_unlock;
+
+	ret = kmscon_module_load(mod);
+	if (ret) {
+		kmscon_module_unref(mod);
+		goto out_unlock;
+	}
+
+	shl_dlist_link(&module_list, &mod->list);
+
+out_unlock:
+	pthread_mutex_unlock(&module_lock);
+	return ret;
+}
+
+void kmscon_load_modules(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&module_lock);
+
+	if (!shl_dlist_empty(&module_list) || !shl_dlist_empty(&index_list)) {
+		log_error("trying to load global modules twice");
+		goto out_unlock;
+	}
+
+	ret = load_index();
+	if (ret)
+		log_debug("no usable module index (%d), loading all modules",
+			  ret);
+	load_all_modules();
+
+out_unlock:
+	pthread_mutex_unlock(&module_lock);
+}
+
 void kmscon_unload_modules(void)
 {
 	struct kmscon_module *module;
 
 	log_debug("unloading modules");
 
+	pthread_mutex_lock(&module_lock);
+
+	while (!shl_dlist_empty(&index_list))
+		free_entry(shl_dlist_entry(index_list.next,
+					   struct module_entry, list));
+
 	while (!shl_dlist_empty(&module_list)) {
 		module = shl_dlist_entry(module_list.prev, struct kmscon_module,
 					 list);
@@ -266,4 +536,6 @@ void kmscon_unload_modules(void)
 		kmscon_module_unload(module);
 		kmscon_module_unref(module);
 	}
+
+	pthread_mutex_unlock(&module_lock);
 }
@@ -49,6 +49,11 @@
  * release the resources as there might still be users of it. Only when
  * "module_exit" is called, kmscon guarantees that there are no more users and
  * the module can release its resources.
+ *
+ * Modules are not loaded eagerly if a module index is installed. Instead, the
+ * font and text subsystems call kmscon_module_request() when a backend is
+ * requested that is not registered, yet. This loads the module which the index
+ * lists as provider of that backend.
  */
 
 #ifndef KMSCON_MODULE_H
@@ -58,6 +63,11 @@
 
 struct kmscon_module;
 
+enum kmscon_module_type {
+	KMSCON_MODULE_FONT,
+	KMSCON_MODULE_TEXT,
+};
+
 int kmscon_module_open(struct kmscon_module **out, const char *file);
 void kmscon_module_ref(struct kmscon_module *module);
 void kmscon_module_unref(struct kmscon_module *module);
@@ -65,6 +75,8 @@ void kmscon_module_unref(struct kmscon_module *module);
 int kmscon_module_load(struct kmscon_module *module);
 void kmscon_module_unload(struct kmscon_module *module);
 
+int kmscon_module_request(unsigned int type, const char *backend);
+
 void kmscon_load_modules(void);
 void kmscon_unload_modules(void);
 
@@ -30,11 +30,14 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "conf.h"
 #include "eloop.h"
 #include "kmscon_conf.h"
+#include "kmscon_capture.h"
 #include "kmscon_dummy.h"
 #include "kmscon_seat.h"
 #include "kmscon_terminal.h"
@@ -55,6 +58,10 @@ struct kmscon_session {
 	bool foreground;
 	bool deactivating;
 
+	/* CLOCK_MONOTONIC secs when the session was last hidden */
+	uint64_t hidden;
+	bool trimmed;
+
 	struct ev_timer *timer;
 
 	kmscon_session_cb_t cb;
@@ -96,6 +103,11 @@ struct kmscon_seat {
 
 	unsigned int async_schedule;
 
+	/* idle-trim and memory-report timer */
+	struct ev_timer *idle_timer;
+	/* NULL unless --capture-dir is given */
+	struct kmscon_capture *capture;
+
 	kmscon_seat_cb_t cb;
 	void *data;
 };
@@ -144,6 +156,14 @@ static void session_call_display_refresh(struct kmscon_session *sess,
 	session_call(sess, KMSCON_SESSION_DISPLAY_REFRESH, disp);
 }
 
+static uint64_t seat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
 static void activate_display(struct kmscon_display *d)
 {
 	int ret;
@@ -322,6 +342,8 @@ static int seat_run(struct kmscon_seat *seat)
 	}
 
 	seat->current_sess = session;
+	session->hidden = 0;
+	session->trimmed = false;
 
 	return 0;
 }
@@ -334,6 +356,7 @@ static void session_deactivate(struct kmscon_session *sess)
 	sess->seat->async_schedule = SCHEDULE_SWITCH;
 	sess->deactivating = false;
 	sess->seat->current_sess = NULL;
+	sess->hidden = seat_now();
 }
 
 static int seat_pause(struct kmscon_seat *seat, bool force)
@@ -493,6 +516,7 @@ static int seat_add_display(struct kmscon_seat *seat,
 
 	uterm_display_ref(d->disp);
 	shl_dlist_link(&seat->displays, &d->list);
+	kmscon_capture_add_display(seat->capture, d->disp);
 	activate_display(d);
 	return 0;
 }
@@ -506,6 +530,7 @@ static void seat_remove_display(struct kmscon_seat *seat,
 	log_debug("remove display %p from seat %s", d->disp, seat->name);
 
 	shl_dlist_unlink(&d->list);
+	kmscon_capture_remove_display(seat->capture, d->disp);
 
 	if (d->activated) {
 		shl_dlist_for_each_safe(iter, tmp, &seat->sessions) {
@@ -630,6 +655,16 @@ static void seat_input_event(struct uterm_input *input,
 		kmscon_session_unregister(s);
 		return;
 	}
+	if (conf_grab_matches(seat->conf->grab_capture,
+			      ev->mods, ev->num_syms, ev->keysyms)) {
+		ev->handled = true;
+		if (!seat->capture)
+			return;
+		ret = kmscon_capture_save(seat->capture);
+		if (ret)
+			log_error("cannot save screen capture: %d", ret);
+		return;
+	}
 	if (conf_grab_matches(seat->conf->grab_terminal_new,
 			      ev->mods, ev->num_syms, ev->keysyms)) {
 		ev->handled = true;
@@ -650,6 +685,69 @@ static void seat_input_event(struct uterm_input *input,
 	}
 }
 
+/*
+ * Idle Sessions
+ * Background sessions keep their renderer caches although nobody looks at
+ * them. With --idle-trim, sessions that were hidden for the given number of
+ * minutes are asked to drop them (KMSCON_SESSION_TRIM). They are recreated
+ * when the session is activated again. With --memory-report, the memory used
+ * by each session is logged on the same timer.
+ */
+
+static void seat_idle_event(struct ev_timer *timer, uint64_t num, void *data)
+{
+	struct kmscon_seat *seat = data;
+	struct shl_dlist *iter;
+	struct kmscon_session *s;
+	struct kmscon_session_memory mem;
+	uint64_t now, limit;
+	size_t sum, total = 0;
+
+	now = seat_now();
+	limit = seat->conf->idle_trim * 60ULL;
+
+	shl_dlist_for_each(iter, &seat->sessions) {
+		s = shl_dlist_entry(iter, struct kmscon_session, list);
+
+		if (limit && !s->trimmed && s != seat->current_sess &&
+		    now - s->hidden >= limit) {
+			log_debug("trimming session %p, hidden for %" PRIu64 "s",
+				  s, now - s->hidden);
+			session_call(s, KMSCON_SESSION_TRIM, NULL);
+			s->trimmed = true;
+		}
+
+		if (!seat->conf->memory_report)
+			continue;
+
+		kmscon_session_get_memory(s, &mem);
+		sum = mem.text + mem.screen + mem.scrollback + mem.pty;
+		total += sum;
+		log_info("seat %s: session %p%s: %zu bytes (text %zu, screen %zu, scrollback %zu, pty %zu)",
+			 seat->name, s, s->trimmed ? " (trimmed)" : "", sum,
+			 mem.text, mem.screen, mem.scrollback, mem.pty);
+	}
+
+	if (seat->conf->memory_report)
+		log_info("seat %s: %zu sessions use %zu bytes",
+			 seat->name, seat->session_count, total);
+}
+
+static int seat_setup_idle(struct kmscon_seat *seat)
+{
+	struct itimerspec spec;
+
+	if (!seat->conf->idle_trim && !seat->conf->memory_report)
+		return 0;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = 60;
+	spec.it_interval.tv_sec = 60;
+
+	return ev_eloop_new_timer(seat->eloop, &seat->idle_timer, &spec,
+				  seat_idle_event, seat);
+}
+
 int kmscon_seat_new(struct kmscon_seat **out,
 		    struct conf_ctx *main_conf,
 		    struct ev_eloop *eloop,
@@ -735,11 +833,29 @@ int kmscon_seat_new(struct kmscon_seat **out,
 	if (ret)
 		goto err_input_cb;
 
+	ret = seat_setup_idle(seat);
+	if (ret) {
+		log_error("cannot create idle timer on seat %s: %d",
+			  seat->name, ret);
+		goto err_vt;
+	}
+
+	/* capturing is a debugging aid, the seat works fine without it */
+	if (seat->conf->capture_dir) {
+		ret = kmscon_capture_new(&seat->capture, seat->eloop,
+					 seat->conf->capture_dir, seat->name);
+		if (ret)
+			log_warning("cannot enable screen capture on seat %s: %d",
+				    seat->name, ret);
+	}
+
 	ev_eloop_ref(seat->eloop);
 	uterm_vt_master_ref(seat->vtm);
 	*out = seat;
 	return 0;
 
+err_vt:
+	uterm_vt_deallocate(seat->vt);
 err_input_cb:
 	uterm_input_unregister_cb(seat->input, seat_input_event, seat);
 err_input:
@@ -786,6 +902,8 @@ void kmscon_seat_free(struct kmscon_seat *seat)
 		seat_remove_display(seat, d);
 	}
 
+	kmscon_capture_free(seat->capture);
+	ev_eloop_rm_timer(seat->idle_timer);
 	uterm_vt_deallocate(seat->vt);
 	uterm_input_unregister_cb(seat->input, seat_input_event, seat);
 	uterm_input_unref(seat->input);
@@ -926,6 +1044,55 @@ struct conf_ctx *kmscon_seat_get_conf(struct kmscon_seat *seat)
 	return seat->conf_ctx;
 }
 
+/*
+ * Apply a freshly loaded seat configuration @conf. Key-repeat is updated on the
+ * seat input, all other changes are forwarded to the sessions which update
+ * only what is affected. Grabs are read from the configuration on each key
+ * press and hence take effect immediately.
+ */
+int kmscon_seat_reload(struct kmscon_seat *seat, const struct conf_ctx *conf)
+{
+	struct shl_dlist *iter, *tmp;
+	struct kmscon_session *s;
+	struct kmscon_session_event ev;
+	unsigned int changes;
+	int ret;
+
+	if (!seat || !conf)
+		return -EINVAL;
+
+	ret = kmscon_conf_reload(seat->conf_ctx, conf, &changes);
+	if (ret) {
+		log_error("cannot reload configuration of seat %s: %d",
+			  seat->name, ret);
+		return ret;
+	}
+
+	log_info("reloaded configuration of seat %s (changes 0x%x)",
+		 seat->name, changes);
+
+	if (changes & KMSCON_CONF_REPEAT)
+		uterm_input_set_repeat(seat->input,
+				       seat->conf->xkb_repeat_delay,
+				       seat->conf->xkb_repeat_rate);
+
+	if (!(changes & ~KMSCON_CONF_REPEAT))
+		return 0;
+
+	shl_dlist_for_each_safe(iter, tmp, &seat->sessions) {
+		s = shl_dlist_entry(iter, struct kmscon_session, list);
+		if (!s->cb)
+			continue;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.type = KMSCON_SESSION_RECONFIGURE;
+		ev.changes = changes;
+		s->cb(s, &ev, s->data);
+	}
+
+	return 0;
+}
+
 void kmscon_seat_schedule(struct kmscon_seat *seat, unsigned int id)
 {
 	struct shl_dlist *iter;
@@ -985,6 +1152,7 @@ int kmscon_seat_register_session(struct kmscon_seat *seat,
 	sess->cb = cb;
 	sess->data = data;
 	sess->foreground = true;
+	sess->hidden = seat_now();
 
 	/* register new sessions next to the current one */
 	if (seat->current_sess)
@@ -1193,3 +1361,22 @@ void kmscon_session_notify_deactivated(struct kmscon_session *sess)
 		seat_switch(seat);
 	}
 }
+
+/* sessions without memory accounting leave all fields at 0 */
+void kmscon_session_get_memory(struct kmscon_session *sess,
+			       struct kmscon_session_memory *mem)
+{
+	struct kmscon_session_event ev;
+
+	if (!mem)
+		return;
+
+	memset(mem, 0, sizeof(*mem));
+	if (!sess || !sess->cb)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = KMSCON_SESSION_MEMORY;
+	ev.mem = mem;
+	sess->cb(sess, &ev, sess->data);
+}
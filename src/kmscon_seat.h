@@ -62,11 +62,25 @@ enum kmscon_session_event_type {
 	KMSCON_SESSION_ACTIVATE,
 	KMSCON_SESSION_DEACTIVATE,
 	KMSCON_SESSION_UNREGISTER,
+	KMSCON_SESSION_TRIM,
+	KMSCON_SESSION_MEMORY,
+	KMSCON_SESSION_RECONFIGURE,
+};
+
+/* bytes used by a session, see kmscon_session_get_memory() */
+struct kmscon_session_memory {
+	size_t text;
+	size_t screen;
+	size_t scrollback;
+	size_t pty;
 };
 
 struct kmscon_session_event {
 	unsigned int type;
 	struct uterm_display *disp;
+	struct kmscon_session_memory *mem;
+	/* KMSCON_CONF_* groups changed by KMSCON_SESSION_RECONFIGURE */
+	unsigned int changes;
 };
 
 typedef int (*kmscon_session_cb_t) (struct kmscon_session *session,
@@ -97,6 +111,7 @@ const char *kmscon_seat_get_name(struct kmscon_seat *seat);
 struct uterm_input *kmscon_seat_get_input(struct kmscon_seat *seat);
 struct ev_eloop *kmscon_seat_get_eloop(struct kmscon_seat *seat);
 struct conf_ctx *kmscon_seat_get_conf(struct kmscon_seat *seat);
+int kmscon_seat_reload(struct kmscon_seat *seat, const struct conf_ctx *conf);
 
 void kmscon_seat_schedule(struct kmscon_seat *seat, unsigned int id);
 
@@ -120,5 +135,7 @@ void kmscon_session_disable(struct kmscon_session *sess);
 bool kmscon_session_is_enabled(struct kmscon_session *sess);
 
 void kmscon_session_notify_deactivated(struct kmscon_session *sess);
+void kmscon_session_get_memory(struct kmscon_session *sess,
+			       struct kmscon_session_memory *mem);
 
 #endif /* KMSCON_SEAT_H */
@@ -33,30 +33,141 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <libtsm.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "conf.h"
 #include "eloop.h"
+#include "font.h"
+#include "history.h"
 #include "kmscon_conf.h"
 #include "kmscon_seat.h"
 #include "kmscon_terminal.h"
 #include "pty.h"
+#include "shl_array.h"
+#include "shl_latency.h"
 #include "shl_dlist.h"
 #include "shl_log.h"
+#include "shl_misc.h"
 #include "text.h"
 #include "uterm_input.h"
 #include "uterm_video.h"
 
 #define LOG_SUBSYSTEM "terminal"
 
+/* frames of damage we remember; must cover the oldest back-buffer */
+#define SCREEN_HISTORY 4
+/* changed cells per frame before we give up and redraw everything */
+#define SCREEN_DAMAGE_MAX 32
+/* font sizes we keep besides the current one, see zoom_set() */
+#define ZOOM_CACHE 3
+
+struct screen_cell {
+	uint64_t id;
+	unsigned int width;
+	struct tsm_screen_attr attr;
+	bool dirty;
+};
+
+struct screen_damage {
+	bool full;
+	unsigned int num;
+	unsigned int cells[SCREEN_DAMAGE_MAX];
+};
+
+struct zoom_entry {
+	unsigned int points;
+	uint64_t used;
+	struct kmscon_font *font;
+	struct kmscon_font *bold_font;
+};
+
 struct screen {
 	struct shl_dlist list;
 	struct kmscon_terminal *term;
 	struct uterm_display *disp;
 	struct kmscon_text *txt;
+	/* renderers of cached font sizes, indexed like term->zoom */
+	struct kmscon_text *zoom_txt[ZOOM_CACHE];
 
 	bool swapping;
 	bool pending;
+	/* renderer caches were dropped, see screen_trim() */
+	bool trimmed;
+
+	/* frame pacing, all times in usecs of CLOCK_MONOTONIC */
+	struct ev_timer *pace_timer;
+	bool paced;
+	uint64_t target;
+	uint64_t render_time;
+	uint64_t margin;
+
+	/* damage tracking, see screen_scan() */
+	bool valid;
+	unsigned int cols;
+	unsigned int rows;
+	struct screen_cell *cells;
+	unsigned int known;
+	unsigned int damage_pos;
+	struct screen_damage damage[SCREEN_HISTORY];
+
+	/* hardware cursor */
+	bool hwcursor;
+	bool cursor_shown;
+	bool cursor_valid;
+	bool cursor_failed;
+	unsigned int cursor_x;
+	unsigned int cursor_y;
+	struct screen_cell cursor;
+	size_t cursor_size;
+	struct uterm_video_buffer cursor_buf;
+};
+
+/*
+ * Session Threads
+ * With --session-threads, pty reads and VTE parsing of a terminal run on a
+ * separate worker thread with its own eloop. The pty, vte and console objects
+ * are shared with the main thread, which accesses them only with @lock held
+ * (input, resizing, session changes). Rendering never takes the lock. Instead,
+ * the worker publishes snapshots of the screen via a lock-free triple-buffer
+ * and notifies the main loop, which draws the most recent snapshot.
+ */
+
+struct snapshot_cell {
+	uint64_t id;
+	size_t ch;
+	size_t len;
+	unsigned int width;
+	unsigned int posx;
+	unsigned int posy;
+	struct tsm_screen_attr attr;
+};
+
+struct snapshot {
+	struct shl_array *cells;
+	struct shl_array *chars;
+	struct tsm_screen_attr def_attr;
+};
+
+/* set in @ready if the snapshot wasn't picked up by the main thread, yet */
+#define WORKER_DIRTY 0x4
+
+struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct ev_eloop *eloop;
+	struct ev_counter *kick;
+	struct ev_counter *notify;
+	bool exit;
+	bool changed;
+	bool stale;
+
+	struct snapshot snaps[3];
+	unsigned int back;
+	unsigned int front;
+	unsigned int ready;
 };
 
 struct kmscon_terminal {
@@ -79,11 +190,96 @@ struct kmscon_terminal {
 	struct kmscon_pty *pty;
 	struct ev_fd *ptyfd;
 
+	/* set while the user looks at the scrollback buffer */
+	bool sb_active;
+	/* compressed scrollback, NULL unless --sb-compress is set */
+	struct kmscon_history *history;
+	unsigned int sb_pos;
+	/* scroll-back search, see search_start() */
+	bool search_active;
+	bool search_regex;
+	bool search_running;
+	int search_result;
+	unsigned int search_len;
+	uint32_t search_buf[128];
+	unsigned int search_saved_pos;
+	uint64_t search_line;
+	struct kmscon_history_query *search_query;
+	unsigned int prompt_len;
+	uint32_t prompt[192];
+	bool key_capture;
+	size_t key_seq_len;
+	char key_seq[64];
+	/* redraw at the end of the current input batch */
+	bool input_redraw;
+	/* output for the child, flushed once per eloop iteration */
+	size_t out_len;
+	char out_buf[4096];
+	/* NULL unless session threads are enabled */
+	struct worker *worker;
+
 	struct kmscon_font_attr font_attr;
 	struct kmscon_font *font;
 	struct kmscon_font *bold_font;
+	/* recently used font sizes, see zoom_set() */
+	struct zoom_entry zoom[ZOOM_CACHE];
+	uint64_t zoom_tick;
 };
 
+static void terminal_lock(struct kmscon_terminal *term)
+{
+	if (term->worker)
+		pthread_mutex_lock(&term->worker->lock);
+}
+
+static void terminal_unlock(struct kmscon_terminal *term)
+{
+	if (term->worker)
+		pthread_mutex_unlock(&term->worker->lock);
+}
+
+/* Returns the most recent snapshot; must be called from the main thread. */
+static struct snapshot *worker_acquire(struct worker *w)
+{
+	unsigned int ready;
+
+	ready = __atomic_load_n(&w->ready, __ATOMIC_SEQ_CST);
+	if (!(ready & WORKER_DIRTY))
+		return &w->snaps[w->front];
+
+	ready = __atomic_exchange_n(&w->ready, w->front, __ATOMIC_SEQ_CST);
+	w->front = ready & ~WORKER_DIRTY;
+
+	/* the worker skipped updates while we didn't pick up this snapshot */
+	if (__atomic_exchange_n(&w->stale, false, __ATOMIC_SEQ_CST))
+		ev_counter_inc(w->kick, 1);
+
+	return &w->snaps[w->front];
+}
+
+static void snapshot_draw(struct snapshot *snap, struct kmscon_text *txt)
+{
+	struct snapshot_cell *cells, *cell;
+	uint32_t *chars;
+	size_t i, num;
+
+	cells = shl_array_get_array(snap->cells);
+	chars = shl_array_get_array(snap->chars);
+	num = shl_array_get_length(snap->cells);
+
+	for (i = 0; i < num; ++i) {
+		cell = &cells[i];
+
+		/* snapshot may be older than the last resize */
+		if (cell->posx >= txt->cols || cell->posy >= txt->rows)
+			continue;
+
+		kmscon_text_draw(txt, cell->id, &chars[cell->ch], cell->len,
+				 cell->width, cell->posx, cell->posy,
+				 &cell->attr);
+	}
+}
+
 static void do_clear_margins(struct screen *scr)
 {
 	unsigned int w, h, sw, sh;
@@ -102,7 +298,10 @@ static void do_clear_margins(struct screen *scr)
 	dw = sw - w;
 	dh = sh - h;
 
-	tsm_vte_get_def_attr(scr->term->vte, &attr);
+	if (scr->term->worker)
+		attr = worker_acquire(scr->term->worker)->def_attr;
+	else
+		tsm_vte_get_def_attr(scr->term->vte, &attr);
 
 	if (dw > 0)
 		uterm_display_fill(scr->disp, attr.br, attr.bg, attr.bb,
@@ -114,27 +313,574 @@ static void do_clear_margins(struct screen *scr)
 				   sw, dh);
 }
 
-static void do_redraw_screen(struct screen *scr)
+static uint64_t pace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Damage Tracking
+ * Each screen caches the cells it has drawn. Before rendering, the console is
+ * compared against this cache and the changed cells are recorded as damage of
+ * the new frame. If the display tells us how old its back-buffer is and we know
+ * the damage of all frames since then, only those cells are redrawn. The most
+ * common case is a cursor movement, which changes just two cells.
+ * With --hwcursor the cursor is not drawn into the cells at all but shown on
+ * the cursor plane of the display, so moving it doesn't redraw anything.
+ * Session threads draw from snapshots and always redraw everything.
+ */
+
+struct scan {
+	struct screen *scr;
+	struct screen_damage *dmg;
+	bool cursor;
+	bool found;
+	bool uploaded;
+	unsigned int x;
+	unsigned int y;
+};
+
+static bool attr_equal(const struct tsm_screen_attr *a,
+		       const struct tsm_screen_attr *b)
+{
+	return a->fccode == b->fccode && a->bccode == b->bccode &&
+	       a->fr == b->fr && a->fg == b->fg && a->fb == b->fb &&
+	       a->br == b->br && a->bg == b->bg && a->bb == b->bb &&
+	       a->bold == b->bold && a->italic == b->italic &&
+	       a->underline == b->underline && a->inverse == b->inverse &&
+	       a->protect == b->protect && a->blink == b->blink;
+}
+
+static bool cell_equal(const struct screen_cell *cell, uint64_t id,
+		       unsigned int width, const struct tsm_screen_attr *attr)
+{
+	return cell->id == id && cell->width == width &&
+	       attr_equal(&cell->attr, attr);
+}
+
+static void cell_set(struct screen_cell *cell, uint64_t id,
+		     unsigned int width, const struct tsm_screen_attr *attr)
+{
+	cell->id = id;
+	cell->width = width;
+	cell->attr = *attr;
+}
+
+struct search_draw {
+	struct kmscon_terminal *term;
+	tsm_screen_draw_cb cb;
+	void *data;
+	unsigned int row;
+	struct tsm_screen_attr attr;
+};
+
+/* replaces the last row with the search prompt */
+static int search_draw_cb(struct tsm_screen *con, uint64_t id,
+			  const uint32_t *ch, size_t len, unsigned int width,
+			  unsigned int posx, unsigned int posy,
+			  const struct tsm_screen_attr *attr, tsm_age_t age,
+			  void *data)
 {
+	struct search_draw *sd = data;
+	struct kmscon_terminal *term = sd->term;
+	unsigned int i;
 	int ret;
 
-	if (!scr->term->awake)
+	if (posy != sd->row)
+		return sd->cb(con, id, ch, len, width, posx, posy, attr, age,
+			      sd->data);
+
+	/* cover both columns of wide characters */
+	i = 0;
+	do {
+		if (posx + i < term->prompt_len)
+			ret = sd->cb(con, term->prompt[posx + i],
+				     &term->prompt[posx + i], 1, 1, posx + i,
+				     posy, &sd->attr, age, sd->data);
+		else
+			ret = sd->cb(con, 0, NULL, 0, 1, posx + i, posy,
+				     &sd->attr, age, sd->data);
+	} while (!ret && ++i < width);
+
+	return ret;
+}
+
+/* Draws the console like tsm_screen_draw(). With a compressed history, this
+ * includes the archived lines the user scrolled back to and, while searching,
+ * the search prompt. */
+static void terminal_draw(struct kmscon_terminal *term,
+			  tsm_screen_draw_cb cb, void *data)
+{
+	struct search_draw sd;
+
+	if (term->search_active) {
+		sd.term = term;
+		sd.cb = cb;
+		sd.data = data;
+		sd.row = tsm_screen_get_height(term->console) - 1;
+		tsm_vte_get_def_attr(term->vte, &sd.attr);
+		sd.attr.inverse = 1;
+		cb = search_draw_cb;
+		data = &sd;
+	}
+
+	if (term->history)
+		kmscon_history_draw(term->history, term->console,
+				    term->sb_pos, cb, data);
+	else
+		tsm_screen_draw(term->console, cb, data);
+}
+
+/* forget everything we know about the content of the display */
+static void screen_invalidate(struct screen *scr)
+{
+	scr->valid = false;
+	scr->cursor_valid = false;
+}
+
+static bool screen_use_hwcursor(struct screen *scr)
+{
+	return scr->hwcursor && !scr->term->worker && !scr->term->sb_active;
+}
+
+/* Runs tsm_screen_draw() but keeps libtsm from drawing the cursor if we show
+ * it on the cursor plane. */
+static void screen_draw(struct screen *scr, tsm_screen_draw_cb cb, void *data)
+{
+	struct tsm_screen *con = scr->term->console;
+	bool hide;
+
+	hide = screen_use_hwcursor(scr) &&
+	       !(tsm_screen_get_flags(con) & TSM_SCREEN_HIDE_CURSOR);
+	if (hide)
+		tsm_screen_set_flags(con, TSM_SCREEN_HIDE_CURSOR);
+	terminal_draw(scr->term, cb, data);
+	if (hide)
+		tsm_screen_reset_flags(con, TSM_SCREEN_HIDE_CURSOR);
+}
+
+static uint8_t blend(uint8_t fg, uint8_t bg, unsigned int alpha)
+{
+	return (fg * alpha + bg * (255 - alpha)) / 255;
+}
+
+/* Renders the cell under the cursor inverted, like libtsm does, and uploads it
+ * to the cursor plane. */
+static int cursor_render(struct screen *scr, uint64_t id, const uint32_t *ch,
+			 size_t len, unsigned int width,
+			 const struct tsm_screen_attr *attr)
+{
+	struct kmscon_text *txt = scr->txt;
+	struct uterm_video_buffer *buf = &scr->cursor_buf;
+	const struct kmscon_glyph *glyph;
+	struct kmscon_font *font;
+	unsigned int x, y, w, h, a;
+	uint8_t fr, fg, fb, br, bg, bb;
+	const uint8_t *src;
+	uint32_t *dst;
+	uint8_t *data;
+	size_t size;
+	int ret;
+
+	font = attr->bold ? txt->bold_font : txt->font;
+	font->attr.underline = attr->underline;
+	font->attr.italic = attr->italic;
+
+	if (!len)
+		ret = kmscon_font_render_empty(font, &glyph);
+	else
+		ret = kmscon_font_render(font, id, ch, len, &glyph);
+	if (ret)
+		ret = kmscon_font_render_inval(font, &glyph);
+	if (ret)
+		return ret;
+	if (glyph->buf.format != UTERM_FORMAT_GREY)
+		return -EOPNOTSUPP;
+
+	w = txt->font->attr.width * (width ? width : 1);
+	h = txt->font->attr.height;
+	size = w * h * 4;
+	if (size > scr->cursor_size) {
+		data = realloc(buf->data, size);
+		if (!data)
+			return -ENOMEM;
+		buf->data = data;
+		scr->cursor_size = size;
+	}
+
+	buf->width = w;
+	buf->height = h;
+	buf->stride = w * 4;
+	buf->format = UTERM_FORMAT_XRGB32;
+
+	if (attr->inverse) {
+		fr = attr->fr;
+		fg = attr->fg;
+		fb = attr->fb;
+		br = attr->br;
+		bg = attr->bg;
+		bb = attr->bb;
+	} else {
+		fr = attr->br;
+		fg = attr->bg;
+		fb = attr->bb;
+		br = attr->fr;
+		bg = attr->fg;
+		bb = attr->fb;
+	}
+
+	for (y = 0; y < h; ++y) {
+		dst = (uint32_t*)&buf->data[y * buf->stride];
+		src = NULL;
+		if (y < glyph->buf.height)
+			src = &glyph->buf.data[y * glyph->buf.stride];
+
+		for (x = 0; x < w; ++x) {
+			a = (src && x < glyph->buf.width) ? src[x] : 0;
+			dst[x] = (blend(fr, br, a) << 16) |
+				 (blend(fg, bg, a) << 8) |
+				 blend(fb, bb, a);
+		}
+	}
+
+	return uterm_display_set_cursor(scr->disp, buf);
+}
+
+static int scan_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		   size_t len, unsigned int width, unsigned int posx,
+		   unsigned int posy, const struct tsm_screen_attr *attr,
+		   tsm_age_t age, void *data)
+{
+	struct scan *sc = data;
+	struct screen *scr = sc->scr;
+	struct screen_damage *dmg = sc->dmg;
+	struct screen_cell *cell;
+	unsigned int idx;
+
+	if (posx >= scr->cols || posy >= scr->rows)
+		return 0;
+
+	if (sc->cursor && posx == sc->x && posy == sc->y) {
+		sc->found = true;
+		if (!scr->cursor_valid ||
+		    !cell_equal(&scr->cursor, id, width, attr)) {
+			if (cursor_render(scr, id, ch, len, width, attr)) {
+				scr->cursor_failed = true;
+			} else {
+				cell_set(&scr->cursor, id, width, attr);
+				scr->cursor_valid = true;
+				scr->cursor_shown = true;
+				sc->uploaded = true;
+			}
+		}
+	}
+
+	idx = posy * scr->cols + posx;
+	cell = &scr->cells[idx];
+	if (scr->valid && cell_equal(cell, id, width, attr))
+		return 0;
+
+	cell_set(cell, id, width, attr);
+	if (dmg->full)
+		return 0;
+
+	if (dmg->num >= SCREEN_DAMAGE_MAX)
+		dmg->full = true;
+	else
+		dmg->cells[dmg->num++] = idx;
+
+	return 0;
+}
+
+/*
+ * Compares the console with the cached cells and records the damage of the next
+ * frame in scr->damage[scr->damage_pos]. The hardware cursor is updated, too.
+ * Returns false if the framebuffer doesn't need to be redrawn.
+ */
+static bool screen_scan(struct screen *scr)
+{
+	struct tsm_screen *con = scr->term->console;
+	struct screen_damage *dmg;
+	struct screen_cell *cells;
+	unsigned int cols, rows;
+	struct scan sc;
+	int ret;
+
+	cols = scr->txt->cols;
+	rows = scr->txt->rows;
+	if (!scr->cells || cols != scr->cols || rows != scr->rows) {
+		cells = calloc(cols * rows + 1, sizeof(*cells));
+		if (!cells) {
+			log_warning("cannot allocate cell cache for display %p",
+				    scr->disp);
+			scr->damage[scr->damage_pos].full = true;
+			return true;
+		}
+		free(scr->cells);
+		scr->cells = cells;
+		scr->cols = cols;
+		scr->rows = rows;
+		scr->valid = false;
+	}
+
+	dmg = &scr->damage[scr->damage_pos];
+	dmg->full = !scr->valid;
+	dmg->num = 0;
+
+	memset(&sc, 0, sizeof(sc));
+	sc.scr = scr;
+	sc.dmg = dmg;
+	if (screen_use_hwcursor(scr) &&
+	    !(tsm_screen_get_flags(con) & TSM_SCREEN_HIDE_CURSOR)) {
+		sc.cursor = true;
+		sc.x = tsm_screen_get_cursor_x(con);
+		sc.y = tsm_screen_get_cursor_y(con);
+		if (sc.x >= tsm_screen_get_width(con))
+			sc.x = tsm_screen_get_width(con) - 1;
+	}
+
+	screen_draw(scr, scan_cb, &sc);
+	scr->valid = true;
+
+	if (sc.found && !scr->cursor_failed &&
+	    (sc.uploaded || sc.x != scr->cursor_x || sc.y != scr->cursor_y)) {
+		ret = uterm_display_move_cursor(scr->disp,
+					sc.x * scr->txt->font->attr.width,
+					sc.y * scr->txt->font->attr.height);
+		if (ret)
+			scr->cursor_failed = true;
+		scr->cursor_x = sc.x;
+		scr->cursor_y = sc.y;
+	}
+
+	if (scr->cursor_failed) {
+		log_info("cannot use hardware cursor on display %p, using software cursor",
+			 scr->disp);
+		scr->cursor_failed = false;
+		scr->hwcursor = false;
+		sc.found = false;
+	}
+
+	if (!sc.found && scr->cursor_shown) {
+		uterm_display_set_cursor(scr->disp, NULL);
+		scr->cursor_shown = false;
+		scr->cursor_valid = false;
+	}
+
+	/* the cells were scanned with the hardware cursor hidden; rescan to
+	 * get the software cursor drawn */
+	if (sc.cursor && !scr->hwcursor) {
+		scr->valid = false;
+		return screen_scan(scr);
+	}
+
+	return dmg->full || dmg->num;
+}
+
+static int draw_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		   size_t len, unsigned int width, unsigned int posx,
+		   unsigned int posy, const struct tsm_screen_attr *attr,
+		   tsm_age_t age, void *data)
+{
+	struct screen *scr = data;
+
+	return kmscon_text_draw(scr->txt, id, ch, len, width, posx, posy,
+				attr);
+}
+
+static int draw_dirty_cb(struct tsm_screen *con, uint64_t id,
+			 const uint32_t *ch, size_t len, unsigned int width,
+			 unsigned int posx, unsigned int posy,
+			 const struct tsm_screen_attr *attr, tsm_age_t age,
+			 void *data)
+{
+	struct screen *scr = data;
+	struct screen_cell *cell;
+
+	if (posx >= scr->cols || posy >= scr->rows)
+		return 0;
+
+	cell = &scr->cells[posy * scr->cols + posx];
+	if (!cell->dirty)
+		return 0;
+
+	cell->dirty = false;
+	return kmscon_text_draw(scr->txt, id, ch, len, width, posx, posy,
+				attr);
+}
+
+/* marks all cells that changed during the last @age frames */
+static void screen_mark_dirty(struct screen *scr, unsigned int age)
+{
+	struct screen_damage *dmg;
+	unsigned int i, j;
+
+	for (i = 0; i < age; ++i) {
+		dmg = &scr->damage[(scr->damage_pos + SCREEN_HISTORY - i) %
+				   SCREEN_HISTORY];
+		for (j = 0; j < dmg->num; ++j)
+			scr->cells[dmg->cells[j]].dirty = true;
+	}
+}
+
+static void do_redraw_screen(struct screen *scr)
+{
+	struct kmscon_terminal *term = scr->term;
+	struct screen_damage *dmg = NULL;
+	unsigned int known = 0;
+	uint64_t start = 0;
+	int ret, age = 0;
+
+	if (!term->awake)
 		return;
 
 	scr->pending = false;
-	do_clear_margins(scr);
 
-	kmscon_text_prepare(scr->txt);
-	tsm_screen_draw(scr->term->console, kmscon_text_draw_cb, scr->txt);
-	kmscon_text_render(scr->txt);
+	if (!term->worker) {
+		if (!screen_scan(scr))
+			return;
+
+		dmg = &scr->damage[scr->damage_pos];
+		if (!dmg->full && scr->known < SCREEN_HISTORY)
+			known = scr->known + 1;
+		else if (!dmg->full)
+			known = SCREEN_HISTORY;
+		age = uterm_display_get_age(scr->disp);
+	}
+
+	if (scr->pace_timer)
+		start = pace_now();
+
+	if (age > 0 && age <= known) {
+		screen_mark_dirty(scr, age);
+		kmscon_text_prepare(scr->txt);
+		screen_draw(scr, draw_dirty_cb, scr);
+		kmscon_text_render(scr->txt);
+	} else {
+		do_clear_margins(scr);
+		kmscon_text_prepare(scr->txt);
+		if (term->worker)
+			snapshot_draw(worker_acquire(term->worker), scr->txt);
+		else
+			screen_draw(scr, draw_cb, scr);
+		kmscon_text_render(scr->txt);
+	}
 
 	ret = uterm_display_swap(scr->disp, false);
 	if (ret) {
 		log_warning("cannot swap display %p", scr->disp);
+		screen_invalidate(scr);
 		return;
 	}
 
-	scr->swapping = true;
+	if (dmg) {
+		scr->known = known;
+		scr->damage_pos = (scr->damage_pos + 1) % SCREEN_HISTORY;
+	}
+
+	/* displays with spare buffers accept the next frame right away */
+	scr->swapping = uterm_display_is_swapping(scr->disp);
+
+	/* track the worst-case render time with slow decay */
+	if (start) {
+		start = pace_now() - start;
+		if (start > scr->render_time)
+			scr->render_time = start;
+		else
+			scr->render_time = (scr->render_time * 15 + start) / 16;
+	}
+}
+
+/*
+ * Frame Pacing
+ * Instead of rendering as soon as content changes, we predict the next vblank
+ * from the page-flip timestamps of the display and render as late as possible
+ * before it. Input that arrives in between makes it into the same frame. The
+ * render deadline is the predicted vblank minus the measured render time and a
+ * safety margin. The margin doubles whenever a flip misses its vblank and
+ * slowly decays otherwise.
+ */
+
+#define PACE_MIN_MARGIN 1000ULL
+
+static void pace_timer_event(struct ev_timer *timer, uint64_t num, void *data)
+{
+	struct screen *scr = data;
+
+	scr->paced = false;
+	if (scr->swapping)
+		scr->pending = true;
+	else
+		do_redraw_screen(scr);
+}
+
+static void pace_flip(struct screen *scr)
+{
+	uint64_t time, interval;
+
+	if (!scr->target)
+		return;
+	if (uterm_display_get_vblank(scr->disp, &time, &interval))
+		return;
+
+	if (time > scr->target + interval / 2) {
+		scr->margin *= 2;
+		if (scr->margin > interval / 2)
+			scr->margin = interval / 2;
+		log_debug("missed vblank on display %p, margin now %" PRIu64 "us",
+			  scr->disp, scr->margin);
+	} else if (scr->margin > PACE_MIN_MARGIN) {
+		scr->margin -= scr->margin / 32 + 1;
+	}
+
+	scr->target = 0;
+}
+
+static void schedule_redraw(struct screen *scr)
+{
+	struct itimerspec spec;
+	uint64_t now, time, interval, vblank, deadline;
+
+	if (!scr->pace_timer) {
+		do_redraw_screen(scr);
+		return;
+	}
+	if (scr->paced)
+		return;
+
+	if (uterm_display_get_vblank(scr->disp, &time, &interval)) {
+		do_redraw_screen(scr);
+		return;
+	}
+
+	now = pace_now();
+	if (now < time || now - time > 1000000ULL) {
+		/* timestamps are stale after the display was idle */
+		do_redraw_screen(scr);
+		return;
+	}
+
+	vblank = time + ((now - time) / interval + 1) * interval;
+	deadline = vblank - scr->render_time - scr->margin;
+	if (scr->render_time + scr->margin >= vblank || deadline <= now) {
+		scr->target = vblank;
+		do_redraw_screen(scr);
+		return;
+	}
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = (deadline - now) / 1000000ULL;
+	spec.it_value.tv_nsec = (deadline - now) % 1000000ULL * 1000ULL;
+	if (ev_timer_update(scr->pace_timer, &spec)) {
+		do_redraw_screen(scr);
+		return;
+	}
+
+	scr->target = vblank;
+	scr->paced = true;
 }
 
 static void redraw_screen(struct screen *scr)
@@ -145,7 +891,7 @@ static void redraw_screen(struct screen *scr)
 	if (scr->swapping)
 		scr->pending = true;
 	else
-		do_redraw_screen(scr);
+		schedule_redraw(scr);
 }
 
 static void redraw_all(struct kmscon_terminal *term)
@@ -162,6 +908,18 @@ static void redraw_all(struct kmscon_terminal *term)
 	}
 }
 
+/*
+ * Redraw after the console content changed. With session threads, the worker
+ * has to create a new snapshot first; it notifies us when it is ready.
+ */
+static void terminal_update(struct kmscon_terminal *term)
+{
+	if (term->worker)
+		ev_counter_inc(term->worker->kick, 1);
+	else
+		redraw_all(term);
+}
+
 static void redraw_all_test(struct kmscon_terminal *term)
 {
 	struct shl_dlist *iter;
@@ -174,6 +932,7 @@ static void redraw_all_test(struct kmscon_terminal *term)
 		scr = shl_dlist_entry(iter, struct screen, list);
 		if (uterm_display_is_swapping(scr->disp))
 			scr->swapping = true;
+		screen_invalidate(scr);
 		redraw_screen(scr);
 	}
 }
@@ -183,12 +942,22 @@ static void display_event(struct uterm_display *disp,
 {
 	struct screen *scr = data;
 
+	if (ev->action == UTERM_SWAP_ABORTED) {
+		/* the display rolled back its buffers, nothing is known */
+		scr->swapping = false;
+		screen_invalidate(scr);
+		schedule_redraw(scr);
+		return;
+	}
+
 	if (ev->action != UTERM_PAGE_FLIP)
 		return;
 
 	scr->swapping = false;
+	if (scr->pace_timer)
+		pace_flip(scr);
 	if (scr->pending)
-		do_redraw_screen(scr);
+		schedule_redraw(scr);
 }
 
 /*
@@ -224,55 +993,232 @@ static void terminal_resize(struct kmscon_terminal *term,
 	if (!term->min_cols || !term->min_rows)
 		return;
 
+	terminal_lock(term);
 	tsm_screen_resize(term->console, term->min_cols, term->min_rows);
 	kmscon_pty_resize(term->pty, term->min_cols, term->min_rows);
-	redraw_all(term);
+	terminal_unlock(term);
+	terminal_update(term);
 }
 
-static int font_set(struct kmscon_terminal *term)
+/* recompute the terminal size from the cell grids of all screens */
+static void terminal_refit(struct kmscon_terminal *term)
 {
-	int ret;
-	struct kmscon_font *font, *bold_font;
 	struct shl_dlist *iter;
 	struct screen *ent;
 
-	term->font_attr.bold = false;
-	ret = kmscon_font_find(&font, &term->font_attr,
-			       term->conf->font_engine);
+	term->min_cols = 0;
+	term->min_rows = 0;
+	shl_dlist_for_each(iter, &term->screens) {
+		ent = shl_dlist_entry(iter, struct screen, list);
+		terminal_resize(term,
+				kmscon_text_get_cols(ent->txt),
+				kmscon_text_get_rows(ent->txt),
+				false, false);
+	}
+
+	terminal_resize(term, 0, 0, true, true);
+}
+
+static int font_find(struct kmscon_terminal *term,
+		     const struct kmscon_font_attr *attr,
+		     struct kmscon_font **font, struct kmscon_font **bold_font)
+{
+	struct kmscon_font_attr a = *attr;
+	int ret;
+
+	a.bold = false;
+	ret = kmscon_font_find(font, &a, term->conf->font_engine);
 	if (ret)
 		return ret;
 
-	term->font_attr.bold = true;
-	ret = kmscon_font_find(&bold_font, &term->font_attr,
-			       term->conf->font_engine);
+	a.bold = true;
+	ret = kmscon_font_find(bold_font, &a, term->conf->font_engine);
 	if (ret) {
 		log_warning("cannot create bold font: %d", ret);
-		bold_font = font;
-		kmscon_font_ref(bold_font);
+		*bold_font = *font;
+		kmscon_font_ref(*bold_font);
 	}
 
+	return 0;
+}
+
+static void zoom_drop(struct kmscon_terminal *term, unsigned int i)
+{
+	struct shl_dlist *iter;
+	struct screen *ent;
+
+	shl_dlist_for_each(iter, &term->screens) {
+		ent = shl_dlist_entry(iter, struct screen, list);
+		kmscon_text_unref(ent->zoom_txt[i]);
+		ent->zoom_txt[i] = NULL;
+	}
+
+	kmscon_font_unref(term->zoom[i].bold_font);
+	kmscon_font_unref(term->zoom[i].font);
+	memset(&term->zoom[i], 0, sizeof(term->zoom[i]));
+}
+
+static void zoom_flush(struct kmscon_terminal *term)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZOOM_CACHE; ++i)
+		zoom_drop(term, i);
+}
+
+static void screen_zoom_flush(struct screen *scr)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZOOM_CACHE; ++i) {
+		kmscon_text_unref(scr->zoom_txt[i]);
+		scr->zoom_txt[i] = NULL;
+	}
+}
+
+static int font_set(struct kmscon_terminal *term)
+{
+	int ret;
+	struct kmscon_font *font, *bold_font;
+	struct shl_dlist *iter;
+	struct screen *ent;
+
+	ret = font_find(term, &term->font_attr, &font, &bold_font);
+	if (ret)
+		return ret;
+
+	zoom_flush(term);
 	kmscon_font_unref(term->bold_font);
 	kmscon_font_unref(term->font);
 	term->font = font;
 	term->bold_font = bold_font;
 
-	term->min_cols = 0;
-	term->min_rows = 0;
 	shl_dlist_for_each(iter, &term->screens) {
 		ent = shl_dlist_entry(iter, struct screen, list);
+		screen_invalidate(ent);
+
+		/* trimmed screens get the new font in screen_restore() */
+		if (ent->trimmed)
+			continue;
 
 		ret = kmscon_text_set(ent->txt, font, bold_font, ent->disp);
 		if (ret)
 			log_warning("cannot change text-renderer font: %d",
 				    ret);
+	}
 
-		terminal_resize(term,
-				kmscon_text_get_cols(ent->txt),
-				kmscon_text_get_rows(ent->txt),
-				false, false);
+	terminal_refit(term);
+	return 0;
+}
+
+static const char *screen_engine(struct screen *scr)
+{
+	int ret;
+	bool opengl;
+
+	ret = uterm_display_use(scr->disp, &opengl);
+	if (scr->term->conf->render_engine)
+		return scr->term->conf->render_engine;
+	else if (ret >= 0 && opengl)
+		return "gltex";
+	else
+		return "bbulk";
+}
+
+/*
+ * Font Zoom
+ * Changing the font size normally throws away all glyph caches and renderer
+ * state. Instead, the fonts of the last ZOOM_CACHE sizes are kept in
+ * term->zoom together with a text-renderer per screen, which still holds its
+ * glyph cache and atlases. Zooming to a cached size just swaps these objects
+ * with the current ones. Trimmed screens do not cache anything. The least
+ * recently used size is dropped when a new one is needed.
+ */
+
+static int zoom_set(struct kmscon_terminal *term, unsigned int points)
+{
+	struct shl_dlist *iter;
+	struct screen *scr;
+	struct kmscon_font_attr attr;
+	struct kmscon_font *font, *bold_font;
+	struct kmscon_text *txt;
+	struct zoom_entry *z;
+	unsigned int i, slot;
+	bool hit = false;
+	int ret;
+
+	if (points == term->font_attr.points)
+		return 0;
+
+	slot = 0;
+	for (i = 0; i < ZOOM_CACHE; ++i) {
+		if (term->zoom[i].points == points) {
+			slot = i;
+			hit = true;
+			break;
+		}
+		if (term->zoom[i].used < term->zoom[slot].used)
+			slot = i;
 	}
 
-	terminal_resize(term, 0, 0, true, true);
+	z = &term->zoom[slot];
+	if (hit) {
+		font = z->font;
+		bold_font = z->bold_font;
+	} else {
+		attr = term->font_attr;
+		attr.points = points;
+		ret = font_find(term, &attr, &font, &bold_font);
+		if (ret)
+			return ret;
+		zoom_drop(term, slot);
+	}
+
+	log_debug("zoom to %u points (%s)", points, hit ? "cached" : "new");
+
+	/* the current size takes the place of the one we switch to */
+	z->points = term->font_attr.points;
+	z->used = ++term->zoom_tick;
+	z->font = term->font;
+	z->bold_font = term->bold_font;
+	term->font = font;
+	term->bold_font = bold_font;
+	term->font_attr.points = points;
+
+	shl_dlist_for_each(iter, &term->screens) {
+		scr = shl_dlist_entry(iter, struct screen, list);
+		screen_invalidate(scr);
+		if (scr->trimmed)
+			continue;
+
+		txt = scr->zoom_txt[slot];
+		scr->zoom_txt[slot] = NULL;
+		if (!txt) {
+			ret = kmscon_text_new(&txt, screen_engine(scr));
+			if (!ret) {
+				ret = kmscon_text_set(txt, font, bold_font,
+						      scr->disp);
+				if (ret) {
+					kmscon_text_unref(txt);
+					txt = NULL;
+				}
+			}
+		}
+
+		if (txt) {
+			scr->zoom_txt[slot] = scr->txt;
+			scr->txt = txt;
+			continue;
+		}
+
+		/* fall back to re-using the current renderer uncached */
+		ret = kmscon_text_set(scr->txt, font, bold_font, scr->disp);
+		if (ret)
+			log_warning("cannot change text-renderer font: %d",
+				    ret);
+	}
+
+	terminal_refit(term);
 	return 0;
 }
 
@@ -281,8 +1227,6 @@ static int add_display(struct kmscon_terminal *term, struct uterm_display *disp)
 	struct shl_dlist *iter;
 	struct screen *scr;
 	int ret;
-	const char *be;
-	bool opengl;
 
 	shl_dlist_for_each(iter, &term->screens) {
 		scr = shl_dlist_entry(iter, struct screen, list);
@@ -298,6 +1242,7 @@ static int add_display(struct kmscon_terminal *term, struct uterm_display *disp)
 	memset(scr, 0, sizeof(*scr));
 	scr->term = term;
 	scr->disp = disp;
+	scr->hwcursor = term->conf->hwcursor;
 
 	ret = uterm_display_register_cb(scr->disp, display_event, scr);
 	if (ret) {
@@ -305,18 +1250,20 @@ static int add_display(struct kmscon_terminal *term, struct uterm_display *disp)
 		goto err_free;
 	}
 
-	ret = uterm_display_use(scr->disp, &opengl);
-	if (term->conf->render_engine)
-		be = term->conf->render_engine;
-	else if (ret >= 0 && opengl)
-		be = "gltex";
-	else
-		be = "bbulk";
+	if (term->conf->frame_pacing) {
+		ret = ev_eloop_new_timer(term->eloop, &scr->pace_timer, NULL,
+					 pace_timer_event, scr);
+		if (ret) {
+			log_error("cannot create frame-pacing timer: %d", ret);
+			goto err_cb;
+		}
+		scr->margin = PACE_MIN_MARGIN;
+	}
 
-	ret = kmscon_text_new(&scr->txt, be);
+	ret = kmscon_text_new(&scr->txt, screen_engine(scr));
 	if (ret) {
 		log_error("cannot create text-renderer");
-		goto err_cb;
+		goto err_timer;
 	}
 
 	ret = kmscon_text_set(scr->txt, term->font, term->bold_font,
@@ -340,6 +1287,8 @@ static int add_display(struct kmscon_terminal *term, struct uterm_display *disp)
 
 err_text:
 	kmscon_text_unref(scr->txt);
+err_timer:
+	ev_eloop_rm_timer(scr->pace_timer);
 err_cb:
 	uterm_display_unregister_cb(scr->disp, display_event, scr);
 err_free:
@@ -347,99 +1296,486 @@ err_free:
 	return ret;
 }
 
-static void free_screen(struct screen *scr, bool update)
+static void free_screen(struct screen *scr, bool update)
+{
+	struct kmscon_terminal *term = scr->term;
+
+	log_debug("destroying terminal screen %p", scr);
+	shl_dlist_unlink(&scr->list);
+	if (scr->cursor_shown)
+		uterm_display_set_cursor(scr->disp, NULL);
+	screen_zoom_flush(scr);
+	kmscon_text_unref(scr->txt);
+	ev_eloop_rm_timer(scr->pace_timer);
+	uterm_display_unregister_cb(scr->disp, display_event, scr);
+	uterm_display_unref(scr->disp);
+	free(scr->cursor_buf.data);
+	free(scr->cells);
+	free(scr);
+
+	if (update)
+		terminal_refit(term);
+}
+
+/*
+ * Idle Trimming
+ * Screens of sessions that were hidden for a while drop their text-renderer
+ * state (glyph caches, atlases, shadow buffers) together with our own damage
+ * and cursor caches. Everything is recreated when the session is activated
+ * again. Hidden sessions never render, so nothing touches the unset renderer
+ * in between.
+ */
+
+static void screen_trim(struct screen *scr)
+{
+	if (scr->trimmed)
+		return;
+
+	log_debug("trimming terminal screen %p", scr);
+	screen_zoom_flush(scr);
+	kmscon_text_unset(scr->txt);
+	free(scr->cells);
+	scr->cells = NULL;
+	free(scr->cursor_buf.data);
+	scr->cursor_buf.data = NULL;
+	scr->cursor_size = 0;
+	screen_invalidate(scr);
+	scr->trimmed = true;
+}
+
+static void screen_restore(struct screen *scr)
+{
+	struct kmscon_terminal *term = scr->term;
+	int ret;
+
+	if (!scr->trimmed)
+		return;
+
+	ret = kmscon_text_set(scr->txt, term->font, term->bold_font,
+			      scr->disp);
+	if (ret)
+		log_warning("cannot restore text-renderer of screen %p: %d",
+			    scr, ret);
+	scr->trimmed = false;
+}
+
+/* libtsm doesn't export the line count of its scrollback, so we report what
+ * a full scrollback of the current width would use */
+#define SB_CELL_SIZE (sizeof(uint32_t) * 3 + sizeof(struct tsm_screen_attr))
+
+static void terminal_get_memory(struct kmscon_terminal *term,
+				struct kmscon_session_memory *mem)
+{
+	struct shl_dlist *iter;
+	struct screen *scr;
+	size_t cols, rows;
+	unsigned int i;
+
+	shl_dlist_for_each(iter, &term->screens) {
+		scr = shl_dlist_entry(iter, struct screen, list);
+		mem->text += kmscon_text_get_memory(scr->txt);
+		for (i = 0; i < ZOOM_CACHE; ++i)
+			mem->text += kmscon_text_get_memory(scr->zoom_txt[i]);
+		mem->screen += sizeof(*scr) + scr->cursor_size;
+		if (scr->cells)
+			mem->screen += sizeof(*scr->cells) *
+				       (scr->cols * scr->rows + 1);
+	}
+
+	terminal_lock(term);
+	cols = tsm_screen_get_width(term->console);
+	rows = tsm_screen_get_height(term->console);
+	mem->screen += cols * rows * SB_CELL_SIZE;
+	if (term->history)
+		mem->scrollback += kmscon_history_get_memory(term->history);
+	else
+		mem->scrollback += term->conf->sb_size * cols * SB_CELL_SIZE;
+	mem->pty += kmscon_pty_get_memory(term->pty);
+	terminal_unlock(term);
+}
+
+static void rm_display(struct kmscon_terminal *term, struct uterm_display *disp)
+{
+	struct shl_dlist *iter;
+	struct screen *scr;
+
+	shl_dlist_for_each(iter, &term->screens) {
+		scr = shl_dlist_entry(iter, struct screen, list);
+		if (scr->disp == disp)
+			break;
+	}
+
+	if (iter == &term->screens)
+		return;
+
+	log_debug("removed display %p from terminal %p", disp, term);
+	free_screen(scr, true);
+}
+
+static void flush_output(struct kmscon_terminal *term)
+{
+	if (!term->out_len)
+		return;
+
+	kmscon_pty_write(term->pty, term->out_buf, term->out_len);
+	term->out_len = 0;
+}
+
+/*
+ * All data for the child is collected in @out_buf and written with a single
+ * write() at the end of the current eloop iteration. This way, bursts of
+ * keyboard input (eg., pasted or injected by KVMs) don't cause one syscall per
+ * key. Data that doesn't fit into the buffer is written directly.
+ */
+static void term_write(struct kmscon_terminal *term, const char *u8,
+		       size_t len)
+{
+	if (term->out_len + len > sizeof(term->out_buf))
+		flush_output(term);
+
+	if (len > sizeof(term->out_buf)) {
+		kmscon_pty_write(term->pty, u8, len);
+		return;
+	}
+
+	memcpy(&term->out_buf[term->out_len], u8, len);
+	term->out_len += len;
+}
+
+static void post_event(struct ev_eloop *eloop, void *unused, void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	if (!term->worker) {
+		flush_output(term);
+		return;
+	}
+
+	/* If the worker holds the lock, it is dispatching and flushes the
+	 * output itself afterwards. Never block the main loop on it. */
+	if (pthread_mutex_trylock(&term->worker->lock))
+		return;
+
+	flush_output(term);
+	pthread_mutex_unlock(&term->worker->lock);
+}
+
+static void write_key_seq(struct kmscon_terminal *term, unsigned int repeats)
+{
+	char buf[sizeof(term->key_seq) * UTERM_INPUT_MAX_REPEATS];
+	size_t len = term->key_seq_len;
+	unsigned int i;
+
+	if (!len)
+		return;
+	if (repeats > UTERM_INPUT_MAX_REPEATS)
+		repeats = UTERM_INPUT_MAX_REPEATS;
+
+	for (i = 0; i < repeats; ++i)
+		memcpy(&buf[i * len], term->key_seq, len);
+
+	term_write(term, buf, len * repeats);
+}
+
+static void sb_up(struct kmscon_terminal *term, unsigned int num)
+{
+	unsigned int count;
+
+	if (!term->history) {
+		tsm_screen_sb_up(term->console, num);
+		return;
+	}
+
+	count = kmscon_history_get_count(term->history);
+	if (num > count - term->sb_pos)
+		term->sb_pos = count;
+	else
+		term->sb_pos += num;
+}
+
+static void sb_down(struct kmscon_terminal *term, unsigned int num)
+{
+	if (!term->history) {
+		tsm_screen_sb_down(term->console, num);
+		return;
+	}
+
+	if (num > term->sb_pos)
+		term->sb_pos = 0;
+	else
+		term->sb_pos -= num;
+}
+
+static unsigned int sb_page(struct kmscon_terminal *term, unsigned int num)
+{
+	return num * tsm_screen_get_height(term->console);
+}
+
+/*
+ * Scroll-back Search
+ * The search grab opens a prompt on the last row. Each change of the pattern
+ * restarts the search at the bottom of the history and pressing the grab
+ * again continues with the next older match. The view is scrolled so the
+ * matching line is the top row. Tab toggles between substring and regex
+ * search, Return leaves the view at the match and Escape restores it.
+ * Searches run in steps of SEARCH_STEP lines from an idle callback, so slow
+ * regex searches through a long history never stall other sessions.
+ */
+
+#define SEARCH_STEP 4096
+
+static void search_step(struct ev_eloop *eloop, void *unused, void *data);
+
+static void search_stop(struct kmscon_terminal *term)
+{
+	if (!term->search_running)
+		return;
+
+	ev_eloop_unregister_idle_cb(term->eloop, search_step, term, EV_SINGLE);
+	term->search_running = false;
+}
+
+static void search_set_prompt(struct kmscon_terminal *term)
+{
+	const unsigned int max = sizeof(term->prompt) / sizeof(*term->prompt);
+	const char *prefix, *status;
+	unsigned int i, n = 0;
+
+	prefix = term->search_regex ? "Regex search: " : "Search: ";
+	switch (term->search_result) {
+	case -EAGAIN:
+		status = "  [searching]";
+		break;
+	case -ENOENT:
+		status = "  [not found]";
+		break;
+	case -EINVAL:
+		status = "  [invalid pattern]";
+		break;
+	default:
+		status = "";
+		break;
+	}
+
+	for (i = 0; prefix[i] && n < max; ++i)
+		term->prompt[n++] = prefix[i];
+	for (i = 0; i < term->search_len && n < max; ++i)
+		term->prompt[n++] = term->search_buf[i];
+	for (i = 0; status[i] && n < max; ++i)
+		term->prompt[n++] = status[i];
+
+	term->prompt_len = n;
+}
+
+static void search_finish(struct kmscon_terminal *term, int ret)
+{
+	search_stop(term);
+	term->search_result = ret;
+	if (!ret)
+		term->sb_pos = kmscon_history_get_end(term->history) -
+			       term->search_line;
+	search_set_prompt(term);
+}
+
+static void search_run(struct kmscon_terminal *term)
+{
+	int ret;
+
+	ret = kmscon_history_search(term->history, term->search_query,
+				    &term->search_line, SEARCH_STEP);
+	if (ret != -EAGAIN) {
+		search_finish(term, ret);
+		return;
+	}
+
+	if (!term->search_running) {
+		ret = ev_eloop_register_idle_cb(term->eloop, search_step, term,
+						EV_SINGLE);
+		if (ret) {
+			log_warning("cannot continue scroll-back search (%d)",
+				    ret);
+			search_finish(term, ret);
+			return;
+		}
+		term->search_running = true;
+	}
+
+	term->search_result = -EAGAIN;
+	search_set_prompt(term);
+}
+
+static void search_step(struct ev_eloop *eloop, void *unused, void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	terminal_lock(term);
+	search_run(term);
+	terminal_unlock(term);
+	terminal_update(term);
+}
+
+/* the pattern changed, start over at the bottom */
+static void search_update(struct kmscon_terminal *term)
 {
-	struct shl_dlist *iter;
-	struct screen *ent;
-	struct kmscon_terminal *term = scr->term;
+	int ret;
 
-	log_debug("destroying terminal screen %p", scr);
-	shl_dlist_unlink(&scr->list);
-	kmscon_text_unref(scr->txt);
-	uterm_display_unregister_cb(scr->disp, display_event, scr);
-	uterm_display_unref(scr->disp);
-	free(scr);
+	search_stop(term);
+	kmscon_history_query_free(term->search_query);
+	term->search_query = NULL;
+	term->search_result = 0;
+	term->sb_pos = term->search_saved_pos;
 
-	if (!update)
+	if (!term->search_len) {
+		search_set_prompt(term);
 		return;
+	}
 
-	term->min_cols = 0;
-	term->min_rows = 0;
-	shl_dlist_for_each(iter, &term->screens) {
-		ent = shl_dlist_entry(iter, struct screen, list);
-		terminal_resize(term,
-				kmscon_text_get_cols(ent->txt),
-				kmscon_text_get_rows(ent->txt),
-				false, false);
+	ret = kmscon_history_query_new(&term->search_query, term->search_buf,
+				       term->search_len, term->search_regex);
+	if (ret) {
+		search_finish(term, ret);
+		return;
 	}
 
-	terminal_resize(term, 0, 0, true, true);
+	term->search_line = kmscon_history_get_end(term->history);
+	search_run(term);
 }
 
-static void rm_display(struct kmscon_terminal *term, struct uterm_display *disp)
+static void search_start(struct kmscon_terminal *term)
 {
-	struct shl_dlist *iter;
-	struct screen *scr;
+	term->search_active = true;
+	term->search_len = 0;
+	term->search_result = 0;
+	term->search_saved_pos = term->sb_pos;
+	term->sb_active = true;
+	search_set_prompt(term);
+}
 
-	shl_dlist_for_each(iter, &term->screens) {
-		scr = shl_dlist_entry(iter, struct screen, list);
-		if (scr->disp == disp)
-			break;
+static void search_next(struct kmscon_terminal *term)
+{
+	if (term->search_query && !term->search_result)
+		search_run(term);
+}
+
+static void search_end(struct kmscon_terminal *term, bool keep)
+{
+	search_stop(term);
+	kmscon_history_query_free(term->search_query);
+	term->search_query = NULL;
+	term->search_active = false;
+
+	if (!keep)
+		term->sb_pos = term->search_saved_pos;
+	term->sb_active = term->sb_pos > 0;
+}
+
+static void search_input(struct kmscon_terminal *term,
+			 struct uterm_input_event *ev)
+{
+	uint32_t cp;
+
+	ev->handled = true;
+	term->input_redraw = true;
+	if (ev->num_syms != 1)
+		return;
+
+	switch (ev->keysyms[0]) {
+	case XKB_KEY_Escape:
+		search_end(term, false);
+		return;
+	case XKB_KEY_Return:
+	case XKB_KEY_KP_Enter:
+		search_end(term, true);
+		return;
+	case XKB_KEY_Tab:
+		term->search_regex = !term->search_regex;
+		search_update(term);
+		return;
+	case XKB_KEY_BackSpace:
+		if (term->search_len) {
+			--term->search_len;
+			search_update(term);
+		}
+		return;
 	}
 
-	if (iter == &term->screens)
+	if (ev->mods & (SHL_CONTROL_MASK | SHL_ALT_MASK | SHL_LOGO_MASK))
 		return;
 
-	log_debug("removed display %p from terminal %p", disp, term);
-	free_screen(scr, true);
+	cp = ev->codepoints[0];
+	if (cp == UTERM_INPUT_INVALID || cp < 0x20 ||
+	    term->search_len >= sizeof(term->search_buf) /
+				sizeof(*term->search_buf))
+		return;
+
+	term->search_buf[term->search_len++] = cp;
+	search_update(term);
 }
 
-static void input_event(struct uterm_input *input,
-			struct uterm_input_event *ev,
-			void *data)
+static void handle_input(struct kmscon_terminal *term,
+			 struct uterm_input_event *ev)
 {
-	struct kmscon_terminal *term = data;
-
 	if (!term->opened || !term->awake || ev->handled)
 		return;
 
 	if (conf_grab_matches(term->conf->grab_scroll_up,
 			      ev->mods, ev->num_syms, ev->keysyms)) {
-		tsm_screen_sb_up(term->console, 1);
-		redraw_all(term);
+		sb_up(term, ev->repeats);
+		term->sb_active = true;
+		term->input_redraw = true;
 		ev->handled = true;
 		return;
 	}
 	if (conf_grab_matches(term->conf->grab_scroll_down,
 			      ev->mods, ev->num_syms, ev->keysyms)) {
-		tsm_screen_sb_down(term->console, 1);
-		redraw_all(term);
+		sb_down(term, ev->repeats);
+		term->input_redraw = true;
 		ev->handled = true;
 		return;
 	}
 	if (conf_grab_matches(term->conf->grab_page_up,
 			      ev->mods, ev->num_syms, ev->keysyms)) {
-		tsm_screen_sb_page_up(term->console, 1);
-		redraw_all(term);
+		if (term->history)
+			sb_up(term, sb_page(term, ev->repeats));
+		else
+			tsm_screen_sb_page_up(term->console, ev->repeats);
+		term->sb_active = true;
+		term->input_redraw = true;
 		ev->handled = true;
 		return;
 	}
 	if (conf_grab_matches(term->conf->grab_page_down,
 			      ev->mods, ev->num_syms, ev->keysyms)) {
-		tsm_screen_sb_page_down(term->console, 1);
-		redraw_all(term);
+		if (term->history)
+			sb_down(term, sb_page(term, ev->repeats));
+		else
+			tsm_screen_sb_page_down(term->console, ev->repeats);
+		term->input_redraw = true;
+		ev->handled = true;
+		return;
+	}
+	if (term->history &&
+	    conf_grab_matches(term->conf->grab_search,
+			      ev->mods, ev->num_syms, ev->keysyms)) {
+		if (term->search_active)
+			search_next(term);
+		else
+			search_start(term);
+		term->input_redraw = true;
 		ev->handled = true;
 		return;
 	}
+	if (term->search_active) {
+		search_input(term, ev);
+		return;
+	}
 	if (conf_grab_matches(term->conf->grab_zoom_in,
 			      ev->mods, ev->num_syms, ev->keysyms)) {
 		ev->handled = true;
 		if (term->font_attr.points + 1 < term->font_attr.points)
 			return;
 
-		++term->font_attr.points;
-		if (font_set(term))
-			--term->font_attr.points;
+		zoom_set(term, term->font_attr.points + 1);
 		return;
 	}
 	if (conf_grab_matches(term->conf->grab_zoom_out,
@@ -448,9 +1784,7 @@ static void input_event(struct uterm_input *input,
 		if (term->font_attr.points <= 1)
 			return;
 
-		--term->font_attr.points;
-		if (font_set(term))
-			++term->font_attr.points;
+		zoom_set(term, term->font_attr.points - 1);
 		return;
 	}
 
@@ -460,12 +1794,293 @@ static void input_event(struct uterm_input *input,
 	if (ev->num_syms > 1)
 		return;
 
+	/* Batched key-repeats: capture the sequence that the VTE generates
+	 * for a single key-press and write it @repeats times at once. */
+	term->key_capture = ev->repeats > 1;
+	term->key_seq_len = 0;
+
 	if (tsm_vte_handle_keyboard(term->vte, ev->keysyms[0], ev->ascii,
 				    ev->mods, ev->codepoints[0])) {
+		if (term->key_capture)
+			write_key_seq(term, ev->repeats);
 		tsm_screen_sb_reset(term->console);
-		redraw_all(term);
+		term->sb_pos = 0;
+		term->sb_active = false;
+		term->input_redraw = true;
 		ev->handled = true;
 	}
+
+	term->key_capture = false;
+}
+
+static void input_event(struct uterm_input *input,
+			struct uterm_input_event *ev,
+			void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	terminal_lock(term);
+	handle_input(term, ev);
+	terminal_unlock(term);
+}
+
+static void input_batch(struct uterm_input *input, void *unused, void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	if (!term->input_redraw)
+		return;
+
+	term->input_redraw = false;
+	terminal_update(term);
+}
+
+static int snapshot_init(struct snapshot *snap)
+{
+	int ret;
+
+	ret = shl_array_new(&snap->cells, sizeof(struct snapshot_cell), 1024);
+	if (ret)
+		return ret;
+
+	ret = shl_array_new(&snap->chars, sizeof(uint32_t), 1024);
+	if (ret) {
+		shl_array_free(snap->cells);
+		return ret;
+	}
+
+	return 0;
+}
+
+static void snapshot_destroy(struct snapshot *snap)
+{
+	shl_array_free(snap->chars);
+	shl_array_free(snap->cells);
+}
+
+static int snapshot_draw_cb(struct tsm_screen *con,
+			    uint64_t id, const uint32_t *ch, size_t len,
+			    unsigned int width,
+			    unsigned int posx, unsigned int posy,
+			    const struct tsm_screen_attr *attr,
+			    tsm_age_t age, void *data)
+{
+	struct snapshot *snap = data;
+	struct snapshot_cell cell;
+	size_t i;
+	int ret;
+
+	cell.id = id;
+	cell.ch = shl_array_get_length(snap->chars);
+	cell.len = len;
+	cell.width = width;
+	cell.posx = posx;
+	cell.posy = posy;
+	cell.attr = *attr;
+
+	for (i = 0; i < len; ++i) {
+		ret = shl_array_push(snap->chars, &ch[i]);
+		if (ret)
+			return ret;
+	}
+
+	return shl_array_push(snap->cells, &cell);
+}
+
+/*
+ * Create a new snapshot of the console and hand it to the main thread. If the
+ * main thread didn't pick up the previous snapshot, yet, we skip this one and
+ * mark the worker as stale. worker_acquire() kicks us again in this case.
+ * Must be called from the worker thread with the lock held.
+ */
+static void worker_publish(struct kmscon_terminal *term)
+{
+	struct worker *w = term->worker;
+	struct snapshot *snap;
+
+	w->changed = false;
+
+	__atomic_store_n(&w->stale, true, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->ready, __ATOMIC_SEQ_CST) & WORKER_DIRTY)
+		return;
+	__atomic_store_n(&w->stale, false, __ATOMIC_SEQ_CST);
+
+	snap = &w->snaps[w->back];
+	shl_array_zresize(snap->cells, 0);
+	shl_array_zresize(snap->chars, 0);
+	tsm_vte_get_def_attr(term->vte, &snap->def_attr);
+	terminal_draw(term, snapshot_draw_cb, snap);
+
+	w->back = __atomic_exchange_n(&w->ready, w->back | WORKER_DIRTY,
+				      __ATOMIC_SEQ_CST) & ~WORKER_DIRTY;
+	ev_counter_inc(w->notify, 1);
+}
+
+static void worker_pty_event(struct ev_fd *fd, int mask, void *data)
+{
+	struct kmscon_terminal *term = data;
+	struct worker *w = term->worker;
+
+	pthread_mutex_lock(&w->lock);
+	kmscon_pty_dispatch(term->pty);
+	if (w->changed)
+		worker_publish(term);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void worker_kick(struct ev_counter *cnt, uint64_t num, void *data)
+{
+	struct kmscon_terminal *term = data;
+	struct worker *w = term->worker;
+
+	if (__atomic_load_n(&w->exit, __ATOMIC_SEQ_CST)) {
+		ev_eloop_exit(w->eloop);
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	worker_publish(term);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void worker_post(struct ev_eloop *eloop, void *unused, void *data)
+{
+	struct kmscon_terminal *term = data;
+	struct worker *w = term->worker;
+
+	pthread_mutex_lock(&w->lock);
+	flush_output(term);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void worker_notify(struct ev_counter *cnt, uint64_t num, void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	redraw_all(term);
+}
+
+static void *worker_run(void *data)
+{
+	struct kmscon_terminal *term = data;
+	sigset_t mask;
+
+	/* signals are dispatched by the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	ev_eloop_run(term->worker->eloop, -1);
+	return NULL;
+}
+
+static int worker_start(struct kmscon_terminal *term)
+{
+	struct worker *w;
+	pthread_mutexattr_t attr;
+	unsigned int i;
+	int ret;
+
+	w = malloc(sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+	memset(w, 0, sizeof(*w));
+	w->front = 0;
+	w->back = 1;
+	w->ready = 2;
+
+	/* the main thread may re-enter while resizing from an input grab */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	ret = -pthread_mutex_init(&w->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	if (ret)
+		goto err_free;
+
+	for (i = 0; i < 3; ++i) {
+		ret = snapshot_init(&w->snaps[i]);
+		if (ret)
+			goto err_snaps;
+	}
+
+	ret = ev_eloop_new(&w->eloop, log_llog, NULL);
+	if (ret)
+		goto err_snaps;
+
+	ret = ev_eloop_new_fd(w->eloop, &term->ptyfd,
+			      kmscon_pty_get_fd(term->pty),
+			      EV_READABLE, worker_pty_event, term);
+	if (ret)
+		goto err_eloop;
+
+	ret = ev_eloop_new_counter(w->eloop, &w->kick, worker_kick, term);
+	if (ret)
+		goto err_ptyfd;
+
+	ret = ev_eloop_register_post_cb(w->eloop, worker_post, term);
+	if (ret)
+		goto err_kick;
+
+	ret = ev_eloop_new_counter(term->eloop, &w->notify, worker_notify,
+				   term);
+	if (ret)
+		goto err_post;
+
+	term->worker = w;
+	worker_publish(term);
+
+	ret = -pthread_create(&w->thread, NULL, worker_run, term);
+	if (ret) {
+		log_error("cannot create worker thread: %d", ret);
+		goto err_notify;
+	}
+
+	log_debug("started worker thread for terminal %p", term);
+	return 0;
+
+err_notify:
+	term->worker = NULL;
+	ev_eloop_rm_counter(w->notify);
+err_post:
+	ev_eloop_unregister_post_cb(w->eloop, worker_post, term);
+err_kick:
+	ev_eloop_rm_counter(w->kick);
+err_ptyfd:
+	ev_eloop_rm_fd(term->ptyfd);
+	term->ptyfd = NULL;
+err_eloop:
+	ev_eloop_unref(w->eloop);
+err_snaps:
+	while (i--)
+		snapshot_destroy(&w->snaps[i]);
+	pthread_mutex_destroy(&w->lock);
+err_free:
+	free(w);
+	return ret;
+}
+
+static void worker_stop(struct kmscon_terminal *term)
+{
+	struct worker *w = term->worker;
+	unsigned int i;
+
+	__atomic_store_n(&w->exit, true, __ATOMIC_SEQ_CST);
+	ev_counter_inc(w->kick, 1);
+	pthread_join(w->thread, NULL);
+
+	term->worker = NULL;
+	ev_eloop_rm_counter(w->notify);
+	ev_eloop_unregister_post_cb(w->eloop, worker_post, term);
+	ev_eloop_rm_counter(w->kick);
+	ev_eloop_rm_fd(term->ptyfd);
+	term->ptyfd = NULL;
+	ev_eloop_unref(w->eloop);
+
+	for (i = 0; i < 3; ++i)
+		snapshot_destroy(&w->snaps[i]);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+
+	log_debug("stopped worker thread for terminal %p", term);
 }
 
 static void rm_all_screens(struct kmscon_terminal *term)
@@ -498,13 +2113,14 @@ static int terminal_open(struct kmscon_terminal *term)
 		return ret;
 
 	term->opened = true;
-	redraw_all(term);
+	terminal_update(term);
 	return 0;
 }
 
 static void terminal_close(struct kmscon_terminal *term)
 {
 	kmscon_pty_close(term->pty);
+	term->out_len = 0;
 	term->opened = false;
 }
 
@@ -512,11 +2128,18 @@ static void terminal_destroy(struct kmscon_terminal *term)
 {
 	log_debug("free terminal object %p", term);
 
+	if (term->worker)
+		worker_stop(term);
+	search_end(term, true);
 	terminal_close(term);
 	rm_all_screens(term);
+	uterm_input_unregister_batch_cb(term->input, input_batch, term);
 	uterm_input_unregister_cb(term->input, input_event, term);
+	ev_eloop_unregister_post_cb(term->eloop, post_event, term);
 	ev_eloop_rm_fd(term->ptyfd);
 	kmscon_pty_unref(term->pty);
+	kmscon_history_free(term->history);
+	zoom_flush(term);
 	kmscon_font_unref(term->bold_font);
 	kmscon_font_unref(term->font);
 	tsm_vte_unref(term->vte);
@@ -526,10 +2149,90 @@ static void terminal_destroy(struct kmscon_terminal *term)
 	free(term);
 }
 
+/*
+ * Live Reconfiguration
+ * On configuration reloads the seat tells us which option groups changed.
+ * Only the affected state is rebuilt: palette changes apply to new output,
+ * font changes reload the fonts (dropping the current zoom level) and render
+ * engine changes replace the text-renderer of each screen. Hidden sessions
+ * that were trimmed stay trimmed and pick up the new renderer on activation.
+ */
+
+static int screen_set_engine(struct screen *scr)
+{
+	struct kmscon_terminal *term = scr->term;
+	struct kmscon_text *txt;
+	int ret;
+
+	ret = kmscon_text_new(&txt, screen_engine(scr));
+	if (ret)
+		return ret;
+
+	if (!scr->trimmed) {
+		ret = kmscon_text_set(txt, term->font, term->bold_font,
+				      scr->disp);
+		if (ret) {
+			kmscon_text_unref(txt);
+			return ret;
+		}
+	}
+
+	screen_zoom_flush(scr);
+	kmscon_text_unref(scr->txt);
+	scr->txt = txt;
+	screen_invalidate(scr);
+	return 0;
+}
+
+static void terminal_reconfigure(struct kmscon_terminal *term,
+				 unsigned int changes)
+{
+	struct shl_dlist *iter;
+	struct screen *scr;
+	struct kmscon_font_attr attr;
+	int ret;
+
+	if (changes & KMSCON_CONF_PALETTE) {
+		terminal_lock(term);
+		tsm_vte_set_palette(term->vte, term->conf->palette);
+		terminal_unlock(term);
+	}
+
+	if (changes & KMSCON_CONF_FONT) {
+		attr = term->font_attr;
+		strncpy(term->font_attr.name, term->conf->font_name,
+			KMSCON_FONT_MAX_NAME - 1);
+		term->font_attr.ppi = term->conf->font_ppi;
+		term->font_attr.points = term->conf->font_size;
+
+		ret = font_set(term);
+		if (ret) {
+			log_error("cannot load reconfigured font, keeping the old one: %d",
+				  ret);
+			term->font_attr = attr;
+		}
+	}
+
+	if (changes & KMSCON_CONF_RENDER) {
+		shl_dlist_for_each(iter, &term->screens) {
+			scr = shl_dlist_entry(iter, struct screen, list);
+			ret = screen_set_engine(scr);
+			if (ret)
+				log_warning("cannot switch text-renderer of screen %p: %d",
+					    scr, ret);
+		}
+		terminal_refit(term);
+	}
+
+	redraw_all_test(term);
+}
+
 static int session_event(struct kmscon_session *session,
 			 struct kmscon_session_event *ev, void *data)
 {
 	struct kmscon_terminal *term = data;
+	struct shl_dlist *iter;
+	struct screen *scr;
 
 	switch (ev->type) {
 	case KMSCON_SESSION_DISPLAY_NEW:
@@ -543,16 +2246,42 @@ static int session_event(struct kmscon_session *session,
 		break;
 	case KMSCON_SESSION_ACTIVATE:
 		term->awake = true;
+		shl_dlist_for_each(iter, &term->screens) {
+			scr = shl_dlist_entry(iter, struct screen, list);
+			screen_restore(scr);
+		}
+		terminal_lock(term);
 		if (!term->opened)
 			terminal_open(term);
+		terminal_unlock(term);
 		redraw_all_test(term);
 		break;
 	case KMSCON_SESSION_DEACTIVATE:
 		term->awake = false;
+		shl_dlist_for_each(iter, &term->screens) {
+			scr = shl_dlist_entry(iter, struct screen, list);
+			if (scr->cursor_shown) {
+				uterm_display_set_cursor(scr->disp, NULL);
+				scr->cursor_shown = false;
+			}
+			screen_invalidate(scr);
+		}
 		break;
 	case KMSCON_SESSION_UNREGISTER:
 		terminal_destroy(term);
 		break;
+	case KMSCON_SESSION_TRIM:
+		shl_dlist_for_each(iter, &term->screens) {
+			scr = shl_dlist_entry(iter, struct screen, list);
+			screen_trim(scr);
+		}
+		break;
+	case KMSCON_SESSION_MEMORY:
+		terminal_get_memory(term, ev->mem);
+		break;
+	case KMSCON_SESSION_RECONFIGURE:
+		terminal_reconfigure(term, ev->changes);
+		break;
 	}
 
 	return 0;
@@ -562,13 +2291,33 @@ static void pty_input(struct kmscon_pty *pty, const char *u8, size_t len,
 								void *data)
 {
 	struct kmscon_terminal *term = data;
+	unsigned int num, count;
 
 	if (!len) {
 		terminal_close(term);
 		terminal_open(term);
 	} else {
-		tsm_vte_input(term->vte, u8, len);
-		redraw_all(term);
+		/* seat configs may enable session threads on their own; the
+		 * tracer must only be touched from the seat thread */
+		if (!term->conf->session_threads)
+			shl_latency_mark(SHL_LATENCY_VTE_INPUT);
+		if (term->history) {
+			num = kmscon_history_input(term->history, term->vte,
+						   term->console, u8, len);
+			/* keep the view on the lines the user looks at */
+			if (term->sb_pos) {
+				count = kmscon_history_get_count(term->history);
+				term->sb_pos += num;
+				if (term->sb_pos > count)
+					term->sb_pos = count;
+			}
+		} else {
+			tsm_vte_input(term->vte, u8, len);
+		}
+		if (term->worker)
+			term->worker->changed = true;
+		else
+			redraw_all(term);
 	}
 }
 
@@ -584,7 +2333,19 @@ static void write_event(struct tsm_vte *vte, const char *u8, size_t len,
 {
 	struct kmscon_terminal *term = data;
 
-	kmscon_pty_write(term->pty, u8, len);
+	if (term->key_capture) {
+		if (term->key_seq_len + len <= sizeof(term->key_seq)) {
+			memcpy(&term->key_seq[term->key_seq_len], u8, len);
+			term->key_seq_len += len;
+			return;
+		}
+
+		/* sequence too long; flush it and don't batch this key */
+		term->key_capture = false;
+		term_write(term, term->key_seq, term->key_seq_len);
+	}
+
+	term_write(term, u8, len);
 }
 
 int kmscon_terminal_register(struct kmscon_session **out,
@@ -617,7 +2378,15 @@ int kmscon_terminal_register(struct kmscon_session **out,
 	ret = tsm_screen_new(&term->console, log_llog, NULL);
 	if (ret)
 		goto err_free;
-	tsm_screen_set_max_sb(term->console, term->conf->sb_size);
+
+	if (term->conf->sb_compress) {
+		/* the history sizes libtsm's scrollback to the screen */
+		ret = kmscon_history_new(&term->history, term->conf->sb_size);
+		if (ret)
+			goto err_con;
+	} else {
+		tsm_screen_set_max_sb(term->console, term->conf->sb_size);
+	}
 
 	ret = tsm_vte_new(&term->vte, term->console, write_event, term,
 			  log_llog, NULL);
@@ -657,15 +2426,30 @@ int kmscon_terminal_register(struct kmscon_session **out,
 			goto err_pty;
 	}
 
-	ret = ev_eloop_new_fd(term->eloop, &term->ptyfd,
-			      kmscon_pty_get_fd(term->pty),
-			      EV_READABLE, pty_event, term);
+	if (term->conf->session_threads) {
+		ret = worker_start(term);
+		if (ret)
+			goto err_pty;
+	} else {
+		ret = ev_eloop_new_fd(term->eloop, &term->ptyfd,
+				      kmscon_pty_get_fd(term->pty),
+				      EV_READABLE, pty_event, term);
+		if (ret)
+			goto err_pty;
+		ev_fd_set_priority(term->ptyfd, EV_PRIO_BULK);
+	}
+
+	ret = ev_eloop_register_post_cb(term->eloop, post_event, term);
 	if (ret)
-		goto err_pty;
+		goto err_ptyfd;
 
 	ret = uterm_input_register_cb(term->input, input_event, term);
 	if (ret)
-		goto err_ptyfd;
+		goto err_post;
+
+	ret = uterm_input_register_batch_cb(term->input, input_batch, term);
+	if (ret)
+		goto err_cb;
 
 	ret = kmscon_seat_register_session(seat, &term->session, session_event,
 					   term);
@@ -681,9 +2465,16 @@ int kmscon_terminal_register(struct kmscon_session **out,
 	return 0;
 
 err_input:
+	uterm_input_unregister_batch_cb(term->input, input_batch, term);
+err_cb:
 	uterm_input_unregister_cb(term->input, input_event, term);
+err_post:
+	ev_eloop_unregister_post_cb(term->eloop, post_event, term);
 err_ptyfd:
-	ev_eloop_rm_fd(term->ptyfd);
+	if (term->worker)
+		worker_stop(term);
+	else
+		ev_eloop_rm_fd(term->ptyfd);
 err_pty:
 	kmscon_pty_unref(term->pty);
 err_font:
@@ -692,6 +2483,7 @@ err_font:
 err_vte:
 	tsm_vte_unref(term->vte);
 err_con:
+	kmscon_history_free(term->history);
 	tsm_screen_unref(term->console);
 err_free:
 	free(term);
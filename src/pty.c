@@ -38,6 +38,7 @@
 #include <unistd.h>
 #include "eloop.h"
 #include "pty.h"
+#include "shl_latency.h"
 #include "shl_log.h"
 #include "shl_misc.h"
 #include "shl_ring.h"
@@ -228,6 +229,15 @@ int kmscon_pty_get_fd(struct kmscon_pty *pty)
 	return ev_eloop_get_fd(pty->eloop);
 }
 
+/* the read buffer is embedded; the ring only holds unwritten output */
+size_t kmscon_pty_get_memory(struct kmscon_pty *pty)
+{
+	if (!pty)
+		return 0;
+
+	return sizeof(*pty) + shl_ring_get_size(pty->msgbuf);
+}
+
 void kmscon_pty_dispatch(struct kmscon_pty *pty)
 {
 	if (!pty)
@@ -448,6 +458,7 @@ static int read_buf(struct kmscon_pty *pty)
 	do {
 		len = read(pty->fd, pty->io_buf, sizeof(pty->io_buf));
 		if (len > 0) {
+			shl_latency_mark(SHL_LATENCY_PTY_READ);
 			if (pty->input_cb)
 				pty->input_cb(pty, pty->io_buf, len, pty->data);
 		} else if (len == 0) {
@@ -581,6 +592,8 @@ int kmscon_pty_write(struct kmscon_pty *pty, const char *u8, size_t len)
 	if (!pty || !pty_is_open(pty) || !u8 || !len)
 		return -EINVAL;
 
+	shl_latency_mark(SHL_LATENCY_PTY_WRITE);
+
 	if (!shl_ring_is_empty(pty->msgbuf))
 		goto buf;
 
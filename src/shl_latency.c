@@ -0,0 +1,221 @@
+/*
+ * shl - Latency Tracing
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Latency Tracing
+ * Histograms use fixed 50us buckets up to ~100ms. Everything above is
+ * accounted in the last bucket but the exact maximum is tracked separately.
+ * Only a single trace is in flight at a time. If a key-press never makes it
+ * to the screen (eg., it was consumed by a grab), the trace is dropped once it
+ * is older than SHL_LATENCY_TIMEOUT.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_latency.h"
+#include "shl_log.h"
+#include "shl_timer.h"
+
+#define LOG_SUBSYSTEM "latency"
+
+#define SHL_LATENCY_BUCKET 50ULL
+#define SHL_LATENCY_BUCKETS 2048
+#define SHL_LATENCY_TIMEOUT 1000000ULL
+
+struct shl_latency_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint32_t buckets[SHL_LATENCY_BUCKETS];
+};
+
+static const char *shl_latency_names[] = {
+	[SHL_LATENCY_INPUT] = "input",
+	[SHL_LATENCY_PTY_WRITE] = "pty-write",
+	[SHL_LATENCY_PTY_READ] = "pty-read",
+	[SHL_LATENCY_VTE_INPUT] = "vte-input",
+	[SHL_LATENCY_TEXT_RENDER] = "text-render",
+	[SHL_LATENCY_DISPLAY_SWAP] = "display-swap",
+	[SHL_LATENCY_PAGE_FLIP] = "page-flip",
+};
+
+bool shl_latency__enabled;
+
+static struct {
+	bool active;
+	unsigned int next;
+	struct shl_timer timer;
+	uint64_t stamps[SHL_LATENCY_STAGE_NUM];
+	uint64_t dropped;
+	struct shl_latency_hist hist[SHL_LATENCY_STAGE_NUM];
+} shl_latency;
+
+static void hist_add(struct shl_latency_hist *hist, uint64_t usecs)
+{
+	uint64_t idx;
+
+	idx = usecs / SHL_LATENCY_BUCKET;
+	if (idx >= SHL_LATENCY_BUCKETS)
+		idx = SHL_LATENCY_BUCKETS - 1;
+
+	++hist->buckets[idx];
+	++hist->count;
+	hist->sum += usecs;
+	if (usecs > hist->max)
+		hist->max = usecs;
+}
+
+static uint64_t hist_percentile(const struct shl_latency_hist *hist,
+				unsigned int percent)
+{
+	uint64_t limit, sum;
+	unsigned int i;
+
+	if (!hist->count)
+		return 0;
+
+	limit = (hist->count * percent + 99) / 100;
+	sum = 0;
+	for (i = 0; i < SHL_LATENCY_BUCKETS - 1; ++i) {
+		sum += hist->buckets[i];
+		if (sum >= limit)
+			break;
+	}
+
+	/* report the upper bucket bound but never more than the maximum */
+	if ((i + 1) * SHL_LATENCY_BUCKET < hist->max)
+		return (i + 1) * SHL_LATENCY_BUCKET;
+
+	return hist->max;
+}
+
+void shl_latency__start(void)
+{
+	if (shl_latency.active) {
+		if (shl_timer_elapsed(&shl_latency.timer) < SHL_LATENCY_TIMEOUT)
+			return;
+		++shl_latency.dropped;
+	}
+
+	shl_timer_reset(&shl_latency.timer);
+	shl_latency.active = true;
+	shl_latency.stamps[SHL_LATENCY_INPUT] = 0;
+	shl_latency.next = SHL_LATENCY_INPUT + 1;
+}
+
+void shl_latency__mark(unsigned int stage)
+{
+	unsigned int i;
+
+	if (!shl_latency.active || stage != shl_latency.next)
+		return;
+
+	shl_latency.stamps[stage] = shl_timer_elapsed(&shl_latency.timer);
+	++shl_latency.next;
+
+	if (stage != SHL_LATENCY_PAGE_FLIP)
+		return;
+
+	for (i = SHL_LATENCY_INPUT + 1; i < SHL_LATENCY_STAGE_NUM; ++i)
+		hist_add(&shl_latency.hist[i], shl_latency.stamps[i]);
+
+	shl_latency.active = false;
+}
+
+void shl_latency_enable(bool enable)
+{
+	shl_latency__enabled = enable;
+	if (!enable)
+		shl_latency.active = false;
+}
+
+void shl_latency_reset(void)
+{
+	memset(&shl_latency, 0, sizeof(shl_latency));
+}
+
+uint64_t shl_latency_get_count(void)
+{
+	return shl_latency.hist[SHL_LATENCY_PAGE_FLIP].count;
+}
+
+int shl_latency_write(const char *path)
+{
+	const struct shl_latency_hist *hist;
+	unsigned int i;
+	FILE *f;
+	int ret;
+
+	if (!path)
+		return -EINVAL;
+
+	f = fopen(path, "we");
+	if (!f)
+		return -errno;
+
+	fprintf(f, "# latency since key-press in usecs\n");
+	fprintf(f, "# traces: %" PRIu64 " dropped: %" PRIu64 "\n",
+		shl_latency_get_count(), shl_latency.dropped);
+	fprintf(f, "%-14s %10s %10s %10s %10s %10s\n",
+		"stage", "count", "avg", "p50", "p99", "max");
+
+	for (i = SHL_LATENCY_INPUT + 1; i < SHL_LATENCY_STAGE_NUM; ++i) {
+		hist = &shl_latency.hist[i];
+		fprintf(f, "%-14s %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+			" %10" PRIu64 " %10" PRIu64 "\n",
+			shl_latency_names[i], hist->count,
+			hist->count ? hist->sum / hist->count : 0,
+			hist_percentile(hist, 50),
+			hist_percentile(hist, 99),
+			hist->max);
+	}
+
+	ret = ferror(f) ? -EIO : 0;
+	fclose(f);
+	return ret;
+}
+
+void shl_latency_log(void)
+{
+	const struct shl_latency_hist *hist;
+	unsigned int i;
+
+	log_info("latency statistics over %" PRIu64 " traces (%" PRIu64 " dropped):",
+		 shl_latency_get_count(), shl_latency.dropped);
+
+	for (i = SHL_LATENCY_INPUT + 1; i < SHL_LATENCY_STAGE_NUM; ++i) {
+		hist = &shl_latency.hist[i];
+		log_info("  %s: p50 %" PRIu64 "us p99 %" PRIu64 "us max %" PRIu64 "us",
+			 shl_latency_names[i],
+			 hist_percentile(hist, 50),
+			 hist_percentile(hist, 99),
+			 hist->max);
+	}
+}
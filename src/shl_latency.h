@@ -0,0 +1,85 @@
+/*
+ * shl - Latency Tracing
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Latency Tracing
+ * This traces a single key-press through the whole stack until the resulting
+ * frame is scanned out. The trace is started by the input layer and each
+ * following stage marks its timestamp. A trace is only advanced if the stages
+ * are hit in order, so unrelated redraws or swaps do not pollute the results.
+ * Once the page-flip arrives, all timestamps (relative to the key-press) are
+ * added to per-stage histograms.
+ *
+ * Tracing is disabled by default. The inline helpers below then cost a single
+ * branch on a global flag.
+ */
+
+#ifndef SHL_LATENCY_H
+#define SHL_LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+enum shl_latency_stage {
+	SHL_LATENCY_INPUT,
+	SHL_LATENCY_PTY_WRITE,
+	SHL_LATENCY_PTY_READ,
+	SHL_LATENCY_VTE_INPUT,
+	SHL_LATENCY_TEXT_RENDER,
+	SHL_LATENCY_DISPLAY_SWAP,
+	SHL_LATENCY_PAGE_FLIP,
+	SHL_LATENCY_STAGE_NUM,
+};
+
+extern bool shl_latency__enabled;
+
+void shl_latency__start(void);
+void shl_latency__mark(unsigned int stage);
+
+static inline void shl_latency_start(void)
+{
+	if (shl_latency__enabled)
+		shl_latency__start();
+}
+
+static inline void shl_latency_mark(unsigned int stage)
+{
+	if (shl_latency__enabled)
+		shl_latency__mark(stage);
+}
+
+static inline bool shl_latency_is_enabled(void)
+{
+	return shl_latency__enabled;
+}
+
+void shl_latency_enable(bool enable);
+void shl_latency_reset(void);
+uint64_t shl_latency_get_count(void);
+int shl_latency_write(const char *path);
+void shl_latency_log(void);
+
+#endif /* SHL_LATENCY_H */
@@ -105,27 +105,43 @@ static const char *LLOG_SUBSYSTEM __attribute__((__unused__));
 
 #define LLOG_DEFAULT __FILE__, __LINE__, __func__, LLOG_SUBSYSTEM
 
-#define llog_printf(obj, sev, format, ...) \
-	llog_format((obj)->llog, \
-		    (obj)->llog_data, \
-		    LLOG_DEFAULT, \
-		    (sev), \
-		    (format), \
-		    ##__VA_ARGS__)
-#define llog_dprintf(obj, data, sev, format, ...) \
-	llog_format((obj), \
-		    (data), \
-		    LLOG_DEFAULT, \
-		    (sev), \
-		    (format), \
-		    ##__VA_ARGS__)
-
 static inline __attribute__((format(printf, 4, 5)))
 void llog_dummyf(llog_submit_t llog, void *data, unsigned int sev,
 		 const char *format, ...)
 {
 }
 
+/*
+ * Define BUILD_LOG_LEVEL to the least severe llog_severity that shall be
+ * compiled in. Less severe messages are replaced by llog_dummyf() so they
+ * produce no code. The macros stay expressions so they can still be used in
+ * return statements.
+ */
+
+#ifndef BUILD_LOG_LEVEL
+	#define BUILD_LOG_LEVEL 7
+#endif
+
+#define llog_printf(obj, sev, format, ...) \
+	llog_dprintf((obj)->llog, \
+		     (obj)->llog_data, \
+		     (sev), \
+		     (format), \
+		     ##__VA_ARGS__)
+#define llog_dprintf(obj, data, sev, format, ...) \
+	(((sev) <= BUILD_LOG_LEVEL) ? \
+		llog_format((obj), \
+			    (data), \
+			    LLOG_DEFAULT, \
+			    (sev), \
+			    (format), \
+			    ##__VA_ARGS__) : \
+		llog_dummyf((obj), \
+			    (data), \
+			    (sev), \
+			    (format), \
+			    ##__VA_ARGS__))
+
 /*
  * Helpers
  * They pick-up all the default values and submit the message to the
@@ -9,16 +9,23 @@
  * We provide thread-safety so we need a global lock. Function which
  * are prefixed with log__* need the lock to be held. All other functions must
  * be called without the lock held.
+ * Filters are protected by a separate read-write lock so the asynchronous
+ * logger can check them without taking the global lock.
  */
 
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include "shl_githead.h"
 #include "shl_log.h"
 #include "shl_misc.h"
@@ -40,30 +47,74 @@ static inline void log_unlock()
 	pthread_mutex_unlock(&log__mutex);
 }
 
+static pthread_rwlock_t log__conf_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static inline void log_conf_rdlock()
+{
+	pthread_rwlock_rdlock(&log__conf_lock);
+}
+
+static inline void log_conf_wrlock()
+{
+	pthread_rwlock_wrlock(&log__conf_lock);
+}
+
+static inline void log_conf_unlock()
+{
+	pthread_rwlock_unlock(&log__conf_lock);
+}
+
+/*
+ * Fork Handling
+ * Other threads may hold the locks while we fork, the writer-thread even holds
+ * log__mutex while writing. The child would then deadlock on its first
+ * message, so we take both locks across fork(). The order matches
+ * log__submit(), which takes the config-lock with log__mutex held.
+ */
+
+static void log__atfork_child(void);
+
+static void log__atfork_prepare(void)
+{
+	log_lock();
+	log_conf_wrlock();
+}
+
+static void log__atfork_parent(void)
+{
+	log_conf_unlock();
+	log_unlock();
+}
+
 /*
  * Time Management
  * We print seconds and microseconds since application start for each
- * log-message.
+ * log-message. The start is taken with the first message, which is also when
+ * the fork-handlers are installed.
  */
 
+static pthread_once_t log__once = PTHREAD_ONCE_INIT;
 static struct timeval log__ftime;
 
+static void log__init(void)
+{
+	gettimeofday(&log__ftime, NULL);
+	pthread_atfork(log__atfork_prepare, log__atfork_parent,
+		       log__atfork_child);
+}
+
 static void log__time(long long *sec, long long *usec)
 {
 	struct timeval t;
 
-	if (log__ftime.tv_sec == 0 && log__ftime.tv_usec == 0) {
-		gettimeofday(&log__ftime, NULL);
-		*sec = 0;
-		*usec = 0;
-	} else {
-		gettimeofday(&t, NULL);
-		*sec = t.tv_sec - log__ftime.tv_sec;
-		*usec = (long long)t.tv_usec - (long long)log__ftime.tv_usec;
-		if (*usec < 0) {
-			*sec -= 1;
-			*usec = 1000000 + *usec;
-		}
+	pthread_once(&log__once, log__init);
+
+	gettimeofday(&t, NULL);
+	*sec = t.tv_sec - log__ftime.tv_sec;
+	*usec = (long long)t.tv_usec - (long long)log__ftime.tv_usec;
+	if (*usec < 0) {
+		*sec -= 1;
+		*usec = 1000000 + *usec;
 	}
 }
 
@@ -138,14 +189,36 @@ struct log_dynconf {
 
 static struct log_dynconf *log__dconfig = NULL;
 
+/*
+ * Filter generation
+ * Call-sites cache whether they are filtered. Whenever the global config or
+ * the filter list changes, the generation is increased so all caches are
+ * invalidated. It is increased after the change has been applied so a cache
+ * that races with the update is tagged with the old generation. Generation 0
+ * is reserved for uninitialized call-sites.
+ */
+
+SHL_EXPORT
+unsigned long log__generation = 1;
+
+static void log__bump_generation(void)
+{
+	__atomic_add_fetch(&log__generation, 1, __ATOMIC_RELEASE);
+}
+
 void log_set_config(const struct log_config *config)
 {
+	unsigned int i;
+
 	if (!config)
 		return;
 
-	log_lock();
-	log__gconfig = *config;
-	log_unlock();
+	log_conf_wrlock();
+	for (i = 0; i < LOG_SEV_NUM; ++i)
+		__atomic_store_n(&log__gconfig.sev[i], config->sev[i],
+				 __ATOMIC_RELAXED);
+	log__bump_generation();
+	log_conf_unlock();
 }
 
 int log_add_filter(const struct log_filter *filter,
@@ -165,13 +238,14 @@ int log_add_filter(const struct log_filter *filter,
 	memcpy(&dconf->filter, filter, sizeof(*filter));
 	memcpy(&dconf->config, config, sizeof(*config));
 
-	log_lock();
+	log_conf_wrlock();
 	if (log__dconfig)
 		dconf->handle = log__dconfig->handle + 1;
 	dconf->next = log__dconfig;
-	log__dconfig = dconf;
+	__atomic_store_n(&log__dconfig, dconf, __ATOMIC_RELAXED);
 	ret = dconf->handle;
-	log_unlock();
+	log__bump_generation();
+	log_conf_unlock();
 
 	return ret;
 }
@@ -182,20 +256,23 @@ void log_rm_filter(int handle)
 
 	dconf = NULL;
 
-	log_lock();
+	log_conf_wrlock();
 	if (log__dconfig) {
 		if (log__dconfig->handle == handle) {
 			dconf = log__dconfig;
-			log__dconfig = dconf->next;
+			__atomic_store_n(&log__dconfig, dconf->next,
+					 __ATOMIC_RELAXED);
 		} else for (i = log__dconfig; i->next; i = i->next) {
 			dconf = i->next;
 			if (dconf->handle == handle) {
 				i->next = dconf->next;
 				break;
 			}
+			dconf = NULL;
 		}
 	}
-	log_unlock();
+	log__bump_generation();
+	log_conf_unlock();
 
 	free(dconf);
 }
@@ -204,12 +281,13 @@ void log_clean_filters()
 {
 	struct log_dynconf *dconf;
 
-	log_lock();
+	log_conf_wrlock();
 	while ((dconf = log__dconfig)) {
-		log__dconfig = dconf->next;
+		__atomic_store_n(&log__dconfig, dconf->next, __ATOMIC_RELAXED);
 		free(dconf);
 	}
-	log_unlock();
+	log__bump_generation();
+	log_conf_unlock();
 }
 
 static bool log__matches(const struct log_filter *filter,
@@ -235,6 +313,35 @@ static bool log__matches(const struct log_filter *filter,
 	return true;
 }
 
+static bool log__omit_locked(const char *file,
+			     int line,
+			     const char *func,
+			     const struct log_config *config,
+			     const char *subs,
+			     enum log_severity sev)
+{
+	int val;
+	struct log_dynconf *dconf;
+
+	for (dconf = log__dconfig; dconf; dconf = dconf->next) {
+		if (log__matches(&dconf->filter, file, line, func, subs)) {
+			val = dconf->config.sev[sev];
+			if (val == 0)
+				return true;
+			if (val == 1)
+				return false;
+		}
+	}
+
+	val = log__gconfig.sev[sev];
+	if (val == 0)
+		return true;
+	if (val == 1)
+		return false;
+
+	return false;
+}
+
 static bool log__omit(const char *file,
 			int line,
 			const char *func,
@@ -243,7 +350,7 @@ static bool log__omit(const char *file,
 			enum log_severity sev)
 {
 	int val;
-	struct log_dynconf *dconf;
+	bool ret;
 
 	if (sev >= LOG_SEV_NUM)
 		return false;
@@ -256,23 +363,38 @@ static bool log__omit(const char *file,
 			return false;
 	}
 
-	for (dconf = log__dconfig; dconf; dconf = dconf->next) {
-		if (log__matches(&dconf->filter, file, line, func, subs)) {
-			val = dconf->config.sev[sev];
-			if (val == 0)
-				return true;
-			if (val == 1)
-				return false;
-		}
+	/* Without filters only the global config applies. Its entries are
+	 * updated atomically so we can skip the lock. This is the common case
+	 * for all llog users which cannot cache their filter results. */
+	if (!__atomic_load_n(&log__dconfig, __ATOMIC_RELAXED)) {
+		val = __atomic_load_n(&log__gconfig.sev[sev], __ATOMIC_RELAXED);
+		return val == 0;
 	}
 
-	val = log__gconfig.sev[sev];
-	if (val == 0)
-		return true;
-	if (val == 1)
-		return false;
+	log_conf_rdlock();
+	ret = log__omit_locked(file, line, func, config, subs, sev);
+	log_conf_unlock();
 
-	return false;
+	return ret;
+}
+
+SHL_EXPORT
+bool log__site_update(struct log_site *site,
+		      const char *file,
+		      int line,
+		      const char *func,
+		      const struct log_config *config,
+		      const char *subs,
+		      unsigned int sev)
+{
+	unsigned long gen;
+	bool enabled;
+
+	gen = __atomic_load_n(&log__generation, __ATOMIC_ACQUIRE);
+	enabled = !log__omit(file, line, func, config, subs, sev);
+	__atomic_store_n(&site->state, gen << 1 | enabled, __ATOMIC_RELAXED);
+
+	return enabled;
 }
 
 /*
@@ -448,6 +570,393 @@ static void log__format(const char *file,
 	va_end(list);
 }
 
+/*
+ * Asynchronous Logger
+ * In asynchronous mode, log_submit() does not write to the log-target itself.
+ * Instead, each thread formats its messages into its own ring buffer and a
+ * background writer-thread drains all rings. Each ring has a single producer
+ * (the owning thread) and a single consumer (whoever holds log__mutex), so no
+ * locks are needed on the hot path. If a ring is full, the message is dropped
+ * and accounted in the drop-counter of the ring. The writer reports dropped
+ * messages once it catches up.
+ *
+ * Messages with severity LOG_CRITICAL or higher bypass the rings. They flush
+ * all pending messages and are written synchronously so they are not lost if
+ * the application crashes right after. log_flush() can be used to do the same
+ * from crash-handlers.
+ */
+
+#define LOG_RING_SIZE 128
+#define LOG_LINE_MAX 512
+
+struct log_slot {
+	size_t len;
+	char buf[LOG_LINE_MAX];
+};
+
+struct log_ring {
+	struct log_ring *next;
+	unsigned long head;
+	unsigned long tail;
+	unsigned long dropped;
+	unsigned long reported;
+	int dead;
+	struct log_slot slots[LOG_RING_SIZE];
+};
+
+static struct {
+	bool running;
+	bool key_init;
+	int stop;
+	int sleeping;
+	int efd;
+	pthread_t thread;
+	pthread_key_t key;
+	struct log_ring *rings;
+	unsigned long dropped;
+} log__async = {
+	.efd = -1,
+};
+
+static __thread struct log_ring *log__tring;
+
+static void log__ring_release(void *data)
+{
+	struct log_ring *ring = data;
+
+	/* the writer frees the ring once it is drained */
+	__atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static struct log_ring *log__get_ring(void)
+{
+	struct log_ring *ring;
+
+	if (log__tring)
+		return log__tring;
+
+	ring = malloc(sizeof(*ring));
+	if (!ring)
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+
+	log_lock();
+	ring->next = log__async.rings;
+	log__async.rings = ring;
+	log_unlock();
+
+	pthread_setspecific(log__async.key, ring);
+	log__tring = ring;
+	return ring;
+}
+
+static void log__append(char *buf, size_t size, size_t *pos,
+			const char *format, ...)
+{
+	va_list list;
+	int ret;
+
+	if (*pos >= size)
+		return;
+
+	va_start(list, format);
+	ret = vsnprintf(&buf[*pos], size - *pos, format, list);
+	va_end(list);
+
+	if (ret > 0)
+		*pos += ret;
+}
+
+static size_t log__format_line(char *buf, size_t size,
+			       const char *file,
+			       int line,
+			       const char *func,
+			       const char *subs,
+			       unsigned int sev,
+			       const char *format,
+			       va_list args)
+{
+	const char *prefix = NULL;
+	long long sec, usec;
+	size_t pos = 0, len;
+	bool nl;
+	int ret;
+
+	log__time(&sec, &usec);
+
+	if (sev < LOG_SEV_NUM)
+		prefix = log__sev2str[sev];
+
+	log__append(buf, size, &pos, "[%.4lld.%.6lld] ", sec, usec);
+	if (prefix)
+		log__append(buf, size, &pos, "%s: ", prefix);
+	if (subs)
+		log__append(buf, size, &pos, "%s: ", subs);
+
+	if (pos < size) {
+		ret = vsnprintf(&buf[pos], size - pos, format, args);
+		if (ret > 0)
+			pos += ret;
+	}
+
+	len = strlen(format);
+	nl = len && format[len - 1] == '\n';
+
+	if (!nl)
+		log__append(buf, size, &pos, " (%s() in %s:%d)\n",
+			    func ? func : "<unknown>",
+			    file ? file : "<unknown>",
+			    line < 0 ? 0 : line);
+
+	/* truncated lines are terminated explicitly */
+	if (pos >= size) {
+		pos = size - 1;
+		buf[pos - 1] = '\n';
+	}
+
+	return pos;
+}
+
+static bool log__async_push(const char *file,
+			    int line,
+			    const char *func,
+			    const struct log_config *config,
+			    const char *subs,
+			    unsigned int sev,
+			    const char *format,
+			    va_list args)
+{
+	struct log_ring *ring;
+	struct log_slot *slot;
+	unsigned long head, tail;
+	uint64_t one = 1;
+
+	if (log__omit(file, line, func, config, subs, sev))
+		return true;
+
+	ring = log__get_ring();
+	if (!ring)
+		return false;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= LOG_RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+	} else {
+		slot = &ring->slots[head % LOG_RING_SIZE];
+		slot->len = log__format_line(slot->buf, sizeof(slot->buf),
+					     file, line, func, subs, sev,
+					     format, args);
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	/* Pairs with the writer, which sets @sleeping before it checks the
+	 * rings a last time. Either it sees our message or we see the flag.
+	 * Drops wake it up, too, so they are reported. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&log__async.sleeping, 0, __ATOMIC_SEQ_CST)) {
+		if (write(log__async.efd, &one, sizeof(one)) < 0) {
+			/* only fails if the counter is saturated, in which
+			 * case a wake-up is pending anyway */
+		}
+	}
+
+	return true;
+}
+
+/* drain all rings into the log-target; log__mutex must be held */
+static unsigned long log__drain(void)
+{
+	struct log_ring *ring, **iter;
+	struct log_slot *slot;
+	unsigned long head, tail, num = 0, dropped;
+	FILE *out;
+
+	out = log__file ? log__file : stderr;
+
+	iter = &log__async.rings;
+	while ((ring = *iter)) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		for (tail = ring->tail; tail != head; ++tail) {
+			slot = &ring->slots[tail % LOG_RING_SIZE];
+			fwrite(slot->buf, 1, slot->len, out);
+			++num;
+		}
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped != ring->reported) {
+			log__async.dropped += dropped - ring->reported;
+			log__format(LOG_DEFAULT, LOG_WARNING,
+				    "dropped %lu messages (%lu total)",
+				    dropped - ring->reported,
+				    log__async.dropped);
+			ring->reported = dropped;
+		}
+
+		if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) &&
+		    __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+			*iter = ring->next;
+			free(ring);
+		} else {
+			iter = &ring->next;
+		}
+	}
+
+	if (num)
+		fflush(out);
+
+	return num;
+}
+
+static void *log__async_thread(void *data)
+{
+	struct pollfd pfd;
+	unsigned long num;
+	uint64_t val;
+	sigset_t mask;
+
+	/* never steal signals from signalfd users */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pfd.fd = log__async.efd;
+	pfd.events = POLLIN;
+
+	while (!__atomic_load_n(&log__async.stop, __ATOMIC_ACQUIRE)) {
+		log_lock();
+		num = log__drain();
+		log_unlock();
+		if (num)
+			continue;
+
+		__atomic_store_n(&log__async.sleeping, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		/* recheck to avoid missing a wake-up from a producer which
+		 * pushed right before we set the sleeping flag */
+		log_lock();
+		num = log__drain();
+		log_unlock();
+		if (num) {
+			__atomic_store_n(&log__async.sleeping, 0,
+					 __ATOMIC_RELEASE);
+			continue;
+		}
+
+		/* producers and log_set_async() signal the eventfd, so
+		 * there is no need to wake up periodically */
+		if (poll(&pfd, 1, -1) > 0) {
+			if (read(log__async.efd, &val, sizeof(val)) < 0) {
+				/* spurious wake-up; drain anyway */
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* forked children have no writer-thread so fall back to synchronous mode */
+static void log__atfork_child(void)
+{
+	log__async.running = false;
+	log__async.rings = NULL;
+	log__tring = NULL;
+
+	log_conf_unlock();
+	log_unlock();
+}
+
+int log_set_async(bool enable)
+{
+	uint64_t one = 1;
+	int ret;
+
+	if (enable == log__async.running)
+		return 0;
+
+	if (!enable) {
+		__atomic_store_n(&log__async.stop, 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&log__async.running, false, __ATOMIC_RELEASE);
+		if (write(log__async.efd, &one, sizeof(one)) < 0) {
+			/* a wake-up is pending already */
+		}
+		log_flush();
+		pthread_join(log__async.thread, NULL);
+		log_flush();
+		close(log__async.efd);
+		log__async.efd = -1;
+		return 0;
+	}
+
+	if (!log__async.key_init) {
+		ret = pthread_key_create(&log__async.key, log__ring_release);
+		if (ret)
+			return -ret;
+		pthread_once(&log__once, log__init);
+		log__async.key_init = true;
+	}
+
+	log__async.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (log__async.efd < 0)
+		return -errno;
+
+	log__async.stop = 0;
+	log__async.sleeping = 0;
+	ret = pthread_create(&log__async.thread, NULL, log__async_thread, NULL);
+	if (ret) {
+		close(log__async.efd);
+		log__async.efd = -1;
+		return -ret;
+	}
+
+	__atomic_store_n(&log__async.running, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void log_flush(void)
+{
+	int saved_errno = errno;
+
+	log_lock();
+	log__drain();
+	log_unlock();
+
+	errno = saved_errno;
+}
+
+unsigned long log_get_dropped(void)
+{
+	unsigned long ret;
+
+	log_lock();
+	ret = log__async.dropped;
+	log_unlock();
+
+	return ret;
+}
+
+static void log__dispatch(const char *file,
+			  int line,
+			  const char *func,
+			  const struct log_config *config,
+			  const char *subs,
+			  unsigned int sev,
+			  const char *format,
+			  va_list args)
+{
+	if (__atomic_load_n(&log__async.running, __ATOMIC_ACQUIRE) &&
+	    sev > LOG_CRITICAL &&
+	    log__async_push(file, line, func, config, subs, sev, format, args))
+		return;
+
+	log_lock();
+	if (log__async.rings)
+		log__drain();
+	log__submit(file, line, func, config, subs, sev, format, args);
+	log_unlock();
+}
+
 SHL_EXPORT
 void log_submit(const char *file,
 		int line,
@@ -460,9 +969,7 @@ void log_submit(const char *file,
 {
 	int saved_errno = errno;
 
-	log_lock();
-	log__submit(file, line, func, config, subs, sev, format, args);
-	log_unlock();
+	log__dispatch(file, line, func, config, subs, sev, format, args);
 
 	errno = saved_errno;
 }
@@ -481,9 +988,7 @@ void log_format(const char *file,
 	int saved_errno = errno;
 
 	va_start(list, format);
-	log_lock();
-	log__submit(file, line, func, config, subs, sev, format, list);
-	log_unlock();
+	log__dispatch(file, line, func, config, subs, sev, format, list);
 	va_end(list);
 
 	errno = saved_errno;
@@ -19,7 +19,9 @@
  * filtered.
  *
  * Define BUILD_ENABLE_DEBUG before including this header to enable
- * debug-messages for this file.
+ * debug-messages for this file. Define BUILD_LOG_LEVEL to the least severe
+ * log_severity that shall be compiled in. All less severe messages are
+ * stripped at compile-time. This defaults to LOG_DEBUG.
  */
 
 #ifndef SHL_LOG_H_INCLUDED
@@ -174,6 +176,20 @@ void log_clean_filter();
  * every message is prepended with a time-offset since application-start. This
  * offset is measured since the first log-message is sent so you should send
  * some log-message at application start. This is a handy-helper to do this.
+ *
+ * log_set_async(enable):
+ * Enables or disables asynchronous logging. If enabled, messages are formatted
+ * into per-thread ring buffers and written by a background thread. Messages
+ * are dropped if a ring is full. Critical, alert and fatal messages are always
+ * written synchronously after flushing all pending messages. Disabling
+ * asynchronous logging flushes all pending messages and stops the writer.
+ *
+ * log_flush():
+ * Synchronously writes all pending asynchronous messages. This can be called
+ * from crash-handlers.
+ *
+ * log_get_dropped():
+ * Returns the number of messages dropped by the asynchronous logger so far.
  */
 
 __attribute__((format(printf, 7, 0)))
@@ -208,6 +224,9 @@ void log_llog(void *data,
 
 int log_set_file(const char *file);
 void log_print_init(const char *appname);
+int log_set_async(bool enable);
+void log_flush(void);
+unsigned long log_get_dropped(void);
 
 static inline __attribute__((format(printf, 2, 3)))
 void log_dummyf(unsigned int sev, const char *format, ...)
@@ -241,7 +260,9 @@ void log_dummyf(unsigned int sev, const char *format, ...)
  *              LOG_ERROR, "your format string: %s %d", "some args", 5, ...);
  *
  * log_printf is the same as log_format(LOG_DEFAULT, sev, format, ...) and is
- * the most basic wrapper that you can use.
+ * the most basic wrapper that you can use. Unlike log_format() it is a
+ * statement, not an expression. Messages less severe than BUILD_LOG_LEVEL are
+ * stripped and run-time filter results are cached per call-site.
  */
 
 #ifndef LOG_CONFIG
@@ -256,8 +277,62 @@ extern const char *LOG_SUBSYSTEM;
 #define LOG_DEFAULT_CONF LOG_DEFAULT_BASE, &LOG_CONFIG
 #define LOG_DEFAULT LOG_DEFAULT_CONF, LOG_SUBSYSTEM
 
+#ifndef BUILD_LOG_LEVEL
+	#define BUILD_LOG_LEVEL 7
+#endif
+
+/*
+ * Call-Site Cache
+ * Every log_printf() call-site has a static log_site object which caches
+ * whether the filters discard messages of this call-site. The cache is tagged
+ * with the filter generation which is increased whenever the global config or
+ * the filter list is modified. As long as the generation is unchanged, a
+ * discarded message costs a single compare-and-branch.
+ * The state field contains the generation shifted by one and the cached result
+ * in the lowest bit so both are updated atomically. Generation 0 is never used
+ * so zero-initialized objects are always invalid.
+ */
+
+struct log_site {
+	unsigned long state;
+};
+
+extern unsigned long log__generation;
+
+bool log__site_update(struct log_site *site,
+		      const char *file,
+		      int line,
+		      const char *func,
+		      const struct log_config *config,
+		      const char *subs,
+		      unsigned int sev);
+
+static inline bool log__site_enabled(struct log_site *site,
+				     const char *file,
+				     int line,
+				     const char *func,
+				     const struct log_config *config,
+				     const char *subs,
+				     unsigned int sev)
+{
+	unsigned long gen, state;
+
+	gen = __atomic_load_n(&log__generation, __ATOMIC_RELAXED);
+	state = __atomic_load_n(&site->state, __ATOMIC_RELAXED);
+	if (__builtin_expect((state >> 1) == gen, 1))
+		return state & 1;
+
+	return log__site_update(site, file, line, func, config, subs, sev);
+}
+
 #define log_printf(sev, format, ...) \
-	log_format(LOG_DEFAULT, (sev), (format), ##__VA_ARGS__)
+	do { \
+		static struct log_site log__site; \
+		if ((sev) <= BUILD_LOG_LEVEL && \
+		    log__site_enabled(&log__site, LOG_DEFAULT, (sev))) \
+			log_format(LOG_DEFAULT, (sev), (format), \
+				   ##__VA_ARGS__); \
+	} while (0)
 
 /*
  * Helpers
@@ -43,6 +43,10 @@
 #include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define SHL_EXPORT __attribute__((visibility("default")))
 #define SHL_HAS_BITS(_bitmask, _bits) (((_bitmask) & (_bits)) == (_bits))
 #define SHL_DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
@@ -110,6 +114,44 @@ static inline int shl_dup(void **out, const void *data, size_t size)
 	return 0;
 }
 
+/*
+ * Copies @size bytes to memory that is written but never read back, like
+ * framebuffers. With SSE2, non-temporal stores are used so the destination
+ * doesn't pollute the CPU caches. Call shl_memcpy_stream_end() after a batch of
+ * copies to order the stores before later writes (like page-flips).
+ */
+static inline void shl_memcpy_stream(void *dst, const void *src, size_t size)
+{
+#ifdef __SSE2__
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	head = (16 - ((uintptr_t)d & 15)) & 15;
+	if (head > size)
+		head = size;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	for ( ; size >= 16; size -= 16, d += 16, s += 16)
+		_mm_stream_si128((__m128i*)d,
+				 _mm_loadu_si128((const __m128i*)s));
+
+	memcpy(d, s, size);
+#else
+	memcpy(dst, src, size);
+#endif
+}
+
+static inline void shl_memcpy_stream_end(void)
+{
+#ifdef __SSE2__
+	_mm_sfence();
+#endif
+}
+
 static inline bool shl_ends_with(const char *str, const char *suffix)
 {
 	size_t len, slen;
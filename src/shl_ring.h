@@ -89,6 +89,22 @@ static inline bool shl_ring_is_empty(struct shl_ring *ring)
 	return ring->first == NULL;
 }
 
+/* bytes allocated for the ring, including partially used entries */
+static inline size_t shl_ring_get_size(struct shl_ring *ring)
+{
+	struct shl_ring_entry *iter;
+	size_t size;
+
+	if (!ring)
+		return 0;
+
+	size = sizeof(*ring);
+	for (iter = ring->first; iter; iter = iter->next)
+		size += sizeof(*iter) + SHL_RING_SIZE;
+
+	return size;
+}
+
 static inline int shl_ring_write(struct shl_ring *ring, const char *val,
 				 size_t len)
 {
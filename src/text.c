@@ -35,7 +35,9 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include "kmscon_module.h"
 #include "shl_dlist.h"
+#include "shl_latency.h"
 #include "shl_log.h"
 #include "shl_misc.h"
 #include "shl_register.h"
@@ -112,10 +114,14 @@ static int new_text(struct kmscon_text *text, const char *backend)
 	memset(text, 0, sizeof(*text));
 	text->ref = 1;
 
-	if (backend)
+	if (backend) {
 		record = shl_register_find(&text_reg, backend);
-	else
+		if (!record &&
+		    !kmscon_module_request(KMSCON_MODULE_TEXT, backend))
+			record = shl_register_find(&text_reg, backend);
+	} else {
 		record = shl_register_first(&text_reg);
+	}
 
 	if (!record) {
 		log_error("requested backend '%s' not found", name);
@@ -413,6 +419,7 @@ int kmscon_text_render(struct kmscon_text *txt)
 	if (txt->ops->render)
 		ret = txt->ops->render(txt);
 	txt->rendering = false;
+	shl_latency_mark(SHL_LATENCY_TEXT_RENDER);
 
 	return ret;
 }
@@ -437,6 +444,25 @@ void kmscon_text_abort(struct kmscon_text *txt)
 	txt->rendering = false;
 }
 
+/**
+ * kmscon_text_get_memory:
+ * @txt: valid text renderer
+ *
+ * Returns the number of bytes the backend allocated for @txt. This includes
+ * glyph caches, texture atlases and shadow buffers but not the glyphs kept by
+ * the font backends. Backends that do not track their memory return 0. All of
+ * this memory is released by kmscon_text_unset().
+ *
+ * Returns: Number of bytes used by @txt or 0 if @txt is unset.
+ */
+size_t kmscon_text_get_memory(struct kmscon_text *txt)
+{
+	if (!txt || !txt->disp || !txt->font || !txt->ops->memory)
+		return 0;
+
+	return txt->ops->memory(txt);
+}
+
 int kmscon_text_draw_cb(struct tsm_screen *con,
 			uint64_t id, const uint32_t *ch, size_t len,
 			unsigned int width,
@@ -74,6 +74,7 @@ struct kmscon_text_ops {
 		     const struct tsm_screen_attr *attr);
 	int (*render) (struct kmscon_text *txt);
 	void (*abort) (struct kmscon_text *txt);
+	size_t (*memory) (struct kmscon_text *txt);
 };
 
 int kmscon_text_register(const struct kmscon_text_ops *ops);
@@ -99,6 +100,7 @@ int kmscon_text_draw(struct kmscon_text *txt,
 		     const struct tsm_screen_attr *attr);
 int kmscon_text_render(struct kmscon_text *txt);
 void kmscon_text_abort(struct kmscon_text *txt);
+size_t kmscon_text_get_memory(struct kmscon_text *txt);
 
 int kmscon_text_draw_cb(struct tsm_screen *con,
 			uint64_t id, const uint32_t *ch, size_t len,
@@ -130,4 +130,5 @@ struct kmscon_text_ops kmscon_text_bblit_ops = {
 	.draw = bblit_draw,
 	.render = NULL,
 	.abort = NULL,
+	.memory = NULL,
 };
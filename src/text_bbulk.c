@@ -44,6 +44,10 @@
 
 struct bbulk {
 	struct uterm_video_blend_req *reqs;
+	/* cells drawn since the last prepare, only these are blended */
+	struct uterm_video_blend_req *batch;
+	unsigned int *drawn;
+	unsigned int num;
 };
 
 #define FONT_WIDTH(txt) ((txt)->font->attr.width)
@@ -91,6 +95,16 @@ static int bbulk_set(struct kmscon_text *txt)
 		return -ENOMEM;
 	memset(bb->reqs, 0, sizeof(*bb->reqs) * txt->cols * txt->rows);
 
+	bb->batch = malloc(sizeof(*bb->batch) * txt->cols * txt->rows);
+	bb->drawn = malloc(sizeof(*bb->drawn) * txt->cols * txt->rows);
+	if (!bb->batch || !bb->drawn) {
+		free(bb->drawn);
+		free(bb->batch);
+		free(bb->reqs);
+		bb->reqs = NULL;
+		return -ENOMEM;
+	}
+
 	for (i = 0; i < txt->rows; ++i) {
 		for (j = 0; j < txt->cols; ++j) {
 			req = &bb->reqs[i * txt->cols + j];
@@ -106,10 +120,20 @@ static void bbulk_unset(struct kmscon_text *txt)
 {
 	struct bbulk *bb = txt->data;
 
+	free(bb->drawn);
+	free(bb->batch);
 	free(bb->reqs);
 	bb->reqs = NULL;
 }
 
+static int bbulk_prepare(struct kmscon_text *txt)
+{
+	struct bbulk *bb = txt->data;
+
+	bb->num = 0;
+	return 0;
+}
+
 static int bbulk_draw(struct kmscon_text *txt,
 		      uint64_t id, const uint32_t *ch, size_t len,
 		      unsigned int width,
@@ -121,9 +145,13 @@ static int bbulk_draw(struct kmscon_text *txt,
 	int ret;
 	struct uterm_video_blend_req *req;
 	struct kmscon_font *font;
+	unsigned int idx = posy * txt->cols + posx;
+
+	if (bb->num < txt->cols * txt->rows)
+		bb->drawn[bb->num++] = idx;
 
 	if (!width) {
-		bb->reqs[posy * txt->cols + posx].buf = NULL;
+		bb->reqs[idx].buf = NULL;
 		return 0;
 	}
 
@@ -154,7 +182,7 @@ static int bbulk_draw(struct kmscon_text *txt,
 			return ret;
 	}
 
-	req = &bb->reqs[posy * txt->cols + posx];
+	req = &bb->reqs[idx];
 	req->buf = &glyph->buf;
 	if (attr->inverse) {
 		req->fr = attr->br;
@@ -175,12 +203,33 @@ static int bbulk_draw(struct kmscon_text *txt,
 	return 0;
 }
 
+static size_t bbulk_memory(struct kmscon_text *txt)
+{
+	struct bbulk *bb = txt->data;
+	size_t num = txt->cols * txt->rows;
+
+	return num * (sizeof(*bb->reqs) + sizeof(*bb->batch) +
+		      sizeof(*bb->drawn));
+}
+
+/*
+ * Only cells drawn since bbulk_prepare() are pushed to the device. Full redraws
+ * draw every cell and use the request array directly. Partial redraws (see
+ * the damage tracking in the terminal) only blend the damaged cells.
+ */
 static int bbulk_render(struct kmscon_text *txt)
 {
 	struct bbulk *bb = txt->data;
+	unsigned int i;
+
+	if (bb->num == txt->cols * txt->rows)
+		return uterm_display_fake_blendv(txt->disp, bb->reqs,
+						 bb->num);
+
+	for (i = 0; i < bb->num; ++i)
+		bb->batch[i] = bb->reqs[bb->drawn[i]];
 
-	return uterm_display_fake_blendv(txt->disp, bb->reqs,
-					 txt->cols * txt->rows);
+	return uterm_display_fake_blendv(txt->disp, bb->batch, bb->num);
 }
 
 struct kmscon_text_ops kmscon_text_bbulk_ops = {
@@ -190,8 +239,9 @@ struct kmscon_text_ops kmscon_text_bbulk_ops = {
 	.destroy = bbulk_destroy,
 	.set = bbulk_set,
 	.unset = bbulk_unset,
-	.prepare = NULL,
+	.prepare = bbulk_prepare,
 	.draw = bbulk_draw,
 	.render = bbulk_render,
 	.abort = NULL,
+	.memory = bbulk_memory,
 };
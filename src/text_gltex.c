@@ -98,6 +98,7 @@ struct gltex {
 	bool supports_rowlen;
 
 	struct shl_dlist atlases;
+	size_t num_glyphs;
 
 	GLfloat advance_x;
 	GLfloat advance_y;
@@ -520,6 +521,7 @@ static int find_glyph(struct kmscon_text *txt, struct glyph **out,
 		goto err_free;
 
 	atlas->fill += glyph->glyph->width;
+	++gt->num_glyphs;
 
 	*out = glyph;
 	return 0;
@@ -529,6 +531,25 @@ err_free:
 	return ret;
 }
 
+/* GL_ALPHA textures use one byte per texel; drivers may pad them, though */
+static size_t gltex_memory(struct kmscon_text *txt)
+{
+	struct gltex *gt = txt->data;
+	struct shl_dlist *iter;
+	struct atlas *atlas;
+	size_t size;
+
+	size = gt->num_glyphs * sizeof(struct glyph);
+	shl_dlist_for_each(iter, &gt->atlases) {
+		atlas = shl_dlist_entry(iter, struct atlas, list);
+		size += sizeof(*atlas);
+		size += (size_t)atlas->width * atlas->height;
+		size += sizeof(GLfloat) * atlas->cache_size * (2 + 2 + 3 + 3) * 6;
+	}
+
+	return size;
+}
+
 static int gltex_prepare(struct kmscon_text *txt)
 {
 	struct gltex *gt = txt->data;
@@ -703,4 +724,5 @@ struct kmscon_text_ops kmscon_text_gltex_ops = {
 	.draw = gltex_draw,
 	.render = gltex_render,
 	.abort = NULL,
+	.memory = gltex_memory,
 };
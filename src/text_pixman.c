@@ -45,25 +45,36 @@ struct tp_glyph {
 	uint8_t *data;
 };
 
+/* dirty cells [x1, x2) of one text row */
+struct tp_span {
+	unsigned int x1;
+	unsigned int x2;
+};
+
 struct tp_pixman {
 	pixman_image_t *white;
 	struct shl_hashtable *glyphs;
 	struct shl_hashtable *bold_glyphs;
-
-	struct uterm_video_buffer buf[2];
-	pixman_image_t *surf[2];
-	unsigned int format[2];
-
 	bool new_stride;
-	bool use_indirect;
-	uint8_t *data[2];
+
+	/* shadow buffer in system memory that we render into */
+	uint8_t *data;
+	pixman_image_t *surf;
 	struct uterm_video_buffer vbuf;
 
+	/* dirty spans of each display buffer, see tp_render() */
+	bool exact;
+	unsigned int rows;
+	struct tp_span *dirty[UTERM_MAX_BUFFERS];
+
 	/* cache */
 	unsigned int cur;
 	unsigned int c_bpp;
 	uint32_t *c_data;
 	unsigned int c_stride;
+
+	/* bytes allocated for cached glyphs */
+	size_t glyph_mem;
 };
 
 static int tp_init(struct kmscon_text *txt)
@@ -108,55 +119,94 @@ static unsigned int format_u2p(unsigned int f)
 	}
 }
 
-static int alloc_indirect(struct kmscon_text *txt,
-			  unsigned int w, unsigned int h)
+static void free_dirty(struct tp_pixman *tp)
+{
+	unsigned int i;
+
+	for (i = 0; i < UTERM_MAX_BUFFERS; ++i) {
+		free(tp->dirty[i]);
+		tp->dirty[i] = NULL;
+	}
+}
+
+/*
+ * We never render into the framebuffer directly. Compositing glyphs reads back
+ * the destination and reads from write-combined or uncached video memory are
+ * horribly slow. Instead, we render into a shadow buffer in system memory and
+ * copy the changed cells to the display in tp_render().
+ * If the display exposes its buffers, uterm_display_use() identifies the
+ * buffer we copy into and we track dirty cells separately for each of them.
+ * Otherwise, the whole shadow buffer is copied on each frame.
+ */
+static int alloc_shadow(struct kmscon_text *txt, unsigned int w,
+			unsigned int h)
 {
 	struct tp_pixman *tp = txt->data;
-	unsigned int s, i, format;
+	struct uterm_video_buffer buf[UTERM_MAX_BUFFERS];
+	unsigned int s, i, j;
 	int ret;
 
-	log_info("using blitting engine");
-
-	format = format_u2p(UTERM_FORMAT_XRGB32);
 	s = w * 4;
+	tp->data = calloc(h, s);
+	if (!tp->data) {
+		log_error("cannot allocate memory for shadow buffer");
+		return -ENOMEM;
+	}
 
-	tp->data[0] = malloc(s * h);
-	tp->data[1] = malloc(s * h);
-	if (!tp->data[0] || !tp->data[1]) {
-		log_error("cannot allocate memory for render-buffer");
+	tp->surf = pixman_image_create_bits_no_clear(PIXMAN_x8r8g8b8, w, h,
+						     (void*)tp->data, s);
+	if (!tp->surf) {
+		log_error("cannot create pixman surfaces");
 		ret = -ENOMEM;
 		goto err_free;
 	}
 
-	for (i = 0; i < 2; ++i) {
-		tp->format[i] = format;
-		tp->surf[i] = pixman_image_create_bits(format, w, h,
-						       (void*)tp->data[i], s);
-		if (!tp->surf[i]) {
-			log_error("cannot create pixman surfaces");
-			goto err_pixman;
-		}
-	}
-
 	tp->vbuf.width = w;
 	tp->vbuf.height = h;
 	tp->vbuf.stride = s;
 	tp->vbuf.format = UTERM_FORMAT_XRGB32;
-	tp->use_indirect = true;
+	tp->vbuf.data = tp->data;
+	tp->rows = txt->rows;
+
+	memset(buf, 0, sizeof(buf));
+	ret = uterm_display_get_buffers(txt->disp, buf,
+					UTERM_FORMAT_XRGB32 |
+					UTERM_FORMAT_RGB16 |
+					UTERM_FORMAT_RGB24);
+	if (ret) {
+		log_debug("cannot get buffers of display %p, copying full frames",
+			  txt->disp);
+		return 0;
+	}
+
+	for (i = 0; i < UTERM_MAX_BUFFERS; ++i) {
+		if (!buf[i].data)
+			continue;
+
+		tp->dirty[i] = malloc(sizeof(*tp->dirty[i]) * tp->rows);
+		if (!tp->dirty[i]) {
+			log_error("cannot allocate dirty spans");
+			ret = -ENOMEM;
+			goto err_dirty;
+		}
+
+		/* the content of the display buffer is unknown */
+		for (j = 0; j < tp->rows; ++j) {
+			tp->dirty[i][j].x1 = 0;
+			tp->dirty[i][j].x2 = txt->cols;
+		}
+	}
+
+	tp->exact = true;
 	return 0;
 
-err_pixman:
-	if (tp->surf[1])
-		pixman_image_unref(tp->surf[1]);
-	tp->surf[1] = NULL;
-	if (tp->surf[0])
-		pixman_image_unref(tp->surf[0]);
-	tp->surf[0] = NULL;
+err_dirty:
+	free_dirty(tp);
+	pixman_image_unref(tp->surf);
+	tp->surf = NULL;
 err_free:
-	free(tp->data[1]);
-	free(tp->data[0]);
-	tp->data[1] = NULL;
-	tp->data[0] = NULL;
+	free(tp->data);
+	tp->data = NULL;
 	return ret;
 }
 
@@ -196,49 +246,15 @@ static int tp_set(struct kmscon_text *txt)
 	if (ret)
 		goto err_htable;
 
-	/*
-	 * TODO: It is actually faster to use a local shadow buffer and then
-	 * blit all data to the framebuffer afterwards. Reads seem to be
-	 * horribly slow on some mmap'ed framebuffers. However, that's not true
-	 * for all so we actually don't know which to use here.
-	 */
-	ret = uterm_display_get_buffers(txt->disp, tp->buf,
-					UTERM_FORMAT_XRGB32);
-	if (ret) {
-		log_warning("cannot get buffers for display %p",
-			    txt->disp);
-		ret = alloc_indirect(txt, w, h);
-		if (ret)
-			goto err_htable_bold;
-	} else {
-		tp->format[0] = format_u2p(tp->buf[0].format);
-		tp->surf[0] = pixman_image_create_bits_no_clear(tp->format[0],
-					tp->buf[0].width, tp->buf[0].height,
-					(void*)tp->buf[0].data,
-					tp->buf[0].stride);
-		tp->format[1] = format_u2p(tp->buf[1].format);
-		tp->surf[1] = pixman_image_create_bits_no_clear(tp->format[1],
-					tp->buf[1].width, tp->buf[1].height,
-					(void*)tp->buf[1].data,
-					tp->buf[1].stride);
-		if (!tp->surf[0] || !tp->surf[1]) {
-			log_error("cannot create pixman surfaces");
-			goto err_ctx;
-		}
-	}
-
 	txt->cols = w / txt->font->attr.width;
 	txt->rows = h / txt->font->attr.height;
 
+	ret = alloc_shadow(txt, w, h);
+	if (ret)
+		goto err_htable_bold;
+
 	return 0;
 
-err_ctx:
-	if (tp->surf[1])
-		pixman_image_unref(tp->surf[1]);
-	if (tp->surf[0])
-		pixman_image_unref(tp->surf[0]);
-	free(tp->data[1]);
-	free(tp->data[0]);
 err_htable_bold:
 	shl_hashtable_free(tp->bold_glyphs);
 err_htable:
@@ -252,10 +268,9 @@ static void tp_unset(struct kmscon_text *txt)
 {
 	struct tp_pixman *tp = txt->data;
 
-	pixman_image_unref(tp->surf[1]);
-	pixman_image_unref(tp->surf[0]);
-	free(tp->data[1]);
-	free(tp->data[0]);
+	free_dirty(tp);
+	pixman_image_unref(tp->surf);
+	free(tp->data);
 	shl_hashtable_free(tp->bold_glyphs);
 	shl_hashtable_free(tp->glyphs);
 	pixman_image_unref(tp->white);
@@ -365,6 +380,10 @@ static int find_glyph(struct kmscon_text *txt, struct tp_glyph **out,
 	if (ret)
 		goto err_pixman;
 
+	tp->glyph_mem += sizeof(*glyph);
+	if (glyph->data)
+		tp->glyph_mem += stride * buf->height;
+
 	*out = glyph;
 	return 0;
 
@@ -379,7 +398,6 @@ static int tp_prepare(struct kmscon_text *txt)
 {
 	struct tp_pixman *tp = txt->data;
 	int ret;
-	pixman_image_t *img;
 
 	ret = uterm_display_use(txt->disp, NULL);
 	if (ret < 0) {
@@ -388,14 +406,38 @@ static int tp_prepare(struct kmscon_text *txt)
 	}
 
 	tp->cur = ret;
-	img = tp->surf[tp->cur];
-	tp->c_bpp = PIXMAN_FORMAT_BPP(tp->format[tp->cur]);
-	tp->c_data = pixman_image_get_data(img);
-	tp->c_stride = pixman_image_get_stride(img);
+	tp->c_bpp = 32;
+	tp->c_data = pixman_image_get_data(tp->surf);
+	tp->c_stride = pixman_image_get_stride(tp->surf);
 
 	return 0;
 }
 
+static void tp_damage(struct tp_pixman *tp, unsigned int posx,
+		      unsigned int posy)
+{
+	struct tp_span *span;
+	unsigned int i;
+
+	if (!tp->exact || posy >= tp->rows)
+		return;
+
+	for (i = 0; i < UTERM_MAX_BUFFERS; ++i) {
+		if (!tp->dirty[i])
+			continue;
+
+		span = &tp->dirty[i][posy];
+		if (span->x1 == span->x2) {
+			span->x1 = posx;
+			span->x2 = posx + 1;
+		} else if (posx < span->x1) {
+			span->x1 = posx;
+		} else if (posx >= span->x2) {
+			span->x2 = posx + 1;
+		}
+	}
+}
+
 static int tp_draw(struct kmscon_text *txt,
 		   uint64_t id, const uint32_t *ch, size_t len,
 		   unsigned int width,
@@ -416,6 +458,8 @@ static int tp_draw(struct kmscon_text *txt,
 	if (ret)
 		return ret;
 
+	tp_damage(tp, posx, posy);
+
 	if (attr->inverse) {
 		bc = (attr->fr << 16) | (attr->fg << 8) | (attr->fb);
 		fc.red = attr->br << 8;
@@ -450,7 +494,7 @@ static int tp_draw(struct kmscon_text *txt,
 		pixman_image_composite(PIXMAN_OP_SRC,
 				       col,
 				       glyph->surf,
-				       tp->surf[tp->cur],
+				       tp->surf,
 				       0, 0, 0, 0,
 				       posx * txt->font->attr.width,
 				       posy * txt->font->attr.height,
@@ -467,7 +511,7 @@ static int tp_draw(struct kmscon_text *txt,
 		pixman_image_composite(PIXMAN_OP_OVER,
 				       col,
 				       glyph->surf,
-				       tp->surf[tp->cur],
+				       tp->surf,
 				       0, 0, 0, 0,
 				       posx * txt->font->attr.width,
 				       posy * txt->font->attr.height,
@@ -480,21 +524,77 @@ static int tp_draw(struct kmscon_text *txt,
 	return 0;
 }
 
+static size_t tp_memory(struct kmscon_text *txt)
+{
+	struct tp_pixman *tp = txt->data;
+	size_t size;
+	unsigned int i;
+
+	size = tp->glyph_mem;
+	size += (size_t)tp->vbuf.stride * tp->vbuf.height;
+	for (i = 0; i < UTERM_MAX_BUFFERS; ++i) {
+		if (tp->dirty[i])
+			size += sizeof(*tp->dirty[i]) * tp->rows;
+	}
+
+	return size;
+}
+
+/*
+ * Copies the dirty cells of the current display buffer from the shadow buffer
+ * to the display. Consecutive rows with equal spans are copied at once, so a
+ * full redraw is a single blit.
+ */
 static int tp_render(struct kmscon_text *txt)
 {
 	struct tp_pixman *tp = txt->data;
+	struct uterm_video_buffer buf;
+	struct tp_span *dirty, *span;
+	unsigned int fw, fh, i, j;
 	int ret;
 
-	if (!tp->use_indirect)
+	if (!tp->exact || tp->cur >= UTERM_MAX_BUFFERS || !tp->dirty[tp->cur]) {
+		ret = uterm_display_blit(txt->disp, &tp->vbuf, 0, 0);
+		if (ret) {
+			log_error("cannot blit back-buffer to display: %d",
+				  ret);
+			return ret;
+		}
+
 		return 0;
+	}
 
-	tp->vbuf.data = tp->data[tp->cur];
-	ret = uterm_display_blit(txt->disp, &tp->vbuf, 0, 0);
-	if (ret) {
-		log_error("cannot blit back-buffer to display: %d", ret);
-		return ret;
+	dirty = tp->dirty[tp->cur];
+	fw = txt->font->attr.width;
+	fh = txt->font->attr.height;
+
+	for (i = 0; i < tp->rows; i = j) {
+		span = &dirty[i];
+		for (j = i + 1; j < tp->rows; ++j) {
+			if (dirty[j].x1 != span->x1 || dirty[j].x2 != span->x2)
+				break;
+		}
+
+		if (span->x1 == span->x2)
+			continue;
+
+		buf = tp->vbuf;
+		buf.width = (span->x2 - span->x1) * fw;
+		buf.height = (j - i) * fh;
+		buf.data = &tp->data[i * fh * buf.stride + span->x1 * fw * 4];
+
+		ret = uterm_display_blit(txt->disp, &buf, span->x1 * fw,
+					 i * fh);
+		if (ret) {
+			log_error("cannot blit back-buffer to display: %d",
+				  ret);
+			return ret;
+		}
 	}
 
+	for (i = 0; i < tp->rows; ++i)
+		dirty[i].x1 = dirty[i].x2 = 0;
+
 	return 0;
 }
 
@@ -509,4 +609,5 @@ struct kmscon_text_ops kmscon_text_pixman_ops = {
 	.draw = tp_draw,
 	.render = tp_render,
 	.abort = NULL,
+	.memory = tp_memory,
 };
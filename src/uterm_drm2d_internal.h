@@ -40,11 +40,21 @@ struct uterm_drm2d_rb {
 	uint32_t stride;
 	uint64_t size;
 	void *map;
+	/* swaps since this buffer was queued, 0 if its content is undefined */
+	unsigned int age;
 };
 
+/*
+ * Buffers are used round-robin. @current_rb is scanned out or pending,
+ * @queued_rb (or -1) waits for the pending page-flip and @back_rb is
+ * rendered into.
+ */
 struct uterm_drm2d_display {
+	unsigned int num_rb;
 	int current_rb;
-	struct uterm_drm2d_rb rb[2];
+	int queued_rb;
+	int back_rb;
+	struct uterm_drm2d_rb rb[UTERM_MAX_BUFFERS];
 };
 
 struct uterm_drm2d_video {
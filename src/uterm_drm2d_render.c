@@ -39,6 +39,7 @@
 #include <xf86drmMode.h>
 #include "eloop.h"
 #include "shl_log.h"
+#include "shl_misc.h"
 #include "uterm_drm_shared_internal.h"
 #include "uterm_drm2d_internal.h"
 #include "uterm_video.h"
@@ -60,7 +61,7 @@ int uterm_drm2d_display_blit(struct uterm_display *disp,
 	if (!buf || buf->format != UTERM_FORMAT_XRGB32)
 		return -EINVAL;
 
-	rb = &d2d->rb[d2d->current_rb ^ 1];
+	rb = &d2d->rb[d2d->back_rb];
 	sw = uterm_drm_mode_get_width(disp->current_mode);
 	sh = uterm_drm_mode_get_height(disp->current_mode);
 
@@ -85,10 +86,11 @@ int uterm_drm2d_display_blit(struct uterm_display *disp,
 	src = buf->data;
 
 	while (height--) {
-		memcpy(dst, src, 4 * width);
+		shl_memcpy_stream(dst, src, 4 * width);
 		dst += rb->stride;
 		src += buf->stride;
 	}
+	shl_memcpy_stream_end();
 
 	return 0;
 }
@@ -108,7 +110,7 @@ int uterm_drm2d_display_fake_blendv(struct uterm_display *disp,
 	if (!req)
 		return -EINVAL;
 
-	rb = &d2d->rb[d2d->current_rb ^ 1];
+	rb = &d2d->rb[d2d->back_rb];
 	sw = uterm_drm_mode_get_width(disp->current_mode);
 	sh = uterm_drm_mode_get_height(disp->current_mode);
 
@@ -195,7 +197,7 @@ int uterm_drm2d_display_fill(struct uterm_display *disp,
 	struct uterm_drm2d_rb *rb;
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
 
-	rb = &d2d->rb[d2d->current_rb ^ 1];
+	rb = &d2d->rb[d2d->back_rb];
 	sw = uterm_drm_mode_get_width(disp->current_mode);
 	sh = uterm_drm_mode_get_height(disp->current_mode);
 
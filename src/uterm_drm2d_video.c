@@ -160,9 +160,9 @@ static int display_activate(struct uterm_display *disp, struct uterm_mode *mode)
 {
 	struct uterm_video *video = disp->video;
 	struct uterm_drm_video *vdrm = video->data;
-	struct uterm_drm_display *ddrm = disp->data;
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
 	int ret;
+	unsigned int i;
 	drmModeModeInfo *minfo;
 
 	if (!mode)
@@ -176,34 +176,32 @@ static int display_activate(struct uterm_display *disp, struct uterm_mode *mode)
 	if (ret)
 		return ret;
 
+	d2d->num_rb = video->buffers ? video->buffers : 2;
 	d2d->current_rb = 0;
+	d2d->queued_rb = -1;
+	d2d->back_rb = 1;
 	disp->current_mode = mode;
 
-	ret = init_rb(disp, &d2d->rb[0]);
-	if (ret)
-		goto err_saved;
-
-	ret = init_rb(disp, &d2d->rb[1]);
-	if (ret)
-		goto err_rb;
+	for (i = 0; i < d2d->num_rb; ++i) {
+		ret = init_rb(disp, &d2d->rb[i]);
+		if (ret)
+			goto err_rb;
+		d2d->rb[i].age = 0;
+	}
 
-	ret = drmModeSetCrtc(vdrm->fd, ddrm->crtc_id,
-			     d2d->rb[0].fb, 0, 0, &ddrm->conn_id, 1,
-			     minfo);
+	ret = uterm_drm_display_modeset(disp, d2d->rb[0].fb, minfo);
 	if (ret) {
 		log_err("cannot set drm-crtc");
-		ret = -EFAULT;
-		goto err_fb;
+		goto err_rb;
 	}
 
+	log_debug("using %u buffers on display %p", d2d->num_rb, disp);
 	disp->flags |= DISPLAY_ONLINE;
 	return 0;
 
-err_fb:
-	destroy_rb(disp, &d2d->rb[1]);
 err_rb:
-	destroy_rb(disp, &d2d->rb[0]);
-err_saved:
+	while (i--)
+		destroy_rb(disp, &d2d->rb[i]);
 	disp->current_mode = NULL;
 	uterm_drm_display_deactivate(disp, vdrm->fd);
 	return ret;
@@ -213,14 +211,17 @@ static void display_deactivate(struct uterm_display *disp)
 {
 	struct uterm_drm_video *vdrm;
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+	unsigned int i;
 
 	vdrm = disp->video->data;
 	log_info("deactivating display %p", disp);
 
+	d2d->queued_rb = -1;
+	disp->flags &= ~DISPLAY_QUEUE;
 	uterm_drm_display_deactivate(disp, vdrm->fd);
 
-	destroy_rb(disp, &d2d->rb[1]);
-	destroy_rb(disp, &d2d->rb[0]);
+	for (i = 0; i < d2d->num_rb; ++i)
+		destroy_rb(disp, &d2d->rb[i]);
 	disp->current_mode = NULL;
 }
 
@@ -231,7 +232,7 @@ static int display_use(struct uterm_display *disp, bool *opengl)
 	if (opengl)
 		*opengl = false;
 
-	return d2d->current_rb ^ 1;
+	return d2d->back_rb;
 }
 
 static int display_get_buffers(struct uterm_display *disp,
@@ -240,12 +241,12 @@ static int display_get_buffers(struct uterm_display *disp,
 {
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
 	struct uterm_drm2d_rb *rb;
-	int i;
+	unsigned int i;
 
 	if (!(formats & UTERM_FORMAT_XRGB32))
 		return -EOPNOTSUPP;
 
-	for (i = 0; i < 2; ++i) {
+	for (i = 0; i < d2d->num_rb; ++i) {
 		rb = &d2d->rb[i];
 		buffer[i].width = uterm_drm_mode_get_width(disp->current_mode);
 		buffer[i].height = uterm_drm_mode_get_height(disp->current_mode);
@@ -257,17 +258,90 @@ static int display_get_buffers(struct uterm_display *disp,
 	return 0;
 }
 
+/* ages all buffers by one frame and advances the back-buffer */
+static void advance_rb(struct uterm_drm2d_display *d2d, int rb)
+{
+	unsigned int i;
+
+	for (i = 0; i < d2d->num_rb; ++i) {
+		if (d2d->rb[i].age)
+			++d2d->rb[i].age;
+	}
+
+	d2d->rb[rb].age = 1;
+	d2d->back_rb = (rb + 1) % d2d->num_rb;
+}
+
+/* with spare buffers, allow one frame to be queued behind a pending flip */
+static void update_queue(struct uterm_display *disp)
+{
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+
+	if (d2d->num_rb > 2 && d2d->queued_rb < 0 &&
+	    (disp->flags & DISPLAY_VSYNC))
+		disp->flags |= DISPLAY_QUEUE;
+	else
+		disp->flags &= ~DISPLAY_QUEUE;
+}
+
 static int display_swap(struct uterm_display *disp, bool immediate)
 {
 	int ret, rb;
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
 
-	rb = d2d->current_rb ^ 1;
+	rb = d2d->back_rb;
+
+	if (immediate) {
+		d2d->queued_rb = -1;
+	} else if (disp->flags & DISPLAY_VSYNC) {
+		if (!(disp->flags & DISPLAY_QUEUE))
+			return -EBUSY;
+
+		d2d->queued_rb = rb;
+		advance_rb(d2d, rb);
+		update_queue(disp);
+		return 0;
+	}
+
 	ret = uterm_drm_display_swap(disp, d2d->rb[rb].fb, immediate);
 	if (ret)
 		return ret;
 
 	d2d->current_rb = rb;
+	advance_rb(d2d, rb);
+	update_queue(disp);
+	return 0;
+}
+
+static int display_get_age(struct uterm_display *disp)
+{
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+
+	return d2d->rb[d2d->back_rb].age;
+}
+
+static int display_capture(struct uterm_display *disp,
+			   struct uterm_video_capture *cap)
+{
+	struct uterm_drm_video *vdrm = disp->video->data;
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+	struct uterm_drm2d_rb *rb = &d2d->rb[d2d->current_rb];
+	int ret;
+
+	cap->width = uterm_drm_mode_get_width(disp->current_mode);
+	cap->height = uterm_drm_mode_get_height(disp->current_mode);
+	cap->stride = rb->stride;
+	cap->format = UTERM_FORMAT_XRGB32;
+	cap->size = rb->size;
+	cap->data = rb->map;
+
+	ret = drmPrimeHandleToFD(vdrm->fd, rb->handle, DRM_CLOEXEC, &cap->fd);
+	if (ret) {
+		log_debug("cannot export dumb buffer as dma-buf (%d): %m",
+			  errno);
+		cap->fd = -1;
+	}
+
 	return 0;
 }
 
@@ -283,6 +357,10 @@ static const struct display_ops drm2d_display_ops = {
 	.blit = uterm_drm2d_display_blit,
 	.fake_blendv = uterm_drm2d_display_fake_blendv,
 	.fill = uterm_drm2d_display_fill,
+	.get_age = display_get_age,
+	.set_cursor = uterm_drm_display_set_cursor,
+	.move_cursor = uterm_drm_display_move_cursor,
+	.capture = display_capture,
 };
 
 static void show_displays(struct uterm_video *video)
@@ -310,12 +388,49 @@ static void show_displays(struct uterm_video *video)
 		 * wakeup/sleep. */
 
 		d2d = uterm_drm_display_get_data(iter);
+		d2d->queued_rb = -1;
+		iter->flags &= ~DISPLAY_QUEUE;
 		rb = &d2d->rb[d2d->current_rb];
 		memset(rb->map, 0, rb->size);
 		uterm_drm_display_wait_pflip(iter);
 	}
 }
 
+static void page_flip_handler(struct uterm_display *disp)
+{
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+	int ret, rb = d2d->queued_rb;
+
+	if (rb >= 0) {
+		d2d->queued_rb = -1;
+		ret = uterm_drm_display_swap(disp, d2d->rb[rb].fb, false);
+		if (ret)
+			log_warning("cannot flip queued buffer on display %p: %d",
+				    disp, ret);
+		else
+			d2d->current_rb = rb;
+	}
+
+	update_queue(disp);
+}
+
+/* The page-flip to the current buffer failed, so its predecessor is still
+ * scanned out. The queued frame is dropped and the failed buffer becomes the
+ * back-buffer again. Ages are reset as the user redraws everything anyway. */
+static void abort_handler(struct uterm_display *disp)
+{
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+	unsigned int i;
+
+	d2d->queued_rb = -1;
+	d2d->back_rb = d2d->current_rb;
+	d2d->current_rb = (d2d->current_rb + d2d->num_rb - 1) % d2d->num_rb;
+	for (i = 0; i < d2d->num_rb; ++i)
+		d2d->rb[i].age = 0;
+
+	update_queue(disp);
+}
+
 static int video_init(struct uterm_video *video, const char *node)
 {
 	int ret;
@@ -323,7 +438,7 @@ static int video_init(struct uterm_video *video, const char *node)
 	struct uterm_drm_video *vdrm;
 
 	ret = uterm_drm_video_init(video, node, &drm2d_display_ops,
-				   NULL, NULL);
+				   page_flip_handler, abort_handler, NULL);
 	if (ret)
 		return ret;
 	vdrm = video->data;
@@ -378,6 +493,7 @@ static const struct video_ops drm2d_video_ops = {
 	.poll = video_poll,
 	.sleep = video_sleep,
 	.wake_up = video_wake_up,
+	.probe = uterm_drm_video_probe,
 };
 
 static const struct uterm_video_module drm2d_module = {
@@ -140,7 +140,6 @@ static int display_activate(struct uterm_display *disp,
 	struct uterm_video *video = disp->video;
 	struct uterm_drm_video *vdrm;
 	struct uterm_drm3d_video *v3d;
-	struct uterm_drm_display *ddrm = disp->data;
 	struct uterm_drm3d_display *d3d = uterm_drm_display_get_data(disp);
 	int ret;
 	struct gbm_bo *bo;
@@ -211,11 +210,9 @@ static int display_activate(struct uterm_display *disp,
 		goto err_bo;
 	}
 
-	ret = drmModeSetCrtc(vdrm->fd, ddrm->crtc_id, d3d->current->fb,
-			     0, 0, &ddrm->conn_id, 1, minfo);
+	ret = uterm_drm_display_modeset(disp, d3d->current->fb, minfo);
 	if (ret) {
 		log_err("cannot set drm-crtc");
-		ret = -EFAULT;
 		goto err_bo;
 	}
 
@@ -340,6 +337,45 @@ static int display_swap(struct uterm_display *disp, bool immediate)
 	return 0;
 }
 
+/* GL renders into gbm buffers without CPU mapping, so we can only export them */
+static int display_capture(struct uterm_display *disp,
+			   struct uterm_video_capture *cap)
+{
+	struct uterm_drm3d_display *d3d = uterm_drm_display_get_data(disp);
+	struct gbm_bo *bo;
+
+	if (!d3d->current)
+		return -ENODATA;
+
+	bo = d3d->current->bo;
+	cap->width = gbm_bo_get_width(bo);
+	cap->height = gbm_bo_get_height(bo);
+#ifdef BUILD_HAVE_GBM_BO_GET_PITCH
+	cap->stride = gbm_bo_get_pitch(bo);
+#else
+	cap->stride = gbm_bo_get_stride(bo);
+#endif
+	cap->format = UTERM_FORMAT_XRGB32;
+	cap->fourcc = gbm_bo_get_format(bo);
+#ifdef BUILD_HAVE_GBM_BO_GET_MODIFIER
+	cap->modifier = gbm_bo_get_modifier(bo);
+	cap->offset = gbm_bo_get_offset(bo, 0);
+#else
+	/* the driver may have picked a tiled layout we cannot query */
+	cap->modifier = UTERM_MODIFIER_INVALID;
+#endif
+	cap->size = (size_t)cap->stride * cap->height;
+
+	cap->fd = gbm_bo_get_fd(bo);
+	if (cap->fd < 0) {
+		log_debug("cannot export gbm buffer as dma-buf");
+		cap->fd = -1;
+		return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
 static const struct display_ops drm_display_ops = {
 	.init = display_init,
 	.destroy = display_destroy,
@@ -352,6 +388,9 @@ static const struct display_ops drm_display_ops = {
 	.blit = uterm_drm3d_display_blit,
 	.fake_blendv = uterm_drm3d_display_fake_blendv,
 	.fill = uterm_drm3d_display_fill,
+	.set_cursor = uterm_drm_display_set_cursor,
+	.move_cursor = uterm_drm_display_move_cursor,
+	.capture = display_capture,
 };
 
 static void show_displays(struct uterm_video *video)
@@ -394,6 +433,17 @@ static void page_flip_handler(struct uterm_display *disp)
 	}
 }
 
+/* the page-flip to @next failed, hand it back to gbm without showing it */
+static void abort_handler(struct uterm_display *disp)
+{
+	struct uterm_drm3d_display *d3d = uterm_drm_display_get_data(disp);
+
+	if (d3d->next) {
+		gbm_surface_release_buffer(d3d->gbm, d3d->next->bo);
+		d3d->next = NULL;
+	}
+}
+
 static int video_init(struct uterm_video *video, const char *node)
 {
 	static const EGLint conf_att[] = {
@@ -423,7 +473,7 @@ static int video_init(struct uterm_video *video, const char *node)
 	memset(v3d, 0, sizeof(*v3d));
 
 	ret = uterm_drm_video_init(video, node, &drm_display_ops,
-				   page_flip_handler, v3d);
+				   page_flip_handler, abort_handler, v3d);
 	if (ret)
 		goto err_free;
 	vdrm = video->data;
@@ -566,6 +616,7 @@ static const struct video_ops drm_video_ops = {
 	.poll = video_poll,
 	.sleep = video_sleep,
 	.wake_up = video_wake_up,
+	.probe = uterm_drm_video_probe,
 };
 
 static const struct uterm_video_module drm3d_module = {
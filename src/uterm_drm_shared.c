@@ -33,9 +33,11 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include "shl_latency.h"
 #include "shl_log.h"
 #include "shl_timer.h"
 #include "uterm_drm_shared_internal.h"
@@ -196,6 +198,416 @@ int uterm_drm_get_dpms(int fd, drmModeConnector *conn)
 	return UTERM_DPMS_UNKNOWN;
 }
 
+static const struct {
+	uint32_t type;
+	const char *name;
+} drm_props[UTERM_DRM_PROP_NUM] = {
+	[UTERM_DRM_CONN_CRTC_ID] = { DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID" },
+	[UTERM_DRM_CRTC_MODE_ID] = { DRM_MODE_OBJECT_CRTC, "MODE_ID" },
+	[UTERM_DRM_CRTC_ACTIVE] = { DRM_MODE_OBJECT_CRTC, "ACTIVE" },
+	[UTERM_DRM_PLANE_FB_ID] = { DRM_MODE_OBJECT_PLANE, "FB_ID" },
+	[UTERM_DRM_PLANE_CRTC_ID] = { DRM_MODE_OBJECT_PLANE, "CRTC_ID" },
+	[UTERM_DRM_PLANE_SRC_X] = { DRM_MODE_OBJECT_PLANE, "SRC_X" },
+	[UTERM_DRM_PLANE_SRC_Y] = { DRM_MODE_OBJECT_PLANE, "SRC_Y" },
+	[UTERM_DRM_PLANE_SRC_W] = { DRM_MODE_OBJECT_PLANE, "SRC_W" },
+	[UTERM_DRM_PLANE_SRC_H] = { DRM_MODE_OBJECT_PLANE, "SRC_H" },
+	[UTERM_DRM_PLANE_CRTC_X] = { DRM_MODE_OBJECT_PLANE, "CRTC_X" },
+	[UTERM_DRM_PLANE_CRTC_Y] = { DRM_MODE_OBJECT_PLANE, "CRTC_Y" },
+	[UTERM_DRM_PLANE_CRTC_W] = { DRM_MODE_OBJECT_PLANE, "CRTC_W" },
+	[UTERM_DRM_PLANE_CRTC_H] = { DRM_MODE_OBJECT_PLANE, "CRTC_H" },
+};
+
+/* Looks up the IDs of all properties in @drm_props that belong to object
+ * type @type and stores them in @props. If @name is given, the value of the
+ * property with that name is stored in @value. */
+static int get_props(int fd, uint32_t obj, uint32_t type, uint32_t *props,
+		     const char *name, uint64_t *value)
+{
+	drmModeObjectProperties *list;
+	drmModePropertyRes *prop;
+	unsigned int i, j;
+
+	list = drmModeObjectGetProperties(fd, obj, type);
+	if (!list) {
+		log_error("cannot get properties of DRM object %u (%d): %m",
+			  obj, errno);
+		return -EFAULT;
+	}
+
+	for (i = 0; i < list->count_props; ++i) {
+		prop = drmModeGetProperty(fd, list->props[i]);
+		if (!prop)
+			continue;
+
+		for (j = 0; props && j < UTERM_DRM_PROP_NUM; ++j) {
+			if (drm_props[j].type == type &&
+			    !strcmp(drm_props[j].name, prop->name))
+				props[j] = prop->prop_id;
+		}
+		if (name && !strcmp(name, prop->name))
+			*value = list->prop_values[i];
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(list);
+	return 0;
+}
+
+static bool plane_is_used(struct uterm_video *video, uint32_t plane_id)
+{
+	struct shl_dlist *iter;
+	struct uterm_display *disp;
+	struct uterm_drm_display *ddrm;
+
+	shl_dlist_for_each(iter, &video->displays) {
+		disp = shl_dlist_entry(iter, struct uterm_display, list);
+		ddrm = disp->data;
+		if (ddrm->plane_id == plane_id)
+			return true;
+	}
+
+	return false;
+}
+
+/* Finds the primary plane of the CRTC of @disp and caches all property IDs
+ * needed for atomic commits. If anything is missing, the display keeps
+ * using the legacy modesetting API. */
+static void atomic_init_display(struct uterm_display *disp, int fd,
+				drmModeRes *res)
+{
+	struct uterm_drm_display *ddrm = disp->data;
+	drmModePlaneRes *planes;
+	drmModePlane *plane;
+	uint64_t type;
+	uint32_t id = 0;
+	unsigned int i;
+	int idx;
+
+	for (idx = 0; idx < res->count_crtcs; ++idx) {
+		if (res->crtcs[idx] == ddrm->crtc_id)
+			break;
+	}
+	if (idx >= res->count_crtcs || idx >= 32)
+		return;
+
+	planes = drmModeGetPlaneResources(fd);
+	if (!planes) {
+		log_warning("cannot get DRM planes (%d): %m", errno);
+		return;
+	}
+
+	for (i = 0; i < planes->count_planes && !id; ++i) {
+		plane = drmModeGetPlane(fd, planes->planes[i]);
+		if (!plane)
+			continue;
+
+		type = DRM_PLANE_TYPE_OVERLAY;
+		if ((plane->possible_crtcs & (1U << idx)) &&
+		    !plane_is_used(disp->video, plane->plane_id) &&
+		    !get_props(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE,
+			       NULL, "type", &type) &&
+		    type == DRM_PLANE_TYPE_PRIMARY)
+			id = plane->plane_id;
+
+		drmModeFreePlane(plane);
+	}
+
+	drmModeFreePlaneResources(planes);
+
+	if (!id) {
+		log_warning("no primary plane for DRM-CRTC %d, using legacy modesetting",
+			    ddrm->crtc_id);
+		return;
+	}
+
+	memset(ddrm->props, 0, sizeof(ddrm->props));
+	if (get_props(fd, ddrm->conn_id, DRM_MODE_OBJECT_CONNECTOR,
+		      ddrm->props, NULL, NULL) ||
+	    get_props(fd, ddrm->crtc_id, DRM_MODE_OBJECT_CRTC,
+		      ddrm->props, NULL, NULL) ||
+	    get_props(fd, id, DRM_MODE_OBJECT_PLANE,
+		      ddrm->props, NULL, NULL))
+		return;
+
+	for (i = 0; i < UTERM_DRM_PROP_NUM; ++i) {
+		if (!ddrm->props[i]) {
+			log_warning("DRM property %s missing, using legacy modesetting",
+				    drm_props[i].name);
+			return;
+		}
+	}
+
+	ddrm->plane_id = id;
+	log_debug("using primary plane %u for display %p", id, disp);
+}
+
+static int atomic_add_plane(drmModeAtomicReq *req,
+			    struct uterm_drm_display *ddrm, uint32_t fb,
+			    drmModeModeInfo *mode)
+{
+	uint64_t val[UTERM_DRM_PROP_NUM];
+	unsigned int i;
+
+	val[UTERM_DRM_PLANE_FB_ID] = fb;
+	val[UTERM_DRM_PLANE_CRTC_ID] = ddrm->crtc_id;
+	val[UTERM_DRM_PLANE_SRC_X] = 0;
+	val[UTERM_DRM_PLANE_SRC_Y] = 0;
+	val[UTERM_DRM_PLANE_SRC_W] = (uint64_t)mode->hdisplay << 16;
+	val[UTERM_DRM_PLANE_SRC_H] = (uint64_t)mode->vdisplay << 16;
+	val[UTERM_DRM_PLANE_CRTC_X] = 0;
+	val[UTERM_DRM_PLANE_CRTC_Y] = 0;
+	val[UTERM_DRM_PLANE_CRTC_W] = mode->hdisplay;
+	val[UTERM_DRM_PLANE_CRTC_H] = mode->vdisplay;
+
+	for (i = UTERM_DRM_PLANE_FB_ID; i <= UTERM_DRM_PLANE_CRTC_H; ++i) {
+		if (drmModeAtomicAddProperty(req, ddrm->plane_id,
+					     ddrm->props[i], val[i]) < 0)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Performs a blocking atomic modeset. The new state is validated with a
+ * test-only commit first so invalid modes are rejected without touching the
+ * hardware. Returns -EFAULT if the real commit failed and the caller should
+ * retry with the legacy API. */
+static int atomic_modeset(struct uterm_display *disp, uint32_t fb,
+			  drmModeModeInfo *mode)
+{
+	struct uterm_drm_display *ddrm = disp->data;
+	struct uterm_drm_video *vdrm = disp->video->data;
+	drmModeAtomicReq *req;
+	uint32_t blob;
+	int ret;
+
+	ret = drmModeCreatePropertyBlob(vdrm->fd, mode, sizeof(*mode), &blob);
+	if (ret) {
+		log_error("cannot create DRM mode blob (%d): %m", errno);
+		return -EFAULT;
+	}
+
+	req = drmModeAtomicAlloc();
+	if (!req) {
+		ret = -ENOMEM;
+		goto err_blob;
+	}
+
+	if (drmModeAtomicAddProperty(req, ddrm->conn_id,
+				     ddrm->props[UTERM_DRM_CONN_CRTC_ID],
+				     ddrm->crtc_id) < 0 ||
+	    drmModeAtomicAddProperty(req, ddrm->crtc_id,
+				     ddrm->props[UTERM_DRM_CRTC_MODE_ID],
+				     blob) < 0 ||
+	    drmModeAtomicAddProperty(req, ddrm->crtc_id,
+				     ddrm->props[UTERM_DRM_CRTC_ACTIVE],
+				     1) < 0 ||
+	    atomic_add_plane(req, ddrm, fb, mode)) {
+		ret = -ENOMEM;
+		goto err_req;
+	}
+
+	ret = drmModeAtomicCommit(vdrm->fd, req,
+				  DRM_MODE_ATOMIC_TEST_ONLY |
+				  DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+	if (ret) {
+		log_warning("mode %s rejected on display %p (%d): %m",
+			    mode->name, disp, errno);
+		ret = -EINVAL;
+		goto err_req;
+	}
+
+	ret = drmModeAtomicCommit(vdrm->fd, req,
+				  DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+	if (ret) {
+		log_warning("atomic modeset on display %p failed (%d): %m",
+			    disp, errno);
+		ret = -EFAULT;
+		goto err_req;
+	}
+
+	drmModeAtomicFree(req);
+	if (ddrm->mode_blob)
+		drmModeDestroyPropertyBlob(vdrm->fd, ddrm->mode_blob);
+	ddrm->mode_blob = blob;
+	return 0;
+
+err_req:
+	drmModeAtomicFree(req);
+err_blob:
+	drmModeDestroyPropertyBlob(vdrm->fd, blob);
+	return ret;
+}
+
+int uterm_drm_display_modeset(struct uterm_display *disp, uint32_t fb,
+			      drmModeModeInfo *mode)
+{
+	struct uterm_drm_display *ddrm = disp->data;
+	struct uterm_drm_video *vdrm = disp->video->data;
+	int ret;
+
+	if (vdrm->atomic && ddrm->plane_id) {
+		ret = atomic_modeset(disp, fb, mode);
+		if (ret != -EFAULT)
+			return ret;
+
+		log_warning("falling back to legacy modesetting");
+		vdrm->atomic = false;
+	}
+
+	ret = drmModeSetCrtc(vdrm->fd, ddrm->crtc_id, fb, 0, 0,
+			     &ddrm->conn_id, 1, mode);
+	if (ret) {
+		log_error("cannot set DRM-CRTC (%d): %m", errno);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static void do_pflips(struct ev_eloop *eloop, void *unused, void *data);
+static void do_commit(struct ev_eloop *eloop, void *unused, void *data);
+
+/* Drops a swap that never reached the hardware. The backend rolls back its
+ * buffer state and the user is told from idle context to redraw. */
+static void display_abort(struct uterm_display *disp)
+{
+	struct uterm_video *video = disp->video;
+	struct uterm_drm_video *vdrm = video->data;
+	struct uterm_drm_display *ddrm = disp->data;
+
+	ddrm->queued_fb = 0;
+	disp->flags &= ~(DISPLAY_PFLIP | DISPLAY_VSYNC);
+	disp->flags |= DISPLAY_ABORT;
+	if (vdrm->abort)
+		vdrm->abort(disp);
+
+	ev_eloop_register_idle_cb(video->eloop, do_pflips, video,
+				  EV_ONESHOT | EV_SINGLE);
+}
+
+/* Returns true if a page-flip was committed but its event is outstanding. */
+static bool flips_pending(struct uterm_video *video)
+{
+	struct uterm_display *disp;
+	struct uterm_drm_display *ddrm;
+	struct shl_dlist *iter;
+
+	shl_dlist_for_each(iter, &video->displays) {
+		disp = shl_dlist_entry(iter, struct uterm_display, list);
+		ddrm = disp->data;
+		if ((disp->flags & DISPLAY_VSYNC) &&
+		    !(disp->flags & DISPLAY_PFLIP) && !ddrm->queued_fb)
+			return true;
+	}
+
+	return false;
+}
+
+/* Commits the framebuffers of all displays with a queued page-flip in a single
+ * non-blocking atomic commit. If a flip is still in flight, the kernel returns
+ * EBUSY and the commit is retried after the next page-flip event. If the
+ * driver rejects atomic page-flips, the legacy API is used instead. Swaps that
+ * cannot be committed are aborted. */
+static void atomic_flush(struct uterm_video *video)
+{
+	struct uterm_drm_video *vdrm = video->data;
+	struct uterm_display *disp;
+	struct uterm_drm_display *ddrm;
+	struct shl_dlist *iter;
+	drmModeAtomicReq *req;
+	unsigned int num = 0;
+	int ret = -ENOMEM, err = ENOMEM;
+
+	ev_eloop_unregister_idle_cb(video->eloop, do_commit, video,
+				    EV_ONESHOT | EV_SINGLE);
+	vdrm->retry = false;
+
+	req = drmModeAtomicAlloc();
+	if (req) {
+		shl_dlist_for_each(iter, &video->displays) {
+			disp = shl_dlist_entry(iter, struct uterm_display,
+					       list);
+			ddrm = disp->data;
+			if (!ddrm->queued_fb)
+				continue;
+
+			ret = drmModeAtomicAddProperty(req, ddrm->plane_id,
+					ddrm->props[UTERM_DRM_PLANE_FB_ID],
+					ddrm->queued_fb);
+			if (ret < 0)
+				break;
+			++num;
+		}
+
+		if (!num) {
+			drmModeAtomicFree(req);
+			return;
+		}
+
+		if (ret >= 0) {
+			ret = drmModeAtomicCommit(vdrm->fd, req,
+						  DRM_MODE_ATOMIC_NONBLOCK |
+						  DRM_MODE_PAGE_FLIP_EVENT,
+						  video);
+			err = errno;
+		}
+		drmModeAtomicFree(req);
+	}
+
+	if (ret >= 0) {
+		shl_dlist_for_each(iter, &video->displays) {
+			disp = shl_dlist_entry(iter, struct uterm_display,
+					       list);
+			ddrm = disp->data;
+			ddrm->queued_fb = 0;
+		}
+		return;
+	}
+
+	if (err == EBUSY && flips_pending(video)) {
+		log_debug("atomic page-flip busy, retrying after next flip");
+		vdrm->retry = true;
+		return;
+	}
+
+	log_warning("atomic page-flip of %u displays failed (%d): %s",
+		    num, err, strerror(err));
+
+	/* EBUSY and EACCES are temporary (pending flip or lost DRM-Master)
+	 * and a legacy page-flip would fail the same way. Everything else
+	 * means the driver cannot do what we ask for. */
+	if (err != EBUSY && err != EACCES) {
+		log_warning("falling back to legacy page-flips");
+		vdrm->atomic = false;
+	}
+
+	shl_dlist_for_each(iter, &video->displays) {
+		disp = shl_dlist_entry(iter, struct uterm_display, list);
+		ddrm = disp->data;
+		if (!ddrm->queued_fb)
+			continue;
+
+		if (!vdrm->atomic &&
+		    !drmModePageFlip(vdrm->fd, ddrm->crtc_id, ddrm->queued_fb,
+				     DRM_MODE_PAGE_FLIP_EVENT, video)) {
+			ddrm->queued_fb = 0;
+			continue;
+		}
+
+		if (!vdrm->atomic)
+			log_error("cannot page-flip on DRM-CRTC (%d): %m",
+				  errno);
+		display_abort(disp);
+	}
+}
+
+static void do_commit(struct ev_eloop *eloop, void *unused, void *data)
+{
+	atomic_flush(data);
+}
+
 int uterm_drm_display_init(struct uterm_display *disp, void *data)
 {
 	struct uterm_drm_display *d;
@@ -218,6 +630,7 @@ void uterm_drm_display_destroy(struct uterm_display *disp)
 int uterm_drm_display_activate(struct uterm_display *disp, int fd)
 {
 	struct uterm_video *video = disp->video;
+	struct uterm_drm_video *vdrm = video->data;
 	struct uterm_drm_display *ddrm = disp->data;
 	drmModeRes *res;
 	drmModeConnector *conn;
@@ -248,10 +661,10 @@ int uterm_drm_display_activate(struct uterm_display *disp, int fd)
 	}
 
 	drmModeFreeConnector(conn);
-	drmModeFreeResources(res);
 
 	if (crtc < 0) {
 		log_warn("cannot find crtc for new display");
+		drmModeFreeResources(res);
 		return -ENODEV;
 	}
 
@@ -260,6 +673,163 @@ int uterm_drm_display_activate(struct uterm_display *disp, int fd)
 		drmModeFreeCrtc(ddrm->saved_crtc);
 	ddrm->saved_crtc = drmModeGetCrtc(fd, ddrm->crtc_id);
 
+	ddrm->plane_id = 0;
+	if (vdrm->atomic)
+		atomic_init_display(disp, fd, res);
+
+	drmModeFreeResources(res);
+	return 0;
+}
+
+static void cursor_destroy(struct uterm_display *disp, int fd)
+{
+	struct uterm_drm_display *ddrm = disp->data;
+	struct drm_mode_destroy_dumb dreq;
+	int ret;
+
+	if (!ddrm->cursor_handle)
+		return;
+
+	if (disp->video->flags & VIDEO_AWAKE)
+		drmModeSetCursor(fd, ddrm->crtc_id, 0, 0, 0);
+
+	munmap(ddrm->cursor_map, ddrm->cursor_size);
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = ddrm->cursor_handle;
+	ret = drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	if (ret)
+		log_warning("cannot destroy cursor buffer (%d/%d): %m",
+			    ret, errno);
+
+	ddrm->cursor_handle = 0;
+	ddrm->cursor_map = NULL;
+}
+
+static int cursor_init(struct uterm_display *disp, int fd)
+{
+	struct uterm_drm_display *ddrm = disp->data;
+	struct drm_mode_create_dumb req;
+	struct drm_mode_destroy_dumb dreq;
+	struct drm_mode_map_dumb mreq;
+	uint64_t width = 64, height = 64;
+	void *map;
+	int ret;
+
+	drmGetCap(fd, DRM_CAP_CURSOR_WIDTH, &width);
+	drmGetCap(fd, DRM_CAP_CURSOR_HEIGHT, &height);
+
+	memset(&req, 0, sizeof(req));
+	req.width = width;
+	req.height = height;
+	req.bpp = 32;
+
+	ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &req);
+	if (ret < 0) {
+		log_warning("cannot create cursor buffer (%d): %m", errno);
+		return -EFAULT;
+	}
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.handle = req.handle;
+
+	ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
+	if (ret) {
+		log_warning("cannot map cursor buffer (%d): %m", errno);
+		goto err_buf;
+	}
+
+	map = mmap(0, req.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		   mreq.offset);
+	if (map == MAP_FAILED) {
+		log_warning("cannot mmap cursor buffer (%d): %m", errno);
+		goto err_buf;
+	}
+	memset(map, 0, req.size);
+
+	ddrm->cursor_handle = req.handle;
+	ddrm->cursor_stride = req.pitch;
+	ddrm->cursor_size = req.size;
+	ddrm->cursor_width = req.width;
+	ddrm->cursor_height = req.height;
+	ddrm->cursor_map = map;
+	return 0;
+
+err_buf:
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = req.handle;
+	drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	return -EFAULT;
+}
+
+int uterm_drm_display_set_cursor(struct uterm_display *disp,
+				 const struct uterm_video_buffer *buf)
+{
+	struct uterm_drm_display *ddrm = disp->data;
+	struct uterm_drm_video *vdrm = disp->video->data;
+	const uint32_t *src;
+	uint32_t *dst;
+	unsigned int i, j;
+	int ret;
+
+	if (!buf) {
+		ret = drmModeSetCursor(vdrm->fd, ddrm->crtc_id, 0, 0, 0);
+		if (ret) {
+			log_warning("cannot hide cursor (%d): %m", errno);
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	if (buf->format != UTERM_FORMAT_XRGB32)
+		return -EOPNOTSUPP;
+
+	if (!ddrm->cursor_handle) {
+		ret = cursor_init(disp, vdrm->fd);
+		if (ret)
+			return ret;
+	}
+
+	if (buf->width > ddrm->cursor_width ||
+	    buf->height > ddrm->cursor_height)
+		return -E2BIG;
+
+	/* The cursor buffer may be scanned out while we write it. This can
+	 * tear for a single frame but avoids a second buffer. */
+	for (i = 0; i < ddrm->cursor_height; ++i) {
+		dst = (uint32_t*)&ddrm->cursor_map[i * ddrm->cursor_stride];
+		if (i >= buf->height) {
+			memset(dst, 0, ddrm->cursor_width * 4);
+			continue;
+		}
+
+		src = (const uint32_t*)&buf->data[i * buf->stride];
+		for (j = 0; j < buf->width; ++j)
+			dst[j] = src[j] | 0xff000000;
+		memset(&dst[j], 0, (ddrm->cursor_width - j) * 4);
+	}
+
+	ret = drmModeSetCursor(vdrm->fd, ddrm->crtc_id, ddrm->cursor_handle,
+			       ddrm->cursor_width, ddrm->cursor_height);
+	if (ret) {
+		log_warning("cannot set cursor (%d): %m", errno);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+int uterm_drm_display_move_cursor(struct uterm_display *disp, int x, int y)
+{
+	struct uterm_drm_display *ddrm = disp->data;
+	struct uterm_drm_video *vdrm = disp->video->data;
+	int ret;
+
+	ret = drmModeMoveCursor(vdrm->fd, ddrm->crtc_id, x, y);
+	if (ret) {
+		log_warning("cannot move cursor (%d): %m", errno);
+		return -EFAULT;
+	}
+
 	return 0;
 }
 
@@ -268,6 +838,7 @@ void uterm_drm_display_deactivate(struct uterm_display *disp, int fd)
 	struct uterm_drm_display *ddrm = disp->data;
 
 	uterm_drm_display_wait_pflip(disp);
+	cursor_destroy(disp, fd);
 
 	if (ddrm->saved_crtc) {
 		if (disp->video->flags & VIDEO_AWAKE) {
@@ -282,8 +853,16 @@ void uterm_drm_display_deactivate(struct uterm_display *disp, int fd)
 		ddrm->saved_crtc = NULL;
 	}
 
+	if (ddrm->mode_blob) {
+		drmModeDestroyPropertyBlob(fd, ddrm->mode_blob);
+		ddrm->mode_blob = 0;
+	}
+
+	ddrm->queued_fb = 0;
+	ddrm->plane_id = 0;
 	ddrm->crtc_id = 0;
-	disp->flags &= ~(DISPLAY_VSYNC | DISPLAY_ONLINE | DISPLAY_PFLIP);
+	disp->flags &= ~(DISPLAY_VSYNC | DISPLAY_ONLINE | DISPLAY_PFLIP |
+			 DISPLAY_ABORT);
 }
 
 int uterm_drm_display_set_dpms(struct uterm_display *disp, int state)
@@ -306,9 +885,14 @@ int uterm_drm_display_set_dpms(struct uterm_display *disp, int state)
 int uterm_drm_display_wait_pflip(struct uterm_display *disp)
 {
 	struct uterm_video *video = disp->video;
+	struct uterm_drm_video *vdrm = video->data;
+	struct uterm_drm_display *ddrm = disp->data;
 	int ret;
 	unsigned int timeout = 1000; /* 1s */
 
+	if (ddrm->queued_fb)
+		atomic_flush(video);
+
 	if ((disp->flags & DISPLAY_PFLIP) || !(disp->flags & DISPLAY_VSYNC))
 		return 0;
 
@@ -318,6 +902,11 @@ int uterm_drm_display_wait_pflip(struct uterm_display *disp)
 			break;
 		else if ((disp->flags & DISPLAY_PFLIP))
 			break;
+
+		if (vdrm->retry)
+			atomic_flush(video);
+		if (!(disp->flags & DISPLAY_VSYNC))
+			break;
 	} while (timeout > 0);
 
 	if (ret < 0)
@@ -338,7 +927,6 @@ int uterm_drm_display_swap(struct uterm_display *disp, uint32_t fb,
 	struct uterm_video *video = disp->video;
 	struct uterm_drm_video *vdrm = video->data;
 	int ret;
-	drmModeModeInfo *mode;
 
 	if (disp->dpms != UTERM_DPMS_ON)
 		return -EINVAL;
@@ -348,26 +936,34 @@ int uterm_drm_display_swap(struct uterm_display *disp, uint32_t fb,
 		if (ret)
 			return ret;
 
-		mode = uterm_drm_mode_get_info(disp->current_mode);
-		ret = drmModeSetCrtc(vdrm->fd, ddrm->crtc_id, fb, 0, 0,
-				     &ddrm->conn_id, 1, mode);
-		if (ret) {
-			log_error("cannot set DRM-CRTC (%d): %m", errno);
-			return -EFAULT;
-		}
+		ret = uterm_drm_display_modeset(disp, fb,
+				uterm_drm_mode_get_info(disp->current_mode));
+		if (ret)
+			return ret;
 	} else {
 		if ((disp->flags & DISPLAY_VSYNC))
 			return -EBUSY;
 
-		ret = drmModePageFlip(vdrm->fd, ddrm->crtc_id, fb,
-				      DRM_MODE_PAGE_FLIP_EVENT, disp);
-		if (ret) {
-			log_error("cannot page-flip on DRM-CRTC (%d): %m",
-				  errno);
-			return -EFAULT;
+		if (vdrm->atomic && ddrm->plane_id) {
+			/* batch with the other displays of this card */
+			ret = ev_eloop_register_idle_cb(video->eloop,
+							do_commit, video,
+							EV_ONESHOT |
+							EV_SINGLE);
+			if (ret)
+				return ret;
+
+			ddrm->queued_fb = fb;
+		} else {
+			ret = drmModePageFlip(vdrm->fd, ddrm->crtc_id, fb,
+					      DRM_MODE_PAGE_FLIP_EVENT, video);
+			if (ret) {
+				log_error("cannot page-flip on DRM-CRTC (%d): %m",
+					  errno);
+				return -EFAULT;
+			}
 		}
 
-		uterm_display_ref(disp);
 		disp->flags |= DISPLAY_VSYNC;
 	}
 
@@ -382,18 +978,34 @@ static void uterm_drm_display_pflip(struct uterm_display *disp)
 	if (vdrm->page_flip)
 		vdrm->page_flip(disp);
 
+	shl_latency_mark(SHL_LATENCY_PAGE_FLIP);
+
 	DISPLAY_CB(disp, UTERM_PAGE_FLIP);
 }
 
+/* Legacy and atomic page-flips both pass the video object as user-data and
+ * the kernel tells us the CRTC, so the display is looked up here. */
 static void display_event(int fd, unsigned int frame, unsigned int sec,
-			  unsigned int usec, void *data)
+			  unsigned int usec, unsigned int crtc_id, void *data)
 {
-	struct uterm_display *disp = data;
+	struct uterm_video *video = data;
+	struct uterm_display *disp;
+	struct uterm_drm_display *ddrm;
+	struct shl_dlist *iter;
 
-	if (disp->video && (disp->flags & DISPLAY_VSYNC))
-		disp->flags |= DISPLAY_PFLIP;
+	shl_dlist_for_each(iter, &video->displays) {
+		disp = shl_dlist_entry(iter, struct uterm_display, list);
+		ddrm = disp->data;
+		if (ddrm->crtc_id != crtc_id)
+			continue;
 
-	uterm_display_unref(disp);
+		if (disp->flags & DISPLAY_VSYNC) {
+			disp->flags |= DISPLAY_PFLIP;
+			display_report_flip(disp, frame,
+					    (uint64_t)sec * 1000000ULL + usec);
+		}
+		break;
+	}
 }
 
 static int uterm_drm_video_read_events(struct uterm_video *video)
@@ -408,7 +1020,7 @@ static int uterm_drm_video_read_events(struct uterm_video *video)
 	 * this upstream and then make this code actually loop. */
 	memset(&ev, 0, sizeof(ev));
 	ev.version = DRM_EVENT_CONTEXT_VERSION;
-	ev.page_flip_handler = display_event;
+	ev.page_flip_handler2 = display_event;
 	errno = 0;
 	ret = drmHandleEvent(vdrm->fd, &ev);
 
@@ -418,9 +1030,10 @@ static int uterm_drm_video_read_events(struct uterm_video *video)
 	return 0;
 }
 
-static void do_pflips(struct ev_eloop *eloop, void *unused, void *data)
+/* Dispatches completed and aborted page-flips and retries a busy commit. */
+static void dispatch_pflips(struct uterm_video *video)
 {
-	struct uterm_video *video = data;
+	struct uterm_drm_video *vdrm = video->data;
 	struct uterm_display *disp;
 	struct shl_dlist *iter;
 
@@ -429,14 +1042,28 @@ static void do_pflips(struct ev_eloop *eloop, void *unused, void *data)
 		if ((disp->flags & DISPLAY_PFLIP))
 			uterm_drm_display_pflip(disp);
 	}
+
+	if (vdrm->retry)
+		atomic_flush(video);
+
+	shl_dlist_for_each(iter, &video->displays) {
+		disp = shl_dlist_entry(iter, struct uterm_display, list);
+		if ((disp->flags & DISPLAY_ABORT)) {
+			disp->flags &= ~DISPLAY_ABORT;
+			DISPLAY_CB(disp, UTERM_SWAP_ABORTED);
+		}
+	}
+}
+
+static void do_pflips(struct ev_eloop *eloop, void *unused, void *data)
+{
+	dispatch_pflips(data);
 }
 
 static void io_event(struct ev_fd *fd, int mask, void *data)
 {
 	struct uterm_video *video = data;
 	struct uterm_drm_video *vdrm = video->data;
-	struct uterm_display *disp;
-	struct shl_dlist *iter;
 	int ret;
 
 	/* TODO: forward HUP to caller */
@@ -454,11 +1081,7 @@ static void io_event(struct ev_fd *fd, int mask, void *data)
 	if (ret)
 		return;
 
-	shl_dlist_for_each(iter, &video->displays) {
-		disp = shl_dlist_entry(iter, struct uterm_display, list);
-		if ((disp->flags & DISPLAY_PFLIP))
-			uterm_drm_display_pflip(disp);
-	}
+	dispatch_pflips(video);
 }
 
 static void vt_timeout(struct ev_timer *timer, uint64_t exp, void *data)
@@ -493,7 +1116,8 @@ void uterm_drm_video_arm_vt_timer(struct uterm_video *video)
 
 int uterm_drm_video_init(struct uterm_video *video, const char *node,
 			 const struct display_ops *display_ops,
-			 uterm_drm_page_flip_t pflip, void *data)
+			 uterm_drm_page_flip_t pflip,
+			 uterm_drm_page_flip_t abort, void *data)
 {
 	struct uterm_drm_video *vdrm;
 	int ret;
@@ -507,6 +1131,7 @@ int uterm_drm_video_init(struct uterm_video *video, const char *node,
 	video->data = vdrm;
 	vdrm->data = data;
 	vdrm->page_flip = pflip;
+	vdrm->abort = abort;
 	vdrm->display_ops = display_ops;
 
 	vdrm->fd = open(node, O_RDWR | O_CLOEXEC | O_NONBLOCK);
@@ -518,10 +1143,15 @@ int uterm_drm_video_init(struct uterm_video *video, const char *node,
 	/* TODO: fix the race-condition with DRM-Master-on-open */
 	drmDropMaster(vdrm->fd);
 
+	vdrm->atomic = !drmSetClientCap(vdrm->fd, DRM_CLIENT_CAP_ATOMIC, 1);
+	log_info("using %s modesetting on %s",
+		 vdrm->atomic ? "atomic" : "legacy", node);
+
 	ret = ev_eloop_new_fd(video->eloop, &vdrm->efd, vdrm->fd, EV_READABLE,
 			      io_event, video);
 	if (ret)
 		goto err_close;
+	ev_fd_set_priority(vdrm->efd, EV_PRIO_DISPLAY);
 
 	ret = shl_timer_new(&vdrm->timer);
 	if (ret)
@@ -551,6 +1181,8 @@ void uterm_drm_video_destroy(struct uterm_video *video)
 	struct uterm_drm_video *vdrm = video->data;
 
 	ev_eloop_rm_timer(vdrm->vt_timer);
+	ev_eloop_unregister_idle_cb(video->eloop, do_commit, video,
+				    EV_ONESHOT | EV_SINGLE);
 	ev_eloop_unregister_idle_cb(video->eloop, do_pflips, video, EV_SINGLE);
 	shl_timer_free(vdrm->timer);
 	ev_eloop_rm_fd(vdrm->efd);
@@ -672,7 +1304,12 @@ int uterm_drm_video_hotplug(struct uterm_video *video,
 	}
 
 	for (i = 0; i < res->count_connectors; ++i) {
-		conn = drmModeGetConnector(vdrm->fd, res->connectors[i]);
+		if (video->flags & VIDEO_PROBED)
+			conn = drmModeGetConnectorCurrent(vdrm->fd,
+							  res->connectors[i]);
+		else
+			conn = drmModeGetConnector(vdrm->fd,
+						   res->connectors[i]);
 		if (!conn)
 			continue;
 		if (conn->connection != DRM_MODE_CONNECTED) {
@@ -724,7 +1361,7 @@ int uterm_drm_video_hotplug(struct uterm_video *video,
 			uterm_display_unbind(disp);
 	}
 
-	video->flags &= ~VIDEO_HOTPLUG;
+	video->flags &= ~(VIDEO_HOTPLUG | VIDEO_PROBED);
 	return 0;
 }
 
@@ -753,6 +1390,9 @@ void uterm_drm_video_sleep(struct uterm_video *video)
 {
 	struct uterm_drm_video *vdrm = video->data;
 
+	if (vdrm->atomic)
+		atomic_flush(video);
+
 	drmDropMaster(vdrm->fd);
 	ev_timer_drain(vdrm->vt_timer, NULL);
 	ev_timer_update(vdrm->vt_timer, NULL);
@@ -764,6 +1404,61 @@ int uterm_drm_video_poll(struct uterm_video *video)
 	return uterm_drm_video_hotplug(video, false, false);
 }
 
+/* drmIsMaster() of newer libdrm: only the master may authenticate clients,
+ * everybody else gets EACCES even for the invalid magic 0 */
+static bool is_master(int fd)
+{
+	return drmAuthMagic(fd, 0) != -EACCES;
+}
+
+/*
+ * Connector probing reads EDIDs and may take seconds on slow drivers like USB
+ * docks. This runs it on a separate file-descriptor so it can be done on any
+ * thread. The kernel keeps the result for drmModeGetConnectorCurrent().
+ * The kernel only probes for the DRM-Master, so this fails with -EACCES if
+ * somebody else holds it and the caller must not skip its own probe.
+ */
+int uterm_drm_video_probe(const char *node)
+{
+	drmModeRes *res;
+	drmModeConnector *conn;
+	int fd, i, ret = 0;
+
+	fd = open(node, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		log_warning("cannot open drm device %s for probing (%d): %m",
+			    node, errno);
+		return -EFAULT;
+	}
+
+	if (!is_master(fd)) {
+		log_debug("cannot probe drm device %s without DRM-Master",
+			  node);
+		ret = -EACCES;
+		goto out_close;
+	}
+
+	res = drmModeGetResources(fd);
+	if (!res) {
+		log_warning("cannot retrieve drm resources of %s for probing",
+			    node);
+		ret = -EFAULT;
+		goto out_close;
+	}
+
+	for (i = 0; i < res->count_connectors; ++i) {
+		conn = drmModeGetConnector(fd, res->connectors[i]);
+		if (conn)
+			drmModeFreeConnector(conn);
+	}
+
+	drmModeFreeResources(res);
+	drmDropMaster(fd);
+out_close:
+	close(fd);
+	return ret;
+}
+
 /* Waits for events on DRM fd for \mtimeout milliseconds and returns 0 if the
  * timeout expired, -ERR on errors and 1 if a page-flip event has been read.
  * \mtimeout is adjusted to the remaining time. */
@@ -65,11 +65,42 @@ int uterm_drm_get_dpms(int fd, drmModeConnector *conn);
 
 /* drm display */
 
+enum uterm_drm_prop {
+	UTERM_DRM_CONN_CRTC_ID,
+	UTERM_DRM_CRTC_MODE_ID,
+	UTERM_DRM_CRTC_ACTIVE,
+	UTERM_DRM_PLANE_FB_ID,
+	UTERM_DRM_PLANE_CRTC_ID,
+	UTERM_DRM_PLANE_SRC_X,
+	UTERM_DRM_PLANE_SRC_Y,
+	UTERM_DRM_PLANE_SRC_W,
+	UTERM_DRM_PLANE_SRC_H,
+	UTERM_DRM_PLANE_CRTC_X,
+	UTERM_DRM_PLANE_CRTC_Y,
+	UTERM_DRM_PLANE_CRTC_W,
+	UTERM_DRM_PLANE_CRTC_H,
+	UTERM_DRM_PROP_NUM,
+};
+
 struct uterm_drm_display {
 	uint32_t conn_id;
 	int crtc_id;
 	drmModeCrtc *saved_crtc;
 	void *data;
+
+	/* atomic state; plane_id is 0 if the legacy path is used */
+	uint32_t plane_id;
+	uint32_t props[UTERM_DRM_PROP_NUM];
+	uint32_t mode_blob;
+	uint32_t queued_fb;
+
+	/* hardware cursor, allocated on first use */
+	uint32_t cursor_handle;
+	uint32_t cursor_stride;
+	uint64_t cursor_size;
+	unsigned int cursor_width;
+	unsigned int cursor_height;
+	uint8_t *cursor_map;
 };
 
 int uterm_drm_display_init(struct uterm_display *disp, void *data);
@@ -78,8 +109,13 @@ int uterm_drm_display_activate(struct uterm_display *disp, int fd);
 void uterm_drm_display_deactivate(struct uterm_display *disp, int fd);
 int uterm_drm_display_set_dpms(struct uterm_display *disp, int state);
 int uterm_drm_display_wait_pflip(struct uterm_display *disp);
+int uterm_drm_display_modeset(struct uterm_display *disp, uint32_t fb,
+			      drmModeModeInfo *mode);
 int uterm_drm_display_swap(struct uterm_display *disp, uint32_t fb,
 			   bool immediate);
+int uterm_drm_display_set_cursor(struct uterm_display *disp,
+				 const struct uterm_video_buffer *buf);
+int uterm_drm_display_move_cursor(struct uterm_display *disp, int x, int y);
 
 static inline void *uterm_drm_display_get_data(struct uterm_display *disp)
 {
@@ -96,15 +132,21 @@ struct uterm_drm_video {
 	int fd;
 	struct ev_fd *efd;
 	uterm_drm_page_flip_t page_flip;
+	/* rolls back a swap whose page-flip could not be committed */
+	uterm_drm_page_flip_t abort;
 	void *data;
 	struct shl_timer *timer;
 	struct ev_timer *vt_timer;
 	const struct display_ops *display_ops;
+	bool atomic;
+	/* a commit got EBUSY and is retried after the next page-flip */
+	bool retry;
 };
 
 int uterm_drm_video_init(struct uterm_video *video, const char *node,
 			 const struct display_ops *display_ops,
-			 uterm_drm_page_flip_t pflip, void *data);
+			 uterm_drm_page_flip_t pflip,
+			 uterm_drm_page_flip_t abort, void *data);
 void uterm_drm_video_destroy(struct uterm_video *video);
 int uterm_drm_video_find_crtc(struct uterm_video *video, drmModeRes *res,
 			      drmModeEncoder *enc);
@@ -113,6 +155,7 @@ int uterm_drm_video_hotplug(struct uterm_video *video, bool read_dpms,
 int uterm_drm_video_wake_up(struct uterm_video *video);
 void uterm_drm_video_sleep(struct uterm_video *video);
 int uterm_drm_video_poll(struct uterm_video *video);
+int uterm_drm_video_probe(const char *node);
 int uterm_drm_video_wait_pflip(struct uterm_video *video,
 			       unsigned int *mtimeout);
 void uterm_drm_video_arm_vt_timer(struct uterm_video *video);
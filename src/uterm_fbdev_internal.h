@@ -47,7 +47,12 @@ struct fbdev_display {
 	unsigned int rate;
 	const char *node;
 
+	/* with DISPLAY_DBUF, @num_buf buffers are stacked vertically and used
+	 * round-robin; @bufid is scanned out and @back rendered into */
+	unsigned int num_buf;
 	unsigned int bufid;
+	unsigned int back;
+	unsigned int age[UTERM_MAX_BUFFERS];
 	size_t xres;
 	size_t yres;
 	size_t len;
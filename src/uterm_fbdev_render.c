@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "shl_log.h"
+#include "shl_misc.h"
 #include "uterm_fbdev_internal.h"
 #include "uterm_video.h"
 #include "uterm_video_internal.h"
@@ -144,19 +145,17 @@ int uterm_fbdev_display_blit(struct uterm_display *disp,
 	else
 		height = buf->height;
 
-	if (!(disp->flags & DISPLAY_DBUF) || fbdev->bufid)
-		dst = fbdev->map;
-	else
-		dst = &fbdev->map[fbdev->yres * fbdev->stride];
+	dst = &fbdev->map[fbdev->back * fbdev->yres * fbdev->stride];
 	dst = &dst[y * fbdev->stride + x * fbdev->Bpp];
 	src = buf->data;
 
 	if (fbdev->xrgb32) {
 		while (height--) {
-			memcpy(dst, src, 4 * width);
+			shl_memcpy_stream(dst, src, 4 * width);
 			dst += fbdev->stride;
 			src += buf->stride;
 		}
+		shl_memcpy_stream_end();
 	} else if (fbdev->Bpp == 2) {
 		while (height--) {
 			for (i = 0; i < width; ++i) {
@@ -229,10 +228,7 @@ int uterm_fbdev_display_fake_blendv(struct uterm_display *disp,
 		else
 			height = req->buf->height;
 
-		if (!(disp->flags & DISPLAY_DBUF) || fbdev->bufid)
-			dst = fbdev->map;
-		else
-			dst = &fbdev->map[fbdev->yres * fbdev->stride];
+		dst = &fbdev->map[fbdev->back * fbdev->yres * fbdev->stride];
 		dst = &dst[req->y * fbdev->stride + req->x * fbdev->Bpp];
 		src = req->buf->data;
 
@@ -384,10 +380,7 @@ int uterm_fbdev_display_fill(struct uterm_display *disp,
 	if (tmp > fbdev->yres)
 		height = fbdev->yres - y;
 
-	if (!(disp->flags & DISPLAY_DBUF) || fbdev->bufid)
-		dst = fbdev->map;
-	else
-		dst = &fbdev->map[fbdev->yres * fbdev->stride];
+	dst = &fbdev->map[fbdev->back * fbdev->yres * fbdev->stride];
 	dst = &dst[y * fbdev->stride + x * fbdev->Bpp];
 
 	full_val  = ((r & 0xff) >> (8 - fbdev->len_r)) << fbdev->off_r;
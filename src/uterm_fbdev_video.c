@@ -170,25 +170,26 @@ static int display_activate_force(struct uterm_display *disp,
 	vinfo->yoffset = 0;
 	vinfo->activate = FB_ACTIVATE_NOW | FB_ACTIVATE_FORCE;
 	vinfo->xres_virtual = vinfo->xres;
-	vinfo->yres_virtual = vinfo->yres * 2;
-	disp->flags |= DISPLAY_DBUF;
 
 	/* udlfb is broken as it reports the sizes of the virtual framebuffer
 	 * (even mmap() accepts it) but the actual size that we can access
 	 * without segfaults is the _real_ framebuffer. Therefore, disable
-	 * double-buffering for it.
+	 * multi-buffering for it.
 	 * TODO: fix this kernel-side!
-	 * TODO: There are so many broken fbdev drivers that just accept any
-	 * virtual FB sizes and then break mmap that we now disable
-	 * double-buffering entirely. We might instead add a white-list or
-	 * optional command-line argument to re-enable it. */
-	if (true || !strcmp(finfo->id, "udlfb")) {
-		disp->flags &= ~DISPLAY_DBUF;
-		vinfo->yres_virtual = vinfo->yres;
+	 * There are so many broken fbdev drivers that just accept any virtual
+	 * FB sizes and then break mmap that multi-buffering is only enabled if
+	 * explicitly requested via uterm_video_set_buffers(). */
+	dfb->num_buf = 1;
+	disp->flags &= ~DISPLAY_DBUF;
+	if (disp->video->buffers > 1 && strcmp(finfo->id, "udlfb")) {
+		dfb->num_buf = disp->video->buffers;
+		disp->flags |= DISPLAY_DBUF;
 	}
+	vinfo->yres_virtual = vinfo->yres * dfb->num_buf;
 
 	ret = ioctl(dfb->fd, FBIOPUT_VSCREENINFO, vinfo);
 	if (ret) {
+		dfb->num_buf = 1;
 		disp->flags &= ~DISPLAY_DBUF;
 		vinfo->yres_virtual = vinfo->yres;
 		ret = ioctl(dfb->fd, FBIOPUT_VSCREENINFO, vinfo);
@@ -198,11 +199,6 @@ static int display_activate_force(struct uterm_display *disp,
 		}
 	}
 
-	if (disp->flags & DISPLAY_DBUF)
-		log_debug("enable double buffering");
-	else
-		log_debug("disable double buffering");
-
 	ret = refresh_info(disp);
 	if (ret)
 		goto err_close;
@@ -247,14 +243,25 @@ static int display_activate_force(struct uterm_display *disp,
 	}
 
 	if (vinfo->xres_virtual < vinfo->xres ||
-	    (disp->flags & DISPLAY_DBUF &&
-	     vinfo->yres_virtual < vinfo->yres * 2) ||
 	    vinfo->yres_virtual < vinfo->yres) {
 		log_warning("device %s has weird virtual buffer sizes (%d %d %d %d)",
 			    dfb->node, vinfo->xres, vinfo->xres_virtual,
 			    vinfo->yres, vinfo->yres_virtual);
 	}
 
+	if (vinfo->yres_virtual < vinfo->yres * dfb->num_buf) {
+		log_warning("device %s cannot provide %u buffers, disabling multi-buffering",
+			    dfb->node, dfb->num_buf);
+		dfb->num_buf = 1;
+		disp->flags &= ~DISPLAY_DBUF;
+	}
+
+	if (disp->flags & DISPLAY_DBUF)
+		log_debug("enable multi-buffering with %u buffers",
+			  dfb->num_buf);
+	else
+		log_debug("disable multi-buffering");
+
 	if (finfo->visual != FB_VISUAL_TRUECOLOR) {
 		log_error("device %s does not support true-color",
 			  dfb->node);
@@ -299,9 +306,7 @@ static int display_activate_force(struct uterm_display *disp,
 	log_debug("vblank timer: %u ms, monitor refresh rate: %u Hz", val,
 		  dfb->rate / 1000);
 
-	len = finfo->line_length * vinfo->yres;
-	if (disp->flags & DISPLAY_DBUF)
-		len *= 2;
+	len = finfo->line_length * vinfo->yres * dfb->num_buf;
 
 	dfb->map = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, dfb->fd, 0);
 	if (dfb->map == MAP_FAILED) {
@@ -317,6 +322,8 @@ static int display_activate_force(struct uterm_display *disp,
 	dfb->len = len;
 	dfb->stride = finfo->line_length;
 	dfb->bufid = 0;
+	dfb->back = dfb->num_buf > 1 ? 1 : 0;
+	memset(dfb->age, 0, sizeof(dfb->age));
 	dfb->Bpp = vinfo->bits_per_pixel / 8;
 	dfb->off_r = vinfo->red.offset;
 	dfb->len_r = vinfo->red.length;
@@ -446,10 +453,7 @@ static int display_use(struct uterm_display *disp, bool *opengl)
 	if (opengl)
 		*opengl = false;
 
-	if (!(disp->flags & DISPLAY_DBUF))
-		return 0;
-
-	return dfb->bufid ^ 1;
+	return dfb->back;
 }
 
 static int display_get_buffers(struct uterm_display *disp,
@@ -469,20 +473,55 @@ static int display_get_buffers(struct uterm_display *disp,
 	if (!(formats & f))
 		return -EOPNOTSUPP;
 
-	for (i = 0; i < 2; ++i) {
+	for (i = 0; i < dfb->num_buf; ++i) {
 		buffer[i].width = dfb->xres;
 		buffer[i].height = dfb->yres;
 		buffer[i].stride = dfb->stride;
 		buffer[i].format = f;
-		if (!(disp->flags & DISPLAY_DBUF) || !i)
-			buffer[i].data = dfb->map;
-		else
-			buffer[i].data = &dfb->map[dfb->yres * dfb->stride];
+		buffer[i].data = &dfb->map[i * dfb->yres * dfb->stride];
 	}
 
 	return 0;
 }
 
+/* reading from the write-combined framebuffer is slow, so callers copy it
+ * once and convert the copy */
+static int display_capture(struct uterm_display *disp,
+			   struct uterm_video_capture *cap)
+{
+	struct fbdev_display *dfb = disp->data;
+
+	if (dfb->xrgb32)
+		cap->format = UTERM_FORMAT_XRGB32;
+	else if (dfb->rgb16)
+		cap->format = UTERM_FORMAT_RGB16;
+	else
+		return -EOPNOTSUPP;
+
+	cap->width = dfb->xres;
+	cap->height = dfb->yres;
+	cap->stride = dfb->stride;
+	cap->size = dfb->yres * dfb->stride;
+	cap->data = &dfb->map[dfb->bufid * cap->size];
+
+	return 0;
+}
+
+/* the back-buffer became the front-buffer; age all buffers by one frame */
+static void advance_buffers(struct fbdev_display *dfb)
+{
+	unsigned int i;
+
+	for (i = 0; i < dfb->num_buf; ++i) {
+		if (dfb->age[i])
+			++dfb->age[i];
+	}
+
+	dfb->age[dfb->back] = 1;
+	dfb->bufid = dfb->back;
+	dfb->back = (dfb->back + 1) % dfb->num_buf;
+}
+
 static int display_swap(struct uterm_display *disp, bool immediate)
 {
 	struct fbdev_display *dfb = disp->data;
@@ -490,6 +529,7 @@ static int display_swap(struct uterm_display *disp, bool immediate)
 	int ret;
 
 	if (!(disp->flags & DISPLAY_DBUF)) {
+		advance_buffers(dfb);
 		if (immediate)
 			return 0;
 		return display_schedule_vblank_timer(disp);
@@ -501,10 +541,7 @@ static int display_swap(struct uterm_display *disp, bool immediate)
 	else
 		vinfo->activate = FB_ACTIVATE_VBL;
 
-	if (!dfb->bufid)
-		vinfo->yoffset = dfb->yres;
-	else
-		vinfo->yoffset = 0;
+	vinfo->yoffset = dfb->back * dfb->yres;
 
 	ret = ioctl(dfb->fd, FBIOPUT_VSCREENINFO, vinfo);
 	if (ret) {
@@ -513,10 +550,17 @@ static int display_swap(struct uterm_display *disp, bool immediate)
 		return -EFAULT;
 	}
 
-	dfb->bufid ^= 1;
+	advance_buffers(dfb);
 	return display_schedule_vblank_timer(disp);
 }
 
+static int display_get_age(struct uterm_display *disp)
+{
+	struct fbdev_display *dfb = disp->data;
+
+	return dfb->age[dfb->back];
+}
+
 static const struct display_ops fbdev_display_ops = {
 	.init = display_init,
 	.destroy = display_destroy,
@@ -529,6 +573,8 @@ static const struct display_ops fbdev_display_ops = {
 	.blit = uterm_fbdev_display_blit,
 	.fake_blendv = uterm_fbdev_display_fake_blendv,
 	.fill = uterm_fbdev_display_fill,
+	.get_age = display_get_age,
+	.capture = display_capture,
 };
 
 static void intro_idle_event(struct ev_eloop *eloop, void *unused, void *data)
@@ -51,21 +51,69 @@
 
 static void input_free_dev(struct uterm_input_dev *dev);
 
-static void notify_key(struct uterm_input_dev *dev,
-			uint16_t type,
-			uint16_t code,
-			int32_t value)
+static unsigned int flush_frame(struct uterm_input_dev *dev)
 {
-	if (type != EV_KEY)
-		return;
+	unsigned int i, num = 0;
+
+	for (i = 0; i < dev->frame_len; ++i) {
+		if (!uxkb_dev_process(dev, dev->frame[i].value,
+				      dev->frame[i].code))
+			++num;
+	}
+
+	dev->frame_len = 0;
+	return num;
+}
+
+/*
+ * Key events are queued until the SYN_REPORT that terminates their frame. If
+ * the kernel buffer overflowed, SYN_DROPPED is sent. In this case, the current
+ * frame and all events up to the next SYN_REPORT are dropped and the keyboard
+ * state is re-synced instead. Key-repeat is stopped as well, the release of the
+ * repeating key may have been among the dropped events. Returns the number of
+ * delivered key events.
+ */
+static unsigned int notify_event(struct uterm_input_dev *dev,
+				 const struct input_event *ev)
+{
+	unsigned int num = 0;
+
+	switch (ev->type) {
+	case EV_SYN:
+		if (ev->code == SYN_DROPPED) {
+			llog_debug(dev->input, "events dropped on %s",
+				   dev->node);
+			dev->frame_len = 0;
+			dev->dropped = true;
+		} else if (ev->code == SYN_REPORT) {
+			if (!dev->dropped)
+				return flush_frame(dev);
+
+			dev->dropped = false;
+			dev->repeating = false;
+			ev_timer_update(dev->repeat_timer, NULL);
+			uxkb_dev_wake_up(dev);
+		}
+		break;
+	case EV_KEY:
+		if (dev->dropped)
+			break;
+		if (dev->frame_len >= UTERM_INPUT_FRAME_MAX)
+			num = flush_frame(dev);
+
+		dev->frame[dev->frame_len++] = *ev;
+		break;
+	}
 
-	uxkb_dev_process(dev, value, code);
+	return num;
 }
 
 static void input_data_dev(struct ev_fd *fd, int mask, void *data)
 {
 	struct uterm_input_dev *dev = data;
-	struct input_event ev[16];
+	struct uterm_input *input = dev->input;
+	struct input_event ev[64];
+	unsigned int num = 0;
 	ssize_t len, n;
 	int i;
 
@@ -93,10 +141,12 @@ static void input_data_dev(struct ev_fd *fd, int mask, void *data)
 		} else {
 			n = len / sizeof(*ev);
 			for (i = 0; i < n; i++)
-				notify_key(dev, ev[i].type, ev[i].code,
-								ev[i].value);
+				num += notify_event(dev, &ev[i]);
 		}
 	}
+
+	if (num)
+		shl_hook_call(input->batch_hook, input, NULL);
 }
 
 static int input_wake_up_dev(struct uterm_input_dev *dev)
@@ -122,6 +172,7 @@ static int input_wake_up_dev(struct uterm_input_dev *dev)
 		dev->rfd = -1;
 		return ret;
 	}
+	ev_fd_set_priority(dev->fd, EV_PRIO_INPUT);
 
 	return 0;
 }
@@ -133,6 +184,8 @@ static void input_sleep_dev(struct uterm_input_dev *dev)
 
 	uxkb_dev_sleep(dev);
 
+	dev->frame_len = 0;
+	dev->dropped = false;
 	dev->repeating = false;
 	ev_timer_update(dev->repeat_timer, NULL);
 	ev_eloop_rm_fd(dev->fd);
@@ -218,6 +271,23 @@ static void input_free_dev(struct uterm_input_dev *dev)
 	free(dev);
 }
 
+static void input_set_repeat(struct uterm_input *input,
+			     unsigned int repeat_delay,
+			     unsigned int repeat_rate)
+{
+	if (!repeat_delay)
+		repeat_delay = 250;
+	if (repeat_delay >= 1000)
+		repeat_delay = 999;
+	if (!repeat_rate)
+		repeat_rate = 50;
+	if (repeat_rate >= 1000)
+		repeat_rate = 999;
+
+	input->repeat_delay = repeat_delay;
+	input->repeat_rate = repeat_rate;
+}
+
 SHL_EXPORT
 int uterm_input_new(struct uterm_input **out,
 		    struct ev_eloop *eloop,
@@ -238,15 +308,6 @@ int uterm_input_new(struct uterm_input **out,
 	if (!out || !eloop)
 		return -EINVAL;
 
-	if (!repeat_delay)
-		repeat_delay = 250;
-	if (repeat_delay >= 1000)
-		repeat_delay = 999;
-	if (!repeat_rate)
-		repeat_rate = 50;
-	if (repeat_rate >= 1000)
-		repeat_rate = 999;
-
 	input = malloc(sizeof(*input));
 	if (!input)
 		return -ENOMEM;
@@ -255,24 +316,29 @@ int uterm_input_new(struct uterm_input **out,
 	input->llog = log;
 	input->llog_data = log_data;
 	input->eloop = eloop;
-	input->repeat_delay = repeat_delay;
-	input->repeat_rate = repeat_rate;
+	input_set_repeat(input, repeat_delay, repeat_rate);
 	shl_dlist_init(&input->devices);
 
 	ret = shl_hook_new(&input->hook);
 	if (ret)
 		goto err_free;
 
+	ret = shl_hook_new(&input->batch_hook);
+	if (ret)
+		goto err_hook;
+
 	ret = uxkb_desc_init(input, model, layout, variant, options, keymap,
 				use_compose);
 	if (ret)
-		goto err_hook;
+		goto err_batch;
 
 	llog_debug(input, "new object %p", input);
 	ev_eloop_ref(input->eloop);
 	*out = input;
 	return 0;
 
+err_batch:
+	shl_hook_free(input->batch_hook);
 err_hook:
 	shl_hook_free(input->hook);
 err_free:
@@ -307,6 +373,7 @@ void uterm_input_unref(struct uterm_input *input)
 	}
 
 	uxkb_desc_destroy(input);
+	shl_hook_free(input->batch_hook);
 	shl_hook_free(input->hook);
 	ev_eloop_unref(input->eloop);
 	free(input);
@@ -425,6 +492,40 @@ void uterm_input_unregister_cb(struct uterm_input *input,
 	shl_hook_rm_cast(input->hook, cb, data);
 }
 
+SHL_EXPORT
+int uterm_input_register_batch_cb(struct uterm_input *input,
+				  uterm_input_batch_cb cb,
+				  void *data)
+{
+	if (!input || !cb)
+		return -EINVAL;
+
+	return shl_hook_add_cast(input->batch_hook, cb, data, false);
+}
+
+SHL_EXPORT
+void uterm_input_unregister_batch_cb(struct uterm_input *input,
+				     uterm_input_batch_cb cb,
+				     void *data)
+{
+	if (!input || !cb)
+		return;
+
+	shl_hook_rm_cast(input->batch_hook, cb, data);
+}
+
+/* Takes effect with the next key-press; running repeats keep their timing. */
+SHL_EXPORT
+void uterm_input_set_repeat(struct uterm_input *input,
+			    unsigned int repeat_delay,
+			    unsigned int repeat_rate)
+{
+	if (!input)
+		return;
+
+	input_set_repeat(input, repeat_delay, repeat_rate);
+}
+
 SHL_EXPORT
 void uterm_input_sleep(struct uterm_input *input)
 {
@@ -61,11 +61,16 @@ enum uterm_input_modifier {
 /* keep in sync with TSM_VTE_INVALID */
 #define UTERM_INPUT_INVALID 0xffffffff
 
+/* maximum number of key-repeats that are batched into a single event */
+#define UTERM_INPUT_MAX_REPEATS 32
+
 struct uterm_input_event {
 	bool handled;		/* user-controlled, default is false */
 	uint16_t keycode;	/* linux keycode - KEY_* - linux/input.h */
 	uint32_t ascii;		/* ascii keysym for @keycode */
 	unsigned int mods;	/* active modifiers - uterm_modifier mask */
+	unsigned int repeats;	/* number of key-presses this event represents;
+				 * >1 for batched key-repeats, otherwise 1 */
 
 	unsigned int num_syms;	/* number of keysyms */
 	uint32_t *keysyms;	/* XKB-common keysym-array - XKB_KEY_* */
@@ -78,6 +83,16 @@ typedef void (*uterm_input_cb) (struct uterm_input *input,
 				struct uterm_input_event *ev,
 				void *data);
 
+/*
+ * Batch callbacks are called after a batch of key events was delivered to the
+ * input callbacks. A batch contains all events that were read from a device in
+ * one go (possibly many SYN_REPORT frames) or a single key-repeat event. Users
+ * can defer expensive work like redraws until the end of a batch.
+ */
+typedef void (*uterm_input_batch_cb) (struct uterm_input *input,
+				      void *unused,
+				      void *data);
+
 int uterm_input_new(struct uterm_input **out, struct ev_eloop *eloop,
 		    const char *model, const char *layout, const char *variant,
 		    const char *options, const char *keymap, bool use_compose,
@@ -93,6 +108,13 @@ int uterm_input_register_cb(struct uterm_input *input, uterm_input_cb cb,
 			    void *data);
 void uterm_input_unregister_cb(struct uterm_input *input, uterm_input_cb cb,
 			       void *data);
+int uterm_input_register_batch_cb(struct uterm_input *input,
+				  uterm_input_batch_cb cb, void *data);
+void uterm_input_unregister_batch_cb(struct uterm_input *input,
+				     uterm_input_batch_cb cb, void *data);
+
+void uterm_input_set_repeat(struct uterm_input *input,
+			    unsigned int repeat_delay, unsigned int repeat_rate);
 
 void uterm_input_sleep(struct uterm_input *input);
 void uterm_input_wake_up(struct uterm_input *input);
@@ -30,6 +30,7 @@
 
 #include <inttypes.h>
 #include <limits.h>
+#include <linux/input.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <xkbcommon/xkbcommon-keysyms.h>
@@ -39,6 +40,9 @@
 #include "shl_misc.h"
 #include "uterm_input.h"
 
+/* maximum number of key events that are queued per SYN_REPORT frame */
+#define UTERM_INPUT_FRAME_MAX 32
+
 enum uterm_input_device_capability {
 	UTERM_DEVICE_HAS_KEYS = (1 << 0),
 	UTERM_DEVICE_HAS_LEDS = (1 << 1),
@@ -54,9 +58,16 @@ struct uterm_input_dev {
 	struct ev_fd *fd;
 	struct xkb_state *state;
 	struct xkb_compose_state *compose_state;
-	/* Used in sleep/wake up to store the key's pressed/released state. */
+	/* Used in sleep/wake up to store the key's pressed/released state.
+	 * While awake, this tracks all processed key events. */
 	char key_state_bits[SHL_DIV_ROUND_UP(KEY_CNT, CHAR_BIT)];
 
+	/* key events of the current SYN_REPORT frame */
+	unsigned int frame_len;
+	struct input_event frame[UTERM_INPUT_FRAME_MAX];
+	/* true if SYN_DROPPED was received and we wait for the next frame */
+	bool dropped;
+
 	unsigned int num_syms;
 	struct uterm_input_event event;
 	struct uterm_input_event repeat_event;
@@ -75,6 +86,7 @@ struct uterm_input {
 	unsigned int repeat_delay;
 
 	struct shl_hook *hook;
+	struct shl_hook *batch_hook;
 	struct xkb_context *ctx;
 	struct xkb_keymap *keymap;
 	struct xkb_compose_table *compose;
@@ -34,6 +34,7 @@
 #include <xkbcommon/xkbcommon.h>
 #include <xkbcommon/xkbcommon-compose.h>
 #include "shl_hook.h"
+#include "shl_latency.h"
 #include "shl_llog.h"
 #include "shl_misc.h"
 #include "uterm_input.h"
@@ -207,8 +208,18 @@ static void timer_event(struct ev_timer *timer, uint64_t num, void *data)
 {
 	struct uterm_input_dev *dev = data;
 
+	/* If we were too slow to handle all repeat-ticks, deliver the missed
+	 * ones as a single batched event. This keeps the repeat-rate
+	 * independent of the load of the main loop. */
+	if (!num)
+		return;
+	if (num > UTERM_INPUT_MAX_REPEATS)
+		num = UTERM_INPUT_MAX_REPEATS;
+
 	dev->repeat_event.handled = false;
+	dev->repeat_event.repeats = num;
 	shl_hook_call(dev->input->hook, dev->input, &dev->repeat_event);
+	shl_hook_call(dev->input->batch_hook, dev->input, NULL);
 }
 
 int uxkb_dev_init(struct uterm_input_dev *dev)
@@ -432,6 +443,17 @@ int uxkb_dev_process(struct uterm_input_dev *dev,
 	if (key_state == KEY_REPEATED)
 		return -ENOKEY;
 
+	if (key_state == KEY_PRESSED)
+		shl_latency_start();
+
+	/* keep track of the key state so we can resync after SYN_DROPPED */
+	if (code < KEY_CNT) {
+		if (key_state == KEY_PRESSED)
+			dev->key_state_bits[code / 8] |= 1 << (code % 8);
+		else if (key_state == KEY_RELEASED)
+			dev->key_state_bits[code / 8] &= ~(1 << (code % 8));
+	}
+
 	state = dev->state;
 	compose_state = dev->compose_state;
 	keycode = code + EVDEV_KEYCODE_OFFSET;
@@ -486,6 +508,7 @@ int uxkb_dev_process(struct uterm_input_dev *dev,
 		return -ENOKEY;
 
 	dev->event.handled = false;
+	dev->event.repeats = 1;
 	shl_hook_call(dev->input->hook, dev->input, &dev->event);
 
 	return 0;
@@ -546,6 +569,7 @@ void uxkb_dev_wake_up(struct uterm_input_dev *dev)
 				     cur_bit ? XKB_KEY_DOWN : XKB_KEY_UP);
 	}
 
+	memcpy(dev->key_state_bits, cur_bits, sizeof(cur_bits));
 	uxkb_dev_update_keyboard_leds(dev);
 
 	if (dev->compose_state)
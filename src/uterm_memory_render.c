@@ -0,0 +1,235 @@
+/*
+ * uterm - Linux User-Space Terminal memory module
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory module rendering functions
+ * The memory backend supports XRGB32 and RGB16 buffers. Unlike fbdev we never
+ * dither here so the output is pixel-exact and can be compared against
+ * reference frames.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_log.h"
+#include "uterm_memory_internal.h"
+#include "uterm_video.h"
+#include "uterm_video_internal.h"
+
+#define LOG_SUBSYSTEM "memory_render"
+
+static inline uint16_t xrgb32_to_rgb16(uint32_t pixel)
+{
+	return ((pixel >> 8) & 0xf800) |
+	       ((pixel >> 5) & 0x07e0) |
+	       ((pixel >> 3) & 0x001f);
+}
+
+static inline uint32_t blend_pixel(const struct uterm_video_blend_req *req,
+				   uint8_t alpha)
+{
+	unsigned int r, g, b;
+
+	/* Same approximation as the fbdev backend so both render
+	 * identically. */
+	if (alpha == 0) {
+		r = req->br;
+		g = req->bg;
+		b = req->bb;
+	} else if (alpha == 255) {
+		r = req->fr;
+		g = req->fg;
+		b = req->fb;
+	} else {
+		r = (req->fr * alpha + req->br * (255 - alpha)) / 256;
+		g = (req->fg * alpha + req->bg * (255 - alpha)) / 256;
+		b = (req->fb * alpha + req->bb * (255 - alpha)) / 256;
+	}
+
+	return (r << 16) | (g << 8) | b;
+}
+
+static int clip_rect(struct memory_display *mem,
+		     unsigned int x, unsigned int y,
+		     unsigned int *width, unsigned int *height)
+{
+	unsigned int tmp;
+
+	tmp = x + *width;
+	if (tmp < x || x >= mem->width)
+		return -EINVAL;
+	if (tmp > mem->width)
+		*width = mem->width - x;
+
+	tmp = y + *height;
+	if (tmp < y || y >= mem->height)
+		return -EINVAL;
+	if (tmp > mem->height)
+		*height = mem->height - y;
+
+	return 0;
+}
+
+uint8_t *uterm_memory_display_back(struct uterm_display *disp)
+{
+	struct memory_display *mem = disp->data;
+
+	if (mem->bufid)
+		return mem->map;
+	else
+		return &mem->map[mem->height * mem->stride];
+}
+
+int uterm_memory_display_blit(struct uterm_display *disp,
+			      const struct uterm_video_buffer *buf,
+			      unsigned int x, unsigned int y)
+{
+	struct memory_display *mem = disp->data;
+	unsigned int width, height, i;
+	uint8_t *dst, *src;
+	int ret;
+
+	if (!mem->map)
+		return -EINVAL;
+	if (!buf || buf->format != UTERM_FORMAT_XRGB32)
+		return -EINVAL;
+
+	width = buf->width;
+	height = buf->height;
+	ret = clip_rect(mem, x, y, &width, &height);
+	if (ret)
+		return ret;
+
+	dst = uterm_memory_display_back(disp);
+	dst = &dst[y * mem->stride + x * mem->Bpp];
+	src = buf->data;
+
+	if (mem->format == UTERM_FORMAT_XRGB32) {
+		while (height--) {
+			memcpy(dst, src, 4 * width);
+			dst += mem->stride;
+			src += buf->stride;
+		}
+	} else {
+		while (height--) {
+			for (i = 0; i < width; ++i)
+				((uint16_t*)dst)[i] =
+					xrgb32_to_rgb16(((uint32_t*)src)[i]);
+			dst += mem->stride;
+			src += buf->stride;
+		}
+	}
+
+	return 0;
+}
+
+int uterm_memory_display_fake_blendv(struct uterm_display *disp,
+				     const struct uterm_video_blend_req *req,
+				     size_t num)
+{
+	struct memory_display *mem = disp->data;
+	unsigned int width, height, i, j;
+	uint8_t *dst, *src;
+	uint32_t val;
+	int ret;
+
+	if (!req || !mem->map)
+		return -EINVAL;
+
+	for (j = 0; j < num; ++j, ++req) {
+		if (!req->buf)
+			continue;
+
+		if (req->buf->format != UTERM_FORMAT_GREY)
+			return -EOPNOTSUPP;
+
+		width = req->buf->width;
+		height = req->buf->height;
+		ret = clip_rect(mem, req->x, req->y, &width, &height);
+		if (ret)
+			return ret;
+
+		dst = uterm_memory_display_back(disp);
+		dst = &dst[req->y * mem->stride + req->x * mem->Bpp];
+		src = req->buf->data;
+
+		while (height--) {
+			for (i = 0; i < width; ++i) {
+				val = blend_pixel(req, src[i]);
+				if (mem->format == UTERM_FORMAT_XRGB32)
+					((uint32_t*)dst)[i] = val;
+				else
+					((uint16_t*)dst)[i] =
+						xrgb32_to_rgb16(val);
+			}
+			dst += mem->stride;
+			src += req->buf->stride;
+		}
+	}
+
+	return 0;
+}
+
+int uterm_memory_display_fill(struct uterm_display *disp,
+			      uint8_t r, uint8_t g, uint8_t b,
+			      unsigned int x, unsigned int y,
+			      unsigned int width, unsigned int height)
+{
+	struct memory_display *mem = disp->data;
+	unsigned int i;
+	uint8_t *dst;
+	uint32_t val;
+	uint16_t val16;
+	int ret;
+
+	if (!mem->map)
+		return -EINVAL;
+
+	ret = clip_rect(mem, x, y, &width, &height);
+	if (ret)
+		return ret;
+
+	dst = uterm_memory_display_back(disp);
+	dst = &dst[y * mem->stride + x * mem->Bpp];
+	val = (r << 16) | (g << 8) | b;
+	val16 = xrgb32_to_rgb16(val);
+
+	if (mem->format == UTERM_FORMAT_XRGB32) {
+		while (height--) {
+			for (i = 0; i < width; ++i)
+				((uint32_t*)dst)[i] = val;
+			dst += mem->stride;
+		}
+	} else {
+		while (height--) {
+			for (i = 0; i < width; ++i)
+				((uint16_t*)dst)[i] = val16;
+			dst += mem->stride;
+		}
+	}
+
+	return 0;
+}
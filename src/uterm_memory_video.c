@@ -0,0 +1,547 @@
+/*
+ * uterm - Linux User-Space Terminal memory module
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory Video backend
+ * This backend does not need any kernel device. It renders into two buffers
+ * in system memory and simulates page-flips with the display vblank-timer.
+ * This allows running the whole rendering stack in test-suites and
+ * benchmarks.
+ *
+ * The @node argument of uterm_video_new() is a comma-separated list of
+ * options. All of them are optional:
+ *   <width>x<height>[@<hz>]: Mode of the display (default: 1024x768@60)
+ *   xrgb32 / rgb16: Pixel format of the display (default: xrgb32)
+ *   dump=<prefix>: Write each swapped frame as <prefix>-<frame>.ppm
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_log.h"
+#include "shl_misc.h"
+#include "uterm_memory_internal.h"
+#include "uterm_video.h"
+#include "uterm_video_internal.h"
+
+#define LOG_SUBSYSTEM "video_memory"
+
+static int mode_init(struct uterm_mode *mode)
+{
+	struct memory_mode *mem;
+
+	mem = malloc(sizeof(*mem));
+	if (!mem)
+		return -ENOMEM;
+	memset(mem, 0, sizeof(*mem));
+	mode->data = mem;
+
+	return 0;
+}
+
+static void mode_destroy(struct uterm_mode *mode)
+{
+	free(mode->data);
+}
+
+static const char *mode_get_name(const struct uterm_mode *mode)
+{
+	return "<memory>";
+}
+
+static unsigned int mode_get_width(const struct uterm_mode *mode)
+{
+	struct memory_mode *mem = mode->data;
+
+	return mem->width;
+}
+
+static unsigned int mode_get_height(const struct uterm_mode *mode)
+{
+	struct memory_mode *mem = mode->data;
+
+	return mem->height;
+}
+
+static const struct mode_ops memory_mode_ops = {
+	.init = mode_init,
+	.destroy = mode_destroy,
+	.get_name = mode_get_name,
+	.get_width = mode_get_width,
+	.get_height = mode_get_height,
+};
+
+static int display_init(struct uterm_display *disp)
+{
+	struct memory_display *mem;
+
+	mem = malloc(sizeof(*mem));
+	if (!mem)
+		return -ENOMEM;
+	memset(mem, 0, sizeof(*mem));
+	disp->data = mem;
+	disp->dpms = UTERM_DPMS_UNKNOWN;
+
+	return 0;
+}
+
+static void display_destroy(struct uterm_display *disp)
+{
+	struct memory_display *mem = disp->data;
+
+	free(mem->map);
+	free(mem);
+}
+
+static int display_activate_force(struct uterm_display *disp,
+				  struct uterm_mode *mode,
+				  bool force)
+{
+	struct memory_display *mem = disp->data;
+	struct uterm_mode *m;
+	struct memory_mode *mmem;
+	int ret;
+
+	if (!force && (disp->flags & DISPLAY_ONLINE))
+		return 0;
+
+	/* There is only a single mode per display, which is selected when
+	 * creating the video object. */
+	if (mode && mode != disp->current_mode)
+		return -EINVAL;
+
+	mem->Bpp = (mem->format == UTERM_FORMAT_RGB16) ? 2 : 4;
+	mem->stride = mem->width * mem->Bpp;
+	mem->len = mem->stride * mem->height;
+
+	mem->map = malloc(mem->len * 2);
+	if (!mem->map) {
+		log_error("cannot allocate %zu bytes for memory display",
+			  mem->len * 2);
+		return -ENOMEM;
+	}
+
+	memset(mem->map, 0, mem->len * 2);
+	mem->bufid = 0;
+	disp->flags |= DISPLAY_DBUF;
+
+	display_set_vblank_timer(disp, 1000 / mem->rate);
+	log_info("activating memory display to %ux%u@%u %u bpp",
+		 mem->width, mem->height, mem->rate, mem->Bpp * 8);
+
+	if (disp->current_mode) {
+		m = disp->current_mode;
+	} else {
+		ret = mode_new(&m, &memory_mode_ops);
+		if (ret)
+			goto err_map;
+		ret = uterm_mode_bind(m, disp);
+		if (ret) {
+			uterm_mode_unref(m);
+			goto err_map;
+		}
+		disp->current_mode = m;
+		uterm_mode_unref(m);
+	}
+
+	mmem = m->data;
+	mmem->width = mem->width;
+	mmem->height = mem->height;
+
+	disp->flags |= DISPLAY_ONLINE;
+	return 0;
+
+err_map:
+	free(mem->map);
+	mem->map = NULL;
+	return ret;
+}
+
+static int display_activate(struct uterm_display *disp, struct uterm_mode *mode)
+{
+	return display_activate_force(disp, mode, false);
+}
+
+static void display_deactivate_force(struct uterm_display *disp, bool force)
+{
+	struct memory_display *mem = disp->data;
+
+	log_info("deactivating memory display %p", disp);
+
+	free(mem->map);
+	mem->map = NULL;
+
+	if (!force) {
+		uterm_mode_unbind(disp->current_mode);
+		disp->current_mode = NULL;
+		disp->flags &= ~DISPLAY_ONLINE;
+	}
+}
+
+static void display_deactivate(struct uterm_display *disp)
+{
+	return display_deactivate_force(disp, false);
+}
+
+static int display_set_dpms(struct uterm_display *disp, int state)
+{
+	switch (state) {
+	case UTERM_DPMS_ON:
+	case UTERM_DPMS_STANDBY:
+	case UTERM_DPMS_SUSPEND:
+	case UTERM_DPMS_OFF:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	disp->dpms = state;
+	return 0;
+}
+
+static int display_use(struct uterm_display *disp, bool *opengl)
+{
+	struct memory_display *mem = disp->data;
+
+	if (opengl)
+		*opengl = false;
+
+	return mem->bufid ^ 1;
+}
+
+static int display_get_buffers(struct uterm_display *disp,
+			       struct uterm_video_buffer *buffer,
+			       unsigned int formats)
+{
+	struct memory_display *mem = disp->data;
+	unsigned int i;
+
+	if (!mem->map)
+		return -EINVAL;
+	if (!(formats & mem->format))
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < 2; ++i) {
+		buffer[i].width = mem->width;
+		buffer[i].height = mem->height;
+		buffer[i].stride = mem->stride;
+		buffer[i].format = mem->format;
+		buffer[i].data = &mem->map[i * mem->len];
+	}
+
+	return 0;
+}
+
+static int display_capture(struct uterm_display *disp,
+			   struct uterm_video_capture *cap)
+{
+	struct memory_display *mem = disp->data;
+
+	if (!mem->map)
+		return -EINVAL;
+
+	cap->width = mem->width;
+	cap->height = mem->height;
+	cap->stride = mem->stride;
+	cap->format = mem->format;
+	cap->size = mem->len;
+	cap->data = &mem->map[mem->bufid * mem->len];
+
+	return 0;
+}
+
+static void dump_frame(struct uterm_display *disp)
+{
+	struct memory_display *mem = disp->data;
+	char path[PATH_MAX];
+	unsigned int i, j;
+	uint8_t *src, rgb[3];
+	uint32_t val;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s-%06lu.ppm", mem->dump, mem->frame);
+	f = fopen(path, "we");
+	if (!f) {
+		log_warning("cannot open frame dump %s (%d): %m", path, errno);
+		return;
+	}
+
+	/* @bufid is the front-buffer after the swap */
+	src = &mem->map[mem->bufid * mem->len];
+
+	fprintf(f, "P6\n%u %u\n255\n", mem->width, mem->height);
+	for (i = 0; i < mem->height; ++i) {
+		for (j = 0; j < mem->width; ++j) {
+			if (mem->format == UTERM_FORMAT_XRGB32) {
+				val = ((uint32_t*)src)[j];
+				rgb[0] = val >> 16;
+				rgb[1] = val >> 8;
+				rgb[2] = val;
+			} else {
+				val = ((uint16_t*)src)[j];
+				rgb[0] = ((val >> 11) & 0x1f) << 3;
+				rgb[1] = ((val >> 5) & 0x3f) << 2;
+				rgb[2] = (val & 0x1f) << 3;
+			}
+			fwrite(rgb, 1, sizeof(rgb), f);
+		}
+		src += mem->stride;
+	}
+
+	if (ferror(f))
+		log_warning("cannot write frame dump %s", path);
+	fclose(f);
+}
+
+static int display_swap(struct uterm_display *disp, bool immediate)
+{
+	struct memory_display *mem = disp->data;
+
+	if (!mem->map)
+		return -EINVAL;
+
+	mem->bufid ^= 1;
+	if (mem->dump)
+		dump_frame(disp);
+	++mem->frame;
+
+	if (immediate)
+		return 0;
+
+	return display_schedule_vblank_timer(disp);
+}
+
+static const struct display_ops memory_display_ops = {
+	.init = display_init,
+	.destroy = display_destroy,
+	.activate = display_activate,
+	.deactivate = display_deactivate,
+	.set_dpms = display_set_dpms,
+	.use = display_use,
+	.get_buffers = display_get_buffers,
+	.swap = display_swap,
+	.blit = uterm_memory_display_blit,
+	.fake_blendv = uterm_memory_display_fake_blendv,
+	.fill = uterm_memory_display_fill,
+	.capture = display_capture,
+};
+
+static void intro_idle_event(struct ev_eloop *eloop, void *unused, void *data)
+{
+	struct uterm_video *video = data;
+	struct memory_video *vmem = video->data;
+	struct uterm_display *disp;
+	struct memory_display *mem;
+	int ret;
+
+	vmem->pending_intro = false;
+	ev_eloop_unregister_idle_cb(eloop, intro_idle_event, data, EV_NORMAL);
+
+	ret = display_new(&disp, &memory_display_ops);
+	if (ret) {
+		log_error("cannot create memory display: %d", ret);
+		return;
+	}
+
+	mem = disp->data;
+	mem->width = vmem->width;
+	mem->height = vmem->height;
+	mem->format = vmem->format;
+	mem->rate = vmem->rate;
+	mem->dump = vmem->dump;
+
+	ret = uterm_display_bind(disp, video);
+	if (ret) {
+		log_error("cannot bind memory display: %d", ret);
+		uterm_display_unref(disp);
+		return;
+	}
+
+	uterm_display_unref(disp);
+}
+
+static int parse_node(struct memory_video *vmem, const char *node)
+{
+	char **opts;
+	unsigned int i, w, h, r;
+	int ret, num;
+
+	vmem->width = 1024;
+	vmem->height = 768;
+	vmem->rate = 60;
+	vmem->format = UTERM_FORMAT_XRGB32;
+
+	if (!node || !*node)
+		return 0;
+
+	ret = shl_split_string(node, &opts, NULL, ',', false);
+	if (ret)
+		return ret;
+
+	for (i = 0; opts[i]; ++i) {
+		if (!strcmp(opts[i], "xrgb32")) {
+			vmem->format = UTERM_FORMAT_XRGB32;
+		} else if (!strcmp(opts[i], "rgb16")) {
+			vmem->format = UTERM_FORMAT_RGB16;
+		} else if (!strncmp(opts[i], "dump=", 5) && opts[i][5]) {
+			free(vmem->dump);
+			vmem->dump = strdup(&opts[i][5]);
+			if (!vmem->dump) {
+				ret = -ENOMEM;
+				goto out;
+			}
+		} else {
+			r = vmem->rate;
+			num = sscanf(opts[i], "%ux%u@%u", &w, &h, &r);
+			if (num < 2 || !w || !h || !r || r > 1000 ||
+			    w > 16384 || h > 16384) {
+				log_error("invalid memory video option: %s",
+					  opts[i]);
+				ret = -EINVAL;
+				goto out;
+			}
+
+			vmem->width = w;
+			vmem->height = h;
+			vmem->rate = r;
+		}
+	}
+
+	ret = 0;
+out:
+	free(opts);
+	return ret;
+}
+
+static int video_init(struct uterm_video *video, const char *node)
+{
+	int ret;
+	struct memory_video *vmem;
+
+	log_info("new memory device %s", node ? node : "<default>");
+
+	vmem = malloc(sizeof(*vmem));
+	if (!vmem)
+		return -ENOMEM;
+	memset(vmem, 0, sizeof(*vmem));
+	video->data = vmem;
+
+	vmem->node = strdup(node ? node : "");
+	if (!vmem->node) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = parse_node(vmem, vmem->node);
+	if (ret)
+		goto err_node;
+
+	ret = ev_eloop_register_idle_cb(video->eloop, intro_idle_event, video,
+					EV_NORMAL);
+	if (ret) {
+		log_error("cannot register idle event: %d", ret);
+		goto err_node;
+	}
+	vmem->pending_intro = true;
+
+	return 0;
+
+err_node:
+	free(vmem->dump);
+	free(vmem->node);
+err_free:
+	free(vmem);
+	return ret;
+}
+
+static void video_destroy(struct uterm_video *video)
+{
+	struct memory_video *vmem = video->data;
+
+	log_info("free memory device %s", vmem->node);
+
+	if (vmem->pending_intro)
+		ev_eloop_unregister_idle_cb(video->eloop, intro_idle_event,
+					    video, EV_NORMAL);
+
+	free(vmem->dump);
+	free(vmem->node);
+	free(vmem);
+}
+
+static void video_sleep(struct uterm_video *video)
+{
+	struct uterm_display *iter;
+	struct shl_dlist *i;
+
+	shl_dlist_for_each(i, &video->displays) {
+		iter = shl_dlist_entry(i, struct uterm_display, list);
+
+		if (!display_is_online(iter))
+			continue;
+
+		display_deactivate_force(iter, true);
+	}
+}
+
+static int video_wake_up(struct uterm_video *video)
+{
+	struct uterm_display *iter;
+	struct shl_dlist *i;
+	int ret;
+
+	video->flags |= VIDEO_AWAKE;
+	shl_dlist_for_each(i, &video->displays) {
+		iter = shl_dlist_entry(i, struct uterm_display, list);
+
+		if (!display_is_online(iter))
+			continue;
+
+		ret = display_activate_force(iter, NULL, true);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static const struct video_ops memory_video_ops = {
+	.init = video_init,
+	.destroy = video_destroy,
+	.segfault = NULL,
+	.poll = NULL,
+	.sleep = video_sleep,
+	.wake_up = video_wake_up,
+};
+
+static const struct uterm_video_module memory_module = {
+	.ops = &memory_video_ops,
+};
+
+SHL_EXPORT
+const struct uterm_video_module *UTERM_VIDEO_MEMORY = &memory_module;
@@ -37,6 +37,7 @@
 #include "eloop.h"
 #include "shl_dlist.h"
 #include "shl_hook.h"
+#include "shl_latency.h"
 #include "shl_log.h"
 #include "shl_misc.h"
 #include "uterm_video.h"
@@ -213,6 +214,7 @@ static void display_vblank_timer_event(struct ev_timer *timer,
 	struct uterm_display *disp = data;
 
 	disp->vblank_scheduled = false;
+	shl_latency_mark(SHL_LATENCY_PAGE_FLIP);
 	DISPLAY_CB(disp, UTERM_PAGE_FLIP);
 }
 
@@ -451,6 +453,12 @@ int uterm_display_use(struct uterm_display *disp, bool *opengl)
 	return VIDEO_CALL(disp->ops->use, -EOPNOTSUPP, disp, opengl);
 }
 
+/*
+ * Fills @buffer with the render buffers of @disp. @buffer must have room for
+ * UTERM_MAX_BUFFERS entries, the index returned by uterm_display_use() selects
+ * the current one. Entries of buffers the display doesn't use are left
+ * untouched.
+ */
 SHL_EXPORT
 int uterm_display_get_buffers(struct uterm_display *disp,
 			      struct uterm_video_buffer *buffer,
@@ -469,6 +477,7 @@ int uterm_display_swap(struct uterm_display *disp, bool immediate)
 	if (!disp || !display_is_online(disp) || !video_is_awake(disp->video))
 		return -EINVAL;
 
+	shl_latency_mark(SHL_LATENCY_DISPLAY_SWAP);
 	return VIDEO_CALL(disp->ops->swap, 0, disp, immediate);
 }
 
@@ -478,9 +487,133 @@ bool uterm_display_is_swapping(struct uterm_display *disp)
 	if (!disp)
 		return false;
 
+	/* a pending page-flip doesn't block if the next frame can be queued */
+	if (disp->flags & DISPLAY_QUEUE)
+		return false;
+
 	return disp->vblank_scheduled || (disp->flags & DISPLAY_VSYNC);
 }
 
+/*
+ * Backends report the kernel timestamp and sequence number of each page-flip
+ * here. The refresh interval is measured from consecutive flips so we don't
+ * depend on the accuracy of the mode's refresh rate.
+ */
+void display_report_flip(struct uterm_display *disp, unsigned int frame,
+			 uint64_t usecs)
+{
+	unsigned int num;
+	uint64_t sample;
+
+	num = frame - disp->flip_frame;
+	if (disp->flip_time && num > 0 && num < 256 &&
+	    usecs > disp->flip_time) {
+		sample = (usecs - disp->flip_time) / num;
+		if (!disp->flip_interval)
+			disp->flip_interval = sample;
+		else
+			disp->flip_interval = (disp->flip_interval * 7 +
+					       sample) / 8;
+	}
+
+	disp->flip_frame = frame;
+	disp->flip_time = usecs;
+}
+
+SHL_EXPORT
+int uterm_display_get_vblank(struct uterm_display *disp, uint64_t *time,
+			     uint64_t *interval)
+{
+	if (!disp || !time || !interval)
+		return -EINVAL;
+	if (!disp->flip_time || !disp->flip_interval)
+		return -ENOENT;
+
+	*time = disp->flip_time;
+	*interval = disp->flip_interval;
+	return 0;
+}
+
+/*
+ * Returns how many frames old the content of the buffer returned by
+ * uterm_display_use() is, like EGL_EXT_buffer_age. 1 means it contains the
+ * last swapped frame, 0 means the content is undefined.
+ */
+SHL_EXPORT
+int uterm_display_get_age(struct uterm_display *disp)
+{
+	if (!disp || !display_is_online(disp))
+		return 0;
+
+	return VIDEO_CALL(disp->ops->get_age, 0, disp);
+}
+
+#define CAPTURE_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+				    ((uint32_t)(c) << 16) | \
+				    ((uint32_t)(d) << 24))
+
+/*
+ * Describes the buffer that is currently scanned out on @disp. Backends export
+ * it as dma-buf in @cap->fd if they can, so it can be passed to other
+ * processes without copying, and provide a CPU mapping in @cap->data if they
+ * have one. At least one of both is set on success. The caller owns the fd.
+ * @cap->fourcc and @cap->modifier describe the layout in DRM terms; only
+ * linear buffers can be read through a mapping of the dma-buf.
+ * The content is only stable until the next uterm_display_swap().
+ */
+SHL_EXPORT
+int uterm_display_capture(struct uterm_display *disp,
+			  struct uterm_video_capture *cap)
+{
+	int ret;
+
+	if (!disp || !display_is_online(disp) || !cap)
+		return -EINVAL;
+
+	memset(cap, 0, sizeof(*cap));
+	cap->fd = -1;
+	cap->modifier = UTERM_MODIFIER_LINEAR;
+
+	ret = VIDEO_CALL(disp->ops->capture, -EOPNOTSUPP, disp, cap);
+	if (ret)
+		return ret;
+
+	/* backends without a native fourcc use linear uterm formats */
+	if (!cap->fourcc) {
+		if (cap->format == UTERM_FORMAT_XRGB32)
+			cap->fourcc = CAPTURE_FOURCC('X', 'R', '2', '4');
+		else if (cap->format == UTERM_FORMAT_RGB16)
+			cap->fourcc = CAPTURE_FOURCC('R', 'G', '1', '6');
+	}
+
+	return 0;
+}
+
+/*
+ * Hardware cursors are shown on top of the framebuffer and can be moved without
+ * redrawing it. @buf must be in XRGB32 format and may be smaller than the
+ * cursor plane, the remainder is transparent. Pass NULL to hide the cursor.
+ * -E2BIG is returned if @buf doesn't fit into the cursor plane.
+ */
+SHL_EXPORT
+int uterm_display_set_cursor(struct uterm_display *disp,
+			     const struct uterm_video_buffer *buf)
+{
+	if (!disp || !display_is_online(disp) || !video_is_awake(disp->video))
+		return -EINVAL;
+
+	return VIDEO_CALL(disp->ops->set_cursor, -EOPNOTSUPP, disp, buf);
+}
+
+SHL_EXPORT
+int uterm_display_move_cursor(struct uterm_display *disp, int x, int y)
+{
+	if (!disp || !display_is_online(disp) || !video_is_awake(disp->video))
+		return -EINVAL;
+
+	return VIDEO_CALL(disp->ops->move_cursor, -EOPNOTSUPP, disp, x, y);
+}
+
 SHL_EXPORT
 int uterm_display_fill(struct uterm_display *disp,
 		       uint8_t r, uint8_t g, uint8_t b,
@@ -696,6 +829,57 @@ bool uterm_video_is_awake(struct uterm_video *video)
 	return video && video_is_awake(video);
 }
 
+/*
+ * Sets the number of buffers each display of @video renders into. With more
+ * than two buffers, a new frame can be rendered and queued while the previous
+ * page-flip is still pending. 0 selects the backend default, which is
+ * double-buffering for DRM and a single buffer for fbdev. Backends that manage
+ * their buffers themselves ignore this. It takes effect the next time a display
+ * is activated.
+ */
+SHL_EXPORT
+int uterm_video_set_buffers(struct uterm_video *video, unsigned int num)
+{
+	if (!video)
+		return -EINVAL;
+	if (num && (num < 2 || num > UTERM_MAX_BUFFERS))
+		return -EINVAL;
+
+	video->buffers = num;
+	return 0;
+}
+
+/*
+ * Tells @video that its outputs were probed via uterm_video_probe() just
+ * before it was created. The next hotplug reads the state the kernel already
+ * knows instead of probing the outputs again.
+ */
+SHL_EXPORT
+void uterm_video_set_probed(struct uterm_video *video)
+{
+	if (!video)
+		return;
+
+	video->flags |= VIDEO_PROBED;
+}
+
+/*
+ * Probes the outputs of device @node for module @mod without creating a video
+ * object. Probing may take seconds on some drivers. This doesn't touch any
+ * uterm object and is safe to call from any thread. Returns -EOPNOTSUPP if the
+ * module has nothing to probe.
+ */
+SHL_EXPORT
+int uterm_video_probe(const struct uterm_video_module *mod, const char *node)
+{
+	if (!node)
+		return -EINVAL;
+	if (!mod || !mod->ops)
+		return -EOPNOTSUPP;
+
+	return VIDEO_CALL(mod->ops->probe, -EOPNOTSUPP, node);
+}
+
 SHL_EXPORT
 void uterm_video_poll(struct uterm_video *video)
 {
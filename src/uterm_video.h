@@ -90,6 +90,8 @@ struct uterm_video_hotplug {
 
 enum uterm_display_action {
 	UTERM_PAGE_FLIP,
+	/* the last swap was dropped; the buffers must be redrawn */
+	UTERM_SWAP_ABORTED,
 };
 
 struct uterm_display_event {
@@ -103,6 +105,9 @@ enum uterm_video_format {
 	UTERM_FORMAT_RGB24	= 0x08,
 };
 
+/* maximum number of buffers a display renders into, see uterm_video_set_buffers */
+#define UTERM_MAX_BUFFERS 4
+
 struct uterm_video_buffer {
 	unsigned int width;
 	unsigned int height;
@@ -111,6 +116,28 @@ struct uterm_video_buffer {
 	uint8_t *data;
 };
 
+/* DRM format modifiers of captured buffers, values match drm_fourcc.h */
+#define UTERM_MODIFIER_LINEAR	0ULL
+#define UTERM_MODIFIER_INVALID	0x00ffffffffffffffULL
+
+/* scanned out buffer of a display, see uterm_display_capture() */
+struct uterm_video_capture {
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned int format;
+	/* DRM fourcc and modifier describing the memory layout */
+	uint32_t fourcc;
+	uint64_t modifier;
+	/* start of the pixels inside the dma-buf */
+	unsigned int offset;
+	size_t size;
+	/* dma-buf owned by the caller or -1 */
+	int fd;
+	/* CPU mapping or NULL */
+	const uint8_t *data;
+};
+
 struct uterm_video_blend_req {
 	const struct uterm_video_buffer *buf;
 	unsigned int x;
@@ -172,6 +199,14 @@ int uterm_display_get_buffers(struct uterm_display *disp,
 			      unsigned int formats);
 int uterm_display_swap(struct uterm_display *disp, bool immediate);
 bool uterm_display_is_swapping(struct uterm_display *disp);
+int uterm_display_get_vblank(struct uterm_display *disp, uint64_t *time,
+			     uint64_t *interval);
+int uterm_display_get_age(struct uterm_display *disp);
+int uterm_display_capture(struct uterm_display *disp,
+			  struct uterm_video_capture *cap);
+int uterm_display_set_cursor(struct uterm_display *disp,
+			     const struct uterm_video_buffer *buf);
+int uterm_display_move_cursor(struct uterm_display *disp, int x, int y);
 
 int uterm_display_fill(struct uterm_display *disp,
 		       uint8_t r, uint8_t g, uint8_t b,
@@ -206,6 +241,9 @@ void uterm_video_unregister_cb(struct uterm_video *video, uterm_video_cb cb,
 void uterm_video_sleep(struct uterm_video *video);
 int uterm_video_wake_up(struct uterm_video *video);
 bool uterm_video_is_awake(struct uterm_video *video);
+int uterm_video_set_buffers(struct uterm_video *video, unsigned int num);
+void uterm_video_set_probed(struct uterm_video *video);
+int uterm_video_probe(const struct uterm_video_module *mod, const char *node);
 void uterm_video_poll(struct uterm_video *video);
 
 /* external modules */
@@ -228,4 +266,10 @@ extern const struct uterm_video_module *UTERM_VIDEO_DRM3D;
 #define UTERM_VIDEO_DRM3D NULL
 #endif
 
+#ifdef BUILD_ENABLE_VIDEO_MEMORY
+extern const struct uterm_video_module *UTERM_VIDEO_MEMORY;
+#else
+#define UTERM_VIDEO_MEMORY NULL
+#endif
+
 #endif /* UTERM_UTERM_VIDEO_H */
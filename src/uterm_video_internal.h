@@ -67,6 +67,12 @@ struct display_ops {
 	int (*fill) (struct uterm_display *disp,
 		     uint8_t r, uint8_t g, uint8_t b, unsigned int x,
 		     unsigned int y, unsigned int width, unsigned int height);
+	int (*get_age) (struct uterm_display *disp);
+	int (*set_cursor) (struct uterm_display *disp,
+			   const struct uterm_video_buffer *buf);
+	int (*move_cursor) (struct uterm_display *disp, int x, int y);
+	int (*capture) (struct uterm_display *disp,
+			struct uterm_video_capture *cap);
 };
 
 struct video_ops {
@@ -76,6 +82,7 @@ struct video_ops {
 	int (*poll) (struct uterm_video *video);
 	void (*sleep) (struct uterm_video *video);
 	int (*wake_up) (struct uterm_video *video);
+	int (*probe) (const char *node);
 };
 
 struct uterm_video_module {
@@ -108,6 +115,8 @@ void uterm_mode_unbind(struct uterm_mode *mode);
 #define DISPLAY_DBUF		0x10
 #define DISPLAY_DITHERING	0x20
 #define DISPLAY_PFLIP		0x40
+#define DISPLAY_QUEUE		0x80
+#define DISPLAY_ABORT		0x100
 
 struct uterm_display {
 	struct shl_dlist list;
@@ -125,6 +134,12 @@ struct uterm_display {
 	struct itimerspec vblank_spec;
 	struct ev_timer *vblank_timer;
 
+	/* timing of the last page-flip and measured refresh interval in usecs
+	 * of CLOCK_MONOTONIC; zero if unknown */
+	uint64_t flip_time;
+	uint64_t flip_interval;
+	unsigned int flip_frame;
+
 	const struct display_ops *ops;
 	void *data;
 };
@@ -133,6 +148,8 @@ int display_new(struct uterm_display **out, const struct display_ops *ops);
 void display_set_vblank_timer(struct uterm_display *disp,
 			      unsigned int msecs);
 int display_schedule_vblank_timer(struct uterm_display *disp);
+void display_report_flip(struct uterm_display *disp, unsigned int frame,
+			 uint64_t usecs);
 int uterm_display_bind(struct uterm_display *disp, struct uterm_video *video);
 void uterm_display_unbind(struct uterm_display *disp);
 
@@ -150,6 +167,7 @@ static inline bool display_is_online(const struct uterm_display *disp)
 
 #define VIDEO_AWAKE		0x01
 #define VIDEO_HOTPLUG		0x02
+#define VIDEO_PROBED		0x04
 
 struct uterm_video {
 	unsigned long ref;
@@ -158,6 +176,8 @@ struct uterm_video {
 
 	struct shl_dlist displays;
 	struct shl_hook *hook;
+	/* number of render buffers per display, 0 for the backend default */
+	unsigned int buffers;
 
 	const struct uterm_video_module *mod;
 	const struct video_ops *ops;
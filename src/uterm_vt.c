@@ -743,6 +743,37 @@ static void vt_sigusr2(struct ev_eloop *eloop, struct signalfd_siginfo *info,
 		real_sig_leave(vt, info);
 }
 
+/*
+ * Only real VTs are switched via SIGUSR1/SIGUSR2. Fake VTs don't register the
+ * signals so they don't compete for them if VT masters run on different
+ * threads.
+ */
+static int vt_register_signals(struct uterm_vt *vt)
+{
+	int ret;
+
+	ret = ev_eloop_register_signal_cb(vt->vtm->eloop, SIGUSR1, vt_sigusr1,
+					  vt);
+	if (ret)
+		return ret;
+
+	ret = ev_eloop_register_signal_cb(vt->vtm->eloop, SIGUSR2, vt_sigusr2,
+					  vt);
+	if (ret) {
+		ev_eloop_unregister_signal_cb(vt->vtm->eloop, SIGUSR1,
+					      vt_sigusr1, vt);
+		return ret;
+	}
+
+	return 0;
+}
+
+static void vt_unregister_signals(struct uterm_vt *vt)
+{
+	ev_eloop_unregister_signal_cb(vt->vtm->eloop, SIGUSR2, vt_sigusr2, vt);
+	ev_eloop_unregister_signal_cb(vt->vtm->eloop, SIGUSR1, vt_sigusr1, vt);
+}
+
 static int seat_find_vt(const char *seat, char **out)
 {
 	static const char def_vt[] = "/dev/tty0";
@@ -847,17 +878,9 @@ int uterm_vt_allocate(struct uterm_vt_master *vtm,
 	vt->real_num = -1;
 	vt->real_saved_num = -1;
 
-	ret = ev_eloop_register_signal_cb(vtm->eloop, SIGUSR1, vt_sigusr1, vt);
-	if (ret)
-		goto err_free;
-
-	ret = ev_eloop_register_signal_cb(vtm->eloop, SIGUSR2, vt_sigusr2, vt);
-	if (ret)
-		goto err_sig1;
-
 	ret = uterm_input_register_cb(vt->input, vt_input, vt);
 	if (ret)
-		goto err_sig2;
+		goto err_free;
 
 	if (!vt_name) {
 		ret = seat_find_vt(seat, &path);
@@ -874,7 +897,12 @@ int uterm_vt_allocate(struct uterm_vt_master *vtm,
 			goto err_input;
 		}
 		vt->mode = UTERM_VT_REAL;
-		ret = real_open(vt, vt_name ? vt_name : path);
+		ret = vt_register_signals(vt);
+		if (!ret) {
+			ret = real_open(vt, vt_name ? vt_name : path);
+			if (ret)
+				vt_unregister_signals(vt);
+		}
 	} else {
 		if (!(allowed_types & UTERM_VT_FAKE)) {
 			ret = -ERANGE;
@@ -896,10 +924,6 @@ int uterm_vt_allocate(struct uterm_vt_master *vtm,
 
 err_input:
 	uterm_input_unregister_cb(vt->input, vt_input, vt);
-err_sig2:
-	ev_eloop_unregister_signal_cb(vtm->eloop, SIGUSR2, vt_sigusr2, vt);
-err_sig1:
-	ev_eloop_unregister_signal_cb(vtm->eloop, SIGUSR1, vt_sigusr1, vt);
 err_free:
 	free(vt);
 	return ret;
@@ -911,13 +935,13 @@ void uterm_vt_deallocate(struct uterm_vt *vt)
 	if (!vt || !vt->vtm)
 		return;
 
-	if (vt->mode == UTERM_VT_REAL)
+	if (vt->mode == UTERM_VT_REAL) {
 		real_close(vt);
-	else if (vt->mode == UTERM_VT_FAKE)
+		vt_unregister_signals(vt);
+	} else if (vt->mode == UTERM_VT_FAKE) {
 		fake_close(vt);
+	}
 
-	ev_eloop_unregister_signal_cb(vt->vtm->eloop, SIGUSR2, vt_sigusr2, vt);
-	ev_eloop_unregister_signal_cb(vt->vtm->eloop, SIGUSR1, vt_sigusr1, vt);
 	shl_dlist_unlink(&vt->list);
 	uterm_input_unref(vt->input);
 	vt->vtm = NULL;
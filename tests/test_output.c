@@ -56,6 +56,7 @@ static struct ev_eloop *eloop;
 
 struct {
 	bool fbdev;
+	bool memory;
 	bool test;
 	char *dev;
 } output_conf;
@@ -169,8 +170,12 @@ static void print_help()
 		"\n"
 		"Video Options:\n"
 		"\t    --fbdev                 [off]   Use fbdev instead of DRM\n"
+		"\t    --memory                [off]   Use offscreen memory buffers instead of DRM\n"
 		"\t    --test                  [off]   Try displaying content instead of listing devices\n"
-		"\t    --dev                   [/dev/dri/card0 | /dev/fb0] Use the given device\n",
+		"\t    --dev                   [/dev/dri/card0 | /dev/fb0] Use the given device\n"
+		"\t                                    With --memory, a comma-separated list\n"
+		"\t                                    of <w>x<h>[@<hz>], xrgb32, rgb16 and\n"
+		"\t                                    dump=<file> [1024x768@60]\n",
 		"test_input");
 	/*
 	 * 80 char line:
@@ -185,6 +190,7 @@ static void print_help()
 struct conf_option options[] = {
 	TEST_OPTIONS,
 	CONF_OPTION_BOOL(0, "fbdev", &output_conf.fbdev, false),
+	CONF_OPTION_BOOL(0, "memory", &output_conf.memory, false),
 	CONF_OPTION_BOOL(0, "test", &output_conf.test, false),
 	CONF_OPTION_STRING(0, "dev",  &output_conf.dev, NULL),
 };
@@ -202,7 +208,15 @@ int main(int argc, char **argv)
 	if (ret)
 		goto err_fail;
 
-	if (output_conf.fbdev) {
+	if (output_conf.memory) {
+		mode = UTERM_VIDEO_MEMORY;
+		node = "1024x768@60";
+		if (!mode) {
+			log_err("memory video backend not available, rebuild with --with-video=...,memory");
+			ret = -EOPNOTSUPP;
+			goto err_exit;
+		}
+	} else if (output_conf.fbdev) {
 		mode = UTERM_VIDEO_FBDEV;
 		node = "/dev/fb0";
 	} else {